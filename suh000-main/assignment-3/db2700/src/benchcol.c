@@ -0,0 +1,206 @@
+/**********************************************************
+ * Column store benchmark: the workers table of           *
+ * pop_table.py in row and in column storage, loaded,     *
+ * scanned, searched, projected and joined with its 26   *
+ * departments, with the time of each and the blocks the  *
+ * table takes.                                           *
+ **********************************************************/
+
+#include "schema.h"
+#include "pmsg.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define NUM_FIELDS 3
+#define NUM_DEPARTMENTS 26
+
+static char const* db_dir = "benchcol.db";
+static int num_rows = 100000;
+static int search_val = 990;
+static char *field_names[NUM_FIELDS] = {"id", "income", "department"};
+static int *incomes, *departments;
+
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Blocks of the table, in all the files of its columns in column storage */
+static int num_blocks(char const* name, tbl_storage st) {
+  if (st != COLUMN_STORAGE)
+    return file_num_blocks(name);
+  int n = 0;
+  char fname[64];
+  for (int i = 0; i < NUM_FIELDS; i++) {
+    sprintf(fname, "%s.%s", name, field_names[i]);
+    n += file_num_blocks(fname);
+  }
+  return n;
+}
+
+/* Scan the table named name, adding up its incomes in *sum unless sum
+   is NULL. Returns the number of records. */
+static long scan(char const* name, long* sum) {
+  schema_p s = get_schema(name);
+  record rec = new_record(s);
+  long n = 0;
+  set_tbl_position(get_table(name), TBL_BEG);
+  while (get_record(rec, s) > 0) {
+    if (sum) *sum += *(int *) rec[1];
+    n++;
+  }
+  release_record(rec, s);
+  return n;
+}
+
+/* The workers of pop_table.py: ids in order, incomes in [350, 998] and
+   departments in [1, 26] */
+static void make_rows() {
+  incomes = malloc(num_rows * sizeof (int));
+  departments = malloc(num_rows * sizeof (int));
+  if (!incomes || !departments) {
+    put_msg(FATAL, "no memory for %d rows.\n", num_rows);
+    exit(EXIT_FAILURE);
+  }
+  srand(2700);
+  for (int i = 0; i < num_rows; i++) {
+    incomes[i] = 350 + rand() % 649;
+    departments[i] = 1 + rand() % 26;
+  }
+}
+
+static void bench(tbl_storage st) {
+  char name[32], dept_name[32], res_name[64];
+  sprintf(name, "workers_%s", tbl_storage_name(st));
+
+  /* the departments, in the same storage */
+  open_db();
+  sprintf(dept_name, "departments_%s", tbl_storage_name(st));
+  remove_table(get_table(dept_name));
+  schema_p ds = new_schema(dept_name);
+  add_field(ds, new_int_field("department"));
+  add_field(ds, new_int_field("budget"));
+  set_tbl_storage(ds, st);
+  record rec = new_record(ds);
+  for (int i = 1; i <= NUM_DEPARTMENTS; i++) {
+    fill_record(rec, ds, i, 1000 * i);
+    append_record(rec, ds);
+  }
+  release_record(rec, ds);
+
+  /* load */
+  remove_table(get_table(name));
+  schema_p s = new_schema(name);
+  for (int i = 0; i < NUM_FIELDS; i++)
+    add_field(s, new_int_field(field_names[i]));
+  if (!set_tbl_storage(s, st)) {
+    put_msg(FATAL, "no %s storage.\n", tbl_storage_name(st));
+    exit(EXIT_FAILURE);
+  }
+  rec = new_record(s);
+  double start = now();
+  for (int i = 0; i < num_rows; i++) {
+    fill_record(rec, s, i, incomes[i], departments[i]);
+    append_record(rec, s);
+  }
+  release_record(rec, s);
+  close_db();
+  double load = now() - start;
+
+  /* each query from a buffer without the pages of the table */
+  open_db();
+  int blocks = num_blocks(name, st);
+  long sum = 0;
+  start = now();
+  long n = scan(name, &sum);
+  double scan_secs = now() - start;
+  close_db();
+
+  open_db();
+  start = now();
+  tbl_p res = table_search(get_table(name), "income", ">", search_val);
+  double search_secs = now() - start;
+  sprintf(res_name, "tmp_tbl__%s", name); /* as table_search() names it */
+  long found = scan(res_name, 0);
+  remove_table(res);
+  close_db();
+
+  open_db();
+  char *fields[] = {"id", "income"};
+  start = now();
+  res = table_project(get_table(name), 2, fields);
+  double project_secs = now() - start;
+  sprintf(res_name, "project__%s_0", name); /* as table_project() names it */
+  long projected = scan(res_name, 0);
+  remove_table(res);
+  close_db();
+
+  open_db();
+  start = now();
+  res = table_natural_join(get_table(name), get_table(dept_name));
+  double join_secs = now() - start;
+  long joined = scan("tmp_sch", 0); /* as table_natural_join() names it */
+  remove_table(res);
+  close_db();
+
+  if (n != num_rows || projected != num_rows || joined != num_rows) {
+    put_msg(FATAL, "%s: %ld records scanned, %ld projected, %ld joined, "
+            "of %d.\n", name, n, projected, joined, num_rows);
+    exit(EXIT_FAILURE);
+  }
+  printf("%-8s %8d %10.1f %10.1f %10.1f %10.1f %10.1f %9ld %14ld\n",
+         tbl_storage_name(st), blocks, load * 1e3, scan_secs * 1e3,
+         search_secs * 1e3, project_secs * 1e3, join_secs * 1e3, found, sum);
+}
+
+int main(int argc, char* argv[]) {
+  int c;
+  pager_config cfg;
+  msglevel = WARN;
+  pager_config_default(&cfg);
+
+  while ((c = getopt(argc, argv, "hd:n:v:" PAGER_OPTIONS)) != -1)
+    switch (c) {
+    case 'h':
+      printf("Usage: run_benchcol [switches]\n");
+      printf("\t-h           help, print this message\n");
+      printf("\t-d dir       database directory, default to %s\n", db_dir);
+      printf("\t-n n         number of rows, default to %d\n", num_rows);
+      printf("\t-v n         search for incomes above n, default to %d\n",
+             search_val);
+      put_pager_config_usage();
+      exit(0);
+    case 'd': db_dir = optarg; break;
+    case 'n': num_rows = atoi(optarg); break;
+    case 'v': search_val = atoi(optarg); break;
+    case '?':
+      if (isprint(optopt))
+        printf("Unknown option `-%c'.\n", optopt);
+      exit(EXIT_FAILURE);
+    default:
+      if (pager_config_option(&cfg, c, optarg) != 1)
+        exit(EXIT_FAILURE);
+    }
+  if (num_rows < 1) {
+    put_msg(ERROR, "invalid benchmark parameters.\n");
+    exit(EXIT_FAILURE);
+  }
+  if (!pager_init(&cfg) || !set_system_dir(db_dir)) {
+    put_msg(FATAL, "cannot open %s.\n", db_dir);
+    exit(EXIT_FAILURE);
+  }
+
+  make_rows();
+  printf("%d workers (id, income, department), times in ms\n", num_rows);
+  printf("%-8s %8s %10s %10s %10s %10s %10s %9s %14s\n", "storage", "blocks",
+         "load", "scan", "income>", "project", "join", "found",
+         "sum of incomes");
+  bench(ROW_STORAGE);
+  bench(COLUMN_STORAGE);
+  return 0;
+}
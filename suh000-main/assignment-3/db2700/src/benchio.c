@@ -0,0 +1,200 @@
+/**********************************************************
+ * I/O benchmark: random block reads (or writes) with     *
+ * synchronous pread()/pwrite() and with io_uring at      *
+ * different queue depths.                                *
+ **********************************************************/
+
+#include "iouring.h"
+#include "pmsg.h"
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static char const* fname = "benchio.dat";
+static long block_size = 4096;
+static int num_blocks = 8192;
+static int num_ios = 4096;
+static int writes = 0;
+static int use_direct = 1;
+
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int open_file() {
+  int fd = -1;
+#ifdef O_DIRECT
+  if (use_direct)
+    fd = open(fname, O_RDWR | O_DIRECT);
+#endif
+  if (fd == -1) {
+    use_direct = 0;
+    fd = open(fname, O_RDWR);
+  }
+  if (fd == -1) {
+    put_msg(FATAL, "cannot open %s: %s\n", fname, strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+  /* start every run with a cold page cache */
+  fdatasync(fd);
+  posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+  return fd;
+}
+
+static void prepare_file() {
+  int fd = open(fname, O_RDWR | O_CREAT, 0600);
+  if (fd == -1) {
+    put_msg(FATAL, "cannot create %s: %s\n", fname, strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+  if (lseek(fd, 0, SEEK_END) < (off_t) block_size * num_blocks) {
+    char *buf = malloc(block_size);
+    for (int i = 0; i < num_blocks; i++) {
+      memset(buf, i, block_size);
+      if (pwrite(fd, buf, block_size, (off_t) block_size * i) != block_size) {
+        put_msg(FATAL, "cannot write %s: %s\n", fname, strerror(errno));
+        exit(EXIT_FAILURE);
+      }
+    }
+    free(buf);
+  }
+  close(fd);
+}
+
+static void put_result(char const* engine, int depth, double secs) {
+  printf("%-6s %6d %12.0f %10.2f\n", engine, depth, num_ios / secs,
+         num_ios * (double) block_size / secs / (1024 * 1024));
+}
+
+static void bench_sync(int const* blks, char* buf) {
+  int fd = open_file();
+  double start = now();
+  for (int i = 0; i < num_ios; i++) {
+    off_t off = (off_t) block_size * blks[i];
+    ssize_t res = writes ? pwrite(fd, buf, block_size, off)
+      : pread(fd, buf, block_size, off);
+    if (res != block_size) {
+      put_msg(FATAL, "sync I/O fails: %s\n", strerror(errno));
+      exit(EXIT_FAILURE);
+    }
+  }
+  if (writes) fdatasync(fd);
+  put_result("sync", 1, now() - start);
+  close(fd);
+}
+
+static void bench_uring(int const* blks, char* bufs, int depth) {
+  if (!io_ring_init(depth)) {
+    printf("%-6s %6d %12s\n", "uring", depth, "unavailable");
+    return;
+  }
+  int fd = open_file();
+  struct iovec *iov = malloc(depth * sizeof (struct iovec));
+  int *free_slots = malloc(depth * sizeof (int)), num_free = depth;
+  for (int i = 0; i < depth; i++) {
+    iov[i].iov_base = bufs + (size_t) i * block_size;
+    iov[i].iov_len = block_size;
+    free_slots[i] = i;
+  }
+
+  double start = now();
+  int next = 0, done = 0;
+  while (done < num_ios) {
+    /* keep depth requests in flight */
+    while (next < num_ios && num_free > 0) {
+      int slot = free_slots[num_free - 1];
+      if (!io_ring_prep_rw(writes, fd, &iov[slot], 1,
+                           (off_t) block_size * blks[next],
+                           (void *) (long) slot))
+        break;
+      num_free--;
+      next++;
+    }
+    if (io_ring_submit(1) < 0) exit(EXIT_FAILURE);
+    void *data;
+    int res;
+    while (io_ring_peek(&data, &res)) {
+      if (res != block_size) {
+        put_msg(FATAL, "io_uring I/O fails: %d\n", res);
+        exit(EXIT_FAILURE);
+      }
+      free_slots[num_free++] = (int) (long) data;
+      done++;
+    }
+  }
+  if (writes) fdatasync(fd);
+  put_result("uring", depth, now() - start);
+
+  free(iov);
+  free(free_slots);
+  close(fd);
+  io_ring_exit();
+}
+
+int main(int argc, char* argv[]) {
+  int c, max_depth = 64;
+  msglevel = WARN;
+
+  while ((c = getopt(argc, argv, "hf:b:n:r:q:wB")) != -1)
+    switch (c) {
+    case 'h':
+      printf("Usage: run_bench [switches]\n");
+      printf("\t-h           help, print this message\n");
+      printf("\t-f file      file to read, default to %s\n", fname);
+      printf("\t-b bytes     block size, default to %ld\n", block_size);
+      printf("\t-n n         number of blocks in the file, default to %d\n", num_blocks);
+      printf("\t-r n         number of random I/Os per run, default to %d\n", num_ios);
+      printf("\t-q n         largest queue depth, default to %d\n", max_depth);
+      printf("\t-w           random writes instead of reads\n");
+      printf("\t-B           buffered I/O instead of O_DIRECT\n");
+      exit(0);
+    case 'f': fname = optarg; break;
+    case 'b': block_size = atol(optarg); break;
+    case 'n': num_blocks = atoi(optarg); break;
+    case 'r': num_ios = atoi(optarg); break;
+    case 'q': max_depth = atoi(optarg); break;
+    case 'w': writes = 1; break;
+    case 'B': use_direct = 0; break;
+    default:
+      if (isprint(optopt))
+        printf("Unknown option `-%c'.\n", optopt);
+      exit(EXIT_FAILURE);
+    }
+  if (block_size < 512 || num_blocks < 1 || num_ios < 1 || max_depth < 1) {
+    put_msg(ERROR, "invalid benchmark parameters.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  prepare_file();
+  close(open_file()); /* find out if O_DIRECT is supported */
+  int *blks = malloc(num_ios * sizeof (int));
+  srand(2700);
+  for (int i = 0; i < num_ios; i++)
+    blks[i] = rand() % num_blocks;
+
+  char *bufs;
+  if (posix_memalign((void **) &bufs, 4096, (size_t) max_depth * block_size)) {
+    put_msg(FATAL, "cannot allocate buffers.\n");
+    exit(EXIT_FAILURE);
+  }
+  memset(bufs, 'x', (size_t) max_depth * block_size);
+
+  printf("random %s of %d blocks of %ld bytes, %s I/O\n",
+         writes ? "writes" : "reads", num_ios, block_size,
+         use_direct ? "direct" : "buffered");
+  printf("%-6s %6s %12s %10s\n", "engine", "depth", "IOPS", "MB/s");
+  bench_sync(blks, bufs);
+  for (int depth = 1; depth <= max_depth; depth *= 2)
+    bench_uring(blks, bufs, depth);
+
+  free(blks);
+  free(bufs);
+  return 0;
+}
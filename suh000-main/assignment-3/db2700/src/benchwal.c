@@ -0,0 +1,197 @@
+/**********************************************************
+ * Write-ahead log benchmark: small inserts, each one a   *
+ * transaction of its own, with every sync mode of the    *
+ * log and a growing number of threads committing at the  *
+ * same time, which share the syncs of the log. With -R,  *
+ * the time to recover from a crash after more and more   *
+ * inserts instead, against the size of the log redone.   *
+ **********************************************************/
+
+#include "pager.h"
+#include "wal.h"
+#include "pmsg.h"
+#include <ctype.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#define RECORD_SIZE 64
+
+static char const* db_dir = "benchwal.db";
+static int num_inserts = 2000;
+static int max_threads = 8;
+static int inserts_per_thread;
+static int recovery = 0;
+
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Append a record to a file of its own and commit it,
+   inserts_per_thread times */
+static void *insert_thread(void* arg) {
+  int t = (int) (long) arg, ok = 1;
+  char fname[32], rec[RECORD_SIZE];
+  sprintf(fname, "benchwal_%d", t);
+  memset(rec, 'a' + t % 26, sizeof rec);
+  for (int i = 0; ok && i < inserts_per_thread; i++) {
+    page_p pg = get_page_for_append(fname);
+    if (!pg) return (void *) 0;
+    page_put_int(pg, i);
+    page_put_str(pg, rec, sizeof rec - INT_SIZE);
+    unpin(pg);
+    /* the pages other threads have pinned are left to their commits */
+    ok = pager_commit() != 0;
+  }
+  return (void *) (long) ok;
+}
+
+/* Remove the files of the previous run */
+static void clean_dir() {
+  char fname[32];
+  for (int t = 0; t < max_threads; t++) {
+    sprintf(fname, "benchwal_%d", t);
+    unlink(fname);
+  }
+  unlink("db.wal");
+}
+
+static void bench(pager_wal_mode mode, int num_threads) {
+  pager_config cfg = pager_cfg;
+  cfg.wal = mode;
+  pager_terminate();
+  clean_dir();
+  if (!pager_init(&cfg)) {
+    put_msg(FATAL, "cannot start the pager.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  pthread_t threads[num_threads];
+  int ok = 1;
+  inserts_per_thread = num_inserts / num_threads;
+  double start = now();
+  for (int t = 0; t < num_threads; t++)
+    pthread_create(&threads[t], NULL, insert_thread, (void *) (long) t);
+  for (int t = 0; t < num_threads; t++) {
+    void *res;
+    pthread_join(threads[t], &res);
+    ok = ok && res;
+  }
+  double secs = now() - start;
+  if (!ok) {
+    put_msg(FATAL, "the inserts fail.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  int inserts = inserts_per_thread * num_threads;
+  wal_stats st = wal_get_stats();
+  if (mode == PAGER_WAL_NONE)
+    printf("%-7s %7d %12.0f %8s %12s\n", pager_wal_mode_name(mode),
+           num_threads, inserts / secs, "-", "-");
+  else
+    printf("%-7s %7d %12.0f %8ld %12.2f\n", pager_wal_mode_name(mode),
+           num_threads, inserts / secs, st.num_syncs,
+           st.num_syncs ? (double) st.num_commits / st.num_syncs : 0.0);
+}
+
+/* A child process inserts n records and crashes, then the pager
+   opening the database again redoes its log */
+static void bench_recovery(int n) {
+  pager_config cfg = pager_cfg;
+  cfg.wal = PAGER_WAL_FULL;
+  pager_terminate();
+  clean_dir();
+  pid_t pid = fork();
+  if (pid == 0) {
+    inserts_per_thread = n;
+    _exit(pager_init(&cfg) && insert_thread((void *) 0) ? 0 : EXIT_FAILURE);
+  }
+  int status;
+  if (pid == -1 || waitpid(pid, &status, 0) != pid || !WIFEXITED(status)
+      || WEXITSTATUS(status) != 0) {
+    put_msg(FATAL, "the inserts fail.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  /* the space the log takes, without the holes of its checkpoints */
+  struct stat st;
+  long bytes = stat("db.wal", &st) == 0 ? st.st_blocks * 512L : 0;
+  double start = now();
+  if (!pager_init(&cfg)) {
+    put_msg(FATAL, "cannot recover.\n");
+    exit(EXIT_FAILURE);
+  }
+  double secs = now() - start;
+  printf("%8d %12ld %14.1f\n", n, bytes / 1024, secs * 1e3);
+}
+
+int main(int argc, char* argv[]) {
+  int c;
+  pager_config cfg;
+  msglevel = WARN;
+  pager_config_default(&cfg);
+  cfg.clean_target = 0; /* the inserts alone write to the disk, unless -w */
+
+  while ((c = getopt(argc, argv, "hd:n:t:R" PAGER_OPTIONS)) != -1)
+    switch (c) {
+    case 'h':
+      printf("Usage: run_benchwal [switches]\n");
+      printf("\t-h           help, print this message\n");
+      printf("\t-d dir       database directory, default to %s\n", db_dir);
+      printf("\t-n n         number of inserts per run, default to %d\n", num_inserts);
+      printf("\t-t n         largest number of threads, default to %d\n", max_threads);
+      printf("\t-R           time the recovery after a crash instead\n");
+      put_pager_config_usage();
+      exit(0);
+    case 'd': db_dir = optarg; break;
+    case 'n': num_inserts = atoi(optarg); break;
+    case 't': max_threads = atoi(optarg); break;
+    case 'R': recovery = 1; break;
+    case '?':
+      if (isprint(optopt))
+        printf("Unknown option `-%c'.\n", optopt);
+      exit(EXIT_FAILURE);
+    default:
+      if (pager_config_option(&cfg, c, optarg) != 1)
+        exit(EXIT_FAILURE);
+    }
+  if (num_inserts < 1 || max_threads < 1 || max_threads > num_inserts) {
+    put_msg(ERROR, "invalid benchmark parameters.\n");
+    exit(EXIT_FAILURE);
+  }
+  if (!pager_init(&cfg) || !set_system_dir(db_dir)) {
+    put_msg(FATAL, "cannot open %s.\n", db_dir);
+    exit(EXIT_FAILURE);
+  }
+
+  if (recovery) {
+    printf("recovery after up to %d inserts of %d bytes, each one committed\n",
+           num_inserts, RECORD_SIZE);
+    printf("%8s %12s %14s\n", "inserts", "log (KB)", "recovery (ms)");
+    for (int n = (num_inserts + 7) / 8; n <= num_inserts; n *= 2)
+      bench_recovery(n);
+    pager_terminate();
+    clean_dir();
+    return 0;
+  }
+
+  printf("%d inserts of %d bytes, each one committed\n", num_inserts,
+         RECORD_SIZE);
+  printf("%-7s %7s %12s %8s %12s\n", "log", "threads", "inserts/s",
+         "syncs", "commits/sync");
+  for (pager_wal_mode mode = PAGER_WAL_NONE; mode < NUM_PAGER_WAL_MODES;
+       mode++)
+    for (int t = 1; t <= max_threads; t *= 2)
+      bench(mode, t);
+
+  pager_terminate();
+  clean_dir();
+  return 0;
+}
@@ -0,0 +1,278 @@
+/**********************************************************
+ * Compressed files: chunks of blocks compressed together *
+ **********************************************************/
+
+#include "cfile.h"
+#include "lz.h"
+#include "pmsg.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/** @brief Header of a compressed file, at its start */
+typedef struct cf_header {
+  uint32_t magic;        /**< CFILE_MAGIC */
+  uint32_t version;      /**< CFILE_VERSION */
+  uint32_t block_size;   /**< block size in bytes */
+  uint32_t chunk_blocks; /**< CFILE_CHUNK_BLOCKS */
+  uint32_t num_blocks;   /**< number of blocks of the file */
+  uint32_t num_chunks;   /**< number of entries of the chunk map */
+  uint64_t map_off;      /**< offset of the chunk map */
+} cf_header;
+
+/** room of the header, the first chunk follows it */
+#define HEADER_BYTES 64
+
+/** @brief Entry of the chunk map */
+typedef struct cf_chunk {
+  uint64_t off;  /**< offset of the chunk in the file */
+  uint32_t len;  /**< length of the chunk, 0 if it was never written */
+  uint32_t raw;  /**< non-zero if the chunk is stored uncompressed */
+} cf_chunk;
+
+struct cfile {
+  long block_size;
+  int num_blocks;
+  cf_chunk *chunks;   /**< the chunk map, by chunk nr */
+  int num_chunks;
+  int max_chunks;     /**< room of chunks[] */
+  uint64_t end;       /**< end of the last chunk */
+  uint64_t live;      /**< number of bytes of the chunks */
+  char *buf;          /**< the blocks of chunk buf_chunk */
+  int buf_chunk;      /**< chunk in buf, -1 if none */
+  int buf_dirty;      /**< whether buf is changed since it was read */
+  char *zbuf;         /**< a chunk as it is on disk */
+  int map_dirty;      /**< whether the map is changed since it was synced */
+  long raw_bytes;     /**< number of bytes of the chunks written */
+  long saved_bytes;   /**< number of bytes compression saved of them */
+};
+
+static size_t chunk_bytes(cfile* cf) {
+  return (size_t) CFILE_CHUNK_BLOCKS * cf->block_size;
+}
+
+static cfile *new_cfile(long block_size) {
+  cfile *cf = calloc(1, sizeof (cfile));
+  if (!cf) return 0;
+  cf->block_size = block_size;
+  cf->end = HEADER_BYTES;
+  cf->buf_chunk = -1;
+  cf->buf = malloc(chunk_bytes(cf));
+  cf->zbuf = malloc(chunk_bytes(cf));
+  if (!cf->buf || !cf->zbuf) {
+    cf_free(cf);
+    return 0;
+  }
+  return cf;
+}
+
+void cf_free(cfile* cf) {
+  if (!cf) return;
+  free(cf->chunks);
+  free(cf->buf);
+  free(cf->zbuf);
+  free(cf);
+}
+
+/* Make room in the map for chunk c, returns 0 if out of memory */
+static int grow_chunks(cfile* cf, int c) {
+  if (c < cf->num_chunks) return 1;
+  if (c >= cf->max_chunks) {
+    int n = cf->max_chunks ? 2 * cf->max_chunks : 16;
+    while (n <= c) n *= 2;
+    cf_chunk *chunks = realloc(cf->chunks, n * sizeof (cf_chunk));
+    if (!chunks) return 0;
+    cf->chunks = chunks;
+    cf->max_chunks = n;
+  }
+  memset(cf->chunks + cf->num_chunks, 0,
+         (c + 1 - cf->num_chunks) * sizeof (cf_chunk));
+  cf->num_chunks = c + 1;
+  return 1;
+}
+
+/* Compress the chunk buffer and write it back, in its place if it fits */
+static int flush_chunk(cfile* cf, int fd) {
+  size_t n = chunk_bytes(cf);
+  char const* data = cf->zbuf;
+  size_t len = lz_compress(cf->buf, n, cf->zbuf, n - 1);
+  int raw = len == 0;
+  if (raw) { /* it does not compress */
+    data = cf->buf;
+    len = n;
+  }
+  if (!grow_chunks(cf, cf->buf_chunk)) return 0;
+  cf_chunk *k = &cf->chunks[cf->buf_chunk];
+  uint64_t off = k->len > 0 && len <= k->len ? k->off : cf->end;
+  if (pwrite(fd, data, len, off) != (ssize_t) len) {
+    put_msg(ERROR, "cf_write: cannot write chunk %d.\n", cf->buf_chunk);
+    return 0;
+  }
+  if (off == cf->end)
+    cf->end += len;
+  cf->live += len - k->len;
+  k->off = off;
+  k->len = len;
+  k->raw = raw;
+  cf->raw_bytes += n;
+  cf->saved_bytes += n - len;
+  cf->buf_dirty = 0;
+  cf->map_dirty = 1;
+  return 1;
+}
+
+/* Read chunk c into the chunk buffer, writing back the one there */
+static int load_chunk(cfile* cf, int fd, int c) {
+  if (cf->buf_chunk == c) return 1;
+  if (cf->buf_dirty && !flush_chunk(cf, fd)) return 0;
+  cf->buf_chunk = -1;
+  size_t n = chunk_bytes(cf);
+  cf_chunk const* k = c < cf->num_chunks ? &cf->chunks[c] : 0;
+  if (!k || k->len == 0)
+    memset(cf->buf, 0, n);
+  else if (k->raw ? pread(fd, cf->buf, n, k->off) != (ssize_t) n
+           : pread(fd, cf->zbuf, k->len, k->off) != (ssize_t) k->len
+           || lz_decompress(cf->zbuf, k->len, cf->buf, n) != (long) n) {
+    put_msg(ERROR, "cf_read: chunk %d is corrupt.\n", c);
+    return 0;
+  }
+  cf->buf_chunk = c;
+  return 1;
+}
+
+/* order of chunks by offset */
+static int cmp_chunk_offs(void const* a, void const* b) {
+  cf_chunk const* x = *(cf_chunk* const*) a, * y = *(cf_chunk* const*) b;
+  return x->off < y->off ? -1 : (x->off > y->off);
+}
+
+/* Move the chunks to the start of the file, in the order of their
+   offsets, so that no room is left between them */
+static int compact(cfile* cf, int fd) {
+  cf_chunk **order = malloc(cf->num_chunks * sizeof (cf_chunk *));
+  if (!order) return 0;
+  int n = 0;
+  for (int c = 0; c < cf->num_chunks; c++)
+    if (cf->chunks[c].len > 0)
+      order[n++] = &cf->chunks[c];
+  qsort(order, n, sizeof (cf_chunk *), cmp_chunk_offs);
+  uint64_t pos = HEADER_BYTES;
+  for (int i = 0; i < n; pos += order[i++]->len) {
+    cf_chunk *k = order[i];
+    if (k->off == pos) continue;
+    if (pread(fd, cf->zbuf, k->len, k->off) != (ssize_t) k->len
+        || pwrite(fd, cf->zbuf, k->len, pos) != (ssize_t) k->len) {
+      free(order);
+      return 0;
+    }
+    k->off = pos;
+  }
+  free(order);
+  cf->end = pos;
+  return 1;
+}
+
+int cf_sync(cfile* cf, int fd) {
+  if (cf->buf_dirty && !flush_chunk(cf, fd)) return 0;
+  if (!cf->map_dirty) return 1;
+  if (cf->end - HEADER_BYTES - cf->live > cf->live && !compact(cf, fd)) {
+    put_msg(ERROR, "cf_sync: cannot move the chunks together.\n");
+    return 0;
+  }
+  /* the map follows the last chunk, where the next chunk goes */
+  size_t map_len = cf->num_chunks * sizeof (cf_chunk);
+  cf_header h = {
+    CFILE_MAGIC, CFILE_VERSION, cf->block_size, CFILE_CHUNK_BLOCKS,
+    cf->num_blocks, cf->num_chunks, cf->end
+  };
+  if ((map_len > 0
+       && pwrite(fd, cf->chunks, map_len, cf->end) != (ssize_t) map_len)
+      || pwrite(fd, &h, sizeof h, 0) != sizeof h) {
+    put_msg(ERROR, "cf_sync: cannot write the chunk map.\n");
+    return 0;
+  }
+  if (ftruncate(fd, cf->end + map_len) == -1)
+    put_msg(WARN, "cf_sync: cannot truncate the file.\n");
+  cf->map_dirty = 0;
+  return 1;
+}
+
+int cf_is_compressed(int fd) {
+  uint32_t magic = 0;
+  return pread(fd, &magic, sizeof magic, 0) == sizeof magic
+    && magic == CFILE_MAGIC;
+}
+
+cfile *cf_create(int fd, long block_size) {
+  cfile *cf = new_cfile(block_size);
+  if (!cf) return 0;
+  cf->map_dirty = 1;
+  if (!cf_sync(cf, fd)) {
+    cf_free(cf);
+    return 0;
+  }
+  return cf;
+}
+
+cfile *cf_load(int fd, long block_size) {
+  cf_header h;
+  if (pread(fd, &h, sizeof h, 0) != sizeof h || h.magic != CFILE_MAGIC
+      || h.version != CFILE_VERSION || h.block_size != block_size
+      || h.chunk_blocks != CFILE_CHUNK_BLOCKS || h.map_off < HEADER_BYTES) {
+    put_msg(ERROR, "cf_load: not a compressed file of %ld-byte blocks.\n",
+            block_size);
+    return 0;
+  }
+  cfile *cf = new_cfile(block_size);
+  if (!cf) return 0;
+  size_t map_len = h.num_chunks * sizeof (cf_chunk);
+  if ((h.num_chunks > 0 && !grow_chunks(cf, h.num_chunks - 1))
+      || (map_len > 0
+          && pread(fd, cf->chunks, map_len, h.map_off) != (ssize_t) map_len)) {
+    put_msg(ERROR, "cf_load: cannot read the chunk map.\n");
+    cf_free(cf);
+    return 0;
+  }
+  for (int c = 0; c < cf->num_chunks; c++) {
+    cf_chunk const* k = &cf->chunks[c];
+    if (k->len > 0 && (k->off < HEADER_BYTES || k->off + k->len > h.map_off
+                       || k->len > chunk_bytes(cf))) {
+      put_msg(ERROR, "cf_load: chunk %d is out of place.\n", c);
+      cf_free(cf);
+      return 0;
+    }
+    cf->live += k->len;
+  }
+  cf->num_blocks = h.num_blocks;
+  cf->end = h.map_off;
+  return cf;
+}
+
+int cf_num_blocks(cfile* cf) {
+  return cf->num_blocks;
+}
+
+int cf_read(cfile* cf, int fd, int blk_nr, char* buf) {
+  if (!load_chunk(cf, fd, blk_nr / CFILE_CHUNK_BLOCKS)) return 0;
+  memcpy(buf, cf->buf + (size_t) (blk_nr % CFILE_CHUNK_BLOCKS) * cf->block_size,
+         cf->block_size);
+  return 1;
+}
+
+int cf_write(cfile* cf, int fd, int blk_nr, char const* buf) {
+  if (!load_chunk(cf, fd, blk_nr / CFILE_CHUNK_BLOCKS)) return 0;
+  memcpy(cf->buf + (size_t) (blk_nr % CFILE_CHUNK_BLOCKS) * cf->block_size,
+         buf, cf->block_size);
+  cf->buf_dirty = 1;
+  if (blk_nr >= cf->num_blocks) {
+    cf->num_blocks = blk_nr + 1;
+    cf->map_dirty = 1;
+  }
+  return 1;
+}
+
+void cf_bytes(cfile* cf, long* raw, long* saved) {
+  *raw = cf->raw_bytes;
+  *saved = cf->saved_bytes;
+}
@@ -0,0 +1,63 @@
+/** @file cfile.h
+ * @brief Block map of a compressed file.
+ *
+ * The blocks of a compressed file are grouped into <em>chunks</em> of
+ * @ref CFILE_CHUNK_BLOCKS blocks, which are compressed with lz.h as a
+ * whole and stored one after another with their lengths, so a chunk
+ * takes less room on disk than its blocks. Reading a block decompresses
+ * its chunk into a chunk buffer, where the other blocks of the chunk are
+ * found by the next reads of a scan. Writing a block changes the chunk
+ * buffer, which is compressed and written back when another chunk is
+ * needed or the file is synced, so an appended chunk is written once.
+ *
+ * A chunk that is rewritten goes back to its place if it still fits,
+ * and to the end of the file otherwise. When more than half of the file
+ * is left over by moved chunks, @ref cf_sync "cf_sync()" moves the
+ * chunks together again.
+ *
+ * The file starts with a header naming the place of the chunk map,
+ * which is written after the last chunk by cf_sync().
+ * The descriptor of the file is passed to every call, since the pager
+ * may close and reopen it in the meantime.
+ */
+
+#ifndef _CFILE_H_
+#define _CFILE_H_
+
+/** "LZCF" */
+#define CFILE_MAGIC 0x46435a4cu
+
+#define CFILE_VERSION 1
+
+/** number of blocks compressed together */
+#define CFILE_CHUNK_BLOCKS 8
+
+typedef struct cfile cfile;
+
+/** Whether the file open with @em fd is a compressed file. */
+extern int cf_is_compressed(int fd);
+/** Make the empty file open with @em fd a compressed file of blocks of
+    @em block_size bytes. Returns NULL upon failure. */
+extern cfile *cf_create(int fd, long block_size);
+/** Load the block map of the compressed file open with @em fd.
+    Returns NULL if it is not a compressed file of blocks of
+    @em block_size bytes or its map cannot be read. */
+extern cfile *cf_load(int fd, long block_size);
+/** Release the block map, without syncing it. */
+extern void cf_free(cfile* cf);
+
+/** Number of blocks of the file. */
+extern int cf_num_blocks(cfile* cf);
+/** Read block @em blk_nr into @em buf, zeros if it was never written.
+    Returns 0 upon failure. */
+extern int cf_read(cfile* cf, int fd, int blk_nr, char* buf);
+/** Write block @em blk_nr from @em buf. Returns 0 upon failure. */
+extern int cf_write(cfile* cf, int fd, int blk_nr, char const* buf);
+/** Write the chunk buffer, the block map and the header.
+    Returns 0 upon failure. */
+extern int cf_sync(cfile* cf, int fd);
+/** The bytes of the chunks written so far in @em *raw, and the bytes
+    compression saved of them in @em *saved. */
+extern void cf_bytes(cfile* cf, long* raw, long* saved);
+
+#endif
@@ -0,0 +1,391 @@
+/**********************************************************
+ * Columns of ints packed with a frame of reference, and  *
+ * of strings coded by a dictionary                       *
+ **********************************************************/
+
+#include "column.h"
+#include "pager.h"
+#include "pmsg.h"
+#include <stdint.h>
+#include <string.h>
+
+/* A block of a column holds, after the page header, the number of its
+   values, their frame of reference and the bits of a value, followed by
+   the differences of the values to the frame packed in words */
+#define COUNT_POS PAGE_HEADER_SIZE
+#define BASE_POS (PAGE_HEADER_SIZE + INT_SIZE)
+#define BITS_POS (PAGE_HEADER_SIZE + 2 * INT_SIZE)
+#define WORDS_POS (PAGE_HEADER_SIZE + 3 * INT_SIZE)
+
+/** number of words of packed values of a block */
+#define NUM_WORDS ((int) ((BLOCK_SIZE - WORDS_POS) / INT_SIZE))
+/** most values of a block, which all are the same when they take no bits */
+#define MAX_VALS (NUM_WORDS * 32)
+
+/** @brief Column and its cursor */
+struct column_struct {
+  char *fname;            /**< file of the values */
+  access_strategy_p ring; /**< pages for reading the column */
+  int blk_nr;             /**< block at the cursor, -1 before the first */
+  long first;             /**< record of the first value of the block */
+  int num_vals;           /**< number of values of the block */
+  int pos;                /**< value of the block at the cursor */
+  int decoded;            /**< whether vals[] holds the values of the block */
+  int *vals;              /**< values of the block at the cursor */
+  int *spare;             /**< values of a block packed again */
+  int str_len;            /**< longest string, 0 for a column of ints */
+  char *dict_fname;       /**< file of the dictionary */
+  char **strs;            /**< the strings of the dictionary, by code */
+  int num_strs;
+  int max_strs;           /**< room of strs[] */
+  int *codes;             /**< hash table of the codes + 1, 0 for none */
+  int codes_cap;          /**< size of codes[], a power of 2 */
+};
+
+/* Number of words of n values of bits bits */
+static int num_words(int n, int bits) {
+  return ((long) n * bits + 31) / 32;
+}
+
+/* Number of bits of the differences up to range */
+static int bits_for(uint32_t range) {
+  return range ? 32 - __builtin_clz(range) : 0;
+}
+
+/* The number of values of block pg, and its frame of reference and bits */
+static int block_header(page_p pg, int* base, int* bits) {
+  page_set_pos_begin(pg);
+  if (eop(pg)) { /* a new block */
+    *base = *bits = 0;
+    return 0;
+  }
+  *base = page_get_int_at(pg, BASE_POS);
+  *bits = page_get_int_at(pg, BITS_POS);
+  return page_get_int_at(pg, COUNT_POS);
+}
+
+static void get_words(page_p pg, uint32_t words[], int n) {
+  for (int w = 0; w < n; w++)
+    words[w] = page_get_int_at(pg, WORDS_POS + w * INT_SIZE);
+}
+
+static void unpack(uint32_t const words[], int n, int base, int bits,
+                   int vals[]) {
+  uint64_t mask = ((uint64_t) 1 << bits) - 1;
+  for (int i = 0; i < n; i++) {
+    uint64_t bit = (uint64_t) i * bits;
+    int w = bit / 32, shift = bit % 32;
+    uint64_t x = words[w] >> shift;
+    if (shift + bits > 32)
+      x |= (uint64_t) words[w + 1] << (32 - shift);
+    vals[i] = (int) ((uint32_t) base + (uint32_t) (x & mask));
+  }
+}
+
+static void pack(int const vals[], int n, int base, int bits,
+                 uint32_t words[]) {
+  memset(words, 0, num_words(n, bits) * sizeof (uint32_t));
+  for (int i = 0; bits && i < n; i++) {
+    uint64_t bit = (uint64_t) i * bits;
+    int w = bit / 32, shift = bit % 32;
+    uint64_t x = (uint64_t) ((uint32_t) vals[i] - (uint32_t) base) << shift;
+    words[w] |= (uint32_t) x;
+    if (shift + bits > 32)
+      words[w + 1] |= (uint32_t) (x >> 32);
+  }
+}
+
+/* Write n values packed in words[] to block pg */
+static void put_block(page_p pg, int n, int base, int bits,
+                      uint32_t const words[]) {
+  page_put_int_at(pg, COUNT_POS, n);
+  page_put_int_at(pg, BASE_POS, base);
+  page_put_int_at(pg, BITS_POS, bits);
+  for (int w = 0; w < num_words(n, bits); w++)
+    page_put_int_at(pg, WORDS_POS + w * INT_SIZE, words[w]);
+}
+
+/* Read the values of the block at the cursor. Returns 0 upon failure. */
+static int decode_block(column_p c) {
+  page_p pg = get_page_with_strategy(c->fname, c->blk_nr, c->ring);
+  if (!pg) {
+    put_msg(ERROR, "column %s: cannot get block %d.\n", c->fname, c->blk_nr);
+    return 0;
+  }
+  int base, bits;
+  int n = block_header(pg, &base, &bits);
+  uint32_t words[NUM_WORDS];
+  get_words(pg, words, num_words(n, bits));
+  unpin(pg);
+  unpack(words, n, base, bits, c->vals);
+  c->num_vals = n;
+  c->decoded = 1;
+  return 1;
+}
+
+/* Append val to block pg. Returns 0 if it does not fit in the block. */
+static int block_append(column_p c, page_p pg, int val) {
+  int base, bits;
+  int n = block_header(pg, &base, &bits);
+  if (n == 0) {
+    put_block(pg, 1, val, 0, 0);
+    return 1;
+  }
+  int64_t diff = (int64_t) val - base;
+  if (n < MAX_VALS && diff >= 0 && diff < ((int64_t) 1 << bits)
+      && num_words(n + 1, bits) <= NUM_WORDS) {
+    /* the value fits in the frame: only its words change */
+    uint64_t bit = (uint64_t) n * bits;
+    int w = bit / 32, shift = bit % 32;
+    int last = shift + bits > 32 ? w + 1 : w;
+    uint32_t words[2] = {0, 0};
+    for (int i = w; i <= last && i < num_words(n, bits); i++)
+      words[i - w] = page_get_int_at(pg, WORDS_POS + i * INT_SIZE);
+    uint64_t x = (uint64_t) diff << shift;
+    words[0] |= (uint32_t) x;
+    words[1] |= (uint32_t) (x >> 32);
+    for (int i = w; bits && i <= last; i++)
+      page_put_int_at(pg, WORDS_POS + i * INT_SIZE, words[i - w]);
+    page_put_int_at(pg, COUNT_POS, n + 1);
+    return 1;
+  }
+
+  /* a new frame for the values of the block and val */
+  if (n >= MAX_VALS) return 0;
+  uint32_t words[NUM_WORDS];
+  get_words(pg, words, num_words(n, bits));
+  unpack(words, n, base, bits, c->spare);
+  c->spare[n++] = val;
+  int lo = val, hi = val;
+  for (int i = 0; i < n; i++) {
+    if (c->spare[i] < lo) lo = c->spare[i];
+    if (c->spare[i] > hi) hi = c->spare[i];
+  }
+  bits = bits_for((uint32_t) hi - (uint32_t) lo);
+  if (num_words(n, bits) > NUM_WORDS) return 0;
+  pack(c->spare, n, lo, bits, words);
+  put_block(pg, n, lo, bits, words);
+  return 1;
+}
+
+static int append_int(column_p c, int val) {
+  page_p pg = get_page_for_append(c->fname);
+  if (!pg) {
+    put_msg(ERROR, "column %s: cannot get a block to append to.\n", c->fname);
+    return 0;
+  }
+  if (!block_append(c, pg, val)) {
+    int next = page_block_nr(pg) + 1;
+    unpin(pg);
+    pg = get_page(c->fname, next);
+    if (!pg || !block_append(c, pg, val)) {
+      put_msg(ERROR, "column %s: cannot append to block %d.\n", c->fname, next);
+      if (pg) unpin(pg);
+      return 0;
+    }
+  }
+  /* the values at the cursor may have changed */
+  if (page_block_nr(pg) == c->blk_nr)
+    c->decoded = 0;
+  unpin(pg);
+  return 1;
+}
+
+static uint32_t hash_str(char const* str, int len) {
+  uint32_t h = 2166136261u;
+  for (int i = 0; i < len; i++)
+    h = (h ^ (unsigned char) str[i]) * 16777619u;
+  return h;
+}
+
+/* The entry of codes[] of the string str of len bytes, which is 0 if
+   the dictionary does not have it */
+static int *code_entry(column_p c, char const* str, int len) {
+  for (uint32_t i = hash_str(str, len);; i++) {
+    int *e = &c->codes[i & (c->codes_cap - 1)];
+    if (*e == 0 || (strncmp(c->strs[*e - 1], str, len) == 0
+                    && c->strs[*e - 1][len] == '\0'))
+      return e;
+  }
+}
+
+/* Add the string str of len bytes to the dictionary in memory.
+   Returns its code, -1 upon failure. */
+static int add_str(column_p c, char const* str, int len) {
+  if (c->num_strs == c->max_strs) {
+    int max = c->max_strs ? 2 * c->max_strs : 64;
+    char **strs = realloc(c->strs, max * sizeof (char *));
+    if (!strs) return -1;
+    c->strs = strs;
+    c->max_strs = max;
+  }
+  if (2 * (c->num_strs + 1) > c->codes_cap) {
+    int *old = c->codes, old_cap = c->codes_cap;
+    c->codes_cap = old_cap ? 2 * old_cap : 128;
+    c->codes = calloc(c->codes_cap, sizeof (int));
+    if (!c->codes) {
+      c->codes = old;
+      c->codes_cap = old_cap;
+      return -1;
+    }
+    for (int i = 0; i < old_cap; i++)
+      if (old[i]) {
+        char const* s = c->strs[old[i] - 1];
+        *code_entry(c, s, strlen(s)) = old[i];
+      }
+    free(old);
+  }
+  c->strs[c->num_strs] = strndup(str, len);
+  *code_entry(c, str, len) = c->num_strs + 1;
+  return c->num_strs++;
+}
+
+/* The code of the string str, which is added to the dictionary if it
+   does not have it. Returns -1 upon failure. */
+static int str_code(column_p c, char const* str) {
+  int len = strnlen(str, c->str_len);
+  int code = c->num_strs ? *code_entry(c, str, len) - 1 : -1;
+  if (code >= 0) return code;
+
+  page_p pg = get_page_for_append(c->dict_fname);
+  if (pg && !page_put_slot(pg, str, len)) {
+    int next = page_block_nr(pg) + 1;
+    unpin(pg);
+    pg = get_page(c->dict_fname, next);
+    if (pg && !page_put_slot(pg, str, len)) {
+      unpin(pg);
+      pg = 0;
+    }
+  }
+  if (!pg) {
+    put_msg(ERROR, "column %s: cannot add \"%.*s\" to the dictionary.\n",
+            c->fname, len, str);
+    return -1;
+  }
+  unpin(pg);
+  return add_str(c, str, len);
+}
+
+/* Load the dictionary of c. Returns 0 upon failure. */
+static int load_dict(column_p c) {
+  int n = file_num_blocks(c->dict_fname);
+  for (int blk = 0; blk < n; blk++) {
+    page_p pg = get_page_with_strategy(c->dict_fname, blk, c->ring);
+    if (!pg) return 0;
+    int len, ok = 1;
+    for (page_set_pos_begin(pg); ok && !eop(pg); ) {
+      char const* str = page_get_slot(pg, &len);
+      ok = add_str(c, str, len) >= 0;
+    }
+    unpin(pg);
+    if (!ok) return 0;
+  }
+  return 1;
+}
+
+column_p open_column(char const* fname, char const* dict_fname,
+                     int str_len) {
+  column_p c = calloc(1, sizeof (struct column_struct));
+  if (!c) return 0;
+  c->fname = strdup(fname);
+  c->ring = make_access_strategy(0);
+  c->blk_nr = -1;
+  c->vals = malloc(MAX_VALS * sizeof (int));
+  c->spare = malloc(MAX_VALS * sizeof (int));
+  if (dict_fname) {
+    c->str_len = str_len;
+    c->dict_fname = strdup(dict_fname);
+  }
+  if (!c->vals || !c->spare || (dict_fname && !load_dict(c))) {
+    put_msg(ERROR, "open_column: cannot open %s.\n", fname);
+    close_column(c);
+    return 0;
+  }
+  return c;
+}
+
+void close_column(column_p c) {
+  if (!c) return;
+  release_access_strategy(c->ring);
+  for (int i = 0; i < c->num_strs; i++)
+    free(c->strs[i]);
+  free(c->strs);
+  free(c->codes);
+  free(c->dict_fname);
+  free(c->vals);
+  free(c->spare);
+  free(c->fname);
+  free(c);
+}
+
+int column_append(column_p c, void const* val) {
+  if (!c->str_len)
+    return append_int(c, *(int const*) val);
+  int code = str_code(c, val);
+  return code >= 0 && append_int(c, code);
+}
+
+int column_seek(column_p c, long rec_nr) {
+  if (rec_nr < c->first) { /* from the first block again */
+    c->blk_nr = -1;
+    c->first = c->num_vals = 0;
+  }
+  while (rec_nr >= c->first + c->num_vals) {
+    page_p pg = c->blk_nr + 1 < file_num_blocks(c->fname)
+      ? get_page_with_strategy(c->fname, c->blk_nr + 1, c->ring) : 0;
+    if (!pg) {
+      c->pos = c->num_vals;
+      return 0;
+    }
+    int base, bits;
+    c->first += c->num_vals;
+    c->blk_nr++;
+    c->num_vals = block_header(pg, &base, &bits);
+    c->decoded = 0;
+    unpin(pg);
+  }
+  c->pos = rec_nr - c->first;
+  return 1;
+}
+
+long column_pos(column_p c) {
+  return c->first + c->pos;
+}
+
+int column_next(column_p c, void* val) {
+  if ((c->blk_nr < 0 || c->pos >= c->num_vals)
+      && !column_seek(c, column_pos(c)))
+    return 0;
+  if (!c->decoded && !decode_block(c))
+    return -1;
+  int v = c->vals[c->pos++];
+  if (!c->str_len) {
+    memcpy(val, &v, INT_SIZE);
+    return 1;
+  }
+  if (v < 0 || v >= c->num_strs) {
+    put_msg(ERROR, "column %s: no string has code %d.\n", c->fname, v);
+    return -1;
+  }
+  strncpy(val, c->strs[v], c->str_len);
+  return 1;
+}
+
+long column_find(column_p c, int (*op) (int, int), int val) {
+  for (;;) {
+    if ((c->blk_nr < 0 || c->pos >= c->num_vals)
+        && !column_seek(c, column_pos(c)))
+      return -1;
+    if (!c->decoded && !decode_block(c))
+      return -1;
+    /* the values of the block, without a call for each one */
+    while (c->pos < c->num_vals)
+      if ((*op) (val, c->vals[c->pos++]))
+        return column_pos(c) - 1;
+  }
+}
+
+int column_num_blocks(column_p c) {
+  return file_num_blocks(c->fname)
+    + (c->dict_fname ? file_num_blocks(c->dict_fname) : 0);
+}
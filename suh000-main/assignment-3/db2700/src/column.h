@@ -0,0 +1,55 @@
+/** @file column.h
+ * @brief Columns of the tables in column storage.
+ *
+ * A column holds the values of one field of a table, in the order of
+ * the records, in a file of its own. A block of a column holds ints
+ * encoded with a <em>frame of reference</em>: the smallest value of the
+ * block, and the differences to it packed in as many bits as the
+ * largest one needs. A block is packed again with more bits when a
+ * value appended does not fit, and a new block is started when the
+ * values would no longer fit in the block.
+ *
+ * A column of a str field holds the codes of its strings in a
+ * <em>dictionary</em>, which keeps every distinct string once, in
+ * slotted pages of a file of its own, and is loaded when the column is
+ * opened.
+ *
+ * A column is read with a cursor: @ref column_next "column_next()"
+ * gets the value of the next record and @ref column_seek "column_seek()"
+ * moves to a record, reading only the headers of the blocks it skips.
+ */
+
+#ifndef _COLUMN_H_
+#define _COLUMN_H_
+
+typedef struct column_struct * column_p;
+
+/** Open the column in file @em fname. A column of strings of at most
+    @em str_len bytes has its dictionary in file @em dict_fname, a column
+    of ints has none, NULL. Returns NULL upon failure. */
+extern column_p open_column(char const* fname, char const* dict_fname,
+                            int str_len);
+/** Release the memory of the column. */
+extern void close_column(column_p c);
+
+/** Append the int, or the string of a column of strings, @em val.
+    Returns 0 upon failure. */
+extern int column_append(column_p c, void const* val);
+/** Retrieve the value of the record at the cursor into @em val, an int
+    or a string of at most str_len bytes, and move the cursor to the next
+    record. Returns 1 when @em val is updated, 0 when there is no more
+    record, and -1 when something goes wrong. */
+extern int column_next(column_p c, void* val);
+/** Move the cursor of a column of ints past the first record from the
+    cursor on whose value @em v has (*op)(val, v). Returns the record,
+    -1 if there is none and the cursor is at the end of the column. */
+extern long column_find(column_p c, int (*op) (int, int), int val);
+/** Move the cursor to record @em rec_nr, the first record being 0.
+    Returns 0 if there is no such record. */
+extern int column_seek(column_p c, long rec_nr);
+/** The record at the cursor. */
+extern long column_pos(column_p c);
+/** Number of blocks of the column and its dictionary. */
+extern int column_num_blocks(column_p c);
+
+#endif
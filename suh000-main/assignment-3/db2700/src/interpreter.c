@@ -31,17 +31,20 @@ static const char* const t_select = "select";
 static const char* const t_quit = "quit";
 static const char* const t_help = "help";
 static const char* const t_int = "int";
+static const char* const t_using = "using";
 
 static FILE *in_s; /* input stream, default to stdin */
 
 static int init_with_options (int argc, char* argv[]) {
   char cmd_file[MAX_LINE_WIDTH] = "";
   char db_dir[MAX_LINE_WIDTH] = "";
+  pager_config cfg;
   int c;
 
   msglevel = INFO;
+  pager_config_default(&cfg);
 
-  while ((c = getopt(argc, argv, "hm:d:c:")) != -1)
+  while ((c = getopt(argc, argv, "hm:d:c:" PAGER_OPTIONS)) != -1)
     switch (c) {
     case 'h':
       printf("Usage: runtest [switches]\n");
@@ -49,6 +52,7 @@ static int init_with_options (int argc, char* argv[]) {
       printf("\t-m [fewid]   msg level [fatal,error,warn,info,debug]\n");
       printf("\t-d db_dir    default to ./tests/testfront\n");
       printf("\t-c cmd file  eg. ./tests/testcmd.dbcmd, default to stdin\n");
+      put_pager_config_usage();
       exit(0);
     case 'm':
       switch (optarg[0]) {
@@ -65,7 +69,8 @@ static int init_with_options (int argc, char* argv[]) {
       strcpy(cmd_file, optarg);
       break;
     case '?':
-      if (optopt == 'm' || optopt == 'd' || optopt == 'c')
+      if (optopt == 'm' || optopt == 'd' || optopt == 'c'
+          || strchr(PAGER_OPTIONS, optopt))
         printf("Option -%c requires an argument.\n", optopt);
       else if (isprint(optopt))
         printf("Unknown option `-%c'.\n", optopt);
@@ -73,7 +78,8 @@ static int init_with_options (int argc, char* argv[]) {
         printf("Unknown option character `\\x%x'.\n", optopt);
       abort();
     default:
-      abort();
+      if (pager_config_option(&cfg, c, optarg) != 1)
+        abort();
     }
 
   if (cmd_file[0] == '\0')
@@ -104,6 +110,9 @@ static int init_with_options (int argc, char* argv[]) {
   if (db_dir[0] == '\0')
     strcpy(db_dir, "./tests/testfront");
 
+  if (!pager_init(&cfg))
+    return 0;
+
   if (!set_system_dir(db_dir)) {
     put_msg(ERROR, "cannot set database at %s\n", db_dir);
     return 0;
@@ -236,7 +245,8 @@ static void show_help_info() {
   printf(" - # some comments in the rest of a line\n");
   printf(" - print text\n");
   printf(" - show database\n");
-  printf(" - create table table_name ( field_name field_type, ... )\n");
+  printf(" - create table table_name ( field_name field_type, ... )"
+         " [using row|compressed|slotted|pax|column]\n");
   printf(" - drop table table_name (CAUTION: data will be deleted!!!)\n");
   printf(" - insert into table_name values ( value_1, value_2, ... )\n");
   printf(" - select attr1, attr2 from table_name where attr = int_val;\n\n");
@@ -300,7 +310,19 @@ static void create_tbl() {
     skip_line();
     return;
   }
-  skip_line();
+
+  /* the storage of the table, if given */
+  char rest_of_line[MAX_LINE_WIDTH] = "", storage_name[MAX_TOKEN_LEN] = "";
+  int storage = ROW_STORAGE;
+  fgets(rest_of_line, MAX_LINE_WIDTH, in_s);
+  if (sscanf(rest_of_line, "%31s", token) == 1 && strcmp(token, t_using) == 0) {
+    if (sscanf(rest_of_line, "%*s %31[^; \t\n]", storage_name) != 1
+        || (storage = parse_tbl_storage(storage_name)) < 0) {
+      put_msg(ERROR, "create table %s: unknown storage \"%s\"\n",
+              tbl_name, storage_name);
+      return;
+    }
+  }
 
   schema_p sch = get_schema(tbl_name);
 
@@ -340,6 +362,9 @@ static void create_tbl() {
   }
 
   release_strs(attrs, num_attrs);
+  if (!set_tbl_storage(sch, storage))
+    put_msg(WARN, "create table %s: using row storage\n", tbl_name);
+  pager_checkpoint(); /* the catalog of the log knows the table */
   return;
 
  abort_create:
@@ -460,6 +485,9 @@ static void insert_row() {
   if (rec) {
     append_record(rec, sch);
     release_record(rec, sch);
+    /* every insert is a transaction of its own, the table keeps no pin */
+    if (pager_commit() != 1)
+      put_msg(ERROR, "insert into %s: cannot commit.\n", tbl_name);
   }
 }
 
@@ -0,0 +1,210 @@
+/**********************************************************
+ * io_uring engine for the pager                          *
+ **********************************************************/
+
+#include "iouring.h"
+#include "pmsg.h"
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+/** @brief Submission queue ring, shared with the kernel */
+typedef struct sq_ring {
+  unsigned *head;
+  unsigned *tail;
+  unsigned *mask;
+  unsigned *array;
+  struct io_uring_sqe *sqes;
+  unsigned sqe_tail;   /**< entries prepared, not yet published to tail */
+} sq_ring;
+
+/** @brief Completion queue ring, shared with the kernel */
+typedef struct cq_ring {
+  unsigned *head;
+  unsigned *tail;
+  unsigned *mask;
+  struct io_uring_cqe *cqes;
+} cq_ring;
+
+static struct {
+  int fd;              /**< ring fd, -1 if no ring is set up */
+  unsigned entries;    /**< number of submission entries */
+  sq_ring sq;
+  cq_ring cq;
+  void *sq_ptr;        /**< mapping of the submission ring */
+  size_t sq_len;
+  void *cq_ptr;        /**< mapping of the completion ring (may be sq_ptr) */
+  size_t cq_len;
+  void *sqes_ptr;      /**< mapping of the submission entries */
+  size_t sqes_len;
+  unsigned inflight;   /**< submitted, not yet collected */
+} ring = { .fd = -1 };
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *p) {
+  return (int) syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete,
+                              unsigned flags) {
+  return (int) syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+                       flags, NULL, 0);
+}
+
+static void unmap_ring() {
+  if (ring.sqes_ptr) munmap(ring.sqes_ptr, ring.sqes_len);
+  if (ring.cq_ptr && ring.cq_ptr != ring.sq_ptr)
+    munmap(ring.cq_ptr, ring.cq_len);
+  if (ring.sq_ptr) munmap(ring.sq_ptr, ring.sq_len);
+  ring.sq_ptr = ring.cq_ptr = ring.sqes_ptr = 0;
+}
+
+int io_ring_init(unsigned depth) {
+  if (ring.fd >= 0) io_ring_exit();
+
+  struct io_uring_params p;
+  memset(&p, 0, sizeof p);
+  int fd = sys_io_uring_setup(depth, &p);
+  if (fd < 0) {
+    put_msg(DEBUG, "io_uring_setup: %s\n", strerror(errno));
+    return 0;
+  }
+
+  ring.sq_len = p.sq_off.array + p.sq_entries * sizeof (unsigned);
+  ring.cq_len = p.cq_off.cqes + p.cq_entries * sizeof (struct io_uring_cqe);
+  if (p.features & IORING_FEAT_SINGLE_MMAP) {
+    if (ring.cq_len > ring.sq_len) ring.sq_len = ring.cq_len;
+    ring.cq_len = ring.sq_len;
+  }
+  ring.sq_ptr = mmap(0, ring.sq_len, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+  if (ring.sq_ptr == MAP_FAILED) {
+    ring.sq_ptr = 0;
+    close(fd);
+    return 0;
+  }
+  if (p.features & IORING_FEAT_SINGLE_MMAP)
+    ring.cq_ptr = ring.sq_ptr;
+  else {
+    ring.cq_ptr = mmap(0, ring.cq_len, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    if (ring.cq_ptr == MAP_FAILED) {
+      ring.cq_ptr = 0;
+      unmap_ring();
+      close(fd);
+      return 0;
+    }
+  }
+  ring.sqes_len = p.sq_entries * sizeof (struct io_uring_sqe);
+  ring.sqes_ptr = mmap(0, ring.sqes_len, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+  if (ring.sqes_ptr == MAP_FAILED) {
+    ring.sqes_ptr = 0;
+    unmap_ring();
+    close(fd);
+    return 0;
+  }
+
+  char *sq = ring.sq_ptr, *cq = ring.cq_ptr;
+  ring.sq.head = (unsigned *) (sq + p.sq_off.head);
+  ring.sq.tail = (unsigned *) (sq + p.sq_off.tail);
+  ring.sq.mask = (unsigned *) (sq + p.sq_off.ring_mask);
+  ring.sq.array = (unsigned *) (sq + p.sq_off.array);
+  ring.sq.sqes = ring.sqes_ptr;
+  ring.sq.sqe_tail = *ring.sq.tail;
+  ring.cq.head = (unsigned *) (cq + p.cq_off.head);
+  ring.cq.tail = (unsigned *) (cq + p.cq_off.tail);
+  ring.cq.mask = (unsigned *) (cq + p.cq_off.ring_mask);
+  ring.cq.cqes = (struct io_uring_cqe *) (cq + p.cq_off.cqes);
+
+  ring.fd = fd;
+  ring.entries = p.sq_entries;
+  ring.inflight = 0;
+  return 1;
+}
+
+void io_ring_exit(void) {
+  if (ring.fd < 0) return;
+  void *data;
+  int res;
+  while (ring.inflight > 0) {
+    if (!io_ring_peek(&data, &res) && io_ring_submit(1) < 0)
+      break;
+  }
+  unmap_ring();
+  close(ring.fd);
+  ring.fd = -1;
+}
+
+int io_ring_active(void) {
+  return ring.fd >= 0;
+}
+
+unsigned io_ring_depth(void) {
+  return ring.fd >= 0 ? ring.entries : 0;
+}
+
+unsigned io_ring_inflight(void) {
+  return ring.inflight;
+}
+
+int io_ring_prep_rw(int write, int fd, struct iovec const* iov,
+                    int iovcnt, off_t offset, void* data) {
+  if (ring.fd < 0) return 0;
+  unsigned head = __atomic_load_n(ring.sq.head, __ATOMIC_ACQUIRE);
+  /* the completion queue must also have room for every request */
+  if (ring.sq.sqe_tail - head >= ring.entries
+      || ring.inflight + (ring.sq.sqe_tail - *ring.sq.tail) >= ring.entries)
+    return 0;
+
+  unsigned i = ring.sq.sqe_tail & *ring.sq.mask;
+  struct io_uring_sqe *sqe = &ring.sq.sqes[i];
+  memset(sqe, 0, sizeof *sqe);
+  sqe->opcode = write ? IORING_OP_WRITEV : IORING_OP_READV;
+  sqe->fd = fd;
+  sqe->addr = (unsigned long) iov;
+  sqe->len = iovcnt;
+  sqe->off = offset;
+  sqe->user_data = (unsigned long) data;
+  ring.sq.array[i] = i;
+  ring.sq.sqe_tail++;
+  return 1;
+}
+
+int io_ring_submit(unsigned wait_nr) {
+  if (ring.fd < 0) return -ENXIO;
+  unsigned to_submit = ring.sq.sqe_tail - *ring.sq.tail;
+  __atomic_store_n(ring.sq.tail, ring.sq.sqe_tail, __ATOMIC_RELEASE);
+
+  unsigned ready = __atomic_load_n(ring.cq.tail, __ATOMIC_ACQUIRE)
+    - *ring.cq.head;
+  if (to_submit == 0 && ready >= wait_nr)
+    return 0;
+
+  int res;
+  do
+    res = sys_io_uring_enter(ring.fd, to_submit, wait_nr,
+                             wait_nr ? IORING_ENTER_GETEVENTS : 0);
+  while (res < 0 && errno == EINTR);
+  if (res < 0) {
+    put_msg(ERROR, "io_uring_enter: %s\n", strerror(errno));
+    return -errno;
+  }
+  ring.inflight += res;
+  return res;
+}
+
+int io_ring_peek(void** data, int* res) {
+  if (ring.fd < 0) return 0;
+  unsigned head = *ring.cq.head;
+  if (head == __atomic_load_n(ring.cq.tail, __ATOMIC_ACQUIRE))
+    return 0;
+  struct io_uring_cqe *cqe = &ring.cq.cqes[head & *ring.cq.mask];
+  *data = (void *) (unsigned long) cqe->user_data;
+  *res = cqe->res;
+  __atomic_store_n(ring.cq.head, head + 1, __ATOMIC_RELEASE);
+  ring.inflight--;
+  return 1;
+}
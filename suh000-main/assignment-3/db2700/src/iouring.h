@@ -0,0 +1,52 @@
+/** @file iouring.h
+ * @brief A small io_uring engine for asynchronous block I/O.
+ *
+ * The engine sets up one ring with the raw io_uring system calls,
+ * so no library besides the kernel headers is needed.
+ * Start it with @ref io_ring_init "io_ring_init()" and stop it with
+ * @ref io_ring_exit "io_ring_exit()".
+ *
+ * Queue vectored reads and writes with @ref io_ring_prep_rw
+ * "io_ring_prep_rw()", hand them to the kernel with
+ * @ref io_ring_submit "io_ring_submit()", and collect the results with
+ * @ref io_ring_peek "io_ring_peek()".
+ * Every request carries a pointer that is given back with its result.
+ *
+ * If the kernel does not support io_uring (or it is disabled),
+ * io_ring_init() fails and the caller is expected to use synchronous I/O.
+ */
+
+#ifndef _IOURING_H_
+#define _IOURING_H_
+
+#include <sys/types.h>
+#include <sys/uio.h>
+
+/** Set up a ring with (at least) @em depth entries.
+    Returns 0 if io_uring is unavailable. */
+extern int io_ring_init(unsigned depth);
+/** Tear down the ring. Requests still in flight are waited for. */
+extern void io_ring_exit(void);
+/** Whether a ring is set up. */
+extern int io_ring_active(void);
+/** Number of entries of the ring. */
+extern unsigned io_ring_depth(void);
+/** Number of requests submitted to the kernel but not collected yet. */
+extern unsigned io_ring_inflight(void);
+
+/** Queue a vectored read (or write if @em write is non-zero) of
+    @em iovcnt buffers at @em offset of file @em fd.
+    @em iov must stay valid until the request is submitted.
+    Returns 0 if the ring is full. */
+extern int io_ring_prep_rw(int write, int fd, struct iovec const* iov,
+                           int iovcnt, off_t offset, void* data);
+/** Submit the queued requests and wait for at least @em wait_nr
+    results to be available.
+    Returns the number of requests submitted, -errno upon failure. */
+extern int io_ring_submit(unsigned wait_nr);
+/** Collect a result without blocking.
+    Returns 1 and sets @em data and @em res (bytes transferred or -errno)
+    if a result is available, otherwise 0. */
+extern int io_ring_peek(void** data, int* res);
+
+#endif
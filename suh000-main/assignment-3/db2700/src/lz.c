@@ -0,0 +1,110 @@
+/**********************************************************
+ * LZ77 codec of the blocks of compressed files           *
+ **********************************************************/
+
+#include "lz.h"
+#include <stdint.h>
+#include <string.h>
+
+/** number of bits of the hash of a 4-byte prefix */
+#define HASH_BITS 12
+
+static uint32_t hash4(unsigned char const* p) {
+  uint32_t x;
+  memcpy(&x, p, sizeof x);
+  return (x * 2654435761u) >> (32 - HASH_BITS);
+}
+
+/* Append a length continuing a nibble of 15, returns 0 if out of room */
+static int put_len(char* dst, size_t* op, size_t cap, size_t n) {
+  for (; n >= 255; n -= 255) {
+    if (*op >= cap) return 0;
+    dst[(*op)++] = (char) 255;
+  }
+  if (*op >= cap) return 0;
+  dst[(*op)++] = (char) n;
+  return 1;
+}
+
+/* Append a run of nlit literals followed by a match of mlen bytes at
+   distance dist, or no match if mlen is 0. Returns 0 if out of room. */
+static int put_run(char* dst, size_t* op, size_t cap, char const* lit,
+                   size_t nlit, size_t dist, size_t mlen) {
+  size_t m = mlen ? mlen - LZ_MIN_MATCH : 0;
+  if (*op >= cap) return 0;
+  dst[(*op)++] = (char) (((nlit < 15 ? nlit : 15) << 4) | (m < 15 ? m : 15));
+  if (nlit >= 15 && !put_len(dst, op, cap, nlit - 15)) return 0;
+  if (*op + nlit > cap) return 0;
+  memcpy(dst + *op, lit, nlit);
+  *op += nlit;
+  if (!mlen) return 1;
+  if (*op + 2 > cap) return 0;
+  dst[(*op)++] = (char) (dist & 0xff);
+  dst[(*op)++] = (char) (dist >> 8);
+  return m < 15 || put_len(dst, op, cap, m - 15);
+}
+
+size_t lz_compress(char const* src, size_t len, char* dst, size_t cap) {
+  unsigned char const* s = (unsigned char const*) src;
+  uint32_t table[1 << HASH_BITS]; /* position + 1 of a prefix, 0 if none */
+  memset(table, 0, sizeof table);
+  size_t ip = 0, anchor = 0, op = 0;
+  while (ip + LZ_MIN_MATCH <= len) {
+    uint32_t h = hash4(s + ip);
+    size_t cand = table[h];
+    table[h] = ip + 1;
+    if (cand == 0 || ip - (cand - 1) > LZ_MAX_DISTANCE
+        || memcmp(s + cand - 1, s + ip, LZ_MIN_MATCH) != 0) {
+      ip++;
+      continue;
+    }
+    cand--;
+    size_t mlen = LZ_MIN_MATCH;
+    while (ip + mlen < len && s[cand + mlen] == s[ip + mlen])
+      mlen++;
+    if (!put_run(dst, &op, cap, src + anchor, ip - anchor, ip - cand, mlen))
+      return 0;
+    ip += mlen;
+    anchor = ip;
+  }
+  if (!put_run(dst, &op, cap, src + anchor, len - anchor, 0, 0))
+    return 0;
+  return op;
+}
+
+/* Read a length continuing a nibble of 15, returns 0 at the end of src */
+static int get_len(unsigned char const* s, size_t len, size_t* ip, size_t* n) {
+  unsigned char b;
+  do {
+    if (*ip >= len) return 0;
+    b = s[(*ip)++];
+    *n += b;
+  } while (b == 255);
+  return 1;
+}
+
+long lz_decompress(char const* src, size_t len, char* dst, size_t cap) {
+  unsigned char const* s = (unsigned char const*) src;
+  size_t ip = 0, op = 0;
+  while (ip < len) {
+    unsigned token = s[ip++];
+    size_t nlit = token >> 4, mlen = token & 15;
+    if (nlit == 15 && !get_len(s, len, &ip, &nlit)) return -1;
+    if (ip + nlit > len || op + nlit > cap) return -1;
+    memcpy(dst + op, src + ip, nlit);
+    ip += nlit;
+    op += nlit;
+    if (ip == len) break; /* the last run has no match */
+
+    if (ip + 2 > len) return -1;
+    size_t dist = s[ip] | (size_t) s[ip + 1] << 8;
+    ip += 2;
+    if (mlen == 15 && !get_len(s, len, &ip, &mlen)) return -1;
+    mlen += LZ_MIN_MATCH;
+    if (dist == 0 || dist > op || op + mlen > cap) return -1;
+    /* byte by byte, a match may overlap what it copies */
+    for (size_t i = 0; i < mlen; i++, op++)
+      dst[op] = dst[op - dist];
+  }
+  return (long) op;
+}
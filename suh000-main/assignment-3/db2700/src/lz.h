@@ -0,0 +1,41 @@
+/** @file lz.h
+ * @brief A small LZ77 codec for the blocks of compressed files.
+ *
+ * The compressed form is a sequence of runs, each a token byte
+ * followed by literal bytes and a back reference, in the manner of LZ4:
+ * the high nibble of the token is the number of literals and the low
+ * nibble the length of the match minus @ref LZ_MIN_MATCH. A nibble of
+ * 15 is continued by bytes that are added to it, up to the first byte
+ * that is not 255. The literals are followed by the distance of the
+ * match, 2 bytes little endian, and the continued match length.
+ * The last run has literals only.
+ *
+ * Matches are found through a hash table of the positions of 4-byte
+ * prefixes, so compressing is a single pass over the input. The
+ * zero-padded strings and small ints of fixed-width records compress
+ * well this way.
+ */
+
+#ifndef _LZ_H_
+#define _LZ_H_
+
+#include <stddef.h>
+
+/** shortest match that is worth a back reference */
+#define LZ_MIN_MATCH 4
+
+/** longest distance of a back reference */
+#define LZ_MAX_DISTANCE 65535
+
+/** Compress the @em len bytes of @em src into @em dst, which has room
+    for @em cap bytes.
+    Returns the length of the compressed form, 0 if it does not fit. */
+extern size_t lz_compress(char const* src, size_t len, char* dst, size_t cap);
+
+/** Decompress the @em len bytes of @em src into @em dst, which has room
+    for @em cap bytes.
+    Returns the length of the decompressed form, -1 if @em src is not
+    a valid compressed form or does not fit. */
+extern long lz_decompress(char const* src, size_t len, char* dst, size_t cap);
+
+#endif
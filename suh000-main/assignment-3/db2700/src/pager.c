@@ -4,73 +4,269 @@
  * Author: Weihai Yu                                      *
  **********************************************************/
 
+#define _GNU_SOURCE /* syncfs() */
 #include "pager.h"
 #include "pmsg.h"
+#include "iouring.h"
+#include "pagetrace.h"
+#include "tablespace.h"
+#include "cfile.h"
+#include "wal.h"
 #include <unistd.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
 #include <string.h>
 #include <fcntl.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
 
 /** the dir in which the database files are stored */
 char sys_dir[512];
 
+/** File in sys_dir holding the superblock of the database */
+const char superblock_file[] = "db.pager";
+
+/** File in sys_dir holding all files of a database with a tablespace */
+const char tablespace_file[] = "db.tablespace";
+
+/** File in sys_dir holding the write-ahead log of a database */
+const char wal_file[] = "db.wal";
+
+pager_config pager_cfg = {
+  DEFAULT_NUM_PAGES, 0, DEFAULT_BLOCK_SIZE, DEFAULT_MAX_OPEN_FILES, PAGER_LRU,
+  PAGER_IO_SYNC, DEFAULT_IO_DEPTH, PAGER_COPY, 0, 0, 0, 0, PAGER_DEVICE_HDD, 0, 0,
+  PAGER_WAL_NONE
+};
+
 /** @brief Database file handle */
 typedef struct file_handle_struct {
-  char *fname;  /**< file name */
-  int fd;       /**< Unix file descriptor */
-  /** The blocks (max NUM_PAGES) currently in the memory.
-      blocks_in_mem[i] == NULL when that slot is left unused.
-  */
+  char *fname;  /**< file name (owned by the interned name entry) */
+  int fid;      /**< interned file id, see @ref intern_fname */
+  int slot;     /**< position in file_handles[] */
+  int fd;       /**< Unix file descriptor, -1 while closed, see fd_lru */
+  int seg;      /**< segment in the tablespace, -1 for a Unix file of its own */
+  cfile *cf;    /**< block map of a compressed file, NULL if not compressed */
   int num_blocks; /**< number of blocks this file has. */
-  block_p blocks_in_mem[NUM_PAGES];
+  int alloc_blocks; /**< number of blocks of the Unix file, preallocated
+                         ones included, -1 if unknown */
+  int header_blocks; /**< logical size in the file header, see
+                          LOGICAL_SIZE_POS */
   block_p current_block; /**current block been accessd */
+  int last_blk_nr; /**< block of the previous get_page(), to detect scans */
+  int ra_window;   /**< number of blocks to read ahead at the next sequential miss */
+  char *map;       /**< read-only mapping of the blocks, NULL if not mapped */
+  size_t map_len;  /**< length of the mapping */
+  struct file_handle_struct *lru_prev; /**< previous handle in fd_lru */
+  struct file_handle_struct *lru_next; /**< next handle in fd_lru */
 } file_handle_struct;
 
 typedef struct file_handle_struct * fhandle_p;
 
-/** Handles of all files that are open */
-fhandle_p file_handles[MAX_OPEN_FILES];
+/** Handles of all files that are open (max_file_handles slots) */
+fhandle_p *file_handles;
+
+/** number of slots of file_handles[], grown on demand */
+static int max_file_handles;
+
+/** @brief Handles with an open descriptor, the least recently used first
+
+A file stays open as long as it has a handle, but only MAX_OPEN_FILES
+descriptors are: the descriptor of the least recently used handle is
+closed to open another one, and reopened when its file is read or
+written again.
+*/
+static struct {
+  fhandle_p first, last;
+  int len;
+} fd_lru;
+
+/** @brief Interned file name
+
+A file name is interned to a small integer id the first time the pager
+sees it. Blocks are identified by (file id, block nr), so looking up a
+buffered block never compares strings.
+*/
+typedef struct fname_entry {
+  char *name;               /**< file name */
+  unsigned hash;            /**< hash of the name */
+  int fid;                  /**< interned file id */
+  fhandle_p fhandle;        /**< handle of the file, NULL if not open */
+  int num_blocks;           /**< number of blocks when the file was closed,
+                                 -1 if unknown */
+  int alloc_blocks;         /**< number of blocks of the Unix file when it was
+                                 closed, -1 if unknown */
+  int logged;               /**< non-zero if the write-ahead log has page
+                                 records of the file */
+  struct fname_entry *next; /**< next entry in the same bucket */
+} fname_entry;
+
+/** Position in the header of block 0 of the number of blocks of a file
+    that has preallocated blocks beyond them, 0 if it has none, in which
+    case the size of the Unix file tells the number of blocks. The word
+    is reserved in the header of every page whatever its layout: a new
+    page has it 0, and only the pager writes it, to the Unix file, when
+    it closes a file it preallocated. */
+#define LOGICAL_SIZE_POS 8
+
+/** number of buckets of the interned file names */
+#define FNAME_BUCKETS 256
+
+static fname_entry *fname_table[FNAME_BUCKETS];
+
+/** next file id to hand out */
+static int next_fid = 0;
+
+/** @brief Pages changed since they were logged
+
+A page is listed when it is first changed after it was logged, and
+pager_commit() logs the listed pages. The page may have been logged
+meanwhile, when it was written back. The list and the changed bytes
+of the pages are guarded by log_mutex, since pages are changed without
+holding pager_mutex; they are logged holding both.
+*/
+static page_p *log_pages;
+static int num_log_pages;
+static pthread_mutex_t log_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/** counters of the log when the profiler was reset */
+static wal_stats wal_stats_base;
+
+/** @brief Checkpoints
+
+A fuzzy checkpoint is taken when the log has grown by
+WAL_CHECKPOINT_BYTES since the last one, by the thread that commits
+then, and one at a time. It writes back the pages that have been dirty
+since before the last checkpoint, so that redo never goes back further.
+*/
+static pthread_mutex_t ckpt_mutex = PTHREAD_MUTEX_INITIALIZER;
+static wal_lsn last_ckpt_begin; /**< end of the log at the last checkpoint */
+
+/** gives the catalog a checkpoint saves, see pager_set_catalog() */
+static char *(*catalog_source)(long* len);
+/** the catalog of the log redone, until pager_recovered_catalog() */
+static char *recovered_catalog;
+static long recovered_catalog_len;
 
 typedef struct pq_elm * pq_elm_p;
+typedef struct pqueue * pqueue_p;
 
 /** @brief Database file block */
 typedef struct block_struct {
   fhandle_p fhandle; /**< file handle */
   int blk_nr;            /**< block number */
   page_p page;           /**< buffer page of the block */
+  block_p hnext;         /**< next block in the same bucket of blk_table */
 } block_struct;
 
+/** Buffered blocks, hashed on (file id, block nr).
+    The number of buckets is a power of 2, at least twice the number of pages.
+    Bucket h belongs to shard h % BLK_SHARDS: a bucket chain is changed
+    holding both pager_mutex and the lock of its shard, and may be looked
+    up holding either of them (see @ref get_pinned_page).
+*/
+static block_p *blk_table;
+static unsigned blk_table_mask;
+
+#define BLK_SHARDS 64
+
+static pthread_mutex_t blk_shards[BLK_SHARDS];
+
+/** page queue */
+
+/** @brief element in pqueue */
+typedef struct pq_elm {
+  page_p page;   /**< pointing to the queued page */
+  pqueue_p queue; /**< the queue the element is in */
+  pq_elm_p prev; /**< previous page */
+  pq_elm_p next; /**< next page */
+} pq_elm;
+
 /** @brief Database buffer page
 
 The content of a page/block consists of first a header,
 then a series of records, and finally free space.
 
-The header includes:
+The header takes PAGE_HEADER_SIZE (24) bytes, the same in every
+page layout:
  - bytes 0-3: header size
  - bytes 4-7: position of the beginning of the unused space
- - possibly some more, for example, when implementing variable-length records,
-   file as linked list of blocks, or lsn for write-ahead logging
+ - bytes 8-11: reserved, in block 0 the number of blocks of a file with
+   preallocated blocks, see LOGICAL_SIZE_POS
+ - bytes 12-19: LSN of the last record of the block in the write-ahead
+   log, see LSN_POS
+ - bytes 20-23: beginning of the records of a slotted page, see
+   RECORDS_POS
 */
 
 typedef struct page_struct {
-  char *content;   /**< BLOCK_SIZE of bytes */
+  _Alignas(64) char *content;   /**< BLOCK_SIZE of bytes, in buf or in the mapping of the file */
+  char *buf;       /**< own buffer, allocated on demand with the mmap pager */
   int page_nr;
   block_p block;   /**< the correspoding file block */
-  pq_elm_p qelm;   /**< the corresponding elm in pfifo */
-  int pinned;      /**< non-zoro if the block is pinned to the page */
+  pq_elm_p qelm;   /**< elm if the page is in a page queue, NULL otherwise */
+  pq_elm elm;      /**< the element of the page in its page queue */
+  atomic_int pin_count; /**< number of pins, the block is pinned to the page if > 0 */
+  atomic_int touched;   /**< non-zero if pinned again without telling the policy */
+  atomic_int valid;     /**< non-zero once the content holds the block */
+  int ref;         /**< reference bit, used by CLOCK */
+  long hist1;      /**< time of the last reference, used by LRU-2 */
+  long hist2;      /**< time of the second last reference, used by LRU-2 */
+  atomic_int prefetched; /**< non-zero if read ahead and not referenced yet */
+  int io_pending;  /**< non-zero while an io_uring request on the page is in flight */
   int dirty;       /**< non-zero if the content has been changed (dirty) */
+  int cleaning;    /**< non-zero while the cleaner writes a copy of the page */
+  int cleaned;     /**< 1 (-1) if the cleaner wrote (failed to write) the
+                        page while it was pinned, for the last unpin */
+  int log_lo;      /**< first byte changed since the page was logged */
+  int log_hi;      /**< end of the bytes changed since the page was logged,
+                        nothing is changed if not beyond log_lo */
+  int log_listed;  /**< non-zero if the page is in log_pages */
+  wal_lsn rec_lsn; /**< end of the log before the oldest logged change
+                        that may not be on disk, 0 if there is none */
+  long last_ref;   /**< time of the last pin, the cleaner cleans the oldest first */
+  access_strategy_p ring; /**< the strategy that recycles the page, NULL if the page is shared */
   int free_pos;    /**< beginning of free space */
   int current_pos; /**< current position for next access */
+  pthread_rwlock_t latch; /**< guards the content among threads, see page_latch() */
 } page_struct;
 
-/** page queue */
+/** @brief Buffer access strategy
 
-/** @brief element in pqueue */
-typedef struct pq_elm {
-  page_p page;   /**< pointing to the queued page */
-  pq_elm_p prev; /**< previous page */
-  pq_elm_p next; /**< next page */
-} pq_elm;
+A bulk access, like a scan of a large table, recycles the pages of a
+small ring instead of taking pages from the whole buffer, so that it does
+not evict the blocks that other accesses keep referencing.
+A page leaves the ring when its block is referenced without the strategy.
+*/
+typedef struct access_strategy {
+  int size;      /**< number of pages in the ring */
+  int current;   /**< slot of the page got last */
+  page_p ring[]; /**< pages got by the strategy, NULL for an empty slot */
+} access_strategy;
+
+/** @brief I/O request on a run of adjacent blocks, for the io_uring engine
+
+An asynchronous request (e.g. read-ahead) holds a pin on its pages
+until the result is collected, so that they are not replaced meanwhile.
+*/
+typedef struct io_req {
+  int write;         /**< non-zero for a write */
+  int n;             /**< number of pages */
+  int waited;        /**< non-zero if the submitter waits for the result */
+  int done;          /**< non-zero when the result is collected */
+  struct timespec start; /**< time of the submission */
+  int ok;            /**< non-zero if the request succeeded */
+  int cap;           /**< number of pages the request has room for */
+  page_p *pgs;       /**< pages of the adjacent blocks */
+  struct iovec *iov; /**< content of the pages */
+  struct io_req *next; /**< next request in io_req_pool */
+} io_req;
+
+/** Requests that are done, for reuse */
+static io_req *io_req_pool;
 
 /** @brief queue of pages */
 typedef struct pqueue {
@@ -79,25 +275,291 @@ typedef struct pqueue {
   int len;
 } pqueue;
 
-typedef pqueue * pqueue_p;
-
-/** Page LRF queues for page replacement */
+/** Page LRF queues of LRU */
 static pqueue_p q_pinned, q_unpinned;
 
-/** Pager profiler */
+/** Page queues of 2Q (A1in and Am) and ARC (T1 and T2) */
+static pqueue_p q_a1in, q_am, q_t1, q_t2;
+
+/** Pages without a block, the next one to use last */
+static page_p *free_pages;
+static int num_free_pages;
+
+/** Strategy of the get_page_with_strategy() in progress, under pager_mutex */
+static access_strategy_p active_strategy;
+
+/** @brief Memory of the buffer pool
+
+The buffers, the page structures and the block descriptors are carved
+out of one anonymous mapping: the buffers come first and are aligned to
+the block size (and the mapping to the page size of the OS), the page
+structures are aligned to cache lines. No heap memory is allocated when
+a block is missed. The buffers of the mmap pager are only touched when
+they are used, so the unused ones take no memory.
+*/
 static struct {
+  char *base;             /**< start of the mapping */
+  size_t len;             /**< length of the mapping */
+  page_struct *pages;     /**< the NUM_PAGES page structures */
+  block_struct *blocks;   /**< the block descriptors */
+  int num_blocks;         /**< number of block descriptors */
+} arena;
+
+/** size of the huge pages asked for with pager_config.huge_pages */
+#define HUGE_PAGE_SIZE (2UL << 20)
+
+/** Unused block descriptors of the arena, linked by hnext */
+static block_p free_blocks;
+
+/** @brief Pager profiler counters of a file */
+typedef struct file_counters {
+  int num_hits;        /**< number of get_page() finding a block of the file */
+  int num_misses;      /**< number of get_page() reading a block of the file */
+  int num_evictions;   /**< number of blocks of the file replaced */
+  int num_dirty_evictions; /**< number of dirty blocks of the file replaced */
+  int num_disk_reads;  /**< number of blocks of the file read */
+  int num_disk_writes; /**< number of blocks of the file written */
+  long bytes_read;     /**< number of bytes read from the file */
+  long bytes_written;  /**< number of bytes written to the file */
+  long bytes_compressed; /**< number of bytes of the chunks of the file compressed */
+  long bytes_saved;    /**< number of bytes compression saved of them */
+} file_counters;
+
+/** number of buckets of the I/O latency histograms: bucket 0 counts the
+    requests taking less than 1us, bucket i > 0 those taking [2^(i-1), 2^i)us,
+    and the last bucket the slower ones */
+#define LATENCY_BUCKETS 24
+
+/** @brief Pager profiler counters of a thread
+
+Every thread counts its own events, without synchronization.
+The counters of all threads are merged when they are reported.
+*/
+typedef struct pager_counters {
   int num_seeks;       /**< number of seeks after the reset of pager profiler */
   int num_disk_reads;  /**< number of disk reads after the reset of pager profiler */
   int num_disk_writes; /**< number of disk writes after the reset of pager profiler */
-  int last_fd;     /** fd of the last visited block, used to check if a new seek is needed */
+  int num_hits;        /**< number of get_page() finding the block in the buffer */
+  int num_misses;      /**< number of get_page() reading the block into the buffer */
+  int num_prefetched;  /**< number of blocks read ahead */
+  int num_prefetch_hits; /**< number of read-ahead blocks referenced later */
+  int num_io_submits;  /**< number of io_uring requests */
+  int max_io_inflight; /**< max number of io_uring requests in flight */
+  int num_mapped;      /**< number of blocks accessed through a mapping */
+  int num_cleaned;     /**< number of pages written back by the cleaner */
+  int num_dirty_victims; /**< number of dirty pages replaced by the foreground */
+  int num_recycled;    /**< number of pages recycled by the ring of an access strategy */
+  int num_evictions;   /**< number of pages replaced */
+  int num_reopens;     /**< number of descriptors reopened, see fd_lru */
+  long bytes_read;     /**< number of bytes read */
+  long bytes_written;  /**< number of bytes written */
+  long bytes_compressed; /**< number of bytes of the chunks of compressed files */
+  long bytes_saved;    /**< number of bytes compression saved of them */
+  long read_latency[LATENCY_BUCKETS];  /**< read requests by latency */
+  long write_latency[LATENCY_BUCKETS]; /**< write requests by latency */
+  file_counters *files; /**< counters by file id, grown under counters_mutex */
+  int num_files;       /**< number of entries in files */
+  int last_fid;    /** file id of the last visited block, used to check if a new seek is needed */
   int last_blk_nr; /** nr of the last visited block, used to check if a new seek is needed */
-} pager_profiler;
+  struct pager_counters *next; /**< counters of the next thread */
+} pager_counters;
+
+/** counters of all threads that have used the pager, guarded by counters_mutex */
+static pager_counters *all_counters;
+static pthread_mutex_t counters_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/** counters of the current thread */
+static _Thread_local pager_counters *my_counters;
+
+static void reset_counters(pager_counters *c) {
+  pager_counters *next = c->next;
+  file_counters *files = c->files;
+  int num_files = c->num_files;
+  memset(c, 0, sizeof (pager_counters));
+  memset(files, 0, num_files * sizeof (file_counters));
+  c->next = next;
+  c->files = files;
+  c->num_files = num_files;
+  c->last_fid = -1;
+  c->last_blk_nr = -1;
+}
+
+/* Returns the counters of the current thread, registering them at the
+   first use. They stay registered after the thread ends. */
+static pager_counters *counters() {
+  if (my_counters) return my_counters;
+  pager_counters *c = calloc(1, sizeof (pager_counters));
+  if (!c) {
+    put_msg(FATAL, "cannot allocate pager counters.\n");
+    exit(EXIT_FAILURE);
+  }
+  reset_counters(c);
+  pthread_mutex_lock(&counters_mutex);
+  c->next = all_counters;
+  all_counters = c;
+  pthread_mutex_unlock(&counters_mutex);
+  return my_counters = c;
+}
+
+/* Returns the counters of file fid of the current thread */
+static file_counters *file_counters_of(int fid) {
+  pager_counters *c = counters();
+  if (fid < c->num_files)
+    return &c->files[fid];
+  int n = c->num_files ? c->num_files : 8;
+  while (n <= fid) n *= 2;
+  file_counters *files = calloc(n, sizeof (file_counters));
+  if (!files) {
+    put_msg(FATAL, "cannot allocate pager counters.\n");
+    exit(EXIT_FAILURE);
+  }
+  pthread_mutex_lock(&counters_mutex);
+  memcpy(files, c->files, c->num_files * sizeof (file_counters));
+  free(c->files);
+  c->files = files;
+  c->num_files = n;
+  pthread_mutex_unlock(&counters_mutex);
+  return &c->files[fid];
+}
+
+/* Count a request in a latency histogram, it started at start */
+static void count_latency(long hist[], struct timespec const* start) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  long us = (now.tv_sec - start->tv_sec) * 1000000L
+    + (now.tv_nsec - start->tv_nsec) / 1000;
+  int i = 0;
+  for (; us > 0 && i < LATENCY_BUCKETS - 1; us >>= 1)
+    i++;
+  hist[i]++;
+}
+
+/** number of trace records buffered before they are written */
+#define TRACE_BUF_RECS 1024
+
+/** @brief Page trace of the running pager, see pagetrace.h
+
+The records of all threads are buffered in the order of their accesses,
+guarded by the mutex.
+*/
+static struct {
+  FILE *fp;                /**< the trace file, NULL if not tracing */
+  int n;                   /**< number of records in buf */
+  page_trace_rec buf[TRACE_BUF_RECS];
+  pthread_mutex_t mutex;
+} trace = {.mutex = PTHREAD_MUTEX_INITIALIZER};
+
+static void trace_flush() {
+  if (trace.n > 0 && fwrite(trace.buf, sizeof (page_trace_rec), trace.n,
+                            trace.fp) != (size_t) trace.n)
+    put_msg(ERROR, "cannot write the page trace.\n");
+  trace.n = 0;
+}
+
+static void trace_append(int op, int fid, int blk_nr, int dirty) {
+  if (trace.n == TRACE_BUF_RECS)
+    trace_flush();
+  page_trace_rec *r = &trace.buf[trace.n++];
+  r->op = op;
+  r->dirty = dirty != 0;
+  r->fid = fid;
+  r->blk_nr = blk_nr;
+}
+
+/* Log an access to the page of a block */
+static void trace_page(int op, page_p pg) {
+  pthread_mutex_lock(&trace.mutex);
+  trace_append(op, pg->block->fhandle->fid, pg->block->blk_nr,
+               op == TRACE_UNPIN && pg->dirty);
+  pthread_mutex_unlock(&trace.mutex);
+}
+
+/* Name the file fid in the trace */
+static void trace_fname(int fid, char const* name) {
+  pthread_mutex_lock(&trace.mutex);
+  trace_append(TRACE_FILE, fid, strlen(name), 0);
+  trace_flush();
+  fwrite(name, 1, strlen(name), trace.fp);
+  pthread_mutex_unlock(&trace.mutex);
+}
+
+/* Start the trace of pager_cfg.trace_file */
+static void trace_open() {
+  page_trace_header h = {
+    PAGE_TRACE_MAGIC, PAGE_TRACE_VERSION, pager_cfg.policy,
+    pager_cfg.block_size, pager_cfg.num_pages
+  };
+  trace.fp = fopen(pager_cfg.trace_file, "w");
+  if (!trace.fp || fwrite(&h, sizeof h, 1, trace.fp) != 1) {
+    put_msg(ERROR, "cannot trace the page accesses to %s.\n",
+            pager_cfg.trace_file);
+    if (trace.fp) fclose(trace.fp);
+    trace.fp = 0;
+  }
+}
+
+static void trace_close() {
+  if (!trace.fp) return;
+  trace_flush();
+  fclose(trace.fp);
+  trace.fp = 0;
+}
+
+
+/** @brief Pager locks
 
+The pager state (pages, file handles, replacement queues, free pages,
+io_uring requests) is shared by the threads of the application and the
+cleaner, and guarded by pager_mutex. The mutex is recursive, because
+the public functions of the pager call each other.
+A thread holding pager_mutex may take the lock of a shard of blk_table,
+but not the other way around. A thread that finds pager_mutex busy gets
+a page that is pinned already without it, and pins that are not the
+last one are dropped without it (see @ref get_pinned_page and @ref unpin).
+
+The cleaner writes copies of the pages without holding pager_mutex,
+but holding clean_io_mutex, so that a page being cleaned is replaced
+or written again only after the copy is on disk.
+*/
+static struct {
+  pthread_t thread;
+  int stop;           /**< non-zero to ask the cleaner to stop */
+} cleaner;
+
+/** non-zero while the cleaner thread runs */
+static int cleaner_running;
+static pthread_mutex_t pager_mutex;
+static pthread_once_t pager_locks_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t clean_io_mutex = PTHREAD_MUTEX_INITIALIZER;
+/** whether the last write of the cleaner succeeded, under clean_io_mutex */
+static int clean_io_ok;
+static pthread_cond_t cleaner_cond = PTHREAD_COND_INITIALIZER;
+
+/** one tick per pin, for the age of pages */
+static long ref_clock;
+
+static void init_pager_locks() {
+  pthread_mutexattr_t attr;
+  pthread_mutexattr_init(&attr);
+  pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+  pthread_mutex_init(&pager_mutex, &attr);
+  pthread_mutexattr_destroy(&attr);
+  for (size_t i = 0; i < BLK_SHARDS; i++)
+    pthread_mutex_init(&blk_shards[i], 0);
+}
+
+static void pager_lock() {
+  pthread_mutex_lock(&pager_mutex);
+}
+
+static void pager_unlock() {
+  pthread_mutex_unlock(&pager_mutex);
+}
 
 /** The number of files that are currently open */
 int num_file_handles = 0;
 
-page_p pages[NUM_PAGES];
+page_p *pages;
 
 static void put_fhandle_info(pmsg_level level, fhandle_p fh) {
   if (!fh) {
@@ -110,8 +572,8 @@ static void put_fhandle_info(pmsg_level level, fhandle_p fh) {
              fh->current_block ? fh->current_block->blk_nr : -100);
   put_msg(level, "   in memory: ");
   for (size_t i = 0; i < NUM_PAGES; i++)
-    if (fh->blocks_in_mem[i])
-      append_msg(level,  " %d,", fh->blocks_in_mem[i]->blk_nr);
+    if (pages[i] && pages[i]->block && pages[i]->block->fhandle == fh)
+      append_msg(level,  " %d,", pages[i]->block->blk_nr);
   append_msg(level,  "\n");
 }
 
@@ -138,10 +600,10 @@ void put_page_info(pmsg_level level, page_p p) {
   put_msg(level, "  current_pos: %d, ", p->current_pos);
   append_msg(level, "  free_pos: %d, ", p->free_pos);
 
-  if (p->pinned == 0)
+  if (p->pin_count == 0)
     append_msg(level,  "unpinned, ");
   else
-    append_msg(level,  "pinned, ");
+    append_msg(level,  "pinned %d, ", p->pin_count);
 
   if (p->dirty == 0)
     append_msg(level,  "clean\n");
@@ -165,14 +627,14 @@ void put_pager_info(pmsg_level level,  char const* msg) {
   put_msg(level,  "----Pager Info Begin----\n");
   put_msg(level,  "(%s)\n", msg);
   put_msg(level, "file handlers:\n");
-  for (size_t i = 0; i < MAX_OPEN_FILES; i++)
+  for (size_t i = 0; file_handles && i < max_file_handles; i++)
     if (file_handles[i]) {
       put_msg(level,  " %d:\n", i);
       put_fhandle_info(level, file_handles[i]);
     }
 
   put_msg(level, "pages:\n");
-  for (size_t i = 0; i < NUM_PAGES; i++)
+  for (size_t i = 0; pages && i < NUM_PAGES; i++)
     if (pages[i]) {
       put_msg(level,  " page  %d:\n", i);
       put_page_info(level, pages[i]);
@@ -181,21 +643,353 @@ void put_pager_info(pmsg_level level,  char const* msg) {
   put_msg(level,  "----Pager Info End ----\n");
 }
 
+/* The counters of all threads summed up; the counts of threads using
+   the pager meanwhile may be a bit off. The counters by file of the
+   sum are allocated for the interned file ids, free() them when done. */
+static pager_counters merged_counters() {
+  pager_counters sum = {0};
+  pthread_once(&pager_locks_once, init_pager_locks);
+  pager_lock(); /* the cleaner counts holding pager_mutex */
+  sum.num_files = next_fid;
+  sum.files = calloc(sum.num_files + 1, sizeof (file_counters));
+  pthread_mutex_lock(&counters_mutex);
+  for (pager_counters *c = all_counters; c; c = c->next) {
+    sum.num_seeks += c->num_seeks;
+    sum.num_disk_reads += c->num_disk_reads;
+    sum.num_disk_writes += c->num_disk_writes;
+    sum.num_hits += c->num_hits;
+    sum.num_misses += c->num_misses;
+    sum.num_prefetched += c->num_prefetched;
+    sum.num_prefetch_hits += c->num_prefetch_hits;
+    sum.num_io_submits += c->num_io_submits;
+    if (c->max_io_inflight > sum.max_io_inflight)
+      sum.max_io_inflight = c->max_io_inflight;
+    sum.num_mapped += c->num_mapped;
+    sum.num_cleaned += c->num_cleaned;
+    sum.num_dirty_victims += c->num_dirty_victims;
+    sum.num_recycled += c->num_recycled;
+    sum.num_evictions += c->num_evictions;
+    sum.num_reopens += c->num_reopens;
+    sum.bytes_read += c->bytes_read;
+    sum.bytes_written += c->bytes_written;
+    sum.bytes_compressed += c->bytes_compressed;
+    sum.bytes_saved += c->bytes_saved;
+    for (int i = 0; i < LATENCY_BUCKETS; i++) {
+      sum.read_latency[i] += c->read_latency[i];
+      sum.write_latency[i] += c->write_latency[i];
+    }
+    for (int fid = 0; sum.files && fid < c->num_files && fid < sum.num_files;
+         fid++) {
+      file_counters *f = &sum.files[fid], *g = &c->files[fid];
+      f->num_hits += g->num_hits;
+      f->num_misses += g->num_misses;
+      f->num_evictions += g->num_evictions;
+      f->num_dirty_evictions += g->num_dirty_evictions;
+      f->num_disk_reads += g->num_disk_reads;
+      f->num_disk_writes += g->num_disk_writes;
+      f->bytes_read += g->bytes_read;
+      f->bytes_written += g->bytes_written;
+      f->bytes_compressed += g->bytes_compressed;
+      f->bytes_saved += g->bytes_saved;
+    }
+  }
+  pthread_mutex_unlock(&counters_mutex);
+  pager_unlock();
+  return sum;
+}
+
+/* Names of the interned files by file id, free() the array when done */
+static char const** fnames_by_fid() {
+  char const** names = calloc(next_fid + 1, sizeof (char const*));
+  for (size_t i = 0; names && i < FNAME_BUCKETS; i++)
+    for (fname_entry *e = fname_table[i]; e; e = e->next)
+      names[e->fid] = e->name;
+  return names;
+}
+
+static long latency_count(long const hist[]) {
+  long n = 0;
+  for (int i = 0; i < LATENCY_BUCKETS; i++)
+    n += hist[i];
+  return n;
+}
+
+/* Upper bound in us of the bucket of the given percentile of requests */
+static long latency_percentile(long const hist[], int pct) {
+  long n = latency_count(hist), seen = 0;
+  for (int i = 0; i < LATENCY_BUCKETS; i++) {
+    seen += hist[i];
+    if (seen > 0 && 100 * seen >= pct * n)
+      return 1L << i;
+  }
+  return 1L << (LATENCY_BUCKETS - 1);
+}
+
+static void put_latency_info(pmsg_level level, char const* what,
+                             long const hist[]) {
+  long n = latency_count(hist);
+  if (n > 0)
+    put_msg(level, "%s latency: %ld requests, p50/p99/max < %ld/%ld/%ld us\n",
+            what, n, latency_percentile(hist, 50),
+            latency_percentile(hist, 99), latency_percentile(hist, 100));
+}
+
+/* Estimated seek and transfer times in us of the counters on dev */
+static void estimate_io_time(pager_counters const* sum, pager_device const* dev,
+                             double* seek_us, double* transfer_us) {
+  int overlap = 1;
+  if (io_ring_active() && sum->max_io_inflight > 1)
+    overlap = sum->max_io_inflight < dev->queue_depth
+      ? sum->max_io_inflight : dev->queue_depth;
+  *seek_us = sum->num_seeks * dev->seek_us / overlap;
+  *transfer_us = (sum->bytes_read + sum->bytes_written) / dev->mb_per_s;
+}
+
+double pager_io_time(pager_device const* dev) {
+  double seek_us, transfer_us;
+  pager_counters sum = merged_counters();
+  estimate_io_time(&sum, dev ? dev : &pager_cfg.device, &seek_us, &transfer_us);
+  free(sum.files);
+  return seek_us + transfer_us;
+}
+
 void put_pager_profiler_info(pmsg_level level) {
+  pager_counters sum = merged_counters();
   put_msg(level, "Number of disk seeks/reads/writes/IOs: %d/%d/%d/%d\n",
-          pager_profiler.num_seeks,
-          pager_profiler.num_disk_reads,
-          pager_profiler.num_disk_writes,
-          pager_profiler.num_disk_reads + pager_profiler.num_disk_writes);
+          sum.num_seeks,
+          sum.num_disk_reads,
+          sum.num_disk_writes,
+          sum.num_disk_reads + sum.num_disk_writes);
+  int num_refs = sum.num_hits + sum.num_misses;
+  put_msg(level, "Buffer hits/misses (%s): %d/%d, hit ratio %.1f%%\n",
+          pager_policy_name(pager_cfg.policy),
+          sum.num_hits, sum.num_misses,
+          num_refs ? 100.0 * sum.num_hits / num_refs : 0.0);
+  put_msg(level, "Read-ahead blocks/hits: %d/%d\n",
+          sum.num_prefetched, sum.num_prefetch_hits);
+  if (io_ring_active())
+    put_msg(level, "io_uring requests: %d, max in flight: %d\n",
+            sum.num_io_submits, sum.max_io_inflight);
+  put_msg(level, "Dirty pages replaced: %d, cleaned in the background: %d\n",
+          sum.num_dirty_victims, sum.num_cleaned);
+  if (sum.num_mapped > 0)
+    put_msg(level, "Blocks accessed through mappings: %d\n",
+            sum.num_mapped);
+  if (sum.num_recycled > 0)
+    put_msg(level, "Pages recycled by access strategies: %d\n",
+            sum.num_recycled);
+  if (sum.num_reopens > 0)
+    put_msg(level, "File descriptors reopened: %d\n", sum.num_reopens);
+  put_msg(level, "Pages replaced: %d, bytes read/written: %ld/%ld\n",
+          sum.num_evictions, sum.bytes_read, sum.bytes_written);
+  if (sum.bytes_compressed > 0)
+    put_msg(level, "Compressed bytes/saved: %ld/%ld, %.1f%% saved\n",
+            sum.bytes_compressed, sum.bytes_saved,
+            100.0 * sum.bytes_saved / sum.bytes_compressed);
+  if (wal_active()) {
+    wal_stats w = wal_get_stats();
+    put_msg(level, "Log (%s) records/commits/syncs/checkpoints:"
+            " %ld/%ld/%ld/%ld, bytes logged: %ld\n",
+            pager_wal_mode_name(pager_cfg.wal),
+            w.num_records - wal_stats_base.num_records,
+            w.num_commits - wal_stats_base.num_commits,
+            w.num_syncs - wal_stats_base.num_syncs,
+            w.num_checkpoints - wal_stats_base.num_checkpoints,
+            w.bytes_logged - wal_stats_base.bytes_logged);
+  }
+  put_latency_info(level, "read_page", sum.read_latency);
+  put_latency_info(level, "write_page", sum.write_latency);
+  double seek_us, transfer_us;
+  estimate_io_time(&sum, &pager_cfg.device, &seek_us, &transfer_us);
+  put_msg(level, "Estimated I/O time on %s: %.3f ms, seeks/transfer %.3f/%.3f ms\n",
+          pager_cfg.device.name, (seek_us + transfer_us) / 1000,
+          seek_us / 1000, transfer_us / 1000);
+
+  pager_lock();
+  char const** names = fnames_by_fid();
+  for (int fid = 0; names && sum.files && fid < sum.num_files; fid++) {
+    file_counters *f = &sum.files[fid];
+    if (f->num_hits + f->num_misses + f->num_disk_writes == 0) continue;
+    put_msg(level, "  %s: hits/misses %d/%d, replaced %d (%d dirty),"
+            " bytes read/written %ld/%ld\n", names[fid] ? names[fid] : "?",
+            f->num_hits, f->num_misses, f->num_evictions,
+            f->num_dirty_evictions, f->bytes_read, f->bytes_written);
+    if (f->bytes_compressed > 0)
+      put_msg(level, "  %s: compressed bytes/saved %ld/%ld\n",
+              names[fid] ? names[fid] : "?", f->bytes_compressed,
+              f->bytes_saved);
+  }
+  pager_unlock();
+  free(names);
+  free(sum.files);
+}
+
+/* Put s as a JSON string */
+static void put_json_str(FILE* fp, char const* s) {
+  fputc('"', fp);
+  for (; s && *s; s++)
+    if (*s == '"' || *s == '\\')
+      fprintf(fp, "\\%c", *s);
+    else if ((unsigned char) *s < 0x20)
+      fprintf(fp, "\\u%04x", *s);
+    else
+      fputc(*s, fp);
+  fputc('"', fp);
+}
+
+static void dump_json(FILE* fp, pager_counters const* sum,
+                      char const** names) {
+  int num_refs = sum->num_hits + sum->num_misses;
+  fprintf(fp, "{\n  \"policy\": ");
+  put_json_str(fp, pager_policy_name(pager_cfg.policy));
+  fprintf(fp, ",\n  \"num_pages\": %d,\n  \"block_size\": %ld,\n",
+          NUM_PAGES, BLOCK_SIZE);
+  fprintf(fp, "  \"total\": {\"hits\": %d, \"misses\": %d,"
+          " \"hit_ratio\": %.4f, \"evictions\": %d, \"dirty_evictions\": %d,"
+          " \"disk_reads\": %d, \"disk_writes\": %d, \"seeks\": %d,"
+          " \"bytes_read\": %ld, \"bytes_written\": %ld,"
+          " \"prefetched\": %d, \"prefetch_hits\": %d, \"cleaned\": %d,"
+          " \"recycled\": %d, \"bytes_compressed\": %ld,"
+          " \"bytes_saved\": %ld},\n",
+          sum->num_hits, sum->num_misses,
+          num_refs ? (double) sum->num_hits / num_refs : 0.0,
+          sum->num_evictions, sum->num_dirty_victims,
+          sum->num_disk_reads, sum->num_disk_writes, sum->num_seeks,
+          sum->bytes_read, sum->bytes_written,
+          sum->num_prefetched, sum->num_prefetch_hits, sum->num_cleaned,
+          sum->num_recycled, sum->bytes_compressed, sum->bytes_saved);
+  double seek_us, transfer_us;
+  estimate_io_time(sum, &pager_cfg.device, &seek_us, &transfer_us);
+  fprintf(fp, "  \"device\": {\"name\": ");
+  put_json_str(fp, pager_cfg.device.name);
+  fprintf(fp, ", \"seek_us\": %g, \"mb_per_s\": %g, \"queue_depth\": %d},\n",
+          pager_cfg.device.seek_us, pager_cfg.device.mb_per_s,
+          pager_cfg.device.queue_depth);
+  fprintf(fp, "  \"io_time_us\": {\"total\": %.1f, \"seek\": %.1f,"
+          " \"transfer\": %.1f},\n",
+          seek_us + transfer_us, seek_us, transfer_us);
+  fprintf(fp, "  \"files\": [");
+  int first = 1;
+  for (int fid = 0; sum->files && fid < sum->num_files; fid++) {
+    file_counters const* f = &sum->files[fid];
+    if (!names[fid]) continue;
+    fprintf(fp, "%s\n    {\"name\": ", first ? "" : ",");
+    put_json_str(fp, names[fid]);
+    fprintf(fp, ", \"hits\": %d, \"misses\": %d, \"evictions\": %d,"
+            " \"dirty_evictions\": %d, \"disk_reads\": %d,"
+            " \"disk_writes\": %d, \"bytes_read\": %ld,"
+            " \"bytes_written\": %ld, \"bytes_compressed\": %ld,"
+            " \"bytes_saved\": %ld}",
+            f->num_hits, f->num_misses, f->num_evictions,
+            f->num_dirty_evictions, f->num_disk_reads, f->num_disk_writes,
+            f->bytes_read, f->bytes_written, f->bytes_compressed,
+            f->bytes_saved);
+    first = 0;
+  }
+  fprintf(fp, "\n  ],\n  \"latency_us\": {\n    \"upper_bounds\": [");
+  for (int i = 0; i < LATENCY_BUCKETS - 1; i++)
+    fprintf(fp, "%s%ld", i ? ", " : "", 1L << i);
+  fprintf(fp, ", null],\n    \"read_page\": [");
+  for (int i = 0; i < LATENCY_BUCKETS; i++)
+    fprintf(fp, "%s%ld", i ? ", " : "", sum->read_latency[i]);
+  fprintf(fp, "],\n    \"write_page\": [");
+  for (int i = 0; i < LATENCY_BUCKETS; i++)
+    fprintf(fp, "%s%ld", i ? ", " : "", sum->write_latency[i]);
+  fprintf(fp, "]\n  }\n}\n");
+}
+
+/* One row per value: section, name, metric, value */
+static void dump_csv(FILE* fp, pager_counters const* sum,
+                     char const** names) {
+  fprintf(fp, "section,name,metric,value\n");
+  fprintf(fp, "config,,policy,%s\n", pager_policy_name(pager_cfg.policy));
+  fprintf(fp, "config,,num_pages,%d\n", NUM_PAGES);
+  fprintf(fp, "config,,block_size,%ld\n", BLOCK_SIZE);
+  fprintf(fp, "total,,hits,%d\ntotal,,misses,%d\n",
+          sum->num_hits, sum->num_misses);
+  fprintf(fp, "total,,evictions,%d\ntotal,,dirty_evictions,%d\n",
+          sum->num_evictions, sum->num_dirty_victims);
+  fprintf(fp, "total,,disk_reads,%d\ntotal,,disk_writes,%d\n",
+          sum->num_disk_reads, sum->num_disk_writes);
+  fprintf(fp, "total,,seeks,%d\n", sum->num_seeks);
+  fprintf(fp, "total,,bytes_read,%ld\ntotal,,bytes_written,%ld\n",
+          sum->bytes_read, sum->bytes_written);
+  fprintf(fp, "total,,prefetched,%d\ntotal,,prefetch_hits,%d\n",
+          sum->num_prefetched, sum->num_prefetch_hits);
+  fprintf(fp, "total,,cleaned,%d\ntotal,,recycled,%d\n",
+          sum->num_cleaned, sum->num_recycled);
+  fprintf(fp, "total,,bytes_compressed,%ld\ntotal,,bytes_saved,%ld\n",
+          sum->bytes_compressed, sum->bytes_saved);
+  double seek_us, transfer_us;
+  estimate_io_time(sum, &pager_cfg.device, &seek_us, &transfer_us);
+  fprintf(fp, "device,%s,seek_us,%g\ndevice,%s,mb_per_s,%g\n",
+          pager_cfg.device.name, pager_cfg.device.seek_us,
+          pager_cfg.device.name, pager_cfg.device.mb_per_s);
+  fprintf(fp, "device,%s,queue_depth,%d\n",
+          pager_cfg.device.name, pager_cfg.device.queue_depth);
+  fprintf(fp, "io_time_us,,total,%.1f\nio_time_us,,seek,%.1f\n",
+          seek_us + transfer_us, seek_us);
+  fprintf(fp, "io_time_us,,transfer,%.1f\n", transfer_us);
+  for (int fid = 0; sum->files && fid < sum->num_files; fid++) {
+    file_counters const* f = &sum->files[fid];
+    char const* n = names[fid];
+    if (!n || strpbrk(n, ",\"\n")) continue; /* not a CSV field */
+    fprintf(fp, "file,%s,hits,%d\nfile,%s,misses,%d\n",
+            n, f->num_hits, n, f->num_misses);
+    fprintf(fp, "file,%s,evictions,%d\nfile,%s,dirty_evictions,%d\n",
+            n, f->num_evictions, n, f->num_dirty_evictions);
+    fprintf(fp, "file,%s,disk_reads,%d\nfile,%s,disk_writes,%d\n",
+            n, f->num_disk_reads, n, f->num_disk_writes);
+    fprintf(fp, "file,%s,bytes_read,%ld\nfile,%s,bytes_written,%ld\n",
+            n, f->bytes_read, n, f->bytes_written);
+    fprintf(fp, "file,%s,bytes_compressed,%ld\nfile,%s,bytes_saved,%ld\n",
+            n, f->bytes_compressed, n, f->bytes_saved);
+  }
+  for (int i = 0; i < LATENCY_BUCKETS; i++)
+    fprintf(fp, "read_latency_us,,%s%ld,%ld\n",
+            i < LATENCY_BUCKETS - 1 ? "<" : ">=",
+            1L << (i < LATENCY_BUCKETS - 1 ? i : i - 1), sum->read_latency[i]);
+  for (int i = 0; i < LATENCY_BUCKETS; i++)
+    fprintf(fp, "write_latency_us,,%s%ld,%ld\n",
+            i < LATENCY_BUCKETS - 1 ? "<" : ">=",
+            1L << (i < LATENCY_BUCKETS - 1 ? i : i - 1), sum->write_latency[i]);
+}
+
+int dump_pager_profiler(FILE* fp, pager_stats_format format) {
+  if (!fp) return 0;
+  pager_counters sum = merged_counters();
+  pager_lock();
+  char const** names = fnames_by_fid();
+  int res = names && sum.files;
+  if (res) {
+    if (format == PAGER_STATS_CSV)
+      dump_csv(fp, &sum, names);
+    else
+      dump_json(fp, &sum, names);
+  }
+  pager_unlock();
+  free(names);
+  free(sum.files);
+  return res && !ferror(fp);
+}
+
+/* Dump the statistics to pager_cfg.stats_file, in CSV if its name ends
+   with .csv and in JSON otherwise */
+static void dump_stats_file() {
+  char const* path = pager_cfg.stats_file;
+  size_t len = strlen(path);
+  pager_stats_format format = len >= 4 && strcmp(path + len - 4, ".csv") == 0
+    ? PAGER_STATS_CSV : PAGER_STATS_JSON;
+  FILE *fp = fopen(path, "w");
+  if (!fp || !dump_pager_profiler(fp, format))
+    put_msg(ERROR, "cannot dump the pager statistics to %s.\n", path);
+  if (fp) fclose(fp);
 }
 
 static void put_pqueue_info(pmsg_level level, pqueue_p q,
                             char const* which) {
-  if (!q) {
-    put_msg(level, "Page LRF %s is NULL\n", which);
-    return;
-  }
-  put_msg(level, "Page LRF %s, length %d:\n", which, q->len);
+  if (!q) return; /* not used by the policy */
+  put_msg(level, "Page queue %s, length %d:\n", which, q->len);
   pq_elm_p p = q->first;
   while (p) {
     append_msg(level, "  %d,", p->page->page_nr);
@@ -209,17 +1003,256 @@ static void put_pqueue_info(pmsg_level level, pqueue_p q,
 }
 
 void put_pqueues_info(pmsg_level level) {
+  put_msg(level, "Page replacement policy: %s\n",
+          pager_policy_name(pager_cfg.policy));
   put_pqueue_info(level, q_unpinned, "unpinned");
   put_pqueue_info(level, q_pinned, "pinned");
+  put_pqueue_info(level, q_a1in, "A1in");
+  put_pqueue_info(level, q_am, "Am");
+  put_pqueue_info(level, q_t1, "T1");
+  put_pqueue_info(level, q_t2, "T2");
 }
 
 
 void pager_profiler_reset(void) {
-  pager_profiler.num_seeks = 0;
-  pager_profiler.num_disk_reads = 0;
-  pager_profiler.num_disk_writes = 0;
-  pager_profiler.last_fd = -1;
-  pager_profiler.last_blk_nr = -1;
+  pthread_once(&pager_locks_once, init_pager_locks);
+  pager_lock();
+  pthread_mutex_lock(&counters_mutex);
+  for (pager_counters *c = all_counters; c; c = c->next)
+    reset_counters(c);
+  pthread_mutex_unlock(&counters_mutex);
+  wal_stats_base = wal_get_stats();
+  pager_unlock();
+}
+
+void pager_config_default(pager_config* cfg) {
+  cfg->num_pages = DEFAULT_NUM_PAGES;
+  cfg->pool_bytes = 0;
+  cfg->block_size = DEFAULT_BLOCK_SIZE;
+  cfg->max_open_files = DEFAULT_MAX_OPEN_FILES;
+  cfg->policy = PAGER_LRU;
+  cfg->io_engine = PAGER_IO_SYNC;
+  cfg->io_depth = DEFAULT_IO_DEPTH;
+  cfg->access = PAGER_COPY;
+  cfg->clean_target = 0;
+  cfg->huge_pages = 0;
+  cfg->stats_file = 0;
+  cfg->trace_file = 0;
+  cfg->device = (pager_device) PAGER_DEVICE_HDD;
+  cfg->tablespace = 0;
+  cfg->grow_blocks = 0;
+  cfg->wal = PAGER_WAL_NONE;
+}
+
+/* Parse a positive number with an optional K or M suffix.
+   Returns -1 if str is not such a number. */
+static long parse_size(char const* str) {
+  char *p;
+  long n = strtol(str, &p, 10);
+  if (p == str || n <= 0) return -1;
+  switch (*p) {
+  case 'k': case 'K': n *= 1024; p++; break;
+  case 'm': case 'M': n *= 1024 * 1024; p++; break;
+  }
+  return *p == '\0' ? n : -1;
+}
+
+static int valid_block_size(long size) {
+  return size >= MIN_BLOCK_SIZE && size <= MAX_BLOCK_SIZE
+    && (size & (size - 1)) == 0;
+}
+
+int pager_config_option(pager_config* cfg, int opt, char const* arg) {
+  long n;
+  char *end;
+  switch (opt) {
+  case 'p':
+    n = parse_size(arg);
+    if (n < 1) break;
+    cfg->num_pages = n;
+    cfg->pool_bytes = 0;
+    return 1;
+  case 'P':
+    n = parse_size(arg);
+    if (n < 1) break;
+    cfg->pool_bytes = n;
+    return 1;
+  case 'b':
+    n = parse_size(arg);
+    if (!valid_block_size(n)) break;
+    cfg->block_size = n;
+    return 1;
+  case 'f':
+    n = parse_size(arg);
+    if (n < 1) break;
+    cfg->max_open_files = n;
+    return 1;
+  case 'r':
+    for (int i = 0; i < NUM_PAGER_POLICIES; i++)
+      if (strcmp(arg, pager_policy_name(i)) == 0) {
+        cfg->policy = i;
+        return 1;
+      }
+    break;
+  case 'i':
+    if (strcmp(arg, "sync") == 0)
+      cfg->io_engine = PAGER_IO_SYNC;
+    else if (strcmp(arg, "uring") == 0)
+      cfg->io_engine = PAGER_IO_URING;
+    else
+      break;
+    return 1;
+  case 'q':
+    n = parse_size(arg);
+    if (n < 1 || n > 4096) break;
+    cfg->io_depth = n;
+    return 1;
+  case 'w':
+    n = strtol(arg, &end, 10);
+    if (end == arg || *end != '\0' || n < 0 || n > 100) break;
+    cfg->clean_target = n;
+    return 1;
+  case 'a':
+    if (strcmp(arg, "copy") == 0)
+      cfg->access = PAGER_COPY;
+    else if (strcmp(arg, "mmap") == 0)
+      cfg->access = PAGER_MMAP;
+    else
+      break;
+    return 1;
+  case 'H':
+    cfg->huge_pages = 1;
+    return 1;
+  case 'S':
+    if (!*arg) break;
+    cfg->stats_file = arg;
+    return 1;
+  case 'T':
+    if (!*arg) break;
+    cfg->trace_file = arg;
+    return 1;
+  case 't':
+    n = parse_size(arg);
+    if (n < 1 || n > 65536) break;
+    cfg->tablespace = n;
+    return 1;
+  case 'g':
+    n = strtol(arg, &end, 10);
+    if (end == arg || *end != '\0' || n < 0 || n > 65536) break;
+    cfg->grow_blocks = n;
+    return 1;
+  case 'L':
+    for (int i = 0; i < NUM_PAGER_WAL_MODES; i++)
+      if (strcmp(arg, pager_wal_mode_name(i)) == 0) {
+        cfg->wal = i;
+        return 1;
+      }
+    break;
+  case 'D': {
+    pager_device hdd = PAGER_DEVICE_HDD, ssd = PAGER_DEVICE_SSD;
+    pager_device dev = {"custom", 0, 0, 0};
+    int len = 0;
+    if (strcmp(arg, hdd.name) == 0)
+      dev = hdd;
+    else if (strcmp(arg, ssd.name) == 0)
+      dev = ssd;
+    else if (sscanf(arg, "%lf,%lf,%d%n", &dev.seek_us, &dev.mb_per_s,
+                    &dev.queue_depth, &len) != 3 || arg[len] != '\0'
+             || dev.seek_us < 0 || dev.mb_per_s <= 0 || dev.queue_depth < 1)
+      break;
+    cfg->device = dev;
+    return 1;
+  }
+  default:
+    return -1;
+  }
+  put_msg(ERROR, "invalid value \"%s\" for pager option -%c\n", arg, opt);
+  return 0;
+}
+
+void put_pager_config_usage(void) {
+  printf("\t-p n         buffer size in pages, default to %d\n",
+         DEFAULT_NUM_PAGES);
+  printf("\t-P bytes     buffer size in bytes (K/M suffix allowed)\n");
+  printf("\t-b bytes     block size of a new database [512,16K], default to %ld\n",
+         DEFAULT_BLOCK_SIZE);
+  printf("\t-f n         max number of open descriptors, default to %d\n",
+         DEFAULT_MAX_OPEN_FILES);
+  printf("\t-r policy    page replacement [lru,clock,lru2,2q,arc], default to lru\n");
+  printf("\t-i engine    I/O engine [sync,uring], default to sync\n");
+  printf("\t-q n         queue depth of the uring engine, default to %d\n",
+         DEFAULT_IO_DEPTH);
+  printf("\t-w pct       percentage of pages kept clean by a background\n");
+  printf("\t             cleaner, default to 0 (no cleaner)\n");
+  printf("\t-a access    block access [copy,mmap], mmap maps existing files\n");
+  printf("\t             read-only, default to copy\n");
+  printf("\t-H           back the buffer pool with huge pages\n");
+  printf("\t-S file      dump the pager statistics to file (JSON, or CSV\n");
+  printf("\t             if it ends with .csv) when the pager terminates\n");
+  printf("\t-T file      trace the page accesses to file, see run_tracesim\n");
+  printf("\t-D device    device model estimating the I/O time [hdd,ssd] or\n");
+  printf("\t             seek_us,MB/s,queue_depth, default to hdd\n");
+  printf("\t-t n         keep the tables of a new database in one tablespace\n");
+  printf("\t             file, growing them by extents of n blocks\n");
+  printf("\t-g n         preallocate the files growing by extents of n blocks,\n");
+  printf("\t             default to 0 for none\n");
+  printf("\t-L mode      write-ahead log [none,off,normal,full], the log is\n");
+  printf("\t             never synced, synced before writing pages, or synced\n");
+  printf("\t             by every commit, default to none\n");
+}
+
+/* The end of the last log of the database, where a new one starts */
+static wal_lsn log_end;
+
+/* Write the superblock of the database. Returns 0 upon failure. */
+static int save_superblock() {
+  FILE *fp = fopen(superblock_file, "w");
+  if (!fp) {
+    put_msg(ERROR, "cannot create %s/%s.\n", sys_dir, superblock_file);
+    return 0;
+  }
+  fprintf(fp, "block_size %ld\n", pager_cfg.block_size);
+  if (pager_cfg.tablespace > 0)
+    fprintf(fp, "tablespace %d\n", pager_cfg.tablespace);
+  if (log_end > 0)
+    fprintf(fp, "log_end %" PRIu64 "\n", log_end);
+  fclose(fp);
+  return 1;
+}
+
+/* The superblock keeps the block size of the database.
+   Read it if the database has one, otherwise create one
+   with the configured block size. */
+static int load_superblock() {
+  long block_size = 0;
+  int tablespace = 0;
+  log_end = 0;
+  FILE *fp = fopen(superblock_file, "r");
+  if (fp) {
+    if (fscanf(fp, "block_size %ld\n", &block_size) != 1
+        || !valid_block_size(block_size)) {
+      put_msg(ERROR, "%s/%s: invalid superblock.\n", sys_dir, superblock_file);
+      fclose(fp);
+      return 0;
+    }
+    /* a database without a tablespace line has a file per table */
+    if (fscanf(fp, "tablespace %d\n", &tablespace) != 1)
+      tablespace = 0;
+    /* nor a log_end line if it never removed a log */
+    if (fscanf(fp, "log_end %" SCNu64 "\n", &log_end) != 1)
+      log_end = 0;
+    fclose(fp);
+    if (block_size != pager_cfg.block_size)
+      put_msg(WARN, "database at %s has block size %ld, not %ld.\n",
+              sys_dir, block_size, pager_cfg.block_size);
+    if (tablespace != pager_cfg.tablespace)
+      put_msg(DEBUG, "database at %s has tablespace extents %d, not %d.\n",
+              sys_dir, tablespace, pager_cfg.tablespace);
+    pager_cfg.block_size = block_size;
+    pager_cfg.tablespace = tablespace;
+    return 1;
+  }
+  return save_superblock();
 }
 
 int set_system_dir(char const* dir) {
@@ -240,7 +1273,7 @@ int set_system_dir(char const* dir) {
   getcwd(sys_dir, sizeof sys_dir);
   put_msg(DEBUG, "db dir : %s\n", sys_dir);
 
-  return pager_init();
+  return pager_init(NULL);
 }
 
 char* system_dir() {
@@ -248,33 +1281,149 @@ char* system_dir() {
 }
 
 /** Increment num_seeks if needed
-    update last_fd, last_blk_nr */
-static void inc_num_seeks_maybe(int fd, int blk_nr) {
-  /* put_msg (DEBUG, "seeks_maybe: fd %d, blk: %d\n", fd, blk_nr); */
-  if (fd != pager_profiler.last_fd
-      || abs(blk_nr - pager_profiler.last_blk_nr) > 1)
-    pager_profiler.num_seeks++;
-  pager_profiler.last_fd = fd;
-  pager_profiler.last_blk_nr = blk_nr;
+    update last_fid, last_blk_nr */
+static void inc_num_seeks_maybe(int fid, int blk_nr) {
+  /* put_msg (DEBUG, "seeks_maybe: fid %d, blk: %d\n", fid, blk_nr); */
+  pager_counters *c = counters();
+  if (fid != c->last_fid || abs(blk_nr - c->last_blk_nr) > 1)
+    c->num_seeks++;
+  c->last_fid = fid;
+  c->last_blk_nr = blk_nr;
+}
+
+/* Number of block blk_nr of fh in its Unix file */
+static long disk_block(fhandle_p fh, int blk_nr) {
+  return fh->seg >= 0 ? ts_block(fh->seg, blk_nr) : blk_nr;
+}
+
+/* The Unix file offset of block b */
+static off_t block_offset(block_p b) {
+  return (off_t) BLOCK_SIZE * disk_block(b->fhandle, b->blk_nr);
+}
+
+/* Whether block blk_nr + 1 of fh directly follows block blk_nr on disk */
+static int blocks_contiguous(fhandle_p fh, int blk_nr) {
+  return fh->seg < 0
+    || ts_block(fh->seg, blk_nr) + 1 == ts_block(fh->seg, blk_nr + 1);
+}
+
+/* Number of the blocks of fh that are on disk, the others have nothing
+   to read yet */
+static int stored_blocks(fhandle_p fh) {
+  if (fh->cf) return cf_num_blocks(fh->cf);
+  return fh->seg >= 0 ? ts_num_blocks(fh->seg) : fh->num_blocks;
+}
+
+/** Increment num_disk_reads, for the whole process and the file of b */
+static void inc_num_reads(block_p b) {
+  /* blocks of the tablespace seek within one file */
+  inc_num_seeks_maybe(b->fhandle->seg >= 0 ? -2 : b->fhandle->fid,
+                      disk_block(b->fhandle, b->blk_nr));
+  counters()->num_disk_reads++;
+  counters()->bytes_read += BLOCK_SIZE;
+  file_counters *f = file_counters_of(b->fhandle->fid);
+  f->num_disk_reads++;
+  f->bytes_read += BLOCK_SIZE;
+}
+
+/** increment num_disk_writes, for the whole process and the file of b,
+    and note the write of a block of the tablespace */
+static void inc_num_writes(block_p b) {
+  if (b->fhandle->seg >= 0)
+    ts_written(b->fhandle->seg, b->blk_nr);
+  inc_num_seeks_maybe(b->fhandle->seg >= 0 ? -2 : b->fhandle->fid,
+                      disk_block(b->fhandle, b->blk_nr));
+  counters()->num_disk_writes++;
+  counters()->bytes_written += BLOCK_SIZE;
+  file_counters *f = file_counters_of(b->fhandle->fid);
+  f->num_disk_writes++;
+  f->bytes_written += BLOCK_SIZE;
+}
+
+/** Increment num_hits or num_misses, for the whole process and the file */
+static void inc_num_refs(int fid, int hit) {
+  if (hit) {
+    counters()->num_hits++;
+    file_counters_of(fid)->num_hits++;
+  } else {
+    counters()->num_misses++;
+    file_counters_of(fid)->num_misses++;
+  }
+}
+
+/** Position in the page header of the LSN of the last log record of
+    the block, see wal.h */
+#define LSN_POS 12
+
+static wal_lsn page_lsn(page_p p) {
+  wal_lsn lsn;
+  memcpy(&lsn, p->content + LSN_POS, sizeof lsn);
+  return lsn;
+}
+
+static void set_page_lsn(page_p p, wal_lsn lsn) {
+  memcpy(p->content + LSN_POS, &lsn, sizeof lsn);
+}
+
+/* Note that the len bytes at offset of p are changed, for the log */
+static void page_changed(page_p p, int offset, int len) {
+  if (!wal_active() || !p->block) return;
+  pthread_mutex_lock(&log_mutex);
+  if (p->log_lo >= p->log_hi) {
+    p->log_lo = offset;
+    p->log_hi = offset + len;
+  } else {
+    if (offset < p->log_lo) p->log_lo = offset;
+    if (offset + len > p->log_hi) p->log_hi = offset + len;
+  }
+  if (!p->log_listed) {
+    p->log_listed = 1;
+    log_pages[num_log_pages++] = p;
+  }
+  pthread_mutex_unlock(&log_mutex);
 }
 
-/** Increment num_disk_reads */
-static void inc_num_reads(int fd, int blk_nr) {
-  inc_num_seeks_maybe(fd, blk_nr);
-  pager_profiler.num_disk_reads++;
+/* forward declaration */
+static fname_entry *intern_fname(char const* fname);
+
+/* Append the bytes of p changed since it was logged to the log.
+   Called holding pager_mutex. Returns the LSN of the page. */
+static wal_lsn log_page(page_p p) {
+  if (!wal_active() || !p->block) return 0;
+  pthread_mutex_lock(&log_mutex);
+  if (p->log_lo < p->log_hi) {
+    fhandle_p fh = p->block->fhandle;
+    wal_lsn begin = wal_end(); /* at or before the start of the record */
+    wal_lsn lsn = wal_log_page(fh->fname, p->block->blk_nr, p->log_lo,
+                               p->log_hi - p->log_lo, p->content + p->log_lo);
+    if (lsn) {
+      if (!p->rec_lsn) p->rec_lsn = begin;
+      set_page_lsn(p, lsn);
+      p->log_lo = p->log_hi = 0;
+      intern_fname(fh->fname)->logged = 1;
+    }
+  }
+  pthread_mutex_unlock(&log_mutex);
+  return page_lsn(p);
 }
 
-/** increment num_disk_writes */
-static void inc_num_writes(int fd, int blk_nr) {
-  inc_num_seeks_maybe(fd, blk_nr);
-  pager_profiler.num_disk_writes++;
+/* Log the n pages pgs[] that are to be written back, and write the log
+   up to them first. Called holding pager_mutex. Returns 0 upon failure. */
+static int log_before_write(page_p pgs[], int n) {
+  if (!wal_active()) return 1;
+  wal_lsn lsn = 0;
+  for (int i = 0; i < n; i++) {
+    wal_lsn l = log_page(pgs[i]);
+    if (l > lsn) lsn = l;
+  }
+  return wal_flush(lsn);
 }
 
 static int get_header_int_at(page_p  p, int offset) {
-  if (offset < 0 || offset >= PAGE_HEADER_SIZE -INT_SIZE) {
+  if (offset < 0 || offset > PAGE_HEADER_SIZE - INT_SIZE) {
     put_msg(ERROR,
             "get_header_int_at: offset %d out of range (%ld,%ld)\n",
-            offset, 0L, PAGE_HEADER_SIZE - INT_SIZE - 1);
+            offset, 0L, PAGE_HEADER_SIZE - INT_SIZE);
     exit(EXIT_FAILURE);
   }
   int res = (int) *((int *)((p->content) + offset));
@@ -282,14 +1431,19 @@ static int get_header_int_at(page_p  p, int offset) {
 }
 
 static int put_header_int_at(page_p p, int offset, int val) {
-  if (offset < 0 || offset >= PAGE_HEADER_SIZE - INT_SIZE) {
+  if (offset < 0 || offset > PAGE_HEADER_SIZE - INT_SIZE) {
     put_msg(ERROR,
             "put_header_int_at: offset %d out of range (%ld,%ld)\n",
-            offset, 0L, PAGE_HEADER_SIZE - INT_SIZE - 1);
+            offset, 0L, PAGE_HEADER_SIZE - INT_SIZE);
+    return 0;
+  }
+  if (offset == LOGICAL_SIZE_POS) {
+    put_msg(ERROR, "put_header_int_at: offset %d is reserved.\n", offset);
     return 0;
   }
   memcpy(p->content + offset, (char *) &val, INT_SIZE);
   p->dirty = 1;
+  page_changed(p, offset, INT_SIZE);
   return 1;
 }
 
@@ -320,30 +1474,117 @@ static void set_page_free_pos_from_content(page_p p) {
 
 static void init_page(page_p p) {
   if (!p) return;
-  memset(p->content, 0, BLOCK_SIZE);
-  init_page_header_size(p);
-  set_page_free_pos(p, PAGE_HEADER_SIZE);
-  p->qelm = 0;
+  p->content = p->buf;
+  if (p->content) {
+    memset(p->content, 0, BLOCK_SIZE);
+    init_page_header_size(p);
+    set_page_free_pos(p, PAGE_HEADER_SIZE);
+  } else /* the content will be in a mapping */
+    p->free_pos = PAGE_HEADER_SIZE;
   p->block = 0;
-  p->pinned = 0;
+  p->pin_count = 0;
+  p->touched = 0;
+  p->valid = 0;
+  p->prefetched = 0;
+  p->io_pending = 0;
   p->dirty = 0;
+  p->cleaning = 0;
+  p->cleaned = 0;
+  p->log_lo = p->log_hi = 0;
+  p->rec_lsn = 0;
+  p->last_ref = 0;
+  p->ring = 0;
   p->current_pos = PAGE_HEADER_SIZE;
 }
 
-static page_p make_page(int page_nr) {
-  page_p p = malloc(sizeof (page_struct));
-  if (!p) {
-    put_msg(ERROR, "make_page failed");
-    return 0;
+/* Map the arena of the buffer pool, with huge pages if configured.
+   Without reserved huge pages, transparent huge pages are asked for.
+   Returns 0 if the arena cannot be mapped. */
+static int map_arena() {
+  size_t pages_off = ((size_t) NUM_PAGES * BLOCK_SIZE + 63) & ~(size_t) 63;
+  size_t blocks_off = pages_off + NUM_PAGES * sizeof (page_struct);
+  /* a block is hashed only with a page, except for one being pinned */
+  arena.num_blocks = NUM_PAGES + 2;
+  size_t len = blocks_off + arena.num_blocks * sizeof (block_struct);
+  void *p = MAP_FAILED;
+#ifdef MAP_HUGETLB
+  if (pager_cfg.huge_pages) {
+    size_t huge_len = (len + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+    p = mmap(0, huge_len, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (p != MAP_FAILED)
+      len = huge_len;
+    else
+      put_msg(WARN, "no huge pages reserved, using transparent huge pages.\n");
   }
-  p->content = malloc(BLOCK_SIZE);
-  if (!p->content) {
-    free(p);
-    put_msg(ERROR, "make_page failed");
-    return 0;
+#endif
+  if (p == MAP_FAILED) {
+    p = mmap(0, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) return 0;
+#ifdef MADV_HUGEPAGE
+    if (pager_cfg.huge_pages)
+      madvise(p, len, MADV_HUGEPAGE);
+#endif
+  }
+  arena.base = p;
+  arena.len = len;
+  arena.pages = (page_struct *) (arena.base + pages_off);
+  arena.blocks = (block_struct *) (arena.base + blocks_off);
+  free_blocks = 0;
+  for (int i = arena.num_blocks - 1; i >= 0; i--) {
+    arena.blocks[i].hnext = free_blocks;
+    free_blocks = &arena.blocks[i];
+  }
+  return 1;
+}
+
+static void unmap_arena() {
+  if (arena.base)
+    munmap(arena.base, arena.len);
+  arena.base = 0;
+  free_blocks = 0;
+}
+
+/* The buffer of page page_nr in the arena */
+static char *page_buf(int page_nr) {
+  return arena.base + (size_t) page_nr * BLOCK_SIZE;
+}
+
+/* A block descriptor from the arena, from the heap if none is left */
+static block_p alloc_block(fhandle_p fh, int blk_nr) {
+  block_p b = free_blocks;
+  if (b)
+    free_blocks = b->hnext;
+  else if (!(b = malloc(sizeof (block_struct)))) {
+    put_msg(FATAL, "alloc_block: out of memory.\n");
+    exit(EXIT_FAILURE);
   }
+  b->fhandle = fh;
+  b->blk_nr = blk_nr;
+  b->page = 0;
+  b->hnext = 0;
+  return b;
+}
+
+static void free_block(block_p b) {
+  if (b >= arena.blocks && b < arena.blocks + arena.num_blocks) {
+    b->hnext = free_blocks;
+    free_blocks = b;
+  } else
+    free(b);
+}
+
+static page_p make_page(int page_nr) {
+  page_p p = &arena.pages[page_nr];
+  /* with the mmap pager, only pages of writable files need a buffer */
+  p->buf = pager_cfg.access == PAGER_MMAP ? 0 : page_buf(page_nr);
   init_page(p);
+  pthread_rwlock_init(&p->latch, 0);
   p->page_nr = page_nr;
+  p->log_listed = 0;
+  p->qelm = 0;
+  p->ref = 0;
+  p->hist1 = p->hist2 = 0;
   return p;
 }
 
@@ -355,27 +1596,16 @@ static pqueue_p make_pqueue() {
   return pq;
 }
 
+/* The elements are embedded in the pages and go with them */
 static pqueue_p release_pqueue(pqueue_p q) {
-  if (!q) return 0;
-  pq_elm_p nextp = q->first;
-  pq_elm_p p;
-  while (nextp) {
-    p = nextp; nextp = p->next;
-    free(p);
-    if (nextp == q->last) {
-      if (nextp != q->first)
-        free(nextp); /* beware: already freed if last == first */
-      nextp = 0;
-    }
-  }
   free(q);
-  q = 0;
   return 0;
 }
 
 static pq_elm_p make_pq_elm(page_p pg) {
-  pq_elm_p p = malloc(sizeof (pq_elm));
+  pq_elm_p p = &pg->elm;
   p->page = pg;
+  p->queue = 0;
   pg->qelm = p;
   return p;
 }
@@ -395,6 +1625,7 @@ static void pq_insert(pqueue_p q, pq_elm_p p) {
     q->last = p;
   }
   q->len++;
+  p->queue = q;
   return;
 }
 
@@ -412,18 +1643,32 @@ static void pq_remove(pqueue_p q, pq_elm_p p) {
       q->last = p->prev;
     q->len--;
   }
+  p->queue = 0;
   return;
 }
 
+/* pg becomes the last in q, leaving the queue it was in */
 static void pq_enqueue(pqueue_p q, page_p pg) {
   if (!q || !pg) {
     put_msg(ERROR, "pq_enqueue: NULL pqueue or page.\n");
     return;
   }
-  return pq_insert(q, make_pq_elm(pg));
+  pq_elm_p p = pg->qelm ? pg->qelm : make_pq_elm(pg);
+  if (p->queue)
+    pq_remove(p->queue, p);
+  pq_insert(q, p);
+}
+
+/* pg leaves the queue it is in */
+static void pq_dequeue(page_p pg) {
+  pq_elm_p p = pg->qelm;
+  if (!p) return;
+  if (p->queue)
+    pq_remove(p->queue, p);
+  pg->qelm = 0;
 }
 
-/* pg is moved to the last in the LRF queue */
+/* pg is moved to the last in its queue */
 static void pq_touch(page_p pg) {
   if (!pg) {
     put_msg(WARN, "touching NULL page.\n");
@@ -435,111 +1680,674 @@ static void pq_touch(page_p pg) {
     return;
   }
 
-  pqueue_p q = pg->pinned ? q_pinned : q_unpinned;
-  if (p == q->last) return;
+  pqueue_p q = p->queue;
+  if (!q || p == q->last) return;
   pq_remove(q, p);
   pq_insert(q, p);
   return;
 }
 
-/* remove the first in q */
-static page_p pq_dequeue_unpinned() {
-  if (!q_unpinned->first) return 0;
+/* The first page in q that may be replaced */
+static page_p pq_first_replaceable(pqueue_p q) {
+  pq_elm_p p = q->first;
+  for (int i = 0; i < q->len; i++, p = p->next)
+    if (!p->page->pin_count)
+      return p->page;
+  return 0;
+}
 
-  pq_elm_p p = q_unpinned->first;
-  page_p pg = p->page;
-  pq_remove(q_unpinned, p);
-  free(p);
-  return pg;
+static int in_pqueue(page_p pg, pqueue_p q) {
+  return pg->qelm && pg->qelm->queue == q;
 }
 
-static page_p pq_dequeue_pinned() {
-  if (!q_pinned->first) return 0;
+/** @brief History of a block that has left the buffer
 
-  pq_elm_p p = q_pinned->first;
-  page_p pg = p->page;
-  unpin(pg);
-  pq_remove(q_unpinned, p);
-  free(p);
-  return pg;
-}
+Some policies remember the blocks they recently replaced (the "ghosts"),
+so that a block coming back soon can be recognized.
+*/
+typedef struct ghost_struct * ghost_p;
 
-/* pg truns into pinned, move it to another queue */
-static void pq_turn_pinned(page_p pg) {
-  if (pg->pinned) return;
-  pq_elm_p p = pg->qelm;
-  pq_remove(q_unpinned, p);
-  pq_insert(q_pinned, p);
-  return;
+/** @brief list of ghosts, the oldest first */
+typedef struct ghost_list {
+  ghost_p first;
+  ghost_p last;
+  int len;
+} ghost_list;
+
+typedef struct ghost_struct {
+  int fid;            /**< file id of the block */
+  int blk_nr;         /**< block number */
+  long stamp;         /**< policy specific, e.g. time of the last reference */
+  ghost_list *list;   /**< the list the ghost is in */
+  ghost_p prev;       /**< older ghost in the list */
+  ghost_p next;       /**< newer ghost in the list */
+  ghost_p hnext;      /**< next ghost in the same bucket of ghost_table */
+} ghost_struct;
+
+/** Ghosts, hashed on (file id, block nr) */
+static ghost_p *ghost_table;
+static unsigned ghost_table_mask;
+
+/** History of LRU-2, A1out of 2Q, and B1 and B2 of ARC */
+static ghost_list g_hist, g_a1out, g_b1, g_b2;
+
+/** Forgotten ghosts for reuse, linked by hnext */
+static ghost_p free_ghosts;
+
+static unsigned hash_ids(int fid, int blk_nr, unsigned mask) {
+  return ((unsigned) fid * 0x9E3779B1u ^ (unsigned) blk_nr * 0x85EBCA77u)
+    & mask;
 }
 
-/* pg turns into unpinned, move it to another queue */
-static void pq_turn_unpinned(page_p pg) {
-  if (!pg->pinned) return;
-  pq_elm_p p = pg->qelm;
-  pq_remove(q_pinned, p);
-  pq_insert(q_unpinned, p);
-  return;
+static ghost_p ghost_find(block_p b) {
+  ghost_p g = ghost_table[hash_ids(b->fhandle->fid, b->blk_nr,
+                                   ghost_table_mask)];
+  for (; g; g = g->hnext)
+    if (g->blk_nr == b->blk_nr && g->fid == b->fhandle->fid)
+      return g;
+  return 0;
 }
 
-/* Search the global file_handles[] to see if the file
-   is already open and returns its position in file_handles[].
-   Returns -1 if the file is not open.
-*/
-static int find_fhandle_i(char const* fname) {
-  for (size_t i = 0, num_compared = 0;
-       num_compared < num_file_handles;
-       i++) {
-    if (file_handles[i]) {
-      if (strcmp(file_handles[i]->fname, fname) == 0)
-        return i;
-      num_compared++;
+static void ghost_remove(ghost_p g) {
+  ghost_list *l = g->list;
+  if (g->prev) g->prev->next = g->next; else l->first = g->next;
+  if (g->next) g->next->prev = g->prev; else l->last = g->prev;
+  l->len--;
+
+  ghost_p *gp = &ghost_table[hash_ids(g->fid, g->blk_nr, ghost_table_mask)];
+  for (; *gp; gp = &(*gp)->hnext)
+    if (*gp == g) {
+      *gp = g->hnext;
+      break;
     }
+  g->hnext = free_ghosts;
+  free_ghosts = g;
+}
+
+/* b becomes the newest ghost in l */
+static void ghost_add(ghost_list *l, block_p b, long stamp) {
+  ghost_p g = ghost_find(b);
+  if (g) ghost_remove(g);
+
+  if ((g = free_ghosts))
+    free_ghosts = g->hnext;
+  else if (!(g = malloc(sizeof (ghost_struct)))) {
+    put_msg(FATAL, "ghost_add: out of memory.\n");
+    exit(EXIT_FAILURE);
   }
-  return -1;
+  g->fid = b->fhandle->fid;
+  g->blk_nr = b->blk_nr;
+  g->stamp = stamp;
+  g->list = l;
+  g->prev = l->last;
+  g->next = 0;
+  if (l->last) l->last->next = g; else l->first = g;
+  l->last = g;
+  l->len++;
+
+  unsigned h = hash_ids(g->fid, g->blk_nr, ghost_table_mask);
+  g->hnext = ghost_table[h];
+  ghost_table[h] = g;
 }
 
-/* Search the global file_handles[] for an empty slot,
-   to be used to store a new file handle.
-   Returns -1 if there is no empty slot (the number of
-   open files has reached MAX_OPEN_FILES).
-*/
-static int get_empty_fhandle_i() {
-  for (size_t i = 0; i < MAX_OPEN_FILES; i++)
-    if (!file_handles[i]) return i;
-  return -1;
+/* forget the oldest ghosts of l until it has at most max_len ghosts */
+static void ghost_trim(ghost_list *l, int max_len) {
+  while (l->len > 0 && l->len > max_len)
+    ghost_remove(l->first);
 }
 
-static fhandle_p make_fhandle(char const* fname, int fd) {
+static void release_ghosts() {
+  ghost_trim(&g_hist, 0);
+  ghost_trim(&g_a1out, 0);
+  ghost_trim(&g_b1, 0);
+  ghost_trim(&g_b2, 0);
+  while (free_ghosts) {
+    ghost_p g = free_ghosts;
+    free_ghosts = g->hnext;
+    free(g);
+  }
+  free(ghost_table);
+  ghost_table = 0;
+}
+
+/** @brief Page replacement policy
+
+A policy keeps its own bookkeeping of the pages that hold a block,
+and chooses the victim when a block needs a page and no page is free.
+The pager calls the hooks as follows:
+ - missed(): a block not in the buffer is referenced (optional);
+ - victim(): choose an unpinned page to replace, NULL if all pages are pinned;
+ - loaded(): a page gets a block;
+ - touched(): the block of a page is referenced again;
+ - pinned()/unpinned(): a page turns (un)pinned (optional);
+ - evicted(): a page is about to lose its block.
+*/
+typedef struct repl_policy {
+  char const* name;
+  void (*init)(void);
+  void (*missed)(block_p b);
+  page_p (*victim)(block_p b);
+  void (*loaded)(page_p pg);
+  void (*touched)(page_p pg);
+  void (*pinned)(page_p pg);
+  void (*unpinned)(page_p pg);
+  void (*evicted)(page_p pg);
+} repl_policy;
+
+/* LRU: the unpinned and pinned pages are kept in two LRF queues */
+
+static void lru_init() {
+  q_unpinned = make_pqueue();
+  q_pinned = make_pqueue();
+}
+
+static page_p lru_victim(block_p b) {
+  return pq_first_replaceable(q_unpinned);
+}
+
+static void lru_loaded(page_p pg) {
+  pq_enqueue(pg->pin_count ? q_pinned : q_unpinned, pg);
+}
+
+/* pg turns into pinned, move it to another queue */
+static void lru_pinned(page_p pg) {
+  pq_enqueue(q_pinned, pg);
+}
+
+/* pg turns into unpinned, move it to another queue */
+static void lru_unpinned(page_p pg) {
+  pq_enqueue(q_unpinned, pg);
+}
+
+/* CLOCK: the hand sweeps over pages[], giving referenced pages
+   a second chance */
+
+static int clock_hand;
+
+static void clock_init() {
+  clock_hand = 0;
+}
+
+static page_p clock_victim(block_p b) {
+  for (int i = 0; i < 2 * NUM_PAGES; i++) {
+    page_p pg = pages[clock_hand];
+    clock_hand = (clock_hand + 1) % NUM_PAGES;
+    if (!pg->block || pg->pin_count)
+      continue;
+    if (!pg->ref)
+      return pg;
+    pg->ref = 0;
+  }
+  return 0;
+}
+
+static void clock_referenced(page_p pg) {
+  pg->ref = 1;
+}
+
+static void clock_evicted(page_p pg) {
+  pg->ref = 0;
+}
+
+/* LRU-2: replace the page whose second last reference is the oldest.
+   Pages referenced only once go first, in LRU order.
+   The last reference of a replaced block is kept as history. */
+
+static long lru2_clock; /* one tick per reference */
+
+static void lru2_init() {
+  lru2_clock = 0;
+}
+
+static page_p lru2_victim(block_p b) {
+  page_p res = 0;
+  for (size_t i = 0; i < NUM_PAGES; i++) {
+    page_p pg = pages[i];
+    if (!pg->block || pg->pin_count)
+      continue;
+    if (!res || pg->hist2 < res->hist2
+        || (pg->hist2 == res->hist2 && pg->hist1 < res->hist1))
+      res = pg;
+  }
+  return res;
+}
+
+static void lru2_loaded(page_p pg) {
+  ghost_p g = ghost_find(pg->block);
+  pg->hist2 = g ? g->stamp : 0;
+  if (g) ghost_remove(g);
+  pg->hist1 = ++lru2_clock;
+}
+
+static void lru2_touched(page_p pg) {
+  pg->hist2 = pg->hist1;
+  pg->hist1 = ++lru2_clock;
+}
+
+static void lru2_evicted(page_p pg) {
+  ghost_add(&g_hist, pg->block, pg->hist1);
+  ghost_trim(&g_hist, NUM_PAGES);
+}
+
+/* 2Q: a block referenced for the first time enters the FIFO A1in.
+   Blocks replaced from A1in are remembered in A1out, and a block
+   referenced again while in A1out enters the LRU queue Am. */
+
+static int twoq_kin, twoq_kout; /* max length of A1in and A1out */
+
+static void twoq_init() {
+  q_a1in = make_pqueue();
+  q_am = make_pqueue();
+  twoq_kin = NUM_PAGES / 4 > 1 ? NUM_PAGES / 4 : 1;
+  twoq_kout = NUM_PAGES / 2 > 1 ? NUM_PAGES / 2 : 1;
+}
+
+static page_p twoq_victim(block_p b) {
+  page_p pg = 0;
+  if (q_a1in->len > twoq_kin || q_am->len == 0)
+    pg = pq_first_replaceable(q_a1in);
+  if (!pg)
+    pg = pq_first_replaceable(q_am);
+  if (!pg)
+    pg = pq_first_replaceable(q_a1in);
+  return pg;
+}
+
+static void twoq_loaded(page_p pg) {
+  ghost_p g = ghost_find(pg->block);
+  if (g) {
+    ghost_remove(g);
+    pq_enqueue(q_am, pg);
+  } else
+    pq_enqueue(q_a1in, pg);
+}
+
+static void twoq_touched(page_p pg) {
+  if (in_pqueue(pg, q_am))
+    pq_touch(pg);
+}
+
+static void twoq_evicted(page_p pg) {
+  if (in_pqueue(pg, q_a1in)) {
+    ghost_add(&g_a1out, pg->block, 0);
+    ghost_trim(&g_a1out, twoq_kout);
+  }
+  pq_dequeue(pg);
+}
+
+/* ARC: T1 holds pages referenced once, T2 pages referenced more than once.
+   B1 and B2 remember blocks replaced from T1 and T2, and a reference
+   to them adapts the target length arc_p of T1. */
+
+static int arc_p;
+
+static void arc_init() {
+  q_t1 = make_pqueue();
+  q_t2 = make_pqueue();
+  arc_p = 0;
+}
+
+static void arc_missed(block_p b) {
+  ghost_p g = ghost_find(b);
+  if (!g) return;
+  if (g->list == &g_b1) {
+    int delta = g_b2.len > g_b1.len ? g_b2.len / g_b1.len : 1;
+    arc_p = arc_p + delta < NUM_PAGES ? arc_p + delta : NUM_PAGES;
+  } else {
+    int delta = g_b1.len > g_b2.len ? g_b1.len / g_b2.len : 1;
+    arc_p = arc_p - delta > 0 ? arc_p - delta : 0;
+  }
+}
+
+static page_p arc_victim(block_p b) {
+  ghost_p g = ghost_find(b);
+  int in_b2 = g && g->list == &g_b2;
+  page_p pg = 0;
+  if (q_t1->len > 0
+      && (q_t1->len > arc_p || (in_b2 && q_t1->len == arc_p)))
+    pg = pq_first_replaceable(q_t1);
+  if (!pg)
+    pg = pq_first_replaceable(q_t2);
+  if (!pg)
+    pg = pq_first_replaceable(q_t1);
+  return pg;
+}
+
+static void arc_loaded(page_p pg) {
+  ghost_p g = ghost_find(pg->block);
+  if (g) {
+    ghost_remove(g);
+    pq_enqueue(q_t2, pg);
+  } else
+    pq_enqueue(q_t1, pg);
+}
+
+static void arc_touched(page_p pg) {
+  pq_enqueue(q_t2, pg);
+}
+
+static void arc_evicted(page_p pg) {
+  ghost_add(in_pqueue(pg, q_t1) ? &g_b1 : &g_b2, pg->block, 0);
+  pq_dequeue(pg);
+  /* keep |T1| + |B1| <= c and |T1| + |T2| + |B1| + |B2| <= 2c */
+  ghost_trim(&g_b1, NUM_PAGES - q_t1->len);
+  ghost_trim(&g_b2, 2 * NUM_PAGES - q_t1->len - q_t2->len - g_b1.len);
+}
+
+static repl_policy const policies[NUM_PAGER_POLICIES] = {
+  [PAGER_LRU] = {
+    .name = "lru", .init = lru_init, .victim = lru_victim,
+    .loaded = lru_loaded, .touched = pq_touch,
+    .pinned = lru_pinned, .unpinned = lru_unpinned, .evicted = pq_dequeue
+  },
+  [PAGER_CLOCK] = {
+    .name = "clock", .init = clock_init, .victim = clock_victim,
+    .loaded = clock_referenced, .touched = clock_referenced,
+    .evicted = clock_evicted
+  },
+  [PAGER_LRU2] = {
+    .name = "lru2", .init = lru2_init, .victim = lru2_victim,
+    .loaded = lru2_loaded, .touched = lru2_touched, .evicted = lru2_evicted
+  },
+  [PAGER_2Q] = {
+    .name = "2q", .init = twoq_init, .victim = twoq_victim,
+    .loaded = twoq_loaded, .touched = twoq_touched, .evicted = twoq_evicted
+  },
+  [PAGER_ARC] = {
+    .name = "arc", .init = arc_init, .missed = arc_missed,
+    .victim = arc_victim, .loaded = arc_loaded, .touched = arc_touched,
+    .evicted = arc_evicted
+  }
+};
+
+/** The replacement policy of the running pager */
+static repl_policy const* policy;
+
+char const* pager_policy_name(pager_policy p) {
+  return (p >= 0 && p < NUM_PAGER_POLICIES) ? policies[p].name : "unknown";
+}
+
+char const* pager_wal_mode_name(pager_wal_mode mode) {
+  static char const* const names[] = {"none", "off", "normal", "full"};
+  return (mode >= 0 && mode < NUM_PAGER_WAL_MODES) ? names[mode] : "unknown";
+}
+
+/* FNV-1a hash of a file name */
+static unsigned hash_fname(char const* fname) {
+  unsigned h = 2166136261u;
+  for (; *fname; fname++) {
+    h ^= (unsigned char) *fname;
+    h *= 16777619u;
+  }
+  return h;
+}
+
+/* Returns the interned entry of fname, NULL if fname has not been seen. */
+static fname_entry *find_fname(char const* fname, unsigned hash) {
+  for (fname_entry *e = __atomic_load_n(&fname_table[hash % FNAME_BUCKETS],
+                                        __ATOMIC_ACQUIRE);
+       e; e = e->next)
+    if (e->hash == hash && strcmp(e->name, fname) == 0)
+      return e;
+  return 0;
+}
+
+/* Returns the interned entry of fname, interning it on demand. */
+static fname_entry *intern_fname(char const* fname) {
+  unsigned hash = hash_fname(fname);
+  fname_entry *e = find_fname(fname, hash);
+  if (e) return e;
+
+  e = malloc(sizeof (fname_entry));
+  e->name = strdup(fname);
+  e->hash = hash;
+  e->fid = next_fid++;
+  e->fhandle = 0;
+  e->num_blocks = -1;
+  e->alloc_blocks = -1;
+  if (trace.fp)
+    trace_fname(e->fid, e->name);
+  e->next = fname_table[hash % FNAME_BUCKETS];
+  /* published for get_pinned_page(), which does not hold pager_mutex */
+  __atomic_store_n(&fname_table[hash % FNAME_BUCKETS], e, __ATOMIC_RELEASE);
+  return e;
+}
+
+static void release_fnames() {
+  for (size_t i = 0; i < FNAME_BUCKETS; i++) {
+    fname_entry *e = fname_table[i], *next;
+    for (; e; e = next) {
+      next = e->next;
+      free(e->name);
+      free(e);
+    }
+    fname_table[i] = 0;
+  }
+  next_fid = 0;
+}
+
+/* forward declaration */
+static int release_block(block_p b);
+static void wait_cleaned(page_p pg);
+static void page_write_done(page_p p, int ok);
+static void cleaner_start();
+static void cleaner_stop();
+static int flush_pages(fhandle_p fh);
+static int do_write_pages(page_p pgs[], int n);
+static int sync_compressed(fhandle_p fh);
+static page_p attach_block(block_p b, int quiet);
+static page_p do_page_pin(page_p pg);
+static int read_run(page_p pgs[], int n);
+static int write_run(page_p pgs[], int n);
+static void io_drain(void);
+static void release_io_reqs();
+static io_req *io_submit_run(int write, page_p pgs[], int n, int waited);
+static int io_run(int write, page_p pgs[], int n);
+static void io_reap(unsigned wait_nr);
+static void io_wait_page(page_p pg);
+
+/* Search the global file_handles[] for an empty slot,
+   to be used to store a new file handle, growing it if it is full.
+   Returns -1 if there is no memory for more slots.
+*/
+static int get_empty_fhandle_i() {
+  for (size_t i = 0; i < max_file_handles; i++)
+    if (!file_handles[i]) return i;
+  int n = 2 * max_file_handles;
+  fhandle_p *fhs = realloc(file_handles, n * sizeof (fhandle_p));
+  if (!fhs) return -1;
+  memset(fhs + max_file_handles, 0, max_file_handles * sizeof (fhandle_p));
+  file_handles = fhs;
+  max_file_handles = n;
+  return n / 2;
+}
+
+static void fd_lru_remove(fhandle_p fh) {
+  if (fh->lru_prev) fh->lru_prev->lru_next = fh->lru_next;
+  else fd_lru.first = fh->lru_next;
+  if (fh->lru_next) fh->lru_next->lru_prev = fh->lru_prev;
+  else fd_lru.last = fh->lru_prev;
+  fh->lru_prev = fh->lru_next = 0;
+  fd_lru.len--;
+}
+
+static void fd_lru_append(fhandle_p fh) {
+  fh->lru_prev = fd_lru.last;
+  fh->lru_next = 0;
+  if (fd_lru.last) fd_lru.last->lru_next = fh;
+  else fd_lru.first = fh;
+  fd_lru.last = fh;
+  fd_lru.len++;
+}
+
+/* Close the descriptor of the least recently used handle.
+   Returns 0 if no descriptor is open. */
+static int close_lru_fd() {
+  fhandle_p fh = fd_lru.first;
+  if (!fh) return 0;
+  if (io_ring_active()) { /* queued and in-flight requests use it */
+    io_reap(0);
+    io_drain();
+  }
+  pthread_mutex_lock(&clean_io_mutex); /* and so may the cleaner */
+  close(fh->fd);
+  pthread_mutex_unlock(&clean_io_mutex);
+  fd_lru_remove(fh);
+  fh->fd = -1;
+  return 1;
+}
+
+/* Open a descriptor, closing the least recently used ones to stay
+   within MAX_OPEN_FILES */
+static int open_fd(char const* fname, int flags) {
+  while (fd_lru.len >= MAX_OPEN_FILES && close_lru_fd());
+  return open(fname, flags, 0);
+}
+
+/* The descriptor of fh, reopening it if it has been closed for other
+   files. Returns -1 if the file cannot be opened. */
+static int fhandle_fd(fhandle_p fh) {
+  if (fh->seg >= 0) return fh->fd; /* the tablespace stays open */
+  if (fh->fd >= 0) {
+    if (fh != fd_lru.last) {
+      fd_lru_remove(fh);
+      fd_lru_append(fh);
+    }
+    return fh->fd;
+  }
+  int fd = open_fd(fh->fname, O_RDWR);
+  if (fd == -1) {
+    put_msg(ERROR, "cannot reopen %s.\n", fh->fname);
+    return -1;
+  }
+  fh->fd = fd;
+  fd_lru_append(fh);
+  counters()->num_reopens++;
+  return fd;
+}
+
+/* The logical size in the header of the file open with fd, which has
+   alloc_blocks blocks, 0 if there is none. No page layout keeps anything
+   at LOGICAL_SIZE_POS, so the word is 0 unless the pager preallocated
+   the file. */
+static int read_logical_size(int fd, int alloc_blocks) {
+  int n = 0;
+  if (alloc_blocks == 0
+      || pread(fd, &n, sizeof n, LOGICAL_SIZE_POS) != sizeof n
+      || n < 0 || n > alloc_blocks)
+    return 0;
+  return n;
+}
+
+/* Write the logical size of fh to its header if it changed: the number
+   of blocks if the pager preallocated blocks beyond them, otherwise 0,
+   which is written only to clear an earlier logical size */
+static void write_logical_size(fhandle_p fh) {
+  if (fh->seg >= 0 || fh->cf || fh->alloc_blocks < 0 || fh->num_blocks == 0)
+    return;
+  int n = fh->alloc_blocks > fh->num_blocks ? fh->num_blocks : 0;
+  int fd = n != fh->header_blocks ? fhandle_fd(fh) : -1;
+  if (fd >= 0 && pwrite(fd, &n, sizeof n, LOGICAL_SIZE_POS) == sizeof n)
+    fh->header_blocks = n;
+}
+
+/* Allocate the blocks of fh up to num_blocks in one go, rounded up to
+   extents of grow_blocks blocks, so that an appended file is not
+   allocated block by block */
+static void preallocate(fhandle_p fh, int num_blocks) {
+  int g = pager_cfg.grow_blocks;
+  if (g <= 0 || fh->seg >= 0 || fh->cf || fh->map) return;
+  int fd = fhandle_fd(fh);
+  if (fd < 0) return;
+  if (fh->alloc_blocks < 0)
+    fh->alloc_blocks = lseek(fd, (off_t) 0, SEEK_END) / BLOCK_SIZE;
+  if (num_blocks <= fh->alloc_blocks) return;
+  int n = (num_blocks + g - 1) / g * g;
+  int err = posix_fallocate(fd, (off_t) BLOCK_SIZE * fh->alloc_blocks,
+                            (off_t) BLOCK_SIZE * (n - fh->alloc_blocks));
+  if (err) /* the file grows with its writes */
+    put_msg(DEBUG, "cannot preallocate %s: %s\n", fh->fname, strerror(err));
+  else
+    fh->alloc_blocks = n;
+}
+
+/* A handle of the file of e open with fd. The number of blocks of a file
+   that was created, or closed before, is known without asking the OS. */
+static fhandle_p make_fhandle(fname_entry *e, int fd, int created) {
   fhandle_p fh = malloc(sizeof (file_handle_struct));
-  fh->fname = malloc(strlen(fname) + 1);
-  strcpy(fh->fname, fname);
+  fh->fname = e->name;
+  fh->fid = e->fid;
   fh->fd = fd;
-  fh->num_blocks = lseek(fd, (off_t) 0, SEEK_END) / BLOCK_SIZE;
+  fh->seg = -1;
+  fh->cf = 0;
+  if (created) {
+    fh->num_blocks = 0;
+    fh->alloc_blocks = 0;
+    fh->header_blocks = 0;
+  } else if (e->num_blocks >= 0) {
+    fh->num_blocks = e->num_blocks;
+    fh->alloc_blocks = e->alloc_blocks;
+    fh->header_blocks = fh->alloc_blocks > fh->num_blocks ? fh->num_blocks : 0;
+  } else {
+    fh->alloc_blocks = lseek(fd, (off_t) 0, SEEK_END) / BLOCK_SIZE;
+    fh->header_blocks = read_logical_size(fd, fh->alloc_blocks);
+    fh->num_blocks = fh->header_blocks ? fh->header_blocks : fh->alloc_blocks;
+  }
   fh->current_block = 0;
-  for (size_t i = 0; i < NUM_PAGES; i++)
-    fh->blocks_in_mem[i] = 0;
-
+  fh->last_blk_nr = -1;
+  fh->ra_window = 0;
+  fh->map = 0;
+  fh->map_len = 0;
   return fh;
 }
 
-static fhandle_p get_tbl_file(char const* fname) {
-  int file_i = find_fhandle_i(fname);
+/* Map the blocks of a file read-only.
+   Returns 0 if the file is empty or cannot be mapped. */
+static int map_fhandle(fhandle_p fh) {
+  struct stat st;
+  if (fh->seg >= 0 || fh->cf) return 0; /* the blocks are not in place */
+  size_t len = (size_t) BLOCK_SIZE * fh->num_blocks;
+  if (len == 0 || fstat(fh->fd, &st) == -1 || (size_t) st.st_size < len)
+    return 0;
+  void *map = mmap(0, len, PROT_READ, MAP_SHARED, fh->fd, 0);
+  if (map == MAP_FAILED) {
+    put_msg(WARN, "cannot map %s, copying its blocks.\n", fh->fname);
+    return 0;
+  }
+  fh->map = map;
+  fh->map_len = len;
+  return 1;
+}
 
-  if (file_i == -1) return 0;
+static fhandle_p get_tbl_file(char const* fname) {
+  fname_entry *e = find_fname(fname, hash_fname(fname));
+  return e ? e->fhandle : 0;
+}
 
-  return file_handles[file_i];
+/* Open the segment of fname in the tablespace, creating it on demand */
+static fhandle_p open_ts_file(char const* fname, int slot) {
+  fname_entry *e = intern_fname(fname);
+  fhandle_p fh = make_fhandle(e, ts_fd(), 1);
+  fh->seg = ts_segment(fname, 1);
+  fh->num_blocks = ts_num_blocks(fh->seg);
+  fh->slot = slot;
+  __atomic_store_n(&e->fhandle, fh, __ATOMIC_RELEASE);
+  file_handles[slot] = fh;
+  num_file_handles++;
+  return fh;
 }
 
 static fhandle_p open_tbl_file(char const* fname) {
-  if (num_file_handles == MAX_OPEN_FILES) {
-    put_msg(WARN,
-            "open Cannot file %s because the limit %d of open files has reached.",
-            fname, MAX_OPEN_FILES);
+  int empty_i = get_empty_fhandle_i();
+  if (empty_i == -1) {
+    put_msg(WARN, "Cannot open file %s, out of memory.\n", fname);
     return 0;
   }
+  if (ts_active())
+    return open_ts_file(fname, empty_i);
 
-  int fd = open(fname, O_RDWR, 0);
+  int created = 0;
+  int fd = open_fd(fname, O_RDWR);
   if (fd == -1) {
     /* if the file does not exist, create one */
     if ((fd = creat(fname, 0600)) == -1) {
@@ -550,20 +2358,35 @@ static fhandle_p open_tbl_file(char const* fname) {
     /* close and open the created file again for read and write */
     if (close(fd) == -1 || (fd = open(fname, O_RDWR, 0)) == -1)
       return 0;
+    created = 1;
   }
 
-  int empty_i = get_empty_fhandle_i();
-  if (empty_i == -1) return 0;
-
-  fhandle_p fh = make_fhandle(fname, fd);
+  fname_entry *e = intern_fname(fname);
+  fhandle_p fh = make_fhandle(e, fd, created);
+  if (!created && cf_is_compressed(fd)) {
+    if (!(fh->cf = cf_load(fd, BLOCK_SIZE))) {
+      put_msg(ERROR, "Cannot open compressed file %s.\n", fname);
+      close(fd);
+      free(fh);
+      return 0;
+    }
+    fh->num_blocks = cf_num_blocks(fh->cf);
+  }
 
+  fh->slot = empty_i;
+  __atomic_store_n(&e->fhandle, fh, __ATOMIC_RELEASE);
   file_handles[empty_i] = fh;
   num_file_handles++;
+  fd_lru_append(fh);
+
+  /* files created in this session are written, the others only read */
+  if (pager_cfg.access == PAGER_MMAP)
+    map_fhandle(fh);
 
   return fh;
 }
 
-int file_num_blocks(char const* fname) {
+static int do_file_num_blocks(char const* fname) {
   fhandle_p fh = get_tbl_file(fname);
   if (!fh) fh = open_tbl_file(fname);
 
@@ -574,254 +2397,1453 @@ int file_num_blocks(char const* fname) {
   return fh->num_blocks;
 }
 
-/* forward declaration */
-static void release_block(block_p b);
+int file_num_blocks(char const* fname) {
+  pager_lock();
+  int res = do_file_num_blocks(fname);
+  pager_unlock();
+  return res;
+}
 
-static void close_tbl_file(fhandle_p fhandle) {
-  if (!fhandle) return;
+/* Close a file, its buffered blocks are written back and released.
+   The file stays open if a block cannot be written. Returns 0 then. */
+static int close_tbl_file(fhandle_p fhandle) {
+  if (!fhandle) return 1;
+  io_drain();
+  flush_pages(fhandle);
+  int res = 1;
   for (size_t i = 0; i < NUM_PAGES; i++) {
-    if (fhandle->blocks_in_mem[i])
-      release_block(fhandle->blocks_in_mem[i]);
+    if (pages[i] && pages[i]->block
+        && pages[i]->block->fhandle == fhandle && !release_block(pages[i]->block))
+      res = 0;
   }
-  if (close(fhandle->fd) == 0) {
-    int file_i = find_fhandle_i(fhandle->fname);
-    free(fhandle->fname);
-    free(fhandle);
-    file_handles[file_i] = 0;
-    num_file_handles--;
+  if (!res) return 0;
+  if (fhandle->map)
+    munmap(fhandle->map, fhandle->map_len);
+  cf_free(fhandle->cf);
+  fhandle->cf = 0;
+  /* the blocks written beyond the preallocated ones extended the file */
+  if (fhandle->alloc_blocks >= 0 && fhandle->alloc_blocks < fhandle->num_blocks)
+    fhandle->alloc_blocks = fhandle->num_blocks;
+  write_logical_size(fhandle);
+  if (fhandle->seg < 0 && fhandle->fd >= 0) {
+    if (close(fhandle->fd) != 0) return 0;
+    fd_lru_remove(fhandle);
   }
+  fname_entry *e = intern_fname(fhandle->fname);
+  e->num_blocks = fhandle->num_blocks;
+  e->alloc_blocks = fhandle->alloc_blocks;
+  __atomic_store_n(&e->fhandle, 0, __ATOMIC_RELEASE);
+  file_handles[fhandle->slot] = 0;
+  free(fhandle);
+  num_file_handles--;
+  return 1;
 }
 
 int close_file(char const* fname) {
-  int i = find_fhandle_i(fname);
-  if (i != -1)
-    close_tbl_file(file_handles[i]);
+  pager_lock();
+  fhandle_p fh = get_tbl_file(fname);
+  int i = fh ? fh->slot : -1;
+  if (!close_tbl_file(fh)) i = -1;
+  pager_unlock();
   return i;
 }
 
-int pager_init(void) {
-  num_file_handles = 0;
+static int do_create_compressed_file(char const* fname) {
+  if (ts_active()) {
+    put_msg(WARN, "%s: the files of a tablespace are not compressed.\n",
+            fname);
+    return 0;
+  }
+  fhandle_p fh = get_tbl_file(fname);
+  if (!fh) fh = open_tbl_file(fname);
+  if (!fh) return 0;
+  if (fh->cf) return 1;
+  if (fh->num_blocks > 0 || fh->map) {
+    put_msg(ERROR, "create_compressed_file: %s has blocks already.\n", fname);
+    return 0;
+  }
+  int fd = fhandle_fd(fh);
+  if (fd == -1 || !(fh->cf = cf_create(fd, BLOCK_SIZE))) {
+    put_msg(ERROR, "create_compressed_file: cannot create %s.\n", fname);
+    return 0;
+  }
+  return 1;
+}
 
-  /* global vars file_handles[] are initialized with NULL.
-     in case they are not, or pager_init is called again
-     after pager_terminate, initialize them anyway */
-  for (size_t i = 0; i < MAX_OPEN_FILES; i++)
-    file_handles[i] = 0;
-  for (size_t i = 0; i < NUM_PAGES; i++) {
-    pages[i] = make_page(i);
-    if (pages[i] == NULL) {
-      put_msg(ERROR, "pager_init failed");
-      pager_terminate();
+int create_compressed_file(char const* fname) {
+  pager_lock();
+  int res = do_create_compressed_file(fname);
+  pager_unlock();
+  return res;
+}
+
+/* forward declaration */
+static int do_checkpoint(int with_catalog);
+
+/* Whether the write-ahead log has page records of file fname */
+static int file_logged(char const* fname) {
+  fname_entry *e = find_fname(fname, hash_fname(fname));
+  return e && e->logged;
+}
+
+/* Forget the changes to the pages of file fh that are not logged yet:
+   the file is renamed, and the log, which names the files, must not
+   redo them to a file of the old name */
+static void unlog_file(fhandle_p fh) {
+  if (!fh) return;
+  pthread_mutex_lock(&log_mutex);
+  for (size_t i = 0; i < NUM_PAGES; i++)
+    if (pages[i]->block && pages[i]->block->fhandle == fh)
+      pages[i]->log_lo = pages[i]->log_hi = 0;
+  pthread_mutex_unlock(&log_mutex);
+}
+
+int rename_file(char const* fname, char const* new_name) {
+  pager_lock();
+  /* a file the log names gets its changes out of the log first */
+  if (wal_active() && (file_logged(fname) || file_logged(new_name)))
+    do_checkpoint(1);
+  if (wal_active()) {
+    unlog_file(get_tbl_file(fname));
+    unlog_file(get_tbl_file(new_name));
+  }
+  if (!close_tbl_file(get_tbl_file(fname))
+      || !close_tbl_file(get_tbl_file(new_name))) {
+    pager_unlock();
+    put_msg(ERROR, "rename_file: cannot close %s or %s.\n", fname, new_name);
+    return 0;
+  }
+  /* the block counts of the closed files are no longer theirs */
+  fname_entry *e = find_fname(fname, hash_fname(fname));
+  if (e) e->num_blocks = e->alloc_blocks = -1;
+  if ((e = find_fname(new_name, hash_fname(new_name))))
+    e->num_blocks = e->alloc_blocks = -1;
+  int res = ts_active() ? ts_rename(fname, new_name)
+    : rename(fname, new_name) == 0;
+  pager_unlock();
+  return res;
+}
+
+static int do_map_file(char const* fname) {
+  fhandle_p fh = get_tbl_file(fname);
+  if (!fh) fh = open_tbl_file(fname);
+  if (!fh) {
+    put_msg(ERROR, "map_file: cannot get file \"%s\".\n", fname);
+    return 0;
+  }
+  if (fh->map) return 1;
+  for (size_t i = 0; i < NUM_PAGES; i++)
+    if (pages[i]->block && pages[i]->block->fhandle == fh
+        && pages[i]->pin_count > 0) {
+      put_msg(ERROR, "map_file: block %d of %s is pinned.\n",
+              pages[i]->block->blk_nr, fname);
       return 0;
     }
+
+  /* the mapping sees what is written back, the buffered copies go */
+  io_drain();
+  flush_pages(fh);
+  for (size_t i = 0; i < NUM_PAGES; i++)
+    if (pages[i]->block && pages[i]->block->fhandle == fh
+        && !release_block(pages[i]->block))
+      return 0;
+  return map_fhandle(fh);
+}
+
+int map_file(char const* fname) {
+  pager_lock();
+  int res = do_map_file(fname);
+  pager_unlock();
+  return res;
+}
+
+/* Redo a page record of the log, see wal_redo() */
+static int redo_page(wal_page_rec const* r, void* arg) {
+  /* the blocks of a file are created in order, but a block may be
+     logged before the blocks created before it */
+  int n;
+  while ((n = file_num_blocks(r->fname)) >= 0 && n < r->blk_nr) {
+    page_p pg = get_page(r->fname, n);
+    if (!pg) return 0;
+    unpin(pg);
   }
-  q_pinned = make_pqueue();
-  q_unpinned = make_pqueue();
-  pager_profiler_reset();
+  page_p pg = get_page(r->fname, r->blk_nr);
+  if (!pg) {
+    put_msg(ERROR, "redo: cannot get block %d of %s.\n", r->blk_nr, r->fname);
+    return 0;
+  }
+  if (page_lsn(pg) < r->lsn) {
+    memcpy(pg->content + r->offset, r->data, r->len);
+    set_page_lsn(pg, r->lsn);
+    set_page_free_pos_from_content(pg);
+    pg->dirty = 1;
+  }
+  unpin(pg);
   return 1;
 }
 
-static block_p get_buffered_blk_in_fhandle(fhandle_p fh, int bnr) {
-  for (size_t i = 0; i < NUM_PAGES; i++)
-    if (fh->blocks_in_mem[i]
-        && fh->blocks_in_mem[i]->blk_nr == bnr) {
-      pq_touch(fh->blocks_in_mem[i]->page);
-      return fh->blocks_in_mem[i];
+/* Redo the log, record by record in the order of the log. The pages it
+   redoes are written back and the log is emptied but for the catalog of
+   its last checkpoint. Returns 0 upon failure. */
+static int redo_wal() {
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  long size = wal_size();
+  long n = wal_redo(redo_page, 0);
+  if (n < 0) return 0;
+  long len;
+  char *catalog = wal_catalog(&len);
+  if (catalog) {
+    free(recovered_catalog);
+    recovered_catalog = catalog;
+    recovered_catalog_len = len;
+  }
+  pager_lock();
+  int res = do_checkpoint(1);
+  pager_unlock();
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  if (res && n > 0)
+    put_msg(INFO, "%s/%s: %ld page records redone from %ld bytes of log"
+            " in %.1f ms.\n", sys_dir, wal_file, n, size,
+            (end.tv_sec - start.tv_sec) * 1e3
+            + (end.tv_nsec - start.tv_nsec) / 1e6);
+  return res;
+}
+
+/* Open the write-ahead log of the database if it has one or the
+   configuration asks for one, and redo it. The log is removed then if
+   no log is asked for. Returns 0 upon failure. */
+static int open_wal() {
+  int exists = access(wal_file, F_OK) == 0;
+  if (!exists && pager_cfg.wal == PAGER_WAL_NONE) return 1;
+  wal_sync mode = pager_cfg.wal == PAGER_WAL_OFF ? WAL_SYNC_OFF
+    : pager_cfg.wal == PAGER_WAL_FULL ? WAL_SYNC_FULL : WAL_SYNC_NORMAL;
+  if (!wal_open(wal_file, BLOCK_SIZE, mode, log_end)) return 0;
+  last_ckpt_begin = wal_end();
+  if (wal_size() > 0 && !redo_wal()) return 0;
+  if (pager_cfg.wal == PAGER_WAL_NONE) {
+    /* the pages keep the LSNs of the log, which a next one starts after */
+    log_end = wal_end();
+    wal_close();
+    if (!save_superblock()) return 0;
+    unlink(wal_file);
+  }
+  return 1;
+}
+
+int pager_init(pager_config const* cfg) {
+  pthread_once(&pager_locks_once, init_pager_locks);
+  if (pages) pager_terminate(); /* the buffer is sized by the old config */
+
+  if (cfg) {
+    if (!valid_block_size(cfg->block_size)
+        || cfg->num_pages < 1 || cfg->max_open_files < 1
+        || cfg->policy < 0 || cfg->policy >= NUM_PAGER_POLICIES
+        || cfg->io_depth < 1
+        || (cfg->access != PAGER_COPY && cfg->access != PAGER_MMAP)
+        || cfg->clean_target < 0 || cfg->clean_target > 100) {
+      put_msg(ERROR, "pager_init: invalid configuration.\n");
+      return 0;
     }
+    pager_cfg = *cfg;
+  }
+  if (sys_dir[0] != '\0' && !load_superblock())
+    return 0;
+  if (sys_dir[0] != '\0' && pager_cfg.tablespace > 0) {
+    if (pager_cfg.access == PAGER_MMAP) {
+      put_msg(WARN, "the files of a tablespace are not mapped, copying.\n");
+      pager_cfg.access = PAGER_COPY;
+    }
+    if (!ts_open(tablespace_file, pager_cfg.block_size, pager_cfg.tablespace))
+      return 0;
+  }
+  /* the log is redone into the pages, and changes them */
+  if (sys_dir[0] != '\0' && pager_cfg.access == PAGER_MMAP
+      && (pager_cfg.wal != PAGER_WAL_NONE || access(wal_file, F_OK) == 0)) {
+    put_msg(WARN, "the files of a database with a log are not mapped,"
+            " copying.\n");
+    pager_cfg.access = PAGER_COPY;
+  }
+  if (pager_cfg.pool_bytes > 0) {
+    pager_cfg.num_pages = pager_cfg.pool_bytes / pager_cfg.block_size;
+    if (pager_cfg.num_pages < 1) pager_cfg.num_pages = 1;
+  }
+
+  num_file_handles = 0;
+  max_file_handles = MAX_OPEN_FILES;
+  file_handles = calloc(max_file_handles, sizeof (fhandle_p));
+  pages = calloc(NUM_PAGES, sizeof (page_p));
+  free_pages = calloc(NUM_PAGES, sizeof (page_p));
+  log_pages = calloc(NUM_PAGES, sizeof (page_p));
+  num_log_pages = 0;
+  if (!file_handles || !pages || !free_pages || !log_pages) {
+    put_msg(ERROR, "pager_init failed");
+    pager_terminate();
+    return 0;
+  }
+  if (!map_arena()) {
+    put_msg(ERROR, "pager_init: cannot map the buffer pool.\n");
+    pager_terminate();
+    return 0;
+  }
+  for (size_t i = 0; i < NUM_PAGES; i++)
+    pages[i] = make_page(i);
+  /* page 0 is the first to use */
+  for (num_free_pages = 0; num_free_pages < NUM_PAGES; num_free_pages++)
+    free_pages[num_free_pages] = pages[NUM_PAGES - 1 - num_free_pages];
+
+  policy = &policies[pager_cfg.policy];
+  policy->init();
+
+  unsigned num_buckets = 1;
+  while (num_buckets < 2 * NUM_PAGES) num_buckets <<= 1;
+  blk_table = calloc(num_buckets, sizeof (block_p));
+  blk_table_mask = num_buckets - 1;
+
+  /* ARC remembers up to 2 * NUM_PAGES replaced blocks */
+  while (num_buckets < 4 * NUM_PAGES) num_buckets <<= 1;
+  ghost_table = calloc(num_buckets, sizeof (ghost_p));
+  ghost_table_mask = num_buckets - 1;
+
+  if (pager_cfg.io_engine == PAGER_IO_URING && !io_ring_init(pager_cfg.io_depth))
+    put_msg(WARN, "io_uring is not available, using synchronous I/O.\n");
+
+  if (sys_dir[0] != '\0' && !open_wal()) {
+    pager_terminate();
+    return 0;
+  }
+
+  pager_profiler_reset();
+  if (pager_cfg.trace_file)
+    trace_open();
+  if (pager_cfg.clean_target > 0)
+    cleaner_start();
+  return 1;
+}
+
+static unsigned blk_hash(int fid, int blk_nr) {
+  return hash_ids(fid, blk_nr, blk_table_mask);
+}
+
+/* Returns the buffered block (fid, bnr), NULL if it is not in memory. */
+static block_p lookup_block(int fid, int bnr) {
+  for (block_p b = blk_table[blk_hash(fid, bnr)]; b; b = b->hnext)
+    if (b->blk_nr == bnr && b->fhandle->fid == fid)
+      return b;
+  return 0;
+}
+
+static block_p get_buffered_block(fhandle_p fh, int bnr) {
+  block_p b = lookup_block(fh->fid, bnr);
+  if (b) policy->touched(b->page);
+  return b;
+}
+
+static pthread_mutex_t *blk_shard(unsigned h) {
+  return &blk_shards[h % BLK_SHARDS];
+}
+
+static void hash_block(block_p b) {
+  unsigned h = blk_hash(b->fhandle->fid, b->blk_nr);
+  pthread_mutex_lock(blk_shard(h));
+  b->hnext = blk_table[h];
+  blk_table[h] = b;
+  pthread_mutex_unlock(blk_shard(h));
+}
+
+static void unhash_block(block_p b) {
+  unsigned h = blk_hash(b->fhandle->fid, b->blk_nr);
+  pthread_mutex_lock(blk_shard(h));
+  for (block_p *bp = &blk_table[h]; *bp; bp = &(*bp)->hnext)
+    if (*bp == b) {
+      *bp = b->hnext;
+      break;
+    }
+  pthread_mutex_unlock(blk_shard(h));
+}
+
+/* Pin a page again if it is pinned.
+   Returns 0 if it is not: only a thread holding pager_mutex pins an
+   unpinned page, which it may have to take off the replacement queues. */
+static int pin_again(page_p pg) {
+  int n = pg->pin_count;
+  while (n > 0)
+    if (atomic_compare_exchange_weak(&pg->pin_count, &n, n + 1))
+      return 1;
+  return 0;
+}
+
+static int is_last_block(block_p b) {
+  return (b->blk_nr == b->fhandle->num_blocks - 1);
+}
+
+int peof(page_p p) {
+  return (is_last_block(p->block) && eop(p));
+}
+
+/* The page gives up its block and becomes free */
+static void free_page(page_p pg) {
+  policy->evicted(pg);
+  pg->block = 0;
+  pg->content = pg->buf; /* not into a mapping that may go away */
+  free_pages[num_free_pages++] = pg;
+}
+
+/** Release a block (and unpinn).
+    The block of a closed file may still be pinned, the pins are dropped
+    and a dirty page is written back. A page that cannot be written keeps
+    its block, and stays dirty. Returns 0 then. */
+static int release_block(block_p b) {
+  if (!b) return 1;
+  wait_cleaned(b->page);
+  if (b->page->pin_count > 0) {
+    b->page->pin_count = 1;
+    unpin(b->page);
+  }
+  if (!write_page(b->page)) {
+    put_msg(ERROR, "release_block: cannot write block %d of %s, it stays"
+            " buffered.\n", b->blk_nr, b->fhandle->fname);
+    return 0;
+  }
+  unhash_block(b);
+  if (b->fhandle->current_block == b)
+    __atomic_store_n(&b->fhandle->current_block, 0, __ATOMIC_RELAXED);
+  free_page(b->page);
+  free_block(b);
+  return 1;
+}
+
+void pager_terminate(void) {
+  /* put_pqueues_info (DEBUG); */
+  cleaner_stop();
+  io_drain();
+  /* a clean shutdown leaves an empty log, but for a catalog redone
+     that nobody took yet */
+  if (pages && wal_active()) {
+    pager_lock();
+    do_checkpoint(recovered_catalog != 0);
+    pager_unlock();
+  }
+  if (pages)
+    flush_pages(0);
+  if (pages && pager_cfg.stats_file)
+    dump_stats_file(); /* while the file names are interned */
+  trace_close();
+  for (size_t i = 0; pages && i < NUM_PAGES; i++) {
+    if (!pages[i]) continue;
+    release_block(pages[i]->block);
+    pthread_rwlock_destroy(&pages[i]->latch);
+    pages[i] = 0;
+  }
+  for (size_t i = 0; file_handles && i < max_file_handles; i++)
+    close_tbl_file(file_handles[i]);
+  ts_close();
+  wal_close();
+  free(pages);
+  pages = 0;
+  free(log_pages);
+  log_pages = 0;
+  num_log_pages = 0;
+  free(file_handles);
+  file_handles = 0;
+  q_unpinned = release_pqueue(q_unpinned);
+  q_pinned = release_pqueue(q_pinned);
+  q_a1in = release_pqueue(q_a1in);
+  q_am = release_pqueue(q_am);
+  q_t1 = release_pqueue(q_t1);
+  q_t2 = release_pqueue(q_t2);
+  release_ghosts();
+  io_ring_exit();
+  release_io_reqs();
+  free(free_pages);
+  free_pages = 0;
+  num_free_pages = 0;
+  free(blk_table);
+  blk_table = 0;
+  release_fnames();
+  unmap_arena();
+}
+
+/* forward declaration */
+static int max_io_run();
+
+/* The page of block (fh, bnr) if it is dirty and can be written back
+   together with a neighbour, otherwise NULL */
+static page_p write_behind_page(fhandle_p fh, int bnr) {
+  block_p b = bnr >= 0 ? lookup_block(fh->fid, bnr) : 0;
+  /* the pin count first: the foreground changes pinned pages meanwhile */
+  return b && b->page->pin_count == 0 && b->page->dirty
+    && !b->page->io_pending && !b->page->cleaning ? b->page : 0;
+}
+
+/* Write back a dirty victim together with the unpinned dirty pages of the
+   adjacent blocks, which are written as one sequential run instead of one
+   by one when they are replaced later. */
+static void write_behind(page_p victim) {
+  fhandle_p fh = victim->block->fhandle;
+  int first = victim->block->blk_nr, last = first;
+  while (last - first + 1 < max_io_run() && write_behind_page(fh, first - 1)
+         && blocks_contiguous(fh, first - 1))
+    first--;
+  while (last - first + 1 < max_io_run() && write_behind_page(fh, last + 1)
+         && blocks_contiguous(fh, last))
+    last++;
+
+  int n = last - first + 1;
+  page_p pgs[n];
+  for (int bnr = first; bnr <= last; bnr++) {
+    pgs[bnr - first] = lookup_block(fh->fid, bnr)->page;
+    wait_cleaned(pgs[bnr - first]);
+  }
+  if (io_ring_active())
+    io_run(1, pgs, n);
+  else
+    write_run(pgs, n);
+}
+
+/* The victim gives up its block and becomes a free page.
+   A dirty victim is written back first. Returns 0 if it cannot be
+   written, the victim keeps its block then. */
+static int replace_page(page_p victim) {
+  file_counters *f = file_counters_of(victim->block->fhandle->fid);
+  counters()->num_evictions++;
+  f->num_evictions++;
+  if (victim->dirty) {
+    counters()->num_dirty_victims++;
+    f->num_dirty_evictions++;
+    if (cleaner_running)
+      pthread_cond_signal(&cleaner_cond); /* it falls behind */
+    write_behind(victim);
+  }
+  return release_block(victim->block);
+}
+
+/* The page in the next slot of the ring of s if it can be recycled:
+   it still holds a block got by s, which is neither pinned nor waiting
+   to be referenced after read-ahead. NULL otherwise. */
+static page_p ring_victim(access_strategy_p s) {
+  s->current = (s->current + 1) % s->size;
+  page_p pg = s->ring[s->current];
+  return pg && pg->ring == s && pg->block && pg->pin_count == 0
+    && !pg->prefetched && !pg->io_pending && !pg->cleaning ? pg : 0;
+}
+
+/* Find an available buffer page for block b, in this order:
+   - the next page of the ring of the active strategy,
+   - unused page,
+   - unpinned page chosen by the replacement policy.
+   A pinned page is never replaced. Returns NULL if all pages are pinned,
+   or if the dirty victim cannot be written back,
+   with an error message unless quiet is non-zero.
+   The page got for an active strategy takes the current slot of its ring.
+*/
+static page_p available_page(block_p b, int quiet) {
+  /* put_pqueues_info (DEBUG); */
+  access_strategy_p s = active_strategy;
+  if (policy->missed)
+    policy->missed(b);
+  page_p victim = s ? ring_victim(s) : 0;
+  if (victim)
+    counters()->num_recycled++;
+  else if (num_free_pages == 0) {
+    victim = policy->victim(b); /* replace an unpinned page */
+    if (!victim) {
+      if (!quiet)
+        put_msg(ERROR, "available_page: all %d pages are pinned.\n", NUM_PAGES);
+      return 0;
+    }
+  }
+  if (victim && !replace_page(victim)) {
+    if (!quiet)
+      put_msg(ERROR, "available_page: cannot replace page %d.\n",
+              victim->page_nr);
+    return 0;
+  }
+  page_p pg = free_pages[--num_free_pages];
+  if (!b->fhandle->map && !pg->buf)
+    pg->buf = page_buf(pg->page_nr);
+  init_page(pg);
+  pg->block = b;
+  if (s) {
+    s->ring[s->current] = pg;
+    pg->ring = s;
+  }
+  policy->loaded(pg);
+  return pg;
+}
+
+/* Returns the buffer page (position in pages[]) of the block).
+   If the block does not have a buffer page allocated, allocate one.
+*/
+static page_p page_for_block(block_p b) {
+  if (!b) return 0;
+  block_p buffered = lookup_block(b->fhandle->fid, b->blk_nr);
+  if (buffered && buffered->page)
+    return buffered->page;
+  /* put_msg(WARN, "block %d not in mem yet, allocate an available one.\n", b->blk_nr); */
+  return available_page(b, 0);
+}
+
+/* Max number of blocks read ahead at a time, which are read together
+   with the missed block in one request.
+   A small buffer (less than 4 pages) does no read-ahead. */
+static int max_readahead() {
+  int n = NUM_PAGES / 4;
+  return n < max_io_run() ? n : max_io_run() - 1;
+}
+
+/* Sequential access detection: the read-ahead window doubles with every
+   sequential miss, up to max_readahead(), and is reset by any
+   non-sequential access.
+   Returns the number of blocks to read ahead of blknr. */
+static int readahead_window(fhandle_p fh, int blknr, int miss) {
+  int seq = blknr == fh->last_blk_nr + 1;
+  fh->last_blk_nr = blknr;
+  if (!seq) {
+    fh->ra_window = 0;
+    return 0;
+  }
+  if (!miss || fh->map) return 0; /* the OS reads ahead in mappings */
+  fh->ra_window = fh->ra_window ? 2 * fh->ra_window : 2;
+  if (fh->ra_window > max_readahead())
+    fh->ra_window = max_readahead();
+  return fh->ra_window;
+}
+
+/* Read the blocks from blknr that are not buffered, up to n blocks
+   and stopping at the first buffered block, into pages that are left
+   unpinned and marked as prefetched.
+   If first is not NULL, it is the pinned page of block blknr - 1, which is
+   read in the same preadv().
+   Returns the number of blocks read ahead, -1 if reading fails. */
+static int prefetch_run(fhandle_p fh, int blknr, int n, page_p first) {
+  if (blknr + n > stored_blocks(fh))
+    n = stored_blocks(fh) - blknr;
+  if (n < 0) n = 0;
+
+  page_p pgs[n + 1];
+  int k = 0;
+  if (first) pgs[k++] = first;
+  for (int bnr = blknr; bnr < blknr + n; bnr++) {
+    if (lookup_block(fh->fid, bnr)) break;
+    if ((first || bnr > blknr) && !blocks_contiguous(fh, bnr - 1))
+      break; /* at the end of an extent */
+    block_p blk = alloc_block(fh, bnr);
+    page_p pg = attach_block(blk, 1);
+    if (!pg) { /* all pages are pinned, do not read ahead */
+      free_block(blk);
+      break;
+    }
+    pg->prefetched = 1;
+    hash_block(blk);
+    pg->current_pos = PAGE_HEADER_SIZE;
+    pgs[k++] = pg;
+  }
+
+  int res;
+  if (io_ring_active()) {
+    /* the blocks ahead are read asynchronously, holding their own pins */
+    int ahead = first ? 1 : 0;
+    if (k > ahead)
+      io_submit_run(0, pgs + ahead, k - ahead, 0);
+    if (first) /* submitted together with the blocks ahead */
+      res = io_run(0, pgs, 1) ? k - ahead : -1;
+    else {
+      io_reap(0);
+      res = k;
+    }
+  } else
+    res = k > 0 && !read_run(pgs, k) ? -1 : k - (first ? 1 : 0);
+  for (int i = first ? 1 : 0; i < k; i++) {
+    if (res < 0 && !pgs[i]->io_pending)
+      release_block(pgs[i]->block);
+    else
+      unpin(pgs[i]);
+  }
+  if (res > 0)
+    counters()->num_prefetched += res;
+  return res;
+}
+
+/* pin() with read-ahead of the n blocks following b */
+static page_p pin_with_readahead(block_p b, int n) {
+  page_p pg = attach_block(b, 0);
+  if (!pg) return 0;
+  if (prefetch_run(b->fhandle, b->blk_nr + 1, n, pg) < 0) {
+    put_msg(ERROR, "read_page %d fails\n", pg->page_nr);
+    pg->pin_count = 0;
+    free_page(pg);
+    return 0;
+  }
+  return pg;
+}
+
+/* Pin the page of a buffered block that is referenced again */
+static page_p page_hit(page_p pg) {
+  if (pg->io_pending)
+    io_wait_page(pg);
+  if (pg->prefetched) {
+    counters()->num_prefetch_hits++;
+    pg->prefetched = 0;
+  }
+  return do_page_pin(pg);
+}
+
+static int do_pager_prefetch(char const* fname, int blknr, int n) {
+  fhandle_p fh = get_tbl_file(fname);
+  if (!fh) fh = open_tbl_file(fname);
+  if (!fh) {
+    put_msg(ERROR, "pager_prefetch: NULL fh.\n");
+    return -1;
+  }
+  if (blknr < 0) blknr = 0;
+  if (blknr + n > fh->num_blocks)
+    n = fh->num_blocks - blknr;
+  if (n <= 0) return 0;
+
+  if (fh->map) {
+    madvise(fh->map + (size_t) BLOCK_SIZE * blknr, (size_t) BLOCK_SIZE * n,
+            MADV_WILLNEED);
+    return 0;
+  }
+  /* let the OS read the whole range, and the buffer a part of it */
+  if (fhandle_fd(fh) >= 0)
+    for (int bnr = blknr, len; bnr < blknr + n; bnr += len) {
+      for (len = 1; bnr + len < blknr + n && blocks_contiguous(fh, bnr + len - 1);
+           len++);
+      posix_fadvise(fh->fd, (off_t) BLOCK_SIZE * disk_block(fh, bnr),
+                    (off_t) BLOCK_SIZE * len, POSIX_FADV_WILLNEED);
+    }
+  int budget = max_readahead(), num_read = 0;
+  for (int bnr = blknr; bnr < blknr + n && budget > 0; ) {
+    if (lookup_block(fh->fid, bnr)) {
+      bnr++;
+      continue;
+    }
+    int len = blknr + n - bnr < budget ? blknr + n - bnr : budget;
+    int k = prefetch_run(fh, bnr, len, 0);
+    if (k <= 0) break;
+    bnr += k;
+    budget -= k;
+    num_read += k;
+  }
+  return num_read;
+}
+
+int pager_prefetch(char const* fname, int blknr, int n) {
+  pager_lock();
+  int res = do_pager_prefetch(fname, blknr, n);
+  pager_unlock();
+  return res;
+}
+
+/* get_page() of a block that is buffered, read in and pinned already,
+   for a thread that finds pager_mutex busy. The block is looked up
+   holding only the lock of its shard of blk_table, and its page is pinned
+   once more if it is still pinned: a pinned page is not replaced, and
+   only the holder of pager_mutex pins an unpinned page.
+   The reference is told to the replacement policy when the page is
+   unpinned at last.
+   Returns NULL if the thread has to wait for pager_mutex after all. */
+static page_p get_pinned_page(char const* fname, int blknr) {
+  if (blknr < 0) return 0;
+  fname_entry *e = find_fname(fname, hash_fname(fname));
+  fhandle_p fh = e ? __atomic_load_n(&e->fhandle, __ATOMIC_ACQUIRE) : 0;
+  if (!fh) return 0;
+
+  unsigned h = blk_hash(e->fid, blknr);
+  page_p pg = 0;
+  pthread_mutex_lock(blk_shard(h));
+  for (block_p b = blk_table[h]; b; b = b->hnext)
+    if (b->blk_nr == blknr && b->fhandle->fid == e->fid) {
+      if (b->page->valid && !b->page->prefetched && pin_again(b->page))
+        pg = b->page;
+      break;
+    }
+  pthread_mutex_unlock(blk_shard(h));
+  if (!pg) return 0;
+
+  if (__atomic_load_n(&fh->current_block, __ATOMIC_RELAXED) != pg->block)
+    pg->touched = 1;
+  inc_num_refs(e->fid, 1);
+  return pg;
+}
+
+/* Number of pages in the ring of an access strategy by default: the
+   page being accessed, the pages read ahead of it and one more, but at
+   most half of the buffer */
+static int default_ring_size() {
+  int n = max_readahead() + 2;
+  if (n > NUM_PAGES / 2) n = NUM_PAGES / 2;
+  return n > 0 ? n : 1;
+}
+
+access_strategy_p make_access_strategy(int size) {
+  if (size <= 0) {
+    size = default_ring_size();
+    if (size >= NUM_PAGES)
+      return 0; /* too small a buffer to spare a ring */
+  } else if (size >= NUM_PAGES) {
+    put_msg(ERROR, "make_access_strategy: a ring of %d pages takes the"
+            " whole buffer of %d pages.\n", size, NUM_PAGES);
+    return 0;
+  }
+  access_strategy_p s = calloc(1, sizeof (access_strategy)
+                               + size * sizeof (page_p));
+  if (!s) {
+    put_msg(ERROR, "make_access_strategy: no memory for a ring of %d.\n",
+            size);
+    return 0;
+  }
+  s->size = size;
+  s->current = size - 1; /* the first page takes slot 0 */
+  return s;
+}
+
+void release_access_strategy(access_strategy_p s) {
+  if (!s) return;
+  pager_lock();
+  /* the pages of the ring are shared from now on */
+  for (int i = 0; i < s->size; i++)
+    if (s->ring[i] && s->ring[i]->ring == s)
+      s->ring[i]->ring = 0;
+  pager_unlock();
+  free(s);
+}
+
+static page_p do_get_page(char const* fname, int blknr, access_strategy_p s) {
+  block_p blk = 0;
+  fhandle_p fh = get_tbl_file(fname);
+  if (!fh) fh = open_tbl_file(fname);
+
+  if (!fh) {
+    put_msg(ERROR, "get_page: NULL fh.\n");
+    return 0;
+  }
+
+  if (blknr == -1)
+    blknr = fh->num_blocks == 0 ? 0 : fh->num_blocks - 1;
+
+  if (blknr < 0 || blknr > fh->num_blocks) {
+    put_msg(ERROR, "get_page: block nr %d out of ragne [0,%d].",
+            blknr, fh->num_blocks);
+    return 0;
+  }
+  if (fh->map && blknr == fh->num_blocks) {
+    put_msg(ERROR, "get_page: %s is read-only.\n", fname);
+    return 0;
+  }
+  if (fh->seg >= 0 && blknr == fh->num_blocks && !ts_grow(fh->seg, blknr + 1)) {
+    put_msg(ERROR, "get_page: cannot grow %s in the tablespace.\n", fname);
+    return 0;
+  }
+  if (blknr == fh->num_blocks)
+    preallocate(fh, blknr + 1);
+
+  /* the blocks of a file smaller than a quarter of the buffer are kept
+     in the whole buffer, e.g. the small tables that scans look up */
+  if (fh->num_blocks <= NUM_PAGES / 4)
+    s = 0;
+
+  int ahead = 0;
+  if (fh->current_block && blknr == fh->current_block->blk_nr)
+    blk = fh->current_block; /* not a new reference for the policy */
+  else {
+    if (blknr < fh->num_blocks)
+      blk = get_buffered_block(fh, blknr);
+    if (blk && blk->page->ring != s) /* referenced by another access */
+      blk->page->ring = 0;
+    ahead = readahead_window(fh, blknr, !blk);
+  }
+
+  inc_num_refs(fh->fid, blk != 0);
+  if (blk)
+    page_hit(blk->page);
+  else {
+    blk = alloc_block(fh, blknr);
+    active_strategy = s;
+    page_p pg = ahead > 0 && blknr < stored_blocks(fh) ?
+      pin_with_readahead(blk, ahead) : pin(blk);
+    active_strategy = 0;
+    if (!pg) {
+      free_block(blk);
+      return 0;
+    }
+    if (blknr == fh->num_blocks)
+      fh->num_blocks++;
+    hash_block(blk);
+    blk->page->current_pos = PAGE_HEADER_SIZE;
+  }
+  /* put_msg (DEBUG, "get_page: blk %d, page %d\n",
+     blk->blk_nr, blk->page->page_nr); */
+  __atomic_store_n(&fh->current_block, blk, __ATOMIC_RELAXED);
+  return blk->page;
+}
+
+page_p get_page(char const* fname, int blknr) {
+  return get_page_with_strategy(fname, blknr, 0);
+}
+
+page_p get_page_with_strategy(char const* fname, int blknr,
+                              access_strategy_p s) {
+  if (pthread_mutex_trylock(&pager_mutex) != 0) {
+    page_p pg = get_pinned_page(fname, blknr);
+    if (pg) {
+      if (trace.fp)
+        trace_page(TRACE_GET, pg);
+      return pg;
+    }
+    pager_lock();
+  }
+  page_p res = do_get_page(fname, blknr, s);
+  pager_unlock();
+  if (trace.fp && res)
+    trace_page(TRACE_GET, res);
+  return res;
+}
+
+page_p get_page_for_append(char const* fname) {
+  page_p pg = get_page(fname, -1);
+  if (!pg) return 0;
+  pg->current_pos = pg->free_pos;
+  return pg;
+}
+
+page_p get_next_page(page_p p) {
+  int blk_nr = is_last_block(p->block) ?
+    p->block->fhandle->num_blocks : p->block->blk_nr + 1;
+  return get_page(p->block->fhandle->fname, blk_nr);
+}
+
+void page_set_pos_begin(page_p p) {
+  if (p)
+    p->current_pos = PAGE_HEADER_SIZE;
+}
+
+/* Pin a page to block b without reading the block.
+   If quiet is non-zero, b is not buffered and no error is reported
+   when all pages are pinned. */
+static page_p attach_block(block_p b, int quiet) {
+  page_p pg = quiet ? available_page(b, 1) : page_for_block(b);
+  if (!pg) return 0;
+
+  b->page = pg;
+  pg->block = b;
+  return do_page_pin(pg);
+}
+
+static page_p do_pin(block_p b) {
+  if (!b) return 0;
+  page_p pg = attach_block(b, 0);
+  if (!pg) return 0;
+
+  if (!read_page(pg)) {
+    put_msg(ERROR, "read_page %d fails\n", pg->page_nr);
+    pg->pin_count = 0;
+    free_page(pg);
+    return 0;
+  }
+  return pg;
+}
+
+page_p pin(block_p b) {
+  pager_lock();
+  page_p res = do_pin(b);
+  pager_unlock();
+  return res;
+}
+
+static page_p do_page_pin(page_p pg) {
+  if (!pg || !pg->block) {
+    put_msg(ERROR, "page_pin: NULL page or block.\n");
+    return 0;
+  }
+  if (pg->pin_count++ == 0 && policy->pinned)
+    policy->pinned(pg);
+  pg->last_ref = ++ref_clock;
+  return pg;
+}
+
+page_p page_pin(page_p pg) {
+  pager_lock();
+  page_p res = do_page_pin(pg);
+  if (trace.fp && res)
+    trace_page(TRACE_GET, res);
+  pager_unlock();
+  return res;
+}
+
+int page_pin_count(page_p pg) {
+  return pg ? pg->pin_count : 0;
+}
+
+void page_latch(page_p pg, int exclusive) {
+  if (!pg) return;
+  if (exclusive)
+    pthread_rwlock_wrlock(&pg->latch);
+  else
+    pthread_rwlock_rdlock(&pg->latch);
+}
+
+void page_unlatch(page_p pg) {
+  if (pg)
+    pthread_rwlock_unlock(&pg->latch);
+}
+
+/* Unpin a page that has other pins, without pager_mutex.
+   Returns 0 if this would be the last pin. */
+static int unpin_shared(page_p pg) {
+  int n = pg->pin_count;
+  while (n > 1)
+    if (atomic_compare_exchange_weak(&pg->pin_count, &n, n - 1))
+      return 1;
+  return 0;
+}
+
+void unpin(page_p pg) {
+  if (trace.fp && pg && pg->block && pg->pin_count > 0)
+    trace_page(TRACE_UNPIN, pg);
+  if (!pg || unpin_shared(pg)) return;
+  pager_lock();
+  if (pg->pin_count <= 0)
+    put_msg(WARN, "unpin: page %d is not pinned.\n", pg->page_nr);
+  else if (--pg->pin_count == 0) {
+    if (pg->touched && atomic_exchange(&pg->touched, 0)) { /* by get_pinned_page() */
+      policy->touched(pg);
+      pg->last_ref = ++ref_clock;
+    }
+    if (policy->unpinned)
+      policy->unpinned(pg);
+    if (pg->cleaned) {
+      page_write_done(pg, pg->cleaned > 0);
+      pg->cleaned = 0;
+    }
+    if (pg->dirty && cleaner_running)
+      pthread_cond_signal(&cleaner_cond); /* the page can be cleaned */
+  }
+  pager_unlock();
+}
+
+int pager_flush(void) {
+  if (!pages) return 1;
+  pager_lock();
+  io_drain();
+  int res = flush_pages(0);
+  pager_unlock();
+  return res;
+}
+
+/* The catalog a checkpoint saves, in a buffer of *len bytes the caller
+   frees, NULL if there is none */
+static char *checkpoint_catalog(long* len) {
+  /* the catalog redone is the current one until it is taken */
+  if (!recovered_catalog)
+    return catalog_source ? catalog_source(len) : 0;
+  char *catalog = malloc(recovered_catalog_len + 1);
+  if (catalog) {
+    memcpy(catalog, recovered_catalog, recovered_catalog_len + 1);
+    *len = recovered_catalog_len;
+  }
+  return catalog;
+}
+
+/* Sync the data files: the pages written back so far are on disk then.
+   Returns 0 upon failure. */
+static int sync_data_files(void) {
+  int res = !ts_active() || ts_sync();
+  /* the files written and closed since the last checkpoint too */
+  if (res && pager_cfg.wal != PAGER_WAL_OFF && syncfs(wal_fd()) == -1) {
+    put_msg(ERROR, "checkpoint: cannot sync the files.\n");
+    res = 0;
+  }
+  return res;
+}
+
+/* A sharp checkpoint: write back all the dirty pages and empty the log,
+   which keeps the catalog if with_catalog is non-zero.
+   Called holding pager_mutex. Returns 0 upon failure. */
+static int do_checkpoint(int with_catalog) {
+  io_drain();
+  int res = flush_pages(0) && sync_data_files();
+  if (res && (res = wal_reset()))
+    for (int i = 0; i < FNAME_BUCKETS; i++)
+      for (fname_entry *e = fname_table[i]; e; e = e->next)
+        e->logged = 0;
+  long len = 0;
+  char *catalog = res && with_catalog ? checkpoint_catalog(&len) : 0;
+  if (catalog)
+    res = wal_checkpoint(wal_end(), 0, 0, catalog, len);
+  free(catalog);
+  last_ckpt_begin = wal_end();
+  return res;
+}
+
+/* A fuzzy checkpoint: the dirty page table, the pages whose logged
+   changes may not be on disk, goes to the log with the catalog.
+   Called holding ckpt_mutex, not pager_mutex. Returns 0 upon failure. */
+static int fuzzy_checkpoint(void) {
+  long catalog_len = 0;
+  char *catalog = checkpoint_catalog(&catalog_len);
+  pager_lock();
+  /* the pages dirty since before the last checkpoint are written back */
+  page_p *pgs = malloc(NUM_PAGES * sizeof (page_p));
+  wal_dirty_page *dpt = malloc(NUM_PAGES * sizeof (wal_dirty_page));
+  if (!pgs || !dpt) {
+    pager_unlock();
+    free(pgs);
+    free(dpt);
+    free(catalog);
+    put_msg(ERROR, "checkpoint: out of memory.\n");
+    return 0;
+  }
+  int n = 0, res = 1;
+  for (size_t i = 0; i < NUM_PAGES; i++) {
+    page_p pg = pages[i];
+    if (pg->block && pg->rec_lsn && pg->rec_lsn < last_ckpt_begin
+        && pg->dirty && pg->pin_count == 0 && !pg->io_pending && !pg->cleaning)
+      pgs[n++] = pg;
+  }
+  if (n > 0)
+    res = do_write_pages(pgs, n);
+  /* the writes handed out are done, to the chunk buffers too */
+  io_drain();
+  pthread_mutex_lock(&clean_io_mutex);
+  pthread_mutex_unlock(&clean_io_mutex);
+  for (size_t i = 0; i < max_file_handles; i++) {
+    fhandle_p f = file_handles[i];
+    if (f && f->cf && !sync_compressed(f))
+      res = 0;
+  }
+  wal_lsn begin = wal_end();
+  n = 0;
+  for (size_t i = 0; res && i < NUM_PAGES; i++) {
+    page_p pg = pages[i];
+    if (pg->block && pg->rec_lsn) {
+      dpt[n].fname = strdup(pg->block->fhandle->fname);
+      dpt[n].blk_nr = pg->block->blk_nr;
+      dpt[n++].rec_lsn = pg->rec_lsn;
+    }
+  }
+  pager_unlock();
+
+  /* the pages written back before the table was taken are on disk */
+  res = res && sync_data_files()
+    && wal_checkpoint(begin, dpt, n, catalog, catalog_len);
+  if (res) {
+    pager_lock();
+    last_ckpt_begin = begin;
+    pager_unlock();
+  }
+  for (int i = 0; i < n; i++)
+    free((char *) dpt[i].fname);
+  free(dpt);
+  free(pgs);
+  free(catalog);
+  return res;
+}
+
+int pager_checkpoint(void) {
+  if (!pages || !wal_active()) return 1;
+  pthread_mutex_lock(&ckpt_mutex);
+  int res = fuzzy_checkpoint();
+  pthread_mutex_unlock(&ckpt_mutex);
+  return res;
+}
+
+int pager_commit(void) {
+  if (!pages || !wal_active()) return 1;
+  pager_lock();
+  /* the pages changed since the last commit, in the order they were
+     changed; a page still pinned may be changing, and stays listed for
+     a commit after it is unpinned, which only a thread holding
+     pager_mutex can undo */
+  pthread_mutex_lock(&log_mutex);
+  int n = 0, num_listed = 0, num = num_log_pages;
+  page_p *pgs = malloc(num * sizeof (page_p));
+  for (int i = 0; pgs && i < num; i++) {
+    page_p pg = log_pages[i];
+    if (pg->pin_count > 0) {
+      log_pages[num_listed++] = pg;
+    } else {
+      pgs[n++] = pg;
+      pg->log_listed = 0;
+    }
+  }
+  if (pgs) num_log_pages = num_listed;
+  pthread_mutex_unlock(&log_mutex);
+  if (!pgs && num > 0) {
+    pager_unlock();
+    put_msg(ERROR, "pager_commit: out of memory.\n");
+    return 0;
+  }
+  for (int i = 0; i < n; i++)
+    log_page(pgs[i]);
+  free(pgs);
+  wal_lsn since = last_ckpt_begin;
+  pager_unlock();
+
+  /* waiting for the sync of the log, which the other commits share */
+  wal_lsn lsn = wal_commit();
+  int res = lsn != 0;
+  if (res && lsn - since > WAL_CHECKPOINT_BYTES
+      && pthread_mutex_trylock(&ckpt_mutex) == 0) {
+    res = fuzzy_checkpoint();
+    pthread_mutex_unlock(&ckpt_mutex);
+  }
+  return res && num_listed > 0 ? -1 : res;
+}
 
-  return 0;
+void pager_set_catalog(char* (*catalog)(long* len)) {
+  pager_lock();
+  catalog_source = catalog;
+  pager_unlock();
 }
 
-static int set_blk_in_fhandle(fhandle_p fh, block_p b) {
-  for (size_t i = 0; i < NUM_PAGES; i++)
-    if (!fh->blocks_in_mem[i]) {
-      fh->blocks_in_mem[i] = b;
-      return i;
-    }
+char* pager_recovered_catalog(long* len) {
+  pager_lock();
+  char *catalog = recovered_catalog;
+  *len = recovered_catalog_len;
+  recovered_catalog = 0;
+  recovered_catalog_len = 0;
+  pager_unlock();
+  return catalog;
+}
 
-  put_msg(ERROR, "set_blk_in_fhandle: fails.\n");
-  return -1;
+/* Count the chunks compressed since cf_bytes() gave raw and saved */
+static void count_compressed(fhandle_p fh, long raw, long saved) {
+  long raw_now, saved_now;
+  cf_bytes(fh->cf, &raw_now, &saved_now);
+  file_counters *f = file_counters_of(fh->fid);
+  counters()->bytes_compressed += raw_now - raw;
+  counters()->bytes_saved += saved_now - saved;
+  f->bytes_compressed += raw_now - raw;
+  f->bytes_saved += saved_now - saved;
 }
 
-static void remove_blk_from_fhandle(block_p b) {
-  for (size_t i = 0; i < NUM_PAGES; i++)
-    if (b->fhandle->blocks_in_mem[i] == b) {
-      b->fhandle->blocks_in_mem[i] = 0;
-      return;
-    }
+/* Read or write the n pages pgs[], holding blocks of the same compressed
+   file, through its chunk buffer.
+   Returns the number of bytes transferred, -1 upon failure. */
+static ssize_t compressed_io(int write, page_p pgs[], int n) {
+  fhandle_p fh = pgs[0]->block->fhandle;
+  int fd = fhandle_fd(fh);
+  if (fd == -1) return -1;
+  long raw, saved;
+  cf_bytes(fh->cf, &raw, &saved);
+  int ok = 1;
+  for (int i = 0; ok && i < n; i++)
+    ok = write ? cf_write(fh->cf, fd, pgs[i]->block->blk_nr, pgs[i]->content)
+      : cf_read(fh->cf, fd, pgs[i]->block->blk_nr, pgs[i]->content);
+  count_compressed(fh, raw, saved);
+  return ok ? (ssize_t) n * BLOCK_SIZE : -1;
 }
 
-static int same_block(block_p b1, block_p b2) {
-  if (!b1 || !b2) return 0;
-  return ((strcmp(b1->fhandle->fname, b2->fhandle->fname) == 0)
-          && (b1->blk_nr == b2->blk_nr));
+/* compressed_io() timed as a read_page or write_page request */
+static ssize_t compressed_run(int write, page_p pgs[], int n) {
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  ssize_t res = compressed_io(write, pgs, n);
+  count_latency(write ? counters()->write_latency : counters()->read_latency,
+                &start);
+  return res;
 }
 
-static int is_last_block(block_p b) {
-  return (b->blk_nr == b->fhandle->num_blocks - 1);
+/* Write the chunk buffer and the block map of a compressed file */
+static int sync_compressed(fhandle_p fh) {
+  int fd = fhandle_fd(fh);
+  if (fd == -1) return 0;
+  long raw, saved;
+  cf_bytes(fh->cf, &raw, &saved);
+  int res = cf_sync(fh->cf, fd);
+  count_compressed(fh, raw, saved);
+  return res;
 }
 
-int peof(page_p p) {
-  return (is_last_block(p->block) && eop(p));
+/* Set up a page after bytes_read bytes of its block have been read */
+static void page_read_done(page_p p, ssize_t bytes_read) {
+  if (bytes_read <= 0)
+    set_page_free_pos(p, PAGE_HEADER_SIZE);
+  else {
+    inc_num_reads(p->block);
+    check_page_header_size(p);
+    set_page_free_pos_from_content(p);
+  }
+  p->valid = 1;
 }
 
-/** Release a block (and unpinn). */
-static void release_block(block_p b) {
-  if (!b) return;
-  if (b->page->pinned)
-    unpin(b->page);
-  remove_blk_from_fhandle(b);
-  if (b->fhandle->current_block == b)
-    b->fhandle->current_block = 0;
-  b->page->block = 0;
-  free(b);
+/* A write of page p begins: a change from now on makes it dirty again.
+   Its recovery LSN stays until the block is on disk. */
+static void page_write_begin(page_p p) {
+  inc_num_writes(p->block);
+  p->dirty = 0;
 }
 
-void pager_terminate(void) {
-  /* put_pqueues_info (DEBUG); */
-  for (size_t i = 0; i < NUM_PAGES; i++) {
-    if (!pages[i]) continue;
-    release_block(pages[i]->block);
-    if (pages[i]) {
-      free(pages[i]->content);
-      free(pages[i]);
+/* The write of page p is done, ok if the whole block was written */
+static void page_write_done(page_p p, int ok) {
+  if (!ok)
+    p->dirty = 1; /* to be written again */
+  else if (!p->dirty)
+    p->rec_lsn = 0;
+}
+
+/* A request with room for n pages, reusing one that is done if possible */
+static io_req *alloc_io_req(int n) {
+  for (io_req **rp = &io_req_pool; *rp; rp = &(*rp)->next)
+    if ((*rp)->cap >= n) {
+      io_req *r = *rp;
+      *rp = r->next;
+      return r;
     }
-    pages[i] = 0;
+  int cap = 4;
+  while (cap < n) cap *= 2;
+  io_req *r = malloc(sizeof (io_req) + cap * (sizeof (page_p) + sizeof (struct iovec)));
+  if (!r) {
+    put_msg(FATAL, "alloc_io_req: out of memory.\n");
+    exit(EXIT_FAILURE);
   }
-  for (size_t i = 0; i < MAX_OPEN_FILES; i++)
-    close_tbl_file(file_handles[i]);
-  q_unpinned = release_pqueue(q_unpinned);
-  q_pinned = release_pqueue(q_pinned);
+  r->cap = cap;
+  r->iov = (struct iovec *) (r + 1);
+  r->pgs = (page_p *) (r->iov + cap);
+  return r;
 }
 
-/* Find an available buffer page, in this order:
-   - unused page,
-   - unpinned page,
-   - unpin a pinned page.
-*/
-static page_p available_page() {
-  /* put_pqueues_info (DEBUG); */
-  page_p pg;
-  size_t i;
-  /* First, get an unused page */
-  if (q_pinned->len + q_unpinned->len < NUM_PAGES) {
-    for (i = 0; pages[i]->block; i++);
-    pg = pages[i];
-  } else {
-    /* put_msg (DEBUG, "available_page: all pages are used.\n"); */
-    pg = pq_dequeue_unpinned(); /* replace an unpinned page */
-    if (!pg)
-      /* put_msg(DEBUG, "available_page: all pages are pinned.\n"); */
-      /* If all pages are pinned, unpin the first page
-         and get that one.
-         This is of course a bad page replacement strategy. */
-      pg = pq_dequeue_pinned();
-
-    release_block(pg->block);
-    init_page(pg);
-  }
-  pq_enqueue(q_unpinned, pg);
-  return pg;
+static void free_io_req(io_req *r) {
+  r->next = io_req_pool;
+  io_req_pool = r;
 }
 
-/* Returns the buffer page (position in pages[]) of the block).
-   If the block does not have a buffer page allocated, allocate one.
-*/
-static page_p page_for_block(block_p b) {
-  if (!b) return 0;
-  for (size_t i = 0; i < NUM_PAGES; i++) {
-    if (pages[i] && same_block(pages[i]->block, b))
-      return pages[i];
+static void release_io_reqs() {
+  while (io_req_pool) {
+    io_req *r = io_req_pool;
+    io_req_pool = r->next;
+    free(r);
   }
-  /* put_msg(WARN, "block %d not in mem yet, allocate an available one.\n", b->blk_nr); */
-  return available_page();
 }
 
-page_p get_page(char const* fname, int blknr) {
-  block_p blk = 0;
-  fhandle_p fh = get_tbl_file(fname);
-  if (!fh) fh = open_tbl_file(fname);
-
-  if (!fh) {
-    put_msg(ERROR, "get_page: NULL fh.\n");
-    return 0;
+/* Collect the result res (number of bytes or -errno) of request r */
+static void io_done(io_req *r, int res) {
+  r->done = 1;
+  count_latency(r->write ? counters()->write_latency : counters()->read_latency,
+                &r->start);
+  r->ok = r->write ? res == r->n * BLOCK_SIZE : res >= 0;
+  if (!r->ok)
+    put_msg(ERROR, "io_uring %s of fd %d block %d (%d blocks) fails: %d.\n",
+            r->write ? "write" : "read", r->pgs[0]->block->fhandle->fd,
+            r->pgs[0]->block->blk_nr, r->n, res);
+  for (int i = 0; i < r->n; i++) {
+    page_p pg = r->pgs[i];
+    if (!r->write)
+      page_read_done(pg, r->ok ? res - (ssize_t) i * BLOCK_SIZE : 0);
+    else
+      page_write_done(pg, r->ok);
+    pg->io_pending = 0;
   }
+  if (r->waited) return;
 
-  if (blknr == -1)
-    blknr = fh->num_blocks == 0 ? 0 : fh->num_blocks - 1;
-
-  if (blknr < 0 || blknr > fh->num_blocks) {
-    put_msg(ERROR, "get_page: block nr %d out of ragne [0,%d].",
-            blknr, fh->num_blocks);
-    return 0;
+  for (int i = 0; i < r->n; i++) {
+    page_p pg = r->pgs[i];
+    unpin(pg);
+    if (!r->ok && !r->write && pg->pin_count == 0)
+      release_block(pg->block); /* failed read-ahead */
   }
+  free_io_req(r);
+}
 
-  if (fh->current_block && blknr == fh->current_block->blk_nr)
-    blk = fh->current_block;
-  else if (blknr == fh->num_blocks)
-    fh->num_blocks++;
-  else
-    blk = get_buffered_blk_in_fhandle(fh, blknr);
-
-  if (!blk) {
-    blk = malloc(sizeof (block_struct));
-    blk->fhandle = fh;
-    blk->blk_nr = blknr;
-    if (pin(blk) == NULL) {
-      remove_blk_from_fhandle(blk);
-      free(blk);
-      return 0;
-    }
-    set_blk_in_fhandle(fh, blk);
-    blk->page->current_pos = PAGE_HEADER_SIZE;
+/* Submit the queued requests, wait for at least wait_nr results,
+   and collect all available results */
+static void io_reap(unsigned wait_nr) {
+  if (io_ring_submit(wait_nr) < 0) {
+    put_msg(FATAL, "io_reap: io_uring fails.\n");
+    exit(EXIT_FAILURE);
   }
-  /* put_msg (DEBUG, "get_page: blk %d, page %d\n",
-     blk->blk_nr, blk->page->page_nr); */
-  fh->current_block = blk;
-  return blk->page;
+  pager_counters *c = counters();
+  if (io_ring_inflight() > c->max_io_inflight)
+    c->max_io_inflight = io_ring_inflight();
+  void *data;
+  int res;
+  while (io_ring_peek(&data, &res))
+    io_done(data, res);
 }
 
-page_p get_page_for_append(char const* fname) {
-  page_p pg = get_page(fname, -1);
-  if (!pg) return 0;
-  pg->current_pos = pg->free_pos;
-  return pg;
+/* Submit an io_uring request on the n pages pgs[], holding adjacent
+   blocks of the same file starting at pgs[0].
+   If waited is zero, the request pins the pages until it is done and
+   frees itself; otherwise the submitter waits and frees it
+   with free_io_req().
+   The request is queued, and handed to the kernel by the next io_reap(). */
+static io_req *io_submit_run(int write, page_p pgs[], int n, int waited) {
+  int fd = fhandle_fd(pgs[0]->block->fhandle); /* may wait for requests */
+  if (write && !log_before_write(pgs, n))
+    fd = -1; /* fails like a write */
+  io_req *r = alloc_io_req(n);
+  r->write = write;
+  r->n = n;
+  r->waited = waited;
+  r->done = 0;
+  r->ok = 0;
+  clock_gettime(CLOCK_MONOTONIC, &r->start);
+  for (int i = 0; i < n; i++) {
+    page_p pg = pgs[i];
+    r->pgs[i] = pg;
+    r->iov[i].iov_base = pg->content;
+    r->iov[i].iov_len = BLOCK_SIZE;
+    if (!waited) do_page_pin(pg);
+    pg->io_pending = 1;
+    if (write)
+      page_write_begin(pg);
+  }
+  if (fd == -1) {
+    io_done(r, -EBADF);
+    return r;
+  }
+  if (pgs[0]->block->fhandle->cf) { /* no I/O to hand to the kernel */
+    io_done(r, compressed_io(write, pgs, n));
+    return r;
+  }
+  while (!io_ring_prep_rw(write, fd, r->iov, n, block_offset(pgs[0]->block), r))
+    io_reap(1); /* the ring is full */
+  counters()->num_io_submits++;
+  return r;
 }
 
-page_p get_next_page(page_p p) {
-  int blk_nr = is_last_block(p->block) ?
-    p->block->fhandle->num_blocks : p->block->blk_nr + 1;
-  return get_page(p->block->fhandle->fname, blk_nr);
+/* Read or write a run of pages through io_uring and wait for it */
+static int io_run(int write, page_p pgs[], int n) {
+  io_req *r = io_submit_run(write, pgs, n, 1);
+  while (!r->done)
+    io_reap(1);
+  int ok = r->ok;
+  free_io_req(r);
+  return ok;
 }
 
-void page_set_pos_begin(page_p p) {
-  if (p)
-    p->current_pos = PAGE_HEADER_SIZE;
+/* Wait for the request in flight on pg */
+static void io_wait_page(page_p pg) {
+  while (pg->io_pending)
+    io_reap(1);
 }
 
-page_p pin(block_p b) {
-  if (!b) return 0;
-  page_p pg = page_for_block(b);
+/* Wait for all requests in flight */
+static void io_drain(void) {
+  while (io_ring_active() && io_ring_inflight() > 0)
+    io_reap(1);
+}
 
-  b->page = pg;
-  pq_turn_pinned(pg);
-  pg->block = b;
-  pg->pinned = 1;
-  if (!read_page(pg)) {
-    put_msg(ERROR, "read_page %d fails\n", pg->page_nr);
+/* Point the page to its block in the mapping of the file */
+static int map_page(page_p p) {
+  fhandle_p fh = p->block->fhandle;
+  if (p->block->blk_nr >= fh->num_blocks) {
+    put_msg(ERROR, "map_page: block %d beyond the mapping of %s.\n",
+            p->block->blk_nr, fh->fname);
     return 0;
   }
-  return pg;
-}
-
-void unpin(page_p pg) {
-  pq_turn_unpinned(pg);
-  pg->pinned = 0;
-  if (pg->dirty != 0)
-    write_page(pg);
+  p->content = fh->map + (size_t) BLOCK_SIZE * p->block->blk_nr;
+  check_page_header_size(p);
+  set_page_free_pos_from_content(p);
+  p->valid = 1;
+  counters()->num_mapped++;
+  return 1;
 }
 
-int read_page(page_p p) {
+static int do_read_page(page_p p) {
   if (!p) {
     put_msg(ERROR, "read_page: NULL page.\n");
     return 0;
@@ -835,43 +3857,491 @@ int read_page(page_p p) {
     put_msg(ERROR, "read_page: NULL fhandle.\n");
     return 0;
   }
-  int fd = p->block->fhandle->fd;
-  if (lseek(fd, (off_t) BLOCK_SIZE * p->block->blk_nr, SEEK_SET) < 0) {
-    put_msg(ERROR, "read_page: lseek to fd %d offset %ld fails.\n",
-            fd, BLOCK_SIZE * p->block->blk_nr);
-    return 0;
+  if (p->block->fhandle->map)
+    return map_page(p);
+  if (p->block->blk_nr >= stored_blocks(p->block->fhandle)) {
+    page_read_done(p, 0); /* a new block */
+    return 1;
   }
-  int bytes_read = read(fd, p->content, BLOCK_SIZE);
-  if (bytes_read == -1) return 0;
-  if (bytes_read == 0)
-    set_page_free_pos(p, PAGE_HEADER_SIZE);
-  else {
-    inc_num_reads(fd, p->block->blk_nr);
-    check_page_header_size(p);
-    set_page_free_pos_from_content(p);
+  if (p->block->fhandle->cf) {
+    ssize_t res = compressed_run(0, &p, 1);
+    if (res < 0) return 0;
+    page_read_done(p, res);
+    return 1;
+  }
+  if (io_ring_active())
+    return io_run(0, &p, 1);
+  int fd = fhandle_fd(p->block->fhandle);
+  if (fd == -1) return 0;
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  ssize_t bytes_read = pread(fd, p->content, BLOCK_SIZE, block_offset(p->block));
+  count_latency(counters()->read_latency, &start);
+  if (bytes_read == -1) {
+    put_msg(ERROR, "read_page: pread fd %d offset %ld fails.\n",
+            fd, (long) block_offset(p->block));
+    return 0;
   }
+  page_read_done(p, bytes_read);
   return 1;
 }
 
-int write_page(page_p p) {
+int read_page(page_p p) {
+  pager_lock();
+  int res = do_read_page(p);
+  pager_unlock();
+  return res;
+}
+
+static int do_write_page(page_p p) {
   if (!p) {
     put_msg(ERROR, "write_page: NULL page.\n");
     return 0;
   }
+  wait_cleaned(p);
   if (!p->dirty) return 1;
   if (!p->block) return 0;
   if (!p->block->fhandle) return 0;
+  if (!log_before_write(&p, 1)) return 0;
+  if (p->block->fhandle->cf) {
+    page_write_begin(p);
+    int ok = compressed_run(1, &p, 1) == BLOCK_SIZE;
+    page_write_done(p, ok);
+    return ok;
+  }
+  if (io_ring_active())
+    return io_run(1, &p, 1);
+
+  int fd = fhandle_fd(p->block->fhandle);
+  if (fd == -1) return 0;
+
+  page_write_begin(p);
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  ssize_t res = pwrite(fd, p->content, BLOCK_SIZE, block_offset(p->block));
+  count_latency(counters()->write_latency, &start);
+  page_write_done(p, res == BLOCK_SIZE);
+  if (res != BLOCK_SIZE) {
+    put_msg(ERROR, "write_page: pwrite fd %d block %d fails.\n",
+            fd, p->block->blk_nr);
+    return 0;
+  }
+  return 1;
+}
+
+int write_page(page_p p) {
+  pager_lock();
+  int res = do_write_page(p);
+  pager_unlock();
+  return res;
+}
+
+/* Longest run of blocks transferred with one preadv()/pwritev() */
+static int max_io_run() {
+  long iov_max = sysconf(_SC_IOV_MAX);
+  return iov_max > 0 && iov_max < NUM_PAGES ? iov_max : NUM_PAGES;
+}
 
-  int fd = p->block->fhandle->fd;
+/* Read the n pages pgs[], holding adjacent blocks of the same file
+   starting at pgs[0], with one preadv() */
+static int read_run(page_p pgs[], int n) {
+  if (pgs[0]->block->fhandle->map) {
+    for (int i = 0; i < n; i++)
+      if (!map_page(pgs[i])) return 0;
+    return 1;
+  }
+  /* the blocks that are not on disk yet are new */
+  while (n > 0 && pgs[n - 1]->block->blk_nr >= stored_blocks(pgs[0]->block->fhandle))
+    page_read_done(pgs[--n], 0);
+  if (n == 0) return 1;
+  if (pgs[0]->block->fhandle->cf) {
+    ssize_t res = compressed_run(0, pgs, n);
+    if (res < 0) return 0;
+    for (int i = 0; i < n; i++, res -= BLOCK_SIZE)
+      page_read_done(pgs[i], res);
+    return 1;
+  }
+  if (io_ring_active())
+    return io_run(0, pgs, n);
+  struct iovec iov[n];
+  for (int i = 0; i < n; i++) {
+    iov[i].iov_base = pgs[i]->content;
+    iov[i].iov_len = BLOCK_SIZE;
+  }
+  int fd = fhandle_fd(pgs[0]->block->fhandle);
+  if (fd == -1) return 0;
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  ssize_t bytes_read = preadv(fd, iov, n, block_offset(pgs[0]->block));
+  count_latency(counters()->read_latency, &start);
+  if (bytes_read == -1) {
+    put_msg(ERROR, "read_run: preadv fd %d block %d (%d blocks) fails.\n",
+            fd, pgs[0]->block->blk_nr, n);
+    return 0;
+  }
+  for (int i = 0; i < n; i++, bytes_read -= BLOCK_SIZE)
+    page_read_done(pgs[i], bytes_read);
+  return 1;
+}
 
-  if (lseek(fd, (off_t) BLOCK_SIZE * p->block->blk_nr, SEEK_SET) < 0)
+/* Write the n dirty pages pgs[], holding adjacent blocks of the same file
+   starting at pgs[0], with one pwritev() */
+static int write_run(page_p pgs[], int n) {
+  if (!log_before_write(pgs, n)) return 0;
+  if (pgs[0]->block->fhandle->cf) {
+    for (int i = 0; i < n; i++)
+      page_write_begin(pgs[i]);
+    int ok = compressed_run(1, pgs, n) == (ssize_t) n * BLOCK_SIZE;
+    for (int i = 0; i < n; i++)
+      page_write_done(pgs[i], ok);
+    return ok;
+  }
+  int fd = fhandle_fd(pgs[0]->block->fhandle);
+  if (fd == -1) return 0;
+  struct iovec iov[n];
+  for (int i = 0; i < n; i++) {
+    iov[i].iov_base = pgs[i]->content;
+    iov[i].iov_len = BLOCK_SIZE;
+    page_write_begin(pgs[i]);
+  }
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  ssize_t res = pwritev(fd, iov, n, block_offset(pgs[0]->block));
+  count_latency(counters()->write_latency, &start);
+  for (int i = 0; i < n; i++)
+    page_write_done(pgs[i], res == (ssize_t) n * BLOCK_SIZE);
+  if (res != (ssize_t) n * BLOCK_SIZE) {
+    put_msg(ERROR, "write_run: pwritev fd %d block %d (%d blocks) fails.\n",
+            fd, pgs[0]->block->blk_nr, n);
     return 0;
-  inc_num_writes(fd, p->block->blk_nr);
-  p->dirty = 0;
-  if (write(fd, p->content, BLOCK_SIZE) == -1) return 0;
+  }
   return 1;
 }
 
+/* Whether the block of q directly follows the block of p in the same file,
+   and on disk */
+static int adjacent_pages(page_p p, page_p q) {
+  return p->block->fhandle == q->block->fhandle
+    && p->block->blk_nr + 1 == q->block->blk_nr
+    && blocks_contiguous(p->block->fhandle, p->block->blk_nr);
+}
+
+/* order of pages by (file id, block nr) */
+static int cmp_page_blocks(void const* a, void const* b) {
+  block_p x = (*(page_p const*) a)->block, y = (*(page_p const*) b)->block;
+  if (x->fhandle->fid != y->fhandle->fid)
+    return x->fhandle->fid < y->fhandle->fid ? -1 : 1;
+  return x->blk_nr < y->blk_nr ? -1 : (x->blk_nr > y->blk_nr);
+}
+
+static int do_write_pages(page_p pgs[], int n) {
+  page_p *dirty = malloc(n * sizeof (page_p));
+  int num_dirty = 0, res = 1;
+  for (int i = 0; i < n; i++)
+    if (pgs[i] && pgs[i]->dirty && pgs[i]->block && pgs[i]->block->fhandle) {
+      wait_cleaned(pgs[i]);
+      dirty[num_dirty++] = pgs[i];
+    }
+  qsort(dirty, num_dirty, sizeof (page_p), cmp_page_blocks);
+
+  /* with io_uring, all runs are in flight before waiting for any */
+  io_req **reqs = malloc(num_dirty * sizeof (io_req *));
+  int num_reqs = 0;
+  for (int i = 0, len; i < num_dirty; i += len) {
+    for (len = 1; i + len < num_dirty && len < max_io_run()
+           && adjacent_pages(dirty[i + len - 1], dirty[i + len]); len++);
+    if (io_ring_active())
+      reqs[num_reqs++] = io_submit_run(1, dirty + i, len, 1);
+    else if (!write_run(dirty + i, len))
+      res = 0;
+  }
+  for (int i = 0; i < num_reqs; i++) {
+    while (!reqs[i]->done)
+      io_reap(1);
+    if (!reqs[i]->ok) res = 0;
+    free_io_req(reqs[i]);
+  }
+  free(reqs);
+  free(dirty);
+  return res;
+}
+
+int write_pages(page_p pgs[], int n) {
+  pager_lock();
+  int res = do_write_pages(pgs, n);
+  pager_unlock();
+  return res;
+}
+
+/* Write back the dirty pages of a file (all files if fh is NULL) */
+static int flush_pages(fhandle_p fh) {
+  page_p *pgs = malloc(NUM_PAGES * sizeof (page_p));
+  int n = 0;
+  for (size_t i = 0; i < NUM_PAGES; i++)
+    if (pages[i] && pages[i]->block
+        && (!fh || pages[i]->block->fhandle == fh))
+      pgs[n++] = pages[i];
+  int res = write_pages(pgs, n);
+  free(pgs);
+  /* the chunk buffers of compressed files */
+  for (size_t i = 0; i < max_file_handles; i++) {
+    fhandle_p f = file_handles[i];
+    if (f && f->cf && (!fh || f == fh) && !sync_compressed(f))
+      res = 0;
+  }
+  return res;
+}
+
+/* The cleaner has written the copy of pg, ok if all of it.
+   A page pinned again may be changing without pager_mutex, so its flags
+   are left to the last unpin. */
+static void page_cleaned(page_p pg, int ok) {
+  pg->cleaning = 0;
+  if (pg->pin_count == 0)
+    page_write_done(pg, ok);
+  else
+    pg->cleaned = ok ? 1 : -1;
+}
+
+/* Wait until the cleaner has written the copy of pg, if it is doing so */
+static void wait_cleaned(page_p pg) {
+  if (!pg->cleaning) return;
+  pthread_mutex_lock(&clean_io_mutex);
+  int ok = clean_io_ok;
+  pthread_mutex_unlock(&clean_io_mutex);
+  page_cleaned(pg, ok);
+}
+
+/* order of pages by age, the least recently pinned first */
+static int cmp_page_refs(void const* a, void const* b) {
+  long x = (*(page_p const*) a)->last_ref, y = (*(page_p const*) b)->last_ref;
+  return x < y ? -1 : (x > y);
+}
+
+/* Choose the cold dirty pages to clean, up to max_io_run() pages,
+   so that clean_target percent of the pages can be replaced without
+   writing them afterwards.
+   Pinned pages may be changed by the foreground and are not looked at.
+   Returns the number of pages in pgs[], sorted by (file, block). */
+static int cleaner_pick(page_p pgs[]) {
+  int num_clean = 0, n = 0;
+  for (size_t i = 0; i < NUM_PAGES; i++) {
+    page_p pg = pages[i];
+    if (pg->pin_count > 0) continue;
+    if (pg->dirty && pg->block->fhandle->fd < 0)
+      continue; /* not to open descriptors from this thread */
+    if (pg->dirty && pg->block->fhandle->cf)
+      continue; /* written through the chunk buffer of the foreground */
+    if (!pg->dirty)
+      num_clean++;
+    else if (!pg->cleaning && !pg->io_pending)
+      pgs[n++] = pg;
+  }
+  int excess = NUM_PAGES * pager_cfg.clean_target / 100 - num_clean;
+  if (excess <= 0) return 0;
+  if (excess > max_io_run()) excess = max_io_run();
+  qsort(pgs, n, sizeof (page_p), cmp_page_refs);
+  if (n > excess) n = excess;
+  for (int i = 0; i < n; i++)
+    pgs[i]->cleaning = 1;
+
+  /* with their dirty neighbours, the pages are written in longer runs */
+  for (int i = 0, m = n; i < m; i++)
+    for (int d = -1; d <= 1; d += 2) {
+      fhandle_p fh = pgs[i]->block->fhandle;
+      page_p nb;
+      for (int bnr = pgs[i]->block->blk_nr + d;
+           n < max_io_run() && (nb = write_behind_page(fh, bnr)); bnr += d) {
+        nb->cleaning = 1;
+        pgs[n++] = nb;
+      }
+    }
+  qsort(pgs, n, sizeof (page_p), cmp_page_blocks);
+  return n;
+}
+
+/* Write the copies of the n pages pgs[], sorted by (file, block),
+   to the file offsets offsets[] with one pwritev() per run of adjacent
+   blocks */
+static int cleaner_write(page_p pgs[], char* copies, off_t const offsets[],
+                         int n) {
+  struct iovec iov[n];
+  int res = 1;
+  for (int i = 0, len; i < n; i += len) {
+    for (len = 1; i + len < n
+           && pgs[i + len - 1]->block->fhandle == pgs[i + len]->block->fhandle
+           && offsets[i + len - 1] + BLOCK_SIZE == offsets[i + len]; len++);
+    for (int k = 0; k < len; k++) {
+      iov[k].iov_base = copies + (size_t) (i + k) * BLOCK_SIZE;
+      iov[k].iov_len = BLOCK_SIZE;
+    }
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (pwritev(pgs[i]->block->fhandle->fd, iov, len, offsets[i])
+        != (ssize_t) len * BLOCK_SIZE)
+      res = 0;
+    count_latency(counters()->write_latency, &start);
+  }
+  return res;
+}
+
+/* The cleaner thread: keep clean_target percent of the pages clean by
+   writing back the cold dirty pages in block order */
+static void *cleaner_main(void* arg) {
+  page_p *pgs = malloc(NUM_PAGES * sizeof (page_p));
+  char *copies = malloc((size_t) max_io_run() * BLOCK_SIZE);
+  struct { int fid, blk_nr; } *ids = malloc(max_io_run() * sizeof *ids);
+  /* the block map of a tablespace changes while writing */
+  off_t *offsets = malloc(max_io_run() * sizeof *offsets);
+
+  pthread_mutex_lock(&pager_mutex);
+  while (!cleaner.stop) {
+    int n = cleaner_pick(pgs);
+    if (n == 0) {
+      struct timespec ts;
+      clock_gettime(CLOCK_REALTIME, &ts);
+      ts.tv_nsec += 20 * 1000 * 1000; /* look again after 20ms at the latest */
+      if (ts.tv_nsec >= 1000000000) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000;
+      }
+      pthread_cond_timedwait(&cleaner_cond, &pager_mutex, &ts);
+      continue;
+    }
+
+    /* the log goes first, with the LSNs in the copies */
+    wal_lsn lsn = 0;
+    for (int i = 0; i < n; i++) {
+      wal_lsn l = log_page(pgs[i]);
+      if (l > lsn) lsn = l;
+    }
+    /* the pages are unpinned, so nobody changes them while copying */
+    for (int i = 0; i < n; i++) {
+      page_p pg = pgs[i];
+      memcpy(copies + (size_t) i * BLOCK_SIZE, pg->content, BLOCK_SIZE);
+      ids[i].fid = pg->block->fhandle->fid;
+      ids[i].blk_nr = pg->block->blk_nr;
+      offsets[i] = block_offset(pg->block);
+      page_write_begin(pg);
+      pg->cleaning = 1;
+    }
+    counters()->num_cleaned += n;
+    pthread_mutex_lock(&clean_io_mutex);
+    pthread_mutex_unlock(&pager_mutex);
+    int ok = wal_flush(lsn) && cleaner_write(pgs, copies, offsets, n);
+    clean_io_ok = ok;
+    pthread_mutex_unlock(&clean_io_mutex);
+    pthread_mutex_lock(&pager_mutex);
+
+    for (int i = 0; i < n; i++) {
+      page_p pg = pgs[i];
+      if (!pg->cleaning) continue; /* waited for and maybe replaced */
+      if (pg->block && pg->block->fhandle->fid == ids[i].fid
+          && pg->block->blk_nr == ids[i].blk_nr)
+        page_cleaned(pg, ok);
+      else
+        pg->cleaning = 0;
+    }
+    if (!ok)
+      put_msg(ERROR, "cleaner: cannot write the pages.\n");
+  }
+  pthread_mutex_unlock(&pager_mutex);
+
+  free(pgs);
+  free(copies);
+  free(ids);
+  free(offsets);
+  return arg;
+}
+
+/* Start the cleaner thread */
+static void cleaner_start() {
+  cleaner.stop = 0;
+  cleaner_running = 1;
+  if (pthread_create(&cleaner.thread, 0, cleaner_main, 0) != 0) {
+    cleaner_running = 0;
+    put_msg(WARN, "cannot start the cleaner thread.\n");
+  }
+}
+
+/* Stop the cleaner thread, the pages being cleaned are written */
+static void cleaner_stop() {
+  if (!cleaner_running) return;
+  pthread_mutex_lock(&pager_mutex);
+  cleaner.stop = 1;
+  pthread_cond_signal(&cleaner_cond);
+  pthread_mutex_unlock(&pager_mutex);
+  pthread_join(cleaner.thread, 0);
+  cleaner_running = 0;
+  for (size_t i = 0; i < NUM_PAGES; i++)
+    pages[i]->cleaning = 0;
+}
+
+static int do_get_pages(char const* fname, int blknr, int n, page_p pgs[]) {
+  fhandle_p fh = get_tbl_file(fname);
+  if (!fh) fh = open_tbl_file(fname);
+
+  if (!fh) {
+    put_msg(ERROR, "get_pages: NULL fh.\n");
+    return 0;
+  }
+  if (n < 1 || blknr < 0 || blknr + n > fh->num_blocks) {
+    put_msg(ERROR, "get_pages: blocks [%d,%d) out of range [0,%d).\n",
+            blknr, blknr + n, fh->num_blocks);
+    return 0;
+  }
+
+  /* pin the buffered blocks, and give the others a page to read into */
+  int i, res = 1;
+  for (i = 0; i < n; i++) {
+    block_p blk = get_buffered_block(fh, blknr + i);
+    if (blk) {
+      counters()->num_hits++;
+      pgs[i] = page_hit(blk->page);
+      continue;
+    }
+    counters()->num_misses++;
+    blk = alloc_block(fh, blknr + i);
+    pgs[i] = attach_block(blk, 0);
+    if (!pgs[i]) {
+      free_block(blk);
+      res = 0;
+      break;
+    }
+    hash_block(blk);
+    pgs[i]->current_pos = PAGE_HEADER_SIZE;
+  }
+  n = i;
+
+  /* read the runs of adjacent blocks that are not buffered */
+  for (i = 0; i < n; i++) {
+    if (pgs[i]->valid) continue;
+    int len = 1;
+    while (i + len < n && len < max_io_run() && !pgs[i + len]->valid
+           && adjacent_pages(pgs[i + len - 1], pgs[i + len]))
+      len++;
+    if (!read_run(pgs + i, len)) res = 0;
+    i += len - 1;
+  }
+
+  if (!res) {
+    for (i = 0; i < n; i++)
+      unpin(pgs[i]);
+    return 0;
+  }
+  __atomic_store_n(&fh->current_block, pgs[n - 1]->block, __ATOMIC_RELAXED);
+  return n;
+}
+
+int get_pages(char const* fname, int blknr, int n, page_p pgs[]) {
+  pager_lock();
+  int res = do_get_pages(fname, blknr, n, pgs);
+  for (int i = 0; trace.fp && i < res; i++)
+    trace_page(TRACE_GET, pgs[i]);
+  pager_unlock();
+  return res;
+}
+
 int page_block_nr(page_p p) {
   if (!p) {
     put_msg(ERROR, "page_block_nr: NULL page.\n");
@@ -907,6 +4377,11 @@ int page_valid_pos_for_get(page_p p, int offset) {
 }
 
 int page_valid_pos_for_put(page_p p, int offset, int len) {
+  if (p->block && p->block->fhandle->map) {
+    put_msg(ERROR, "page_valid_pos_for_put: block %d of %s is read-only.\n",
+            p->block->blk_nr, p->block->fhandle->fname);
+    return 0;
+  }
   if (offset >= PAGE_HEADER_SIZE && offset <= p->free_pos
       && offset <= BLOCK_SIZE - len)
     return 1;
@@ -942,17 +4417,27 @@ int page_put_int(page_p p, int val) {
   }
   memcpy(p->content + p->current_pos, (char *) &val, INT_SIZE);
   p->dirty = 1;
+  page_changed(p, p->current_pos, INT_SIZE);
   set_pos_after_put(p, p->current_pos + INT_SIZE);
   return 1;
 }
 
+/* Move the current position by len bytes for page_get_x_at(), which
+   threads sharing the page may call at the same time (the position is
+   meaningless for them then) */
+static void move_pos_shared(page_p p, int len) {
+  __atomic_store_n(&p->current_pos,
+                   __atomic_load_n(&p->current_pos, __ATOMIC_RELAXED) + len,
+                   __ATOMIC_RELAXED);
+}
+
 int page_get_int_at(page_p p, int offset) {
   if (!page_valid_pos_for_get(p, offset)) {
     put_msg(FATAL, "page_get_int_at\n");
     exit(EXIT_FAILURE);
   }
   int res = (int) *((int *)((p->content) + offset));
-  p->current_pos += INT_SIZE;
+  move_pos_shared(p, INT_SIZE);
   return res;
 }
 
@@ -962,6 +4447,7 @@ int page_put_int_at(page_p p, int offset, int val) {
   }
   memcpy(p->content + offset, (char *) &val, INT_SIZE);
   p->dirty = 1;
+  page_changed(p, offset, INT_SIZE);
   set_pos_after_put(p, offset + INT_SIZE);
   return 1;
 }
@@ -982,6 +4468,7 @@ int page_put_str(page_p p, char const* str, int len) {
   }
   strncpy(p->content + p->current_pos, str, len);
   p->dirty = 1;
+  page_changed(p, p->current_pos, len);
   set_pos_after_put(p, p->current_pos + len);
   return 1;
 }
@@ -992,7 +4479,7 @@ int page_get_str_at(page_p p, int offset, char* str, int len) {
     exit(EXIT_FAILURE);
   }
   strncpy(str, p->content + offset, len);
-  p->current_pos += len;
+  move_pos_shared(p, len);
   return 0;
 }
 
@@ -1002,6 +4489,113 @@ int page_put_str_at(page_p p, int offset, char const* str, int len) {
   }
   strncpy(p->content + offset, str, len);
   p->dirty = 1;
+  page_changed(p, offset, len);
   set_pos_after_put(p, offset + len);
   return 1;
 }
+
+/** Position in the header of the beginning of the records of a slotted
+    page, 0 until the first record */
+#define RECORDS_POS 20
+
+static int page_records_pos(page_p p) {
+  int pos = get_header_int_at(p, RECORDS_POS);
+  return pos ? pos : BLOCK_SIZE;
+}
+
+int page_put_slot(page_p p, void const* rec, int len) {
+  int rec_pos = page_records_pos(p) - len;
+  if (p->current_pos != p->free_pos
+      || !page_valid_pos_for_put(p, p->current_pos, SLOT_SIZE)
+      || len < 0 || rec_pos < p->free_pos + SLOT_SIZE)
+    return 0;
+  unsigned short slot[2] = {rec_pos, len};
+  memcpy(p->content + rec_pos, rec, len);
+  memcpy(p->content + p->current_pos, slot, SLOT_SIZE);
+  p->dirty = 1;
+  page_changed(p, rec_pos, len);
+  page_changed(p, p->current_pos, SLOT_SIZE);
+  put_header_int_at(p, RECORDS_POS, rec_pos);
+  set_pos_after_put(p, p->current_pos + SLOT_SIZE);
+  return 1;
+}
+
+/* The record of the slot at offset of p, of *len bytes */
+static char const* slot_record(page_p p, int offset, int* len) {
+  unsigned short slot[2];
+  memcpy(slot, p->content + offset, SLOT_SIZE);
+  if (slot[0] < p->free_pos || slot[0] + slot[1] > BLOCK_SIZE) {
+    put_msg(FATAL, "slot at %d of page %d is out of range.\n",
+            offset, p->page_nr);
+    exit(EXIT_FAILURE);
+  }
+  *len = slot[1];
+  return p->content + slot[0];
+}
+
+char const* page_get_slot(page_p p, int* len) {
+  if (!page_valid_pos_for_get(p, p->current_pos)) {
+    put_msg(FATAL, "page_get_slot\n");
+    exit(EXIT_FAILURE);
+  }
+  char const* rec = slot_record(p, p->current_pos, len);
+  p->current_pos += SLOT_SIZE;
+  return rec;
+}
+
+char const* page_get_slot_at(page_p p, int offset, int* len) {
+  if (!page_valid_pos_for_get(p, offset)) {
+    put_msg(FATAL, "page_get_slot_at\n");
+    exit(EXIT_FAILURE);
+  }
+  char const* rec = slot_record(p, offset, len);
+  move_pos_shared(p, SLOT_SIZE);
+  return rec;
+}
+
+/* Offset in a PAX page of the minipage of the values at offset of
+   records of rec_len bytes: the page has room for as many records as
+   a row page */
+static int minipage_pos(int rec_len, int offset) {
+  return PAGE_HEADER_SIZE + (BLOCK_SIZE - PAGE_HEADER_SIZE) / rec_len * offset;
+}
+
+int page_put_pax(page_p p, void const* rec, int num_fields,
+                 int const lens[]) {
+  int rec_len = 0;
+  for (int j = 0; j < num_fields; j++)
+    rec_len += lens[j];
+  if (!page_valid_pos_for_put(p, p->current_pos, rec_len))
+    return 0;
+  int i = (p->current_pos - PAGE_HEADER_SIZE) / rec_len;
+  for (int j = 0, offset = 0; j < num_fields; offset += lens[j++]) {
+    int pos = minipage_pos(rec_len, offset) + i * lens[j];
+    memcpy(p->content + pos, (char const*) rec + offset, lens[j]);
+    page_changed(p, pos, lens[j]);
+  }
+  p->dirty = 1;
+  set_pos_after_put(p, p->current_pos + rec_len);
+  return 1;
+}
+
+int page_get_pax(page_p p, void* rec, int num_fields, int const lens[]) {
+  if (!page_valid_pos_for_get(p, p->current_pos)) {
+    put_msg(FATAL, "page_get_pax\n");
+    exit(EXIT_FAILURE);
+  }
+  int rec_len = 0;
+  for (int j = 0; j < num_fields; j++)
+    rec_len += lens[j];
+  int i = (p->current_pos - PAGE_HEADER_SIZE) / rec_len;
+  for (int j = 0, offset = 0; j < num_fields; offset += lens[j++])
+    memcpy((char *) rec + offset,
+           p->content + minipage_pos(rec_len, offset) + i * lens[j], lens[j]);
+  p->current_pos += rec_len;
+  return 1;
+}
+
+char const* page_get_minipage(page_p p, int rec_len, int offset,
+                              int* num_recs) {
+  *num_recs = (p->free_pos - PAGE_HEADER_SIZE) / rec_len;
+  return p->content + minipage_pos(rec_len, offset);
+}
@@ -6,6 +6,10 @@
  *
  * Start a pager with @ref pager_init "pager_init()"
  * and terminate it with @ref pager_terminate "pager_terminate()".
+ * The size of the buffer pool, the block size and the number of open files
+ * are given by a @ref pager_config "pager configuration".
+ * The block size is fixed when a database is created and is kept in the
+ * superblock file @ref superblock_file "db.pager" of the database.
  *
  * To process data stored in a table file, first use @ref get_page "get_page()"
  * to get the page of a given block.
@@ -22,11 +26,37 @@
  * to read the content of a block into the page,
  * or @ref write_page "write_page()"
  * to write the content of a page into the block.
+ * Dirty pages are otherwise written back lazily: a page replaced by
+ * another block is written together with the dirty pages of the
+ * adjacent blocks, and @ref pager_flush "pager_flush()" writes all
+ * dirty pages sorted by file and block.
+ * With a @ref pager_config "clean_target", a background cleaner thread
+ * writes back the least recently used dirty pages ahead of time,
+ * so that queries seldom have to write a page before replacing it.
  *
- * When a page is @em pinned to a block, it cannot be replaced by
- * another block unless all pages are pinned.
- * @ref unpin "unpin()" a page to allow the page to be associated
- * with another block.
+ * A page returned by @ref get_page "get_page()" is @em pinned to its block
+ * and cannot be replaced by another block.
+ * Pins are counted: every get_page() or @ref page_pin "page_pin()"
+ * must be paired with an @ref unpin "unpin()", and the page can be
+ * associated with another block only after its last pin is dropped.
+ * If all pages are pinned, get_page() fails instead of taking a page
+ * that is still in use.
+ * Which unpinned page is replaced is decided by the
+ * @ref pager_policy "page replacement policy" of the pager configuration.
+ * A scan of a large table gets its pages with an
+ * @ref make_access_strategy "access strategy" instead, which recycles
+ * a small ring of pages, so that the scan does not evict the blocks of
+ * the other tables.
+ *
+ * The pager may be used by several threads at a time, for example to
+ * scan tables in parallel. Getting a page that another thread has
+ * pinned already, and dropping a pin that is not the last one, do not
+ * wait for the other threads. A page that is shared by threads is
+ * read holding its @ref page_latch "latch" in shared mode and changed
+ * holding it in exclusive mode. The current position of a page is shared
+ * by all its users, so threads sharing a page read the values at given
+ * offsets with @ref page_get_int_at "page_get_x_at()" and ignore the
+ * current position. The pager itself does not latch pages.
  *
  * A page has a <em>current position</em> that can be obtained with
  * @ref page_current_pos "page_current_pos()".
@@ -36,11 +66,46 @@
  * To access a value at a particular position,
  * use @ref page_get_int_at "page_get_x_at()" and @ref page_put_int_at "page_put_x_at()".
  *
+ * A @em slotted page holds records of any length instead: a directory
+ * of slots follows the page header, each one the offset and length of
+ * a record stored from the end of the block downwards. The directory
+ * ends at the beginning of free space, so the current position moves
+ * from slot to slot with @ref page_put_slot "page_put_slot()" and
+ * @ref page_get_slot "page_get_slot()" as over values of a fixed size.
+ *
+ * A @em PAX page holds records of a fixed length like a row page, but
+ * keeps the values of each field of its records together in a
+ * @em minipage, so that @ref page_get_minipage "page_get_minipage()"
+ * gives the values of one field as an array. The current position of
+ * a PAX page moves by record as in a row page.
+ *
+ * With the @ref PAGER_MMAP "mmap" access of the pager configuration,
+ * the files that exist when they are opened are mapped read-only:
+ * their pages point into the mapping instead of holding a copy of the
+ * blocks, and only pages holding blocks of new files get a buffer.
+ * Such a session can read, but not change, the existing tables.
+ * @ref map_file "map_file()" maps a file that will only be read from now on.
+ *
  * @ref put_block_info "put_..._info()" are useful for printing out various info
  * during debugging.
  *
  * Reset the pager profiler with @ref pager_profiler_reset "pager_profiler_reset()"
  * before @ref put_pager_profiler_info "profiling" the pager.
+ * The profiler counts buffer hits and misses, replaced pages and bytes
+ * transferred per file, and the latency of the I/O requests;
+ * @ref dump_pager_profiler "dump_pager_profiler()" writes them as JSON or CSV.
+ * A @ref pager_device "device model" estimates the time of the I/O.
+ *
+ * With a @ref pager_wal_mode "write-ahead log", the changed bytes of
+ * the pages are appended to the log file @ref wal_file "db.wal" before
+ * the pages are written back, and @ref pager_commit "pager_commit()"
+ * makes the changes so far durable by syncing the log, not the pages.
+ * Fuzzy @ref pager_checkpoint "checkpoints" save the dirty page table
+ * and the @ref pager_set_catalog "catalog" to the log without waiting
+ * for the pages to be written back. A database that has a log is redone
+ * from its last checkpoint by pager_init(), in the order of the log,
+ * and the catalog of the checkpoint is kept for
+ * @ref pager_recovered_catalog "pager_recovered_catalog()".
  *
  * See source code in @ref schema.c for examples of how to use the pager.
  */
@@ -52,32 +117,160 @@
 #include <stdlib.h>
 #include "pmsg.h"
 
-/** block size in number of bytes */
-#define BLOCK_SIZE 512L
+/** default block size in number of bytes */
+#define DEFAULT_BLOCK_SIZE 512L
 
-/** buffer size in number of pages */
-#define NUM_PAGES 10
+/** smallest supported block size in number of bytes */
+#define MIN_BLOCK_SIZE 512L
+
+/** largest supported block size in number of bytes */
+#define MAX_BLOCK_SIZE 16384L
+
+/** default buffer size in number of pages */
+#define DEFAULT_NUM_PAGES 10
 
 /** number of bytes as page header */
-#define PAGE_HEADER_SIZE 20
+#define PAGE_HEADER_SIZE 24
 
-/** max number of open files */
-#define MAX_OPEN_FILES 10
+/** default max number of open files */
+#define DEFAULT_MAX_OPEN_FILES 10
+
+/** default number of entries of the io_uring engine */
+#define DEFAULT_IO_DEPTH 32
 
 /** an integer consists of 4 bytes */
 #define INT_SIZE 4
 
+/** a slot of a slotted page consists of 4 bytes */
+#define SLOT_SIZE 4
+
 typedef struct block_struct * block_p;
 typedef struct page_struct * page_p;
+typedef struct access_strategy * access_strategy_p;
+
+/** @brief Page replacement policies */
+typedef enum {
+  PAGER_LRU,   /**< least recently used, the LRF queues of (un)pinned pages */
+  PAGER_CLOCK, /**< second chance with a reference bit per page */
+  PAGER_LRU2,  /**< LRU-K with K = 2, keeping history of evicted blocks */
+  PAGER_2Q,    /**< 2Q, a FIFO for first references and an LRU for hot pages */
+  PAGER_ARC,   /**< adaptive replacement cache */
+  NUM_PAGER_POLICIES
+} pager_policy;
+
+/** @brief I/O engines of the pager */
+typedef enum {
+  PAGER_IO_SYNC,  /**< synchronous pread()/pwrite() */
+  PAGER_IO_URING  /**< io_uring, asynchronous read-ahead and batched writes */
+} pager_io_engine;
+
+/** @brief How buffer pages get the content of file blocks */
+typedef enum {
+  PAGER_COPY, /**< blocks are copied into the buffer of the pages */
+  PAGER_MMAP  /**< existing files are mapped read-only, pages point into them */
+} pager_access;
+
+/** @brief Device model of the profiler.
+    It turns the counted seeks and transferred bytes into an estimated
+    I/O time, see @ref pager_io_time "pager_io_time()". */
+typedef struct pager_device {
+  char const* name;  /**< name of the preset, "custom" otherwise */
+  double seek_us;    /**< cost of a seek, or of a random access, in us */
+  double mb_per_s;   /**< transfer bandwidth in MB/s, i.e. bytes per us */
+  int queue_depth;   /**< number of requests the device serves at once */
+} pager_device;
+
+/** @brief Write-ahead logging of the pager, see wal.h */
+typedef enum {
+  PAGER_WAL_NONE,   /**< no log, the pages are durable when written back */
+  PAGER_WAL_OFF,    /**< a log that is never synced */
+  PAGER_WAL_NORMAL, /**< a commit writes the log, which is synced before
+                         the pages are written back */
+  PAGER_WAL_FULL,   /**< a commit waits until the log is synced */
+  NUM_PAGER_WAL_MODES
+} pager_wal_mode;
+
+/** a hard disk: seek and half a rotation at 7200 rpm */
+#define PAGER_DEVICE_HDD {"hdd", 8000.0, 150.0, 1}
+
+/** a SATA flash disk */
+#define PAGER_DEVICE_SSD {"ssd", 100.0, 500.0, 32}
+
+/** @brief Pager configuration */
+typedef struct pager_config {
+  int num_pages;      /**< buffer size in number of pages */
+  long pool_bytes;    /**< buffer size in bytes, overrides num_pages if > 0 */
+  long block_size;    /**< block size of a new database, a power of 2 */
+  int max_open_files; /**< max number of open file descriptors, the
+                           least recently used one is closed to open
+                           another file */
+  pager_policy policy; /**< page replacement policy */
+  pager_io_engine io_engine; /**< I/O engine */
+  int io_depth;       /**< max number of requests in flight with io_uring */
+  pager_access access; /**< access to the blocks of the files */
+  int clean_target;   /**< percentage of pages a background cleaner keeps
+                           clean, 0 for no cleaner */
+  int huge_pages;     /**< non-zero to back the buffer pool with huge pages */
+  char const* stats_file; /**< file the profiler is dumped to when the pager
+                               terminates, relative to the system dir once set,
+                               NULL for none */
+  char const* trace_file; /**< file the page accesses are traced to, see
+                               pagetrace.h, relative to the system dir once set,
+                               NULL for none */
+  pager_device device; /**< device model of the profiler, default to hdd */
+  int tablespace;     /**< extent size in blocks of the tablespace file of a
+                           new database, 0 for a Unix file per table,
+                           see tablespace.h */
+  int grow_blocks;    /**< number of blocks a file is preallocated by when
+                           it grows, 0 for none; the number of blocks of a
+                           file with preallocated blocks beyond them is kept
+                           in the header of its block 0 */
+  pager_wal_mode wal; /**< write-ahead logging of the changes to the pages */
+} pager_config;
+
+/** The configuration of the running pager.
+    Set it with @ref pager_init "pager_init()", do not change it directly.
+*/
+extern pager_config pager_cfg;
+
+/** block size in number of bytes */
+#define BLOCK_SIZE (pager_cfg.block_size)
+
+/** buffer size in number of pages */
+#define NUM_PAGES (pager_cfg.num_pages)
+
+/** max number of open file descriptors */
+#define MAX_OPEN_FILES (pager_cfg.max_open_files)
 
 /** Database buffer */
-extern page_p pages[];
+extern page_p *pages;
 
 extern void put_file_info(pmsg_level level, char const* fname);
 extern void put_page_info(pmsg_level level, page_p p);
 extern void put_block_info(pmsg_level level, block_p b);
 extern void put_pager_info(pmsg_level level, char const* msg);
 extern void put_pager_profiler_info(pmsg_level level);
+
+/** @brief Formats of dump_pager_profiler() */
+typedef enum {
+  PAGER_STATS_JSON, /**< one JSON object */
+  PAGER_STATS_CSV   /**< rows of section,name,metric,value */
+} pager_stats_format;
+
+/** Write the profiler counters since the last reset to @em fp:
+    the totals, the counters of every file the pager has seen, and the
+    histograms of the read and write request latencies in microseconds.
+    Returns 0 upon failure. */
+extern int dump_pager_profiler(FILE* fp, pager_stats_format format);
+
+/** Estimated time in microseconds the disk reads and writes since the
+    last reset of the profiler would take on device @em dev (the device of
+    the pager configuration if NULL): a seek per non-adjacent access plus
+    the transfer of the bytes. The io_uring engine overlaps the seeks of
+    up to queue_depth requests in flight; the synchronous engine waits for
+    every request. The estimate does not depend on the page cache of the
+    operating system, so it also means something for small test tables. */
+extern double pager_io_time(pager_device const* dev);
 extern void put_pqueues_info(pmsg_level level);
 
 /** Set the directory of the system */
@@ -86,11 +279,64 @@ extern int set_system_dir(char const* dir);
 /** Get the directory of the system */
 extern char* system_dir();
 
+/** Fill @em cfg with the default configuration. */
+extern void pager_config_default(pager_config* cfg);
+
+/** Set a configuration entry from a command-line option.
+Handles the options listed by @ref put_pager_config_usage
+"put_pager_config_usage()":
+ - @c -p @em n: buffer size in number of pages;
+ - @c -P @em bytes: buffer size in bytes (with an optional K or M suffix);
+ - @c -b @em bytes: block size of a new database;
+ - @c -f @em n: max number of open file descriptors;
+ - @c -r @em policy: page replacement policy, one of
+   lru, clock, lru2, 2q and arc;
+ - @c -i @em engine: I/O engine, sync or uring;
+ - @c -q @em n: queue depth of the io_uring engine;
+ - @c -a @em access: block access, copy or mmap;
+ - @c -w @em pct: percentage of pages kept clean by the background cleaner;
+ - @c -H: back the buffer pool with huge pages;
+ - @c -S @em file: dump the profiler to @em file when the pager terminates;
+ - @c -T @em file: trace the page accesses to @em file;
+ - @c -D @em device: device model of the profiler, hdd, ssd or
+   @em seek_us,MB/s,queue_depth;
+ - @c -t @em n: keep the tables of a new database in a tablespace
+   with extents of @em n blocks;
+ - @c -g @em n: preallocate the files growing by extents of @em n blocks;
+ - @c -L @em mode: write-ahead log, one of none, off, normal and full.
+
+Returns 1 if @em opt is a pager option and @em arg is valid,
+0 if @em opt is a pager option but @em arg is invalid,
+and -1 if @em opt is not a pager option.
+*/
+extern int pager_config_option(pager_config* cfg, int opt, char const* arg);
+
+/** The getopt() option string of the pager options. */
+#define PAGER_OPTIONS "p:P:b:f:r:i:q:a:w:HS:T:D:t:g:L:"
+
+/** Print the usage of the pager options. */
+extern void put_pager_config_usage(void);
+
+/** Name of a page replacement policy. */
+extern char const* pager_policy_name(pager_policy policy);
+
+/** Name of a write-ahead log mode. */
+extern char const* pager_wal_mode_name(pager_wal_mode mode);
+
 /** Initiates a pager.
 Memory of buffer pages are allocated.
 Must be called first.
+If @em cfg is NULL, the configuration of the previous pager_init()
+(or the default configuration) is used.
+If the system dir has been set, the block size is read from the
+superblock of the database; a new database gets a superblock
+with the block size of @em cfg.
+If the io_uring engine is configured but not available,
+the pager falls back to synchronous I/O.
+If @em clean_target of the configuration is positive, a background
+cleaner thread is started.
 */
-extern int pager_init(void);
+extern int pager_init(pager_config const* cfg);
 /** Terminates a pager.
 Memory of buffer pages are released.
 If there are dirty pages, they are writtern back to the file blocks.
@@ -111,31 +357,135 @@ get_page() does the following
 - otherwise,
   - make it managed in the @ref file_handle_struct "file handle";
   - pin the block to a buffer page (and read the block into the page).
-  - Returns NULL upon failure of getting the page or pinning (reading) the page.
+  - Returns NULL upon failure of getting the page or pinning (reading) the page,
+    or if all buffer pages are pinned.
   - The current position of the page is set to right after the header
+The returned page is pinned once more, unpin() it when done with it.
 */
 extern page_p get_page(char const* fname, int blknr);
+/** Get the pages of the @em n adjacent blocks starting at @em blknr,
+    which must all exist in the file.
+    The blocks that are not buffered yet are read with as few
+    preadv() calls as possible.
+    Every page in @em pgs is pinned, unpin() each of them when done.
+    Returns the number of pages (@em n), 0 upon failure. */
+extern int get_pages(char const* fname, int blknr, int n, page_p pgs[]);
+/** Make an access strategy for a bulk access, like a scan, a join
+    scanning its inner table again and again, or the writing of a
+    temporary table. The pages that get_page_with_strategy() reads or
+    appends for it are recycled in a ring of @em size pages (a few pages
+    for read-ahead if @em size is 0), instead of replacing the pages that
+    other accesses keep using.
+    Returns NULL if the ring would take the whole buffer. */
+extern access_strategy_p make_access_strategy(int size);
+/** Release an access strategy, the pages of its ring become ordinary
+    pages of the buffer. */
+extern void release_access_strategy(access_strategy_p s);
+/** get_page() for a bulk access with strategy @em s.
+    A block that is not buffered is read into the next page of the ring
+    of @em s if that page is not pinned, otherwise into a page chosen by
+    the replacement policy, which then takes its place in the ring.
+    A block that another access references leaves the ring.
+    The files of at most a quarter of the buffer are buffered as usual,
+    and so is every access if @em s is NULL. */
+extern page_p get_page_with_strategy(char const* fname, int blknr,
+                                     access_strategy_p s);
+/** Hint that the @em n blocks starting at @em blknr will be read soon.
+    The OS is advised to read the range, and up to a quarter of the buffer
+    is filled with the blocks that are not buffered yet, without pinning
+    them.
+    Sequential scans are detected by get_page() and read ahead
+    without such a hint.
+    Returns the number of blocks read into the buffer, -1 upon failure. */
+extern int pager_prefetch(char const* fname, int blknr, int n);
 /** Get the last block and move the current position to the end */
 extern page_p get_page_for_append(char const* fname);
-/** Get the next page */
+/** Get the next page. The next page is pinned, @em p keeps its pin. */
 extern page_p get_next_page(page_p p);
 /** Set current position to the beginning */
 void page_set_pos_begin(page_p p);
 /** Number of blocks in the file */
 extern int file_num_blocks(char const* fname);
-/** Close the file */
+/** Close the file, writing back its buffered blocks. Returns the slot
+    the file had, -1 if it was not open or cannot be closed. */
 extern int close_file(char const* fname);
+/** Close and rename file @em fname to @em new_name, replacing the file
+    @em new_name if it exists. Returns 0 upon failure. */
+extern int rename_file(char const* fname, char const* new_name);
+/** Make file @em fname, which must have no blocks yet, a compressed
+    file, see cfile.h. Its blocks are compressed in chunks on disk and
+    decompressed into the pages reading them, and the profiler counts
+    the bytes compression saves. A file is known to be compressed when it
+    is opened again. Returns 0 upon failure, and in a tablespace. */
+extern int create_compressed_file(char const* fname);
+/** Access the blocks of a file that is no longer changed through a
+    read-only mapping until the file is closed.
+    The dirty pages of the file are written back and its buffered blocks
+    are dropped, so none of them may be pinned.
+    Afterwards get_page() returns pages pointing into the mapping,
+    and putting values into them fails.
+    Returns 1 if the file is mapped, 0 if it is empty or cannot be mapped. */
+extern int map_file(char const* fname);
 
 /** Pin the block to a buffer page and read the block into the page. */
 extern page_p pin(block_p b);
-/** Unpin the page. If the page is dirty, write the content back to disk. */
+/** Pin the page of a block once more, so that it stays in the buffer
+    until the matching unpin(). */
+extern page_p page_pin(page_p p);
+/** Number of pins of the page. */
+extern int page_pin_count(page_p p);
+/** Drop a pin of the page.
+    A dirty page stays in the buffer and is written back when it is
+    replaced, when its file is closed, or by pager_flush(). */
 extern void unpin(page_p p);
+/** Latch the content of a pinned page against other threads:
+    shared for reading if @em exclusive is 0, exclusive for changing
+    it otherwise. */
+extern void page_latch(page_p p, int exclusive);
+/** Release the latch of the page taken by page_latch(). */
+extern void page_unlatch(page_p p);
 /** Read the content of the page from disk.
 If the content of the page is already uptodate, return immediately.
 */
 extern int read_page(page_p p);
 /** Write the content of the (dirty) page to disk. */
 extern int write_page(page_p p);
+/** Write the dirty pages among the @em n pages @em pgs back to disk,
+    runs of adjacent blocks with one pwritev() each. */
+extern int write_pages(page_p pgs[], int n);
+/** Write all dirty pages back to disk, in (file, block) order and
+    runs of adjacent blocks with one pwritev() each.
+    Returns 0 if a write fails. */
+extern int pager_flush(void);
+/** Make the changes to the pages so far durable, if the pager has a
+    @ref pager_wal_mode "write-ahead log": the changed bytes of the pages
+    are appended to the log and a commit record after them, which is
+    synced as the mode of the log asks for. The commits of threads
+    waiting for the same sync of the log share it. The changes to a page
+    that is pinned, by this thread or another one, are not logged: they
+    are committed by a commit after the page is unpinned.
+    The pages are written back later, and when the log has grown by
+    WAL_CHECKPOINT_BYTES since the last checkpoint, the commit takes one.
+    Must not be called holding the latch of a page.
+    Returns 1 if all the changes are durable, or if there is no log,
+    -1 if the changes to pinned pages are left for a later commit and
+    only the others are durable, and 0 upon failure. */
+extern int pager_commit(void);
+/** Take a fuzzy checkpoint: the pages dirty since before the last
+    checkpoint are written back, the files are synced, and the pages that
+    are still dirty go to the log with the catalog, so that redo starts
+    at the oldest change to them and the log before it is freed.
+    Returns 0 upon failure, 1 if there is no log. */
+extern int pager_checkpoint(void);
+/** Set the function giving the catalog of the database that the
+    checkpoints save, in a buffer of @em *len bytes the pager frees,
+    NULL for none. It may be called holding the pager lock, so it must
+    not use the pager. */
+extern void pager_set_catalog(char* (*catalog)(long* len));
+/** The catalog of the last checkpoint of the log redone by pager_init(),
+    in a buffer of @em *len bytes the caller frees, NULL if none was
+    redone. It is handed once, and the checkpoints save it until then. */
+extern char* pager_recovered_catalog(long* len);
 /** Return page's block number. */
 extern int page_block_nr(page_p p);
 /** Return page's current position. */
@@ -194,4 +544,43 @@ Returns 0 if fails (@em offset out of range).
 */
 extern int page_put_str_at(page_p p, int offset, char const* str, int len);
 
+/** Put the record @em rec of @em len bytes in a new slot of a slotted
+page. The current position must be at the end of the slots.
+Returns 0 if there is not enough space in the page.
+The current position is moved to the next slot.
+*/
+extern int page_put_slot(page_p p, void const* rec, int len);
+/** Retrieve the record of the slot at the current position of a slotted
+page and its length in @em len. The record is in the page, and is valid
+as long as the page is pinned.
+The current position is moved to the next slot.
+*/
+extern char const* page_get_slot(page_p p, int* len);
+/** Retrieve the record of the slot at @em offset of a slotted page and
+its length in @em len, as page_get_slot().
+The current position is moved to the next slot.
+*/
+extern char const* page_get_slot_at(page_p p, int offset, int* len);
+
+/** Put the record @em rec, laid out as a row of @em num_fields values of
+@em lens bytes, at the current position of a PAX page: each value goes
+to the minipage of its field.
+Returns 0 if there is not enough space at current position.
+The current position is moved to the next record.
+*/
+extern int page_put_pax(page_p p, void const* rec, int num_fields,
+                        int const lens[]);
+/** Retrieve the record at the current position of a PAX page into
+@em rec, laid out as a row, see page_put_pax().
+The current position is moved to the next record.
+*/
+extern int page_get_pax(page_p p, void* rec, int num_fields,
+                        int const lens[]);
+/** The minipage of the values at @em offset of the records of @em rec_len
+bytes of a PAX page, and the number of records of the page in
+@em num_recs. The minipage is valid as long as the page is pinned.
+*/
+extern char const* page_get_minipage(page_p p, int rec_len, int offset,
+                                     int* num_recs);
+
 #endif
@@ -0,0 +1,52 @@
+/** @file pagetrace.h
+ * @brief Binary trace of the page accesses of the pager.
+ *
+ * With a @ref pager_config "trace_file", the pager logs every
+ * get_page() and page_pin() as a @ref TRACE_GET record and every
+ * unpin() as a @ref TRACE_UNPIN record, which tells if the page is dirty.
+ * A @ref TRACE_FILE record names a file id before its first access.
+ *
+ * The trace starts with a @ref page_trace_header, followed by
+ * @ref page_trace_rec records of 8 bytes in the byte order of the
+ * machine. The name of a @ref TRACE_FILE record follows the record,
+ * blk_nr bytes without a terminating null byte.
+ *
+ * run_tracesim replays a trace against buffer pool sizes and
+ * replacement policies, see tracesim.c.
+ */
+
+#ifndef _PAGETRACE_H_
+#define _PAGETRACE_H_
+
+#include <stdint.h>
+
+/** "PGTR" */
+#define PAGE_TRACE_MAGIC 0x52544750u
+
+#define PAGE_TRACE_VERSION 1
+
+/** @brief Operations of the trace records */
+typedef enum {
+  TRACE_FILE,  /**< file fid is named, blk_nr is the length of the name */
+  TRACE_GET,   /**< block (fid, blk_nr) is referenced and pinned */
+  TRACE_UNPIN  /**< a pin of block (fid, blk_nr) is dropped */
+} page_trace_op;
+
+/** @brief Header of a trace */
+typedef struct page_trace_header {
+  uint32_t magic;      /**< PAGE_TRACE_MAGIC */
+  uint16_t version;    /**< PAGE_TRACE_VERSION */
+  uint16_t policy;     /**< replacement policy of the traced pager */
+  int32_t block_size;  /**< block size of the traced database */
+  int32_t num_pages;   /**< buffer size of the traced pager */
+} page_trace_header;
+
+/** @brief Trace record */
+typedef struct page_trace_rec {
+  uint8_t op;          /**< a page_trace_op */
+  uint8_t dirty;       /**< non-zero if the page is dirty at TRACE_UNPIN */
+  uint16_t fid;        /**< interned file id */
+  int32_t blk_nr;      /**< block nr, the name length for TRACE_FILE */
+} page_trace_rec;
+
+#endif
@@ -5,9 +5,13 @@
  ************************************************************/
 
 #include "schema.h"
+#include "column.h"
 #include "pmsg.h"
 #include <string.h>
 
+/** number of bytes of the end offset of a str field in a slotted page */
+#define STR_END_SIZE 2
+
 /** @brief Field descriptor */
 typedef struct field_desc_struct {
   char *name;        /**< field name */
@@ -19,13 +23,15 @@ typedef struct field_desc_struct {
 
 /** @brief Table/record schema */
 /** A schema is a linked list of @ref field_desc_struct "field descriptors".
-    All records of a table are of the same length.
+    All records of a table are of the same length, but in slotted pages,
+    where a string takes only the bytes it holds.
 */
 typedef struct schema_struct {
   char *name;           /**< schema (table) name */
   field_desc_p first;   /**< first field_desc */
   field_desc_p last;    /**< last field_desc */
   int num_fields;       /**< number of fields in the table */
+  int num_strs;         /**< number of str fields */
   int len;              /**< record length */
   tbl_p tbl;            /**< table descriptor */
 } schema_struct;
@@ -36,8 +42,12 @@ typedef struct schema_struct {
  */
 typedef struct tbl_desc_struct {
   schema_p sch;      /**< schema of this table. */
+  tbl_storage storage; /**< storage of the records */
   int num_records;   /**< number of records this table has. */
-  page_p current_pg; /**< current page being accessed. */
+  page_p current_pg; /**< current page being accessed, holding one pin. */
+  access_strategy_p ring; /**< pages for scanning and appending, made on demand. */
+  column_p *cols;    /**< columns of the fields in column storage, opened on demand. */
+  long next_rec;     /**< record at the current position in column storage. */
   tbl_p next;        /**< next tbl_desc in the database. */
 } tbl_desc_struct;
 
@@ -45,6 +55,72 @@ typedef struct tbl_desc_struct {
 /** @brief Database tables*/
 tbl_p db_tables; /**< a linked list of table descriptors */
 
+/* The current page of a table holds one pin. The pin of the old current
+   page is dropped, pg must already be pinned for the table. */
+static void set_tbl_current_pg(tbl_p t, page_p pg) {
+  if (t->current_pg)
+    unpin(t->current_pg);
+  t->current_pg = pg;
+}
+
+/* Scans and appends get the pages of a table through its own ring,
+   so that they do not evict the pages of the other tables */
+static access_strategy_p tbl_ring(tbl_p t) {
+  if (!t->ring)
+    t->ring = make_access_strategy(0);
+  return t->ring;
+}
+
+static void release_tbl_ring(tbl_p t) {
+  release_access_strategy(t->ring);
+  t->ring = 0;
+}
+
+/* Name of the file of the column of field f of table t */
+static char *column_fname(tbl_p t, field_desc_p f) {
+  char *fname = malloc(strlen(t->sch->name) + strlen(f->name) + 2);
+  sprintf(fname, "%s.%s", t->sch->name, f->name);
+  return fname;
+}
+
+/* Name of the file of the dictionary of a column of strings */
+static char *dict_fname(char const* column_fname) {
+  char *fname = malloc(strlen(column_fname) + 6);
+  sprintf(fname, "%s.dict", column_fname);
+  return fname;
+}
+
+/* The column of field f, the i-th one, of table t in column storage */
+static column_p tbl_column(tbl_p t, int i, field_desc_p f) {
+  if (!t->cols)
+    t->cols = calloc(t->sch->num_fields, sizeof (column_p));
+  if (!t->cols[i]) {
+    char *fname = column_fname(t, f);
+    char *dict = is_int_field(f) ? 0 : dict_fname(fname);
+    t->cols[i] = open_column(fname, dict, f->len);
+    free(dict);
+    free(fname);
+  }
+  return t->cols[i];
+}
+
+static void close_tbl_columns(tbl_p t) {
+  for (int i = 0; t->cols && i < t->sch->num_fields; i++)
+    close_column(t->cols[i]);
+  free(t->cols);
+  t->cols = 0;
+}
+
+/* A result table is not changed after it is built, so the mmap pager
+   scans it through a read-only mapping */
+static tbl_p seal_tbl(tbl_p t) {
+  if (t && pager_cfg.access == PAGER_MMAP) {
+    set_tbl_current_pg(t, 0);
+    map_file(t->sch->name);
+  }
+  return t;
+}
+
 void put_field_info(pmsg_level level, field_desc_p f) {
   if (!f) {
     put_msg(level,  "  empty field\n");
@@ -70,6 +146,8 @@ void put_schema_info(pmsg_level level, schema_p s) {
   field_desc_p f;
   put_msg(level, "--schema %s: %d field(s), totally %d bytes\n",
           s->name, s->num_fields, s->len);
+  if (s->tbl && s->tbl->storage != ROW_STORAGE)
+    put_msg(level, "--using %s\n", tbl_storage_name(s->tbl->storage));
   for (f = s->first; f; f = f->next)
     put_field_info(level, f);
   put_msg(level, "--\n");
@@ -81,9 +159,20 @@ void put_tbl_info(pmsg_level level, tbl_p t) {
     return;
   }
   put_schema_info(level, t->sch);
-  put_file_info(level, t->sch->name);
-  put_msg(level, " %d blocks, %d records\n",
-          file_num_blocks(t->sch->name), t->num_records);
+  if (t->storage == COLUMN_STORAGE) {
+    int blocks = 0;
+    size_t i = 0;
+    for (field_desc_p f = t->sch->first; f; f = f->next, i++) {
+      column_p c = tbl_column(t, i, f);
+      blocks += c ? column_num_blocks(c) : 0;
+    }
+    put_msg(level, " %d blocks in %d columns, %d records\n",
+            blocks, t->sch->num_fields, t->num_records);
+  } else {
+    put_file_info(level, t->sch->name);
+    put_msg(level, " %d blocks, %d records\n",
+            file_num_blocks(t->sch->name), t->num_records);
+  }
   put_msg(level, "----\n");
 }
 
@@ -159,6 +248,7 @@ static schema_p make_schema(char const* name) {
   res->first = 0;
   res->last = 0;
   res->num_fields = 0;
+  res->num_strs = 0;
   res->len = 0;
   return res;
 }
@@ -235,7 +325,11 @@ static char* concat_names(char const* name1, char const* sep, char const* name2)
 
 static void save_tbl_desc(FILE *fp, tbl_p tbl) {
   schema_p sch = tbl->sch;
-  fprintf(fp, "%s %d\n", sch->name, sch->num_fields);
+  if (tbl->storage == ROW_STORAGE)
+    fprintf(fp, "%s %d\n", sch->name, sch->num_fields);
+  else
+    fprintf(fp, "%s %d %s\n", sch->name, sch->num_fields,
+            tbl_storage_name(tbl->storage));
   field_desc_p fld = schema_first_fld_desc(sch);
   while (fld) {
     fprintf(fp, "%s %d %d %d\n",
@@ -255,6 +349,8 @@ static void save_tbl_descs() {
   tbl_p tbl = db_tables, next_tbl = 0;
   while (tbl) {
     save_tbl_desc(dbfile, tbl);
+    release_tbl_ring(tbl);
+    close_tbl_columns(tbl);
     release_schema(tbl->sch);
     next_tbl = tbl->next;
     free(tbl);
@@ -263,19 +359,37 @@ static void save_tbl_descs() {
   fclose(dbfile);
 }
 
-static void read_tbl_descs() {
-  FILE *fp = fopen(tables_desc_file, "r");
+/* The descriptors of the tables, as save_tbl_descs() saves them, in a
+   buffer of *len bytes: the catalog the checkpoints of the pager save */
+static char *tbl_descs_text(long* len) {
+  char *text = 0;
+  size_t size = 0;
+  FILE *fp = open_memstream(&text, &size);
+  if (!fp) return 0;
+  for (tbl_p tbl = db_tables; tbl; tbl = tbl->next)
+    save_tbl_desc(fp, tbl);
+  fclose(fp);
+  *len = size;
+  return text;
+}
+
+static void read_tbl_descs(FILE *fp) {
   if (!fp) return;
-  char name[30] = "";
+  char name[30] = "", storage[30] = "", line[100];
   schema_p sch = NULL;
   field_desc_p fld = NULL;
   int num_flds = 0, fld_type, fld_len;
   while (!feof(fp)) {
-    if (fscanf(fp, "%s %d\n", name, &num_flds) < 2) {
+    /* the storage follows the number of fields, unless it is row */
+    storage[0] = '\0';
+    if (!fgets(line, sizeof line, fp)
+        || sscanf(line, "%29s %d %29s", name, &num_flds, storage) < 2) {
       fclose(fp);
       return;
     }
     sch = new_schema(name);
+    if (storage[0] && parse_tbl_storage(storage) >= 0)
+      sch->tbl->storage = parse_tbl_storage(storage);
     for (size_t i = 0; i < num_flds; i++) {
       fscanf(fp, "%s %d %d", name, &(fld_type), &(fld_len));
       switch (fld_type) {
@@ -295,14 +409,43 @@ static void read_tbl_descs() {
   fclose(fp);
 }
 
+/* Count the records of table t: the catalog of a checkpoint does not
+   count the ones inserted after it, which are redone */
+static void count_tbl_records(tbl_p t) {
+  t->num_records = 0;
+  if (t->storage != COLUMN_STORAGE && file_num_blocks(t->sch->name) <= 0)
+    return;
+  record rec = new_record(t->sch);
+  set_tbl_position(t, TBL_BEG);
+  while (get_record(rec, t->sch) > 0)
+    t->num_records++;
+  set_tbl_current_pg(t, 0);
+  release_record(rec, t->sch);
+}
+
 int open_db(void) {
   pager_terminate(); /* first clean up for a fresh start */
-  pager_init();
-  read_tbl_descs();
+  pager_init(NULL);
+  /* after a crash, the catalog of the last checkpoint of the log is
+     newer than the one saved at close */
+  long len;
+  char *catalog = pager_recovered_catalog(&len);
+  if (catalog) {
+    if (len > 0)
+      read_tbl_descs(fmemopen(catalog, len, "r"));
+    for (tbl_p tbl = db_tables; tbl; tbl = tbl->next)
+      count_tbl_records(tbl);
+    free(catalog);
+  } else
+    read_tbl_descs(fopen(tables_desc_file, "r"));
+  pager_set_catalog(tbl_descs_text);
   return 1;
 }
 
 void close_db(void) {
+  pager_set_catalog(0);
+  /* the records are on disk before the descriptors that count them */
+  pager_flush();
   save_tbl_descs();
   db_tables = 0;
   pager_terminate();
@@ -312,8 +455,12 @@ schema_p new_schema(char const* name) {
   tbl_p tbl = malloc(sizeof (tbl_desc_struct));
   tbl->sch = make_schema(name);
   tbl->sch->tbl = tbl;
+  tbl->storage = ROW_STORAGE;
   tbl->num_records = 0;
   tbl->current_pg = 0;
+  tbl->ring = 0;
+  tbl->cols = 0;
+  tbl->next_rec = 0;
   tbl->next = db_tables;
   db_tables = tbl;
   return tbl->sch;
@@ -344,10 +491,24 @@ void remove_table(tbl_p t) {
       else
         prev->next = t->next;
 
-      close_file(t->sch->name);
+      set_tbl_current_pg(t, 0);
+      release_tbl_ring(t);
+      close_tbl_columns(t);
       char *tbl_backup = concat_names("_", "_", t->sch->name);
-      rename(t->sch->name, tbl_backup);
+      rename_file(t->sch->name, tbl_backup);
       free(tbl_backup);
+      for (field_desc_p f = t->storage == COLUMN_STORAGE ? t->sch->first : 0;
+           f; f = f->next) {
+        char *fname = column_fname(t, f), *dict = dict_fname(fname);
+        char *backup = concat_names("_", "_", fname);
+        char *dict_backup = concat_names("_", "_", dict);
+        rename_file(fname, backup);
+        rename_file(dict, dict_backup);
+        free(dict_backup);
+        free(backup);
+        free(dict);
+        free(fname);
+      }
       release_schema(t->sch);
       free(t);
       return;
@@ -358,6 +519,52 @@ void remove_schema(schema_p s) {
   if (s) remove_table(s->tbl);
 }
 
+/** Names of the storages, by tbl_storage */
+static char const* const storage_names[] = {"row", "compressed", "slotted",
+                                             "pax", "column"};
+
+char const* tbl_storage_name(tbl_storage st) {
+  return storage_names[st];
+}
+
+int parse_tbl_storage(char const* name) {
+  for (int i = 0; i < sizeof storage_names / sizeof storage_names[0]; i++)
+    if (strcmp(name, storage_names[i]) == 0)
+      return i;
+  return -1;
+}
+
+tbl_storage schema_storage(schema_p s) {
+  return s->tbl->storage;
+}
+
+int set_tbl_storage(schema_p s, tbl_storage st) {
+  tbl_p t = s->tbl;
+  if (t->storage == st) return 1;
+  if (t->num_records > 0) {
+    put_msg(ERROR, "set_tbl_storage: %s has records already.\n", s->name);
+    return 0;
+  }
+  if (st == COMPRESSED_STORAGE && !create_compressed_file(s->name))
+    return 0;
+  if (st == SLOTTED_STORAGE
+      && s->len + s->num_strs * STR_END_SIZE + SLOT_SIZE
+         > BLOCK_SIZE - PAGE_HEADER_SIZE) {
+    put_msg(ERROR, "set_tbl_storage: a record of %s may not fit in a slot.\n",
+            s->name);
+    return 0;
+  }
+  for (field_desc_p f = s->first; st == COLUMN_STORAGE && f; f = f->next)
+    if (!is_int_field(f)
+        && f->len + SLOT_SIZE > BLOCK_SIZE - PAGE_HEADER_SIZE) {
+      put_msg(ERROR, "set_tbl_storage: a string of %s may not fit in a slot "
+              "of the dictionary.\n", s->name);
+      return 0;
+    }
+  t->storage = st;
+  return 1;
+}
+
 static field_desc_p dup_field(field_desc_p f) {
   field_desc_p res = malloc(sizeof (field_desc_struct));
   res->name = strdup(f->name);
@@ -432,6 +639,8 @@ int add_field(schema_p s, field_desc_p f) {
   }
   s->last = f;
   s->num_fields++;
+  if (f->type == STR_TYPE)
+    s->num_strs++;
   s->len += f->len;
   return s->num_fields;
 }
@@ -527,26 +736,41 @@ int equal_record(record r1, record r2, schema_p s) {
 }
 
 void set_tbl_position(tbl_p t, tbl_position pos) {
+  page_p pg = 0;
+  if (t->storage == COLUMN_STORAGE) {
+    t->next_rec = pos == TBL_BEG ? 0 : t->num_records;
+    set_tbl_current_pg(t, 0);
+    return;
+  }
   switch (pos) {
   case TBL_BEG:
     {
-      t->current_pg = get_page(t->sch->name, 0);
-      page_set_pos_begin(t-> current_pg);
+      pg = get_page_with_strategy(t->sch->name, 0, tbl_ring(t));
+      page_set_pos_begin(pg);
     }
     break;
   case TBL_END:
-    t->current_pg = get_page_for_append(t->sch->name);
+    pg = get_page_for_append(t->sch->name);
   }
+  set_tbl_current_pg(t, pg);
 }
 
 int eot(tbl_p t) {
-  return (peof(t->current_pg));
+  if (t->storage == COLUMN_STORAGE)
+    return t->next_rec >= t->num_records;
+  return (!t->current_pg || peof(t->current_pg));
+}
+
+/* The current position of a page moves by a record, or by a slot
+   in slotted pages */
+static int rec_step(schema_p s) {
+  return s->tbl->storage == SLOTTED_STORAGE ? SLOT_SIZE : s->len;
 }
 
 /** check if the the current position is valid */
 static int page_valid_pos_for_get_with_schema(page_p p, schema_p s) {
   return (page_valid_pos_for_get(p, page_current_pos(p))
-          && (page_current_pos(p) - PAGE_HEADER_SIZE) % s->len == 0);
+          && (page_current_pos(p) - PAGE_HEADER_SIZE) % rec_step(s) == 0);
 }
 
 /** check if the the current position is valid */
@@ -555,15 +779,136 @@ static int page_valid_pos_for_put_with_schema(page_p p, schema_p s) {
           && (page_current_pos(p) - PAGE_HEADER_SIZE) % s->len == 0);
 }
 
+/* A record in a slotted page begins with the end offsets of its str
+   fields, followed by its int fields and then the characters of its
+   str fields, without padding. An int field is at the same offset in
+   all records. */
+
+/* Offset of int field f in the records of s */
+static int int_field_offset(schema_p s, field_desc_p f) {
+  if (s->tbl->storage != SLOTTED_STORAGE)
+    return f->offset;
+  int offset = s->num_strs * STR_END_SIZE;
+  for (field_desc_p g = s->first; g != f; g = g->next)
+    if (g->type == INT_TYPE)
+      offset += INT_SIZE;
+  return offset;
+}
+
+/* The int field at offset of the record at position pos of p */
+static int page_get_int_field(page_p p, int pos, schema_p s, int offset) {
+  int len, val;
+  switch (s->tbl->storage) {
+  case SLOTTED_STORAGE:
+    memcpy(&val, page_get_slot_at(p, pos, &len) + offset, INT_SIZE);
+    return val;
+  case PAX_STORAGE:
+    if (!page_valid_pos_for_get(p, pos)) {
+      put_msg(FATAL, "page_get_int_field\n");
+      exit(EXIT_FAILURE);
+    }
+    memcpy(&val, page_get_minipage(p, s->len, offset, &len)
+           + (pos - PAGE_HEADER_SIZE) / s->len * INT_SIZE, INT_SIZE);
+    return val;
+  default:
+    return page_get_int_at(p, pos + offset);
+  }
+}
+
+static int get_slotted_record(page_p p, record r, schema_p s) {
+  int len;
+  char const* rec = page_get_slot(p, &len);
+  int int_pos = s->num_strs * STR_END_SIZE;
+  int str_pos = int_pos + (s->num_fields - s->num_strs) * INT_SIZE;
+  unsigned short end;
+  size_t i = 0, j = 0;
+  for (field_desc_p f = s->first; f; f = f->next, i++)
+    if (is_int_field(f)) {
+      memcpy(r[i], rec + int_pos, INT_SIZE);
+      int_pos += INT_SIZE;
+    } else {
+      memcpy(&end, rec + j++ * STR_END_SIZE, STR_END_SIZE);
+      memcpy(r[i], rec + str_pos, end - str_pos);
+      if (end - str_pos < f->len)
+        ((char *) r[i])[end - str_pos] = '\0';
+      str_pos = end;
+    }
+  return 1;
+}
+
+/* A record in a PAX page is put and got laid out as a row, which the
+   pager spreads over the minipages of the fields */
+static void pax_field_lens(schema_p s, int lens[]) {
+  size_t i = 0;
+  for (field_desc_p f = s->first; f; f = f->next, i++)
+    lens[i] = f->len;
+}
+
+static int get_pax_record(page_p p, record r, schema_p s) {
+  char row[s->len];
+  int lens[s->num_fields];
+  pax_field_lens(s, lens);
+  page_get_pax(p, row, s->num_fields, lens);
+  size_t i = 0;
+  for (field_desc_p f = s->first; f; f = f->next, i++)
+    if (is_int_field(f))
+      memcpy(r[i], row + f->offset, INT_SIZE);
+    else
+      strncpy(r[i], row + f->offset, f->len);
+  return 1;
+}
+
+static int put_pax_record(page_p p, record r, schema_p s) {
+  if (!page_valid_pos_for_put_with_schema(p, s))
+    return 0;
+  char row[s->len];
+  int lens[s->num_fields];
+  pax_field_lens(s, lens);
+  size_t i = 0;
+  for (field_desc_p f = s->first; f; f = f->next, i++)
+    if (is_int_field(f))
+      memcpy(row + f->offset, r[i], INT_SIZE);
+    else
+      strncpy(row + f->offset, r[i], f->len);
+  return page_put_pax(p, row, s->num_fields, lens);
+}
+
+static int put_slotted_record(page_p p, record r, schema_p s) {
+  char rec[s->len + s->num_strs * STR_END_SIZE];
+  int int_pos = s->num_strs * STR_END_SIZE;
+  int str_pos = int_pos + (s->num_fields - s->num_strs) * INT_SIZE;
+  unsigned short end;
+  size_t i = 0, j = 0;
+  for (field_desc_p f = s->first; f; f = f->next, i++)
+    if (is_int_field(f)) {
+      memcpy(rec + int_pos, r[i], INT_SIZE);
+      int_pos += INT_SIZE;
+    } else {
+      int n = strnlen(r[i], f->len);
+      memcpy(rec + str_pos, r[i], n);
+      str_pos += n;
+      end = str_pos;
+      memcpy(rec + j++ * STR_END_SIZE, &end, STR_END_SIZE);
+    }
+  return page_put_slot(p, rec, str_pos);
+}
+
 static page_p get_page_for_next_record(schema_p s) {
   page_p pg = s->tbl->current_pg;
-  if (peof(pg)) return 0;
+  if (!pg) return 0;
+  if (peof(pg)) {
+    /* end of table, the page is no longer needed */
+    set_tbl_current_pg(s->tbl, 0);
+    return 0;
+  }
   if (eop(pg)) {
+    int next = page_block_nr(pg) + 1;
+    /* unpin first, so that the page can be replaced by the next one */
     unpin(pg);
-    pg = get_next_page(pg);
+    pg = get_page_with_strategy(s->name, next, tbl_ring(s->tbl));
     if (!pg) {
       put_msg(FATAL, "get_page_for_next_record failed at block %d\n",
-              page_block_nr(pg) + 1);
+              next);
       exit(EXIT_FAILURE);
     }
     page_set_pos_begin(pg);
@@ -578,6 +923,10 @@ static int get_page_record(page_p p, record r, schema_p s) {
     put_msg(FATAL, "try to get record at invalid position.\n");
     exit(EXIT_FAILURE);
   }
+  if (s->tbl->storage == SLOTTED_STORAGE)
+    return get_slotted_record(p, r, s);
+  if (s->tbl->storage == PAX_STORAGE)
+    return get_pax_record(p, r, s);
   field_desc_p fld_desc;
   size_t i = 0;
   for (fld_desc = s->first; fld_desc;
@@ -589,7 +938,39 @@ static int get_page_record(page_p p, record r, schema_p s) {
   return 1;
 }
 
+/* A record in column storage has its value of each field in the column
+   of the field, at the position of the record. */
+
+/* Index of field f in the records of s */
+static int field_index(schema_p s, field_desc_p f) {
+  int i = 0;
+  for (field_desc_p g = s->first; g != f; g = g->next)
+    i++;
+  return i;
+}
+
+/* Retrieve the fields of the record at the current position whose
+   wanted[] is set, all of them if wanted is NULL, reading only their
+   columns. Returns as get_record(). */
+static int get_column_fields(record r, schema_p s, char const wanted[]) {
+  tbl_p t = s->tbl;
+  size_t i = 0;
+  for (field_desc_p f = s->first; f; f = f->next, i++) {
+    if (wanted && !wanted[i]) continue;
+    column_p c = tbl_column(t, i, f);
+    if (!c) return -1;
+    if (column_pos(c) != t->next_rec && !column_seek(c, t->next_rec))
+      return 0;
+    int ret = column_next(c, r[i]);
+    if (ret <= 0) return ret;
+  }
+  t->next_rec++;
+  return 1;
+}
+
 int get_record(record r, schema_p s) {
+  if (s->tbl->storage == COLUMN_STORAGE)
+    return get_column_fields(r, s, 0);
   page_p pg = get_page_for_next_record(s);
   return pg ? get_page_record(pg, r, s) : 0;
 }
@@ -628,26 +1009,66 @@ static int bi_int_equal(int x, int y)
 }
 
 
+/* find_record_int_val() in PAX pages, through the array of the values
+   of the field in each block */
+static int find_pax_record_int_val(record r, schema_p s, int offset,
+                                   int (*op) (int, int), int val) {
+  for (page_p pg = get_page_for_next_record(s); pg;
+       pg = get_page_for_next_record(s)) {
+    int n, rec_val;
+    char const* vals = page_get_minipage(pg, s->len, offset, &n);
+    int i = (page_current_pos(pg) - PAGE_HEADER_SIZE) / s->len;
+    for (; i < n; i++) {
+      memcpy(&rec_val, vals + i * INT_SIZE, INT_SIZE);
+      if ((*op) (val, rec_val))
+        break;
+    }
+    page_set_current_pos(pg, PAGE_HEADER_SIZE + i * s->len);
+    if (i < n)
+      return get_page_record(pg, r, s);
+  }
+  return 0;
+}
+
+/* find_record_int_val() in column storage, through the column of field
+   f alone; the other columns are read for the records found only */
+static int find_column_record_int_val(record r, schema_p s, field_desc_p f,
+                                      int (*op) (int, int), int val) {
+  tbl_p t = s->tbl;
+  column_p c = tbl_column(t, field_index(s, f), f);
+  if (!c || !column_seek(c, t->next_rec)) return 0;
+  long rec_nr = column_find(c, op, val);
+  if (rec_nr < 0) return 0;
+  t->next_rec = rec_nr;
+  return get_column_fields(r, s, 0) > 0;
+}
+
 static int find_record_int_val(record r, schema_p s, int offset,
                                int (*op) (int, int), int val) {
+  if (s->tbl->storage == PAX_STORAGE)
+    return find_pax_record_int_val(r, s, offset, op, val);
   page_p pg = get_page_for_next_record(s);
   if (!pg) return 0;
   int pos, rec_val;
   for (; pg; pg = get_page_for_next_record(s)) {
     pos = page_current_pos(pg);
-    rec_val = page_get_int_at (pg, pos + offset);
+    rec_val = page_get_int_field(pg, pos, s, offset);
     if ((*op) (val, rec_val)) {
       page_set_current_pos(pg, pos);
       get_page_record(pg, r, s);
       return 1;
     }
     else
-      page_set_current_pos(pg, pos + s->len);
+      page_set_current_pos(pg, pos + rec_step(s));
   }
   return 0;
 }
 
 static int put_page_record(page_p p, record r, schema_p s) {
+  if (s->tbl->storage == SLOTTED_STORAGE)
+    return put_slotted_record(p, r, s);
+  if (s->tbl->storage == PAX_STORAGE)
+    return put_pax_record(p, r, s);
   if (!page_valid_pos_for_put_with_schema(p, s))
     return 0;
 
@@ -663,24 +1084,32 @@ static int put_page_record(page_p p, record r, schema_p s) {
 }
 
 int put_record(record r, schema_p s) {
-  page_p p = s->tbl->current_pg;
-
-  if (!page_valid_pos_for_put_with_schema(p, s))
+  if (s->tbl->storage == COLUMN_STORAGE) {
+    put_msg(ERROR, "put_record: %s is in column storage.\n", s->name);
     return 0;
+  }
+  return put_page_record(s->tbl->current_pg, r, s);
+}
 
-  field_desc_p fld_desc;
+static void append_column_record(record r, schema_p s) {
   size_t i = 0;
-  for (fld_desc = s->first; fld_desc;
-       fld_desc = fld_desc->next, i++)
-    if (is_int_field(fld_desc))
-      page_put_int(p, *(int *)r[i]);
-    else
-      page_put_str(p, (char *)r[i], fld_desc->len);
-  return 1;
+  for (field_desc_p f = s->first; f; f = f->next, i++) {
+    column_p c = tbl_column(s->tbl, i, f);
+    if (!c || !column_append(c, r[i])) {
+      put_msg(FATAL, "Failed to append to the column of \"%s\" of \"%s\".\n",
+              f->name, s->name);
+      exit(EXIT_FAILURE);
+    }
+  }
+  s->tbl->num_records++;
 }
 
 void append_record(record r, schema_p s) {
   tbl_p tbl = s->tbl;
+  if (tbl->storage == COLUMN_STORAGE) {
+    append_column_record(r, s);
+    return;
+  }
   page_p pg = get_page_for_append(s->name);
   if (!pg) {
     put_msg(FATAL, "Failed to get page for appending to \"%s\".\n",
@@ -689,20 +1118,24 @@ void append_record(record r, schema_p s) {
   }
   if (!put_page_record(pg, r, s)) {
     /* not enough space in the current page */
+    int next = page_block_nr(pg) + 1;
     unpin(pg);
-    pg = get_next_page(pg);
+    set_tbl_current_pg(tbl, 0);
+    pg = get_page_with_strategy(s->name, next, tbl_ring(tbl));
     if (!pg) {
       put_msg(FATAL, "Failed to get page for \"%s\" block %d.\n",
-              s->name, page_block_nr(pg) + 1);
+              s->name, next);
       exit(EXIT_FAILURE);
     }
     if (!put_page_record(pg, r, s)) {
       put_msg(FATAL, "Failed to put record to page for \"%s\" block %d.\n",
-              s->name, page_block_nr(pg) + 1);
+              s->name, next);
       exit(EXIT_FAILURE);
     }
   }
-  tbl->current_pg = pg;
+  /* the table keeps no pin on the page, so that a commit logs it */
+  unpin(pg);
+  set_tbl_current_pg(tbl, 0);
   tbl->num_records++;
 }
 
@@ -760,24 +1193,23 @@ int binary_search(record const r, schema_p const s, int offset, int val)
 
   /* find block number, 
   depending on the record length, we need to fit whole records in each block */
-  int blk_size = BLOCK_SIZE - PAGE_HEADER_SIZE;     /*find actual block size- page header is 20 bytes */
+  int blk_size = BLOCK_SIZE - PAGE_HEADER_SIZE;     /*find actual block size- without the page header */
   int free_bytes = blk_size - (blk_size % s->len);  /*find free bytes*/
   int blk_num = mid / free_bytes;                   /*use mid and free bytes to find block number */
 
   /* find offset to middle record */
   int rec_page_offset = mid % free_bytes;
 
-  /* get page from block*/
-  page_p mid_page = get_page(s->name, blk_num);
-  if (!mid_page) {
-    return 0;
-  }
-
   while (min <= max) {
+    /* get page from block*/
+    page_p mid_page = get_page(s->name, blk_num);
+    if (!mid_page) {
+      return 0;
+    }
 
     int pos = rec_page_offset + PAGE_HEADER_SIZE;
     /* fetch stored value */
-    int rec_val = page_get_int_at(mid_page, (pos + offset));
+    int rec_val = page_get_int_field(mid_page, pos, s, offset);
 
     if (rec_val < val)        /* if queried value is higher tan recorded value*/
     {      
@@ -795,12 +1227,13 @@ int binary_search(record const r, schema_p const s, int offset, int val)
     {
       page_set_current_pos(mid_page, pos);
       get_page_record(mid_page, r, s);
+      unpin(mid_page);
       return 1;
     }
-    /* update offset, block_num and page from the new middle value */
+    unpin(mid_page);
+    /* update offset and block_num from the new middle value */
     rec_page_offset = (mid % free_bytes);
     blk_num = mid / free_bytes;
-    mid_page = get_page(s->name, blk_num);
   }
   return 0;
 }
@@ -878,8 +1311,10 @@ tbl_p table_search(tbl_p t, char const* attr, char const* op, int val)
   
   set_tbl_position(t, TBL_BEG);
 
-  /* Binary search to equality, need to use == to test binary */
-  if (strcmp(op, "==") == 0) 
+  /* Binary search to equality, need to use == to test binary;
+     the records of slotted pages are not at computed positions */
+  if (strcmp(op, "==") == 0 && s->tbl->storage != SLOTTED_STORAGE
+      && s->tbl->storage != COLUMN_STORAGE) 
   {
     if (binary_search(rec, s, f->offset, val) == 1) 
     {
@@ -887,9 +1322,17 @@ tbl_p table_search(tbl_p t, char const* attr, char const* op, int val)
       append_record(rec, res_sch);
     }
   } 
+  else if (s->tbl->storage == COLUMN_STORAGE)
+  {
+      while (find_column_record_int_val(rec, s, f, cmp_op, val)) {
+        put_record_info(DEBUG, rec, s);
+        append_record(rec, res_sch);
+      }
+  }
   else 
   {   
-      while (find_record_int_val(rec, s, f->offset, cmp_op, val)) {
+      while (find_record_int_val(rec, s, int_field_offset(s, f), cmp_op,
+                                 val)) {
         put_record_info(DEBUG, rec, s);
         append_record(rec, res_sch);
       }
@@ -899,7 +1342,7 @@ tbl_p table_search(tbl_p t, char const* attr, char const* op, int val)
   put_pager_profiler_info(INFO);
   pager_profiler_reset();
 
-  return res_sch->tbl;
+  return seal_tbl(res_sch->tbl);
 }
   
 
@@ -911,9 +1354,15 @@ tbl_p table_project(tbl_p t, int num_fields, char* fields[])
   if (!dest) return 0;
 
   record rec = new_record(s), rec_dest = new_record(dest);
+  /* in column storage, only the columns of the projection are read */
+  char wanted[s->num_fields];
+  memset(wanted, 0, sizeof wanted);
+  for (size_t i = 0; i < num_fields; i++)
+    wanted[field_index(s, get_field(s, fields[i]))] = 1;
 
   set_tbl_position(t, TBL_BEG);
-  while (get_record(rec, s)) {
+  while (s->tbl->storage == COLUMN_STORAGE
+         ? get_column_fields(rec, s, wanted) > 0 : get_record(rec, s)) {
     fill_sub_record(rec_dest, dest, rec, s);
     put_record_info(DEBUG, rec_dest, dest);
     append_record(rec_dest, dest);
@@ -922,12 +1371,105 @@ tbl_p table_project(tbl_p t, int num_fields, char* fields[])
   release_record(rec, s);
   release_record(rec_dest, dest);
 
-  return dest->tbl;
+  return seal_tbl(dest->tbl);
 }
 
 
 //######################
 
+/** number of outer records a join holds in memory per scan of the
+    inner table, in record_nested_loop_join() */
+#define JOIN_CHUNK_RECORDS 1024
+
+/* A value of the join field of an outer record, and the record */
+typedef struct join_key {
+  int val;
+  int k;
+} join_key;
+
+/* order of join keys by value, then by record */
+static int cmp_join_keys(void const* a, void const* b) {
+  join_key const *x = a, *y = b;
+  if (x->val != y->val)
+    return x->val < y->val ? -1 : 1;
+  return x->k < y->k ? -1 : (x->k > y->k);
+}
+
+/* Nested loop join over the records of the tables, whatever their
+   storage: the outer relation is read JOIN_CHUNK_RECORDS records at a
+   time, and the inner relation is scanned once per chunk, through the
+   column of fld2 alone if it is in column storage; the other columns
+   are read for the records that match only */
+static tbl_p record_nested_loop_join(schema_p left_search, schema_p right_search,
+                                     schema_p dest, field_desc_p fld,
+                                     field_desc_p fld2)
+{
+  record *chunk = malloc(JOIN_CHUNK_RECORDS * sizeof (record));
+  join_key *keys = malloc(JOIN_CHUNK_RECORDS * sizeof (join_key));
+  if (!chunk || !keys) {
+    put_msg(FATAL, "record_nested_loop_join: out of memory.\n");
+    exit(EXIT_FAILURE);
+  }
+  int num_chunk = 0;
+  record right_record = new_record(right_search);
+  record rec_dest = new_record(dest);
+  int i = field_index(left_search, fld), j = field_index(right_search, fld2);
+  int column = right_search->tbl->storage == COLUMN_STORAGE;
+  char join_col[right_search->num_fields], other_cols[right_search->num_fields];
+  for (int f = 0; f < right_search->num_fields; f++) {
+    join_col[f] = f == j;
+    other_cols[f] = f != j;
+  }
+
+  set_tbl_position(left_search->tbl, TBL_BEG);
+  for (;;) {
+    int n = 0;
+    for (; n < JOIN_CHUNK_RECORDS; n++) {
+      if (n == num_chunk)
+        chunk[num_chunk++] = new_record(left_search);
+      if (get_record(chunk[n], left_search) <= 0)
+        break;
+      keys[n] = (join_key) { *(int *) chunk[n][i], n };
+    }
+    if (n == 0) break;
+    qsort(keys, n, sizeof (join_key), cmp_join_keys);
+
+    set_tbl_position(right_search->tbl, TBL_BEG);
+    while (column ? get_column_fields(right_record, right_search, join_col) > 0
+           : get_record(right_record, right_search) > 0) {
+      join_key key = { *(int *) right_record[j], -1 };
+      /* the first key of the value */
+      int lo = 0, hi = n;
+      while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (cmp_join_keys(&keys[mid], &key) < 0)
+          lo = mid + 1;
+        else
+          hi = mid;
+      }
+      if (lo == n || keys[lo].val != key.val) continue;
+      if (column) { /* the rest of the record */
+        right_search->tbl->next_rec--;
+        get_column_fields(right_record, right_search, other_cols);
+      }
+      for (; lo < n && keys[lo].val == key.val; lo++) {
+        join_records(rec_dest, dest, chunk[keys[lo].k], left_search,
+                     right_record, right_search);
+        append_record(rec_dest, dest);
+      }
+    }
+    if (n < JOIN_CHUNK_RECORDS) break;
+  }
+
+  for (int k = 0; k < num_chunk; k++)
+    release_record(chunk[k], left_search);
+  free(chunk);
+  free(keys);
+  release_record(right_record, right_search);
+  release_record(rec_dest, dest);
+  return dest->tbl;
+}
+
 tbl_p table_natural_join(tbl_p left, tbl_p right) {
   if (!(left && right)) 
   {
@@ -935,31 +1477,38 @@ tbl_p table_natural_join(tbl_p left, tbl_p right) {
     return 0;
   }
 
-  tbl_p res = 0;
-
-  /* TODO: assignment 3 */
   schema_p left_search = left->sch;
   schema_p right_search = right->sch;
 
-  schema_p result;
-  tbl_p ret;
-  /* iterate and find common field */
-  for (field_desc_p fld = left_search->first; fld; fld = fld->next)
+  /* the first common field is the one joined on */
+  field_desc_p fld, fld2 = 0;
+  for (fld = left_search->first; fld; fld = fld->next)
   {
-    for(field_desc_p fld2 = right_search->first; fld2; fld2 = fld2->next)
-    {
-      if(strcmp(fld->name, fld2->name) == 0) 
-      {
-        result = join_schema(left_search, right_search, "tmp_sch");
-
-        ret = nested_loop_join(left_search, right_search, result, fld, fld2);
-        //ret = block_nested_loop_join(left_search, right_search, result, fld, fld2);
-      }
-    }
+    for (fld2 = right_search->first; fld2; fld2 = fld2->next)
+      if (strcmp(fld->name, fld2->name) == 0)
+        break;
+    if (fld2)
+      break;
+  }
+  if (!fld)
+  {
+    put_msg(ERROR, "%s and %s have no common field.\n",
+            left_search->name, right_search->name);
+    return 0;
   }
 
+  schema_p result = join_schema(left_search, right_search, "tmp_sch");
+  tbl_p ret;
+  if (left->storage == COLUMN_STORAGE || right->storage == COLUMN_STORAGE)
+    ret = record_nested_loop_join(left_search, right_search, result, fld, fld2);
+  else if (left->storage == ROW_STORAGE && right->storage == ROW_STORAGE)
+    ret = block_nested_loop_join(left_search, right_search, result, fld, fld2);
+  else
+    ret = nested_loop_join(left_search, right_search, result, fld, fld2);
+
   put_pager_profiler_info(INFO);
-  return ret;
+  pager_profiler_reset();
+  return seal_tbl(ret);
 }
 
 tbl_p nested_loop_join(schema_p left_search, schema_p right_search, schema_p dest, field_desc_p fld, field_desc_p fld2)
@@ -970,15 +1519,19 @@ tbl_p nested_loop_join(schema_p left_search, schema_p right_search, schema_p des
 
   set_tbl_position(left_search->tbl, TBL_BEG);
   set_tbl_position(right_search->tbl, TBL_BEG);
+  /* the inner relation is scanned for every outer record */
+  pager_prefetch(right_search->name, 0, file_num_blocks(right_search->name));
 
   int rec_val, rec_val2;
+  int offset = int_field_offset(left_search, fld);
+  int offset2 = int_field_offset(right_search, fld2);
   /* Iterate left - outer relation*/
   for(page_p page_l = get_page_for_next_record(left_search); page_l; page_l = get_page_for_next_record(left_search)) 
   {
     int pg_pos = page_current_pos(page_l);
     get_page_record(page_l, left_record, left_search);
 
-    rec_val = page_get_int_at(page_l, (pg_pos + fld->offset));
+    rec_val = page_get_int_field(page_l, pg_pos, left_search, offset);
     set_tbl_position(right_search->tbl, TBL_BEG);
     
     /* iterate right - inner relation */
@@ -986,7 +1539,7 @@ tbl_p nested_loop_join(schema_p left_search, schema_p right_search, schema_p des
     {
       int pg2_pos = page_current_pos(page_r);
       get_page_record(page_r, right_record, right_search);
-      rec_val2 = page_get_int_at(page_r, (pg2_pos + fld2->offset));
+      rec_val2 = page_get_int_field(page_r, pg2_pos, right_search, offset2);
 
       /* if statment for equal values in records. If true, join those records and append our new table */
       if (rec_val == rec_val2) 
@@ -995,9 +1548,9 @@ tbl_p nested_loop_join(schema_p left_search, schema_p right_search, schema_p des
         append_record(rec_dest, dest);
       }
       /* Update position */
-      page_set_current_pos(page_r, (pg2_pos + right_search->len));
+      page_set_current_pos(page_r, (pg2_pos + rec_step(right_search)));
     }
-    page_set_current_pos(page_l, (pg_pos + left_search->len));
+    page_set_current_pos(page_l, (pg_pos + rec_step(left_search)));
   }
   release_record(rec_dest, dest);
   return dest->tbl;
@@ -1005,91 +1558,70 @@ tbl_p nested_loop_join(schema_p left_search, schema_p right_search, schema_p des
 
 tbl_p block_nested_loop_join(schema_p left_search, schema_p right_search, schema_p dest, field_desc_p fld, field_desc_p fld2) 
 {
-  /* Depending on search length, calculate bytes for records */
-  int blk_size = BLOCK_SIZE - PAGE_HEADER_SIZE; 
-  int free_bytes_left = blk_size - (blk_size % left_search->len);
-  int free_bytes_right = blk_size - (blk_size % right_search->len);
-
-  /* Find records per block */
-  int RPB_s1 = free_bytes_left / left_search->len;
-  int RPB_s2 = free_bytes_right / right_search->len;
-
-  /* Blocks per table */
-  int n_blocks_left = left_search->tbl->num_records / RPB_s1;
-  int n_blocks_right = right_search->tbl->num_records / RPB_s2;
+  int n_blocks_left = file_num_blocks(left_search->name);
+  int n_blocks_right = file_num_blocks(right_search->name);
 
   record left_record = new_record(left_search);
   record right_record = new_record(right_search);
   record rec_dest = new_record(dest);
 
   int rec_val, rec_val2, pos, pos2;
-  set_tbl_position(left_search->tbl, TBL_BEG);
+  int offset = int_field_offset(left_search, fld);
+  int offset2 = int_field_offset(right_search, fld2);
 
-  /* Iterate left*/
-  for (int i = 0; i <= n_blocks_left; i++)
+  /* Iterate left, the outer block stays pinned while the inner table is scanned */
+  for (int i = 0; i < n_blocks_left; i++)
   {
-    page_p blk_outer = get_page(left_search->name, i);
-    set_tbl_position(right_search->tbl, TBL_BEG);
-    
-    /* Iterate outer block*/
-    for (int j = 0; j <= n_blocks_right; j++)
+    page_p blk_outer = get_page_with_strategy(left_search->name, i,
+                                              tbl_ring(left_search->tbl));
+    if (!blk_outer)
     {
-      page_p blk_inner = get_page(right_search->name, j);
+      break;
+    }
+    pager_prefetch(right_search->name, 0, n_blocks_right);
 
-      /* iterate inner block */
-      for (int x = 0; x < RPB_s1; x++) 
+    /* Iterate right, one inner block at a time */
+    for (int j = 0; j < n_blocks_right; j++)
+    {
+      page_p blk_inner = get_page_with_strategy(right_search->name, j,
+                                                tbl_ring(right_search->tbl));
+      if (!blk_inner)
       {
-        /* get page again, in case its not in memory */
-        blk_outer = get_page(left_search->name, i);
-        /* manually set positions to read at */
-        if (x == 0) 
-        {
-          pos = PAGE_HEADER_SIZE;
-        } else 
-        {
-          pos = PAGE_HEADER_SIZE + (x * left_search->len);
-        }
+        break;
+      }
 
+      /* iterate records in outer block */
+      page_set_pos_begin(blk_outer);
+      while (!eop(blk_outer))
+      {
+        pos = page_current_pos(blk_outer);
+        rec_val = page_get_int_field(blk_outer, pos, left_search, offset);
         page_set_current_pos(blk_outer, pos);
-        if (peof(blk_outer))
-        {
-          break;
-        }
-        /* if iterations reaches end of block table, we're done in this inner block  */
-        if (eot(left_search->tbl)) 
-        {
-          break;
-        }
-        get_record(left_record, left_search);
-        rec_val = page_get_int_at(blk_outer, (pos + fld->offset));
-        
+        get_page_record(blk_outer, left_record, left_search);
+
         /* iterate records in inner block */
-        for (int y = 0; y < RPB_s2; y++) 
+        page_set_pos_begin(blk_inner);
+        while (!eop(blk_inner))
         {
-          blk_inner = get_page(right_search->name, j);
-          if (y == 0) 
-          {
-            pos2 = PAGE_HEADER_SIZE;
-          } else 
-          {
-            pos2 = PAGE_HEADER_SIZE + (y * right_search->len);
-          }
-          page_set_current_pos(blk_inner, pos2);
-          if (peof(blk_inner)) {
-            break;
-          }
-          get_record(right_record, right_search);
-          rec_val2 = page_get_int_at(blk_inner, (pos2 + fld2->offset));
-          
+          pos2 = page_current_pos(blk_inner);
+          rec_val2 = page_get_int_field(blk_inner, pos2, right_search,
+                                        offset2);
           if (rec_val == rec_val2) 
           {
+            page_set_current_pos(blk_inner, pos2);
+            get_page_record(blk_inner, right_record, right_search);
             join_records(rec_dest, dest, left_record, left_search, right_record, right_search);
             append_record(rec_dest, dest);
-          }  
+          }
+          page_set_current_pos(blk_inner, (pos2 + rec_step(right_search)));
         }
       }
+      unpin(blk_inner);
     }
+    unpin(blk_outer);
   }
+  release_record(left_record, left_search);
+  release_record(right_record, right_search);
   release_record(rec_dest, dest);
   return dest->tbl;
 }
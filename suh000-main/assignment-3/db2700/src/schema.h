@@ -49,6 +49,15 @@
 typedef enum {INT_TYPE, STR_TYPE} field_type;
 typedef enum {TBL_BEG, TBL_END} tbl_position;
 
+/** @brief Storage of the records of a table, chosen when it is created */
+typedef enum {
+  ROW_STORAGE,        /**< records one after another in the blocks */
+  COMPRESSED_STORAGE, /**< as ROW_STORAGE, in a compressed file */
+  SLOTTED_STORAGE,    /**< records of variable length in slotted pages */
+  PAX_STORAGE,        /**< the values of each field together in a block */
+  COLUMN_STORAGE      /**< the values of each field in a file of its own */
+} tbl_storage;
+
 typedef struct field_desc_struct * field_desc_p;
 typedef struct schema_struct * schema_p;
 typedef struct tbl_desc_struct * tbl_p;
@@ -148,7 +157,8 @@ extern int get_record(record const r, schema_p s);
 */
 extern int put_record(record const r, schema_p s);
 /** Append the record to the table file.
-    The current position moves to the new end of the file.
+    The current position moves to the new end of the file, and the table
+    holds no pin on its pages afterwards.
 */
 extern void append_record(record const r, schema_p s);
 
@@ -156,6 +166,15 @@ extern void append_record(record const r, schema_p s);
 extern tbl_p get_table(char const* name);
 /** Remove a table from the current database */
 extern void remove_table(tbl_p t);
+/** Name of a storage, as in "create table ... using name" */
+extern char const* tbl_storage_name(tbl_storage st);
+/** The storage named @em name, -1 if there is none */
+extern int parse_tbl_storage(char const* name);
+/** Storage of the table of schema @em s */
+extern tbl_storage schema_storage(schema_p s);
+/** Set the storage of the table of schema @em s, which must be empty.
+    Returns 0 upon failure, the table keeps its storage then. */
+extern int set_tbl_storage(schema_p s, tbl_storage st);
 /** Print all rows of a table. */
 extern void table_display(tbl_p s);
 /** Make a new table as the result of a search. */
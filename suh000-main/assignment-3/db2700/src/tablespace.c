@@ -0,0 +1,377 @@
+/**********************************************************
+ * Tablespace: the files of the pager in one Unix file    *
+ **********************************************************/
+
+#define _GNU_SOURCE /* fallocate() */
+#include "tablespace.h"
+#include "pmsg.h"
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/** @brief Header of the tablespace, in the first block of the file */
+typedef struct ts_header {
+  uint32_t magic;           /**< TABLESPACE_MAGIC */
+  uint32_t version;         /**< TABLESPACE_VERSION */
+  uint32_t block_size;      /**< block size in bytes */
+  uint32_t extent_blocks;   /**< number of blocks of an extent */
+  uint32_t num_extents;     /**< number of extents of the file */
+  uint32_t map_bytes;       /**< length of the block map */
+  uint32_t num_map_extents; /**< number of extents holding the block map */
+  uint32_t map_extents[];   /**< extents holding the block map, in order */
+} ts_header;
+
+/** @brief Segment of a file */
+typedef struct segment {
+  char *name;          /**< file name, NULL if the segment is dropped */
+  int num_blocks;      /**< number of blocks written */
+  int num_extents;     /**< number of extents allocated */
+  int max_extents;     /**< room of extents[] */
+  uint32_t *extents;   /**< the extents of the segment, in order */
+} segment;
+
+/** @brief A growable array of extent numbers */
+typedef struct extent_list {
+  uint32_t *extents;
+  int len;
+  int max;
+} extent_list;
+
+static struct {
+  int fd;                 /**< tablespace file, -1 if none is open */
+  long block_size;
+  int extent_blocks;
+  uint32_t num_extents;   /**< extents of the file, extent 0 included */
+  extent_list map;        /**< extents holding the block map */
+  extent_list free;       /**< extents of dropped segments */
+  segment *segs;
+  int num_segs;
+  int max_segs;
+} ts = { .fd = -1 };
+
+static void *grow_array(void* p, int* max, size_t elm_size) {
+  int n = *max ? 2 * *max : 8;
+  p = realloc(p, n * elm_size);
+  if (!p) {
+    put_msg(FATAL, "tablespace: out of memory.\n");
+    exit(EXIT_FAILURE);
+  }
+  *max = n;
+  return p;
+}
+
+static void push_extent(extent_list* l, uint32_t x) {
+  if (l->len == l->max)
+    l->extents = grow_array(l->extents, &l->max, sizeof (uint32_t));
+  l->extents[l->len++] = x;
+}
+
+static off_t extent_offset(uint32_t x) {
+  return (off_t) x * ts.extent_blocks * ts.block_size;
+}
+
+static size_t extent_bytes() {
+  return (size_t) ts.extent_blocks * ts.block_size;
+}
+
+/* A new extent, reusing one of a dropped segment if there is one.
+   Its blocks are allocated on disk in one go, not one by one as they are
+   written. */
+static uint32_t alloc_extent() {
+  uint32_t x = ts.free.len > 0 ? ts.free.extents[--ts.free.len]
+    : ts.num_extents++;
+  /* without it, the extent is allocated by its writes */
+  posix_fallocate(ts.fd, extent_offset(x), extent_bytes());
+  return x;
+}
+
+/* Give the extents of seg back, their blocks read as zeros from now on */
+static void free_extents(segment* s) {
+  for (int i = 0; i < s->num_extents; i++) {
+    uint32_t x = s->extents[i];
+    if (fallocate(ts.fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                  extent_offset(x), extent_bytes()) == -1) {
+      char *zeros = calloc(1, extent_bytes());
+      if (zeros && pwrite(ts.fd, zeros, extent_bytes(), extent_offset(x)) == -1)
+        put_msg(WARN, "tablespace: cannot clear extent %u.\n", x);
+      free(zeros);
+    }
+    push_extent(&ts.free, x);
+  }
+  s->num_extents = 0;
+  s->num_blocks = 0;
+}
+
+/* Serialize the block map: the free extents, then for every segment its
+   name length, name, number of blocks, number of extents and extents.
+   Returns the length of the map in *len, free() the map when done. */
+static char *encode_map(size_t* len) {
+  size_t n = 2 * sizeof (uint32_t) + ts.free.len * sizeof (uint32_t);
+  for (int i = 0; i < ts.num_segs; i++)
+    if (ts.segs[i].name)
+      n += 3 * sizeof (uint32_t) + strlen(ts.segs[i].name)
+        + ts.segs[i].num_extents * sizeof (uint32_t);
+  char *buf = malloc(n), *p = buf;
+  if (!buf) return 0;
+#define PUT(v) do { uint32_t v_ = (v); memcpy(p, &v_, 4); p += 4; } while (0)
+  PUT(ts.free.len);
+  for (int i = 0; i < ts.free.len; i++)
+    PUT(ts.free.extents[i]);
+  int num_segs = 0;
+  for (int i = 0; i < ts.num_segs; i++)
+    num_segs += ts.segs[i].name != 0;
+  PUT(num_segs);
+  for (int i = 0; i < ts.num_segs; i++) {
+    segment *s = &ts.segs[i];
+    if (!s->name) continue;
+    PUT(strlen(s->name));
+    memcpy(p, s->name, strlen(s->name));
+    p += strlen(s->name);
+    PUT(s->num_blocks);
+    PUT(s->num_extents);
+    for (int k = 0; k < s->num_extents; k++)
+      PUT(s->extents[k]);
+  }
+#undef PUT
+  *len = n;
+  return buf;
+}
+
+/* Parse the block map of len bytes in buf. Returns 0 if it is invalid. */
+static int decode_map(char const* buf, size_t len) {
+  char const* p = buf, *end = buf + len;
+  uint32_t v;
+#define GET(v) (p + 4 <= end ? (memcpy(&(v), p, 4), p += 4, 1) : 0)
+  uint32_t num_free, num_segs;
+  if (!GET(num_free)) return 0;
+  for (uint32_t i = 0; i < num_free; i++) {
+    if (!GET(v)) return 0;
+    push_extent(&ts.free, v);
+  }
+  if (!GET(num_segs)) return 0;
+  for (uint32_t i = 0; i < num_segs; i++) {
+    uint32_t name_len, num_blocks, num_extents;
+    if (!GET(name_len) || p + name_len > end) return 0;
+    char *name = strndup(p, name_len);
+    p += name_len;
+    if (!GET(num_blocks) || !GET(num_extents)) {
+      free(name);
+      return 0;
+    }
+    int seg = ts_segment(name, 1);
+    free(name);
+    segment *s = &ts.segs[seg];
+    s->num_blocks = num_blocks;
+    for (uint32_t k = 0; k < num_extents; k++) {
+      if (!GET(v)) return 0;
+      if (s->num_extents == s->max_extents)
+        s->extents = grow_array(s->extents, &s->max_extents, sizeof (uint32_t));
+      s->extents[s->num_extents++] = v;
+    }
+  }
+#undef GET
+  return p == end;
+}
+
+/* Read the header and the block map of the tablespace */
+static int load_tablespace(char const* path) {
+  ts_header *h = malloc(ts.block_size);
+  if (!h || pread(ts.fd, h, ts.block_size, 0) != ts.block_size
+      || h->magic != TABLESPACE_MAGIC || h->version != TABLESPACE_VERSION
+      || h->block_size != ts.block_size || h->extent_blocks < 1) {
+    put_msg(ERROR, "%s: invalid tablespace header.\n", path);
+    free(h);
+    return 0;
+  }
+  ts.extent_blocks = h->extent_blocks;
+  ts.num_extents = h->num_extents;
+  for (uint32_t i = 0; i < h->num_map_extents; i++)
+    push_extent(&ts.map, h->map_extents[i]);
+
+  size_t len = h->map_bytes, done = 0;
+  char *buf = malloc(len + 1);
+  for (int i = 0; buf && done < len && i < ts.map.len; i++) {
+    size_t n = len - done < extent_bytes() ? len - done : extent_bytes();
+    if (pread(ts.fd, buf + done, n, extent_offset(ts.map.extents[i])) != n)
+      break;
+    done += n;
+  }
+  int res = buf && done == len && decode_map(buf, len);
+  if (!res)
+    put_msg(ERROR, "%s: invalid tablespace block map.\n", path);
+  free(buf);
+  free(h);
+  return res;
+}
+
+int ts_sync(void) {
+  if (ts.fd == -1) return 0;
+  size_t len, max_map_extents =
+    (ts.block_size - sizeof (ts_header)) / sizeof (uint32_t);
+  char *buf;
+  /* a map extent taken from the free ones changes the map */
+  while ((buf = encode_map(&len)) && ts.map.len * extent_bytes() < len) {
+    free(buf);
+    if (ts.map.len == max_map_extents) {
+      put_msg(ERROR, "tablespace: the block map of %zu bytes is too large.\n",
+              len);
+      return 0;
+    }
+    push_extent(&ts.map, alloc_extent());
+  }
+  if (!buf) return 0;
+  int res = 1;
+  for (size_t i = 0, done = 0; done < len; i++) {
+    size_t n = len - done < extent_bytes() ? len - done : extent_bytes();
+    if (pwrite(ts.fd, buf + done, n, extent_offset(ts.map.extents[i])) != n)
+      res = 0;
+    done += n;
+  }
+  free(buf);
+
+  ts_header *h = calloc(1, ts.block_size);
+  if (!h) return 0;
+  h->magic = TABLESPACE_MAGIC;
+  h->version = TABLESPACE_VERSION;
+  h->block_size = ts.block_size;
+  h->extent_blocks = ts.extent_blocks;
+  h->num_extents = ts.num_extents;
+  h->map_bytes = len;
+  h->num_map_extents = ts.map.len;
+  memcpy(h->map_extents, ts.map.extents, ts.map.len * sizeof (uint32_t));
+  /* the header last, so that it points to a complete map */
+  if (res && pwrite(ts.fd, h, ts.block_size, 0) != ts.block_size)
+    res = 0;
+  free(h);
+  if (!res)
+    put_msg(ERROR, "tablespace: cannot write the block map.\n");
+  return res;
+}
+
+/* Close the tablespace file and forget the block map, without writing it */
+static void release_tablespace() {
+  if (ts.fd != -1) close(ts.fd);
+  ts.fd = -1;
+  for (int i = 0; i < ts.num_segs; i++) {
+    free(ts.segs[i].name);
+    free(ts.segs[i].extents);
+  }
+  free(ts.segs);
+  free(ts.map.extents);
+  free(ts.free.extents);
+  ts.segs = 0;
+  ts.num_segs = ts.max_segs = 0;
+  memset(&ts.map, 0, sizeof ts.map);
+  memset(&ts.free, 0, sizeof ts.free);
+  ts.num_extents = 0;
+}
+
+int ts_open(char const* path, long block_size, int extent_blocks) {
+  ts_close();
+  struct stat st;
+  ts.fd = open(path, O_RDWR | O_CREAT, 0600);
+  if (ts.fd == -1 || fstat(ts.fd, &st) == -1) {
+    put_msg(ERROR, "cannot open the tablespace %s.\n", path);
+    release_tablespace();
+    return 0;
+  }
+  ts.block_size = block_size;
+  if (st.st_size > 0) {
+    if (!load_tablespace(path)) {
+      release_tablespace();
+      return 0;
+    }
+    if (ts.extent_blocks != extent_blocks)
+      put_msg(DEBUG, "tablespace %s has extents of %d blocks, not %d.\n",
+              path, ts.extent_blocks, extent_blocks);
+    return 1;
+  }
+  ts.extent_blocks = extent_blocks > 0 ? extent_blocks : 1;
+  ts.num_extents = 1; /* the header */
+  if (!ts_sync()) {
+    release_tablespace();
+    return 0;
+  }
+  return 1;
+}
+
+int ts_close(void) {
+  if (ts.fd == -1) return 1;
+  int res = ts_sync();
+  release_tablespace();
+  return res;
+}
+
+int ts_active(void) {
+  return ts.fd != -1;
+}
+
+int ts_fd(void) {
+  return ts.fd;
+}
+
+int ts_extent_blocks(void) {
+  return ts.extent_blocks;
+}
+
+int ts_segment(char const* name, int create) {
+  int empty = -1;
+  for (int i = 0; i < ts.num_segs; i++)
+    if (!ts.segs[i].name)
+      empty = i;
+    else if (strcmp(ts.segs[i].name, name) == 0)
+      return i;
+  if (!create) return -1;
+  if (empty == -1) {
+    if (ts.num_segs == ts.max_segs)
+      ts.segs = grow_array(ts.segs, &ts.max_segs, sizeof (segment));
+    empty = ts.num_segs++;
+    memset(&ts.segs[empty], 0, sizeof (segment));
+  }
+  ts.segs[empty].name = strdup(name);
+  ts.segs[empty].num_blocks = 0;
+  return empty;
+}
+
+int ts_num_blocks(int seg) {
+  return ts.segs[seg].num_blocks;
+}
+
+int ts_grow(int seg, int num_blocks) {
+  segment *s = &ts.segs[seg];
+  while ((long) s->num_extents * ts.extent_blocks < num_blocks) {
+    if (s->num_extents == s->max_extents)
+      s->extents = grow_array(s->extents, &s->max_extents, sizeof (uint32_t));
+    s->extents[s->num_extents++] = alloc_extent();
+  }
+  return 1;
+}
+
+void ts_written(int seg, int blk_nr) {
+  if (blk_nr >= ts.segs[seg].num_blocks)
+    ts.segs[seg].num_blocks = blk_nr + 1;
+}
+
+long ts_block(int seg, int blk_nr) {
+  segment *s = &ts.segs[seg];
+  int x = blk_nr / ts.extent_blocks;
+  if (blk_nr < 0 || x >= s->num_extents) return -1;
+  return (long) s->extents[x] * ts.extent_blocks + blk_nr % ts.extent_blocks;
+}
+
+int ts_rename(char const* name, char const* new_name) {
+  int seg = ts_segment(name, 0), old = ts_segment(new_name, 0);
+  if (seg == -1) return 0;
+  if (old == seg) return 1;
+  if (old != -1) {
+    free_extents(&ts.segs[old]);
+    free(ts.segs[old].name);
+    ts.segs[old].name = 0;
+  }
+  free(ts.segs[seg].name);
+  ts.segs[seg].name = strdup(new_name);
+  return 1;
+}
@@ -0,0 +1,64 @@
+/** @file tablespace.h
+ * @brief A tablespace keeping the blocks of all files in one Unix file.
+ *
+ * With a tablespace, the files of the pager are <em>segments</em> of
+ * one Unix file instead of a Unix file each, so a query over many
+ * tables needs one descriptor and no open() or close() per table.
+ *
+ * The tablespace file is a sequence of extents of a fixed number of
+ * blocks. The first block of extent 0 is the header of the tablespace.
+ * A segment gets one extent after another as it grows, and block n of
+ * a segment is block n % extent_blocks of its extent n / extent_blocks,
+ * so the blocks of an extent are adjacent on disk.
+ * The extents of a dropped segment are reused by the others.
+ *
+ * The block map, i.e. the extents and the number of blocks of every
+ * segment, is kept in memory, and written to the map extents listed
+ * in the header by @ref ts_sync "ts_sync()" and @ref ts_close
+ * "ts_close()".
+ */
+
+#ifndef _TABLESPACE_H_
+#define _TABLESPACE_H_
+
+/** "TSPC" */
+#define TABLESPACE_MAGIC 0x43505354u
+
+#define TABLESPACE_VERSION 1
+
+/** Open the tablespace in file @em path, creating it with extents of
+    @em extent_blocks blocks of @em block_size bytes if it does not exist.
+    An existing tablespace keeps the extent size it was created with.
+    Returns 0 upon failure. */
+extern int ts_open(char const* path, long block_size, int extent_blocks);
+/** Write the block map and close the tablespace.
+    Returns 0 if the block map cannot be written. */
+extern int ts_close(void);
+/** Write the block map. Returns 0 upon failure. */
+extern int ts_sync(void);
+/** Whether a tablespace is open. */
+extern int ts_active(void);
+/** Descriptor of the tablespace file, -1 if none is open. */
+extern int ts_fd(void);
+/** Number of blocks of an extent. */
+extern int ts_extent_blocks(void);
+
+/** Segment of file @em name, a new empty one if there is none and
+    @em create is non-zero. Returns -1 if there is no such segment. */
+extern int ts_segment(char const* name, int create);
+/** Number of blocks written to segment @em seg. */
+extern int ts_num_blocks(int seg);
+/** Allocate the extents for the first @em num_blocks blocks of
+    segment @em seg. Returns 0 upon failure. */
+extern int ts_grow(int seg, int num_blocks);
+/** Note that block @em blk_nr of segment @em seg is written. */
+extern void ts_written(int seg, int blk_nr);
+/** Block number in the tablespace file of block @em blk_nr of segment
+    @em seg, -1 if its extent is not allocated. */
+extern long ts_block(int seg, int blk_nr);
+/** Rename the segment of file @em name to @em new_name, dropping the
+    segment that has this name already.
+    Returns 0 if there is no segment of file @em name. */
+extern int ts_rename(char const* name, char const* new_name);
+
+#endif
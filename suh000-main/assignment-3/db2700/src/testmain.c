@@ -1,4 +1,5 @@
 #include "test_data_gen.h"
+#include "testpager.h"
 #include "testschema.h"
 #include "pmsg.h"
 #include <ctype.h>
@@ -10,11 +11,13 @@
 void handle_test_options(int argc, char* argv[]) {                          /* Handele test option -h/-m/-d*/
   int c;
   char new_sys_dir[512];                                                    /* Blocks of 512 bytes */
+  pager_config cfg;
 
   new_sys_dir[0] = '\0';
   msglevel = INFO;
+  pager_config_default(&cfg);
 
-  while ((c = getopt(argc, argv, "hm:d:")) != -1)
+  while ((c = getopt(argc, argv, "hm:d:" PAGER_OPTIONS)) != -1)
     switch (c) 
     {
     case 'h':                                                               /* Test flag option h gives iformation abouth test flags */
@@ -22,6 +25,7 @@ void handle_test_options(int argc, char* argv[]) {                          /* H
       printf("\t-h           help, print this message\n");                  /* -h prints this info */
       printf("\t-m [fewid]   msg level [fatal,error,warn,info,debug]\n");   /* -m provides msg info/debug/error an requres an argument */
       printf("\t-d db_dir  default to ./tests/testdb\n");                   /* -d requires an argument */
+      put_pager_config_usage();                                             /* -p/-P/-b/-f configure the pager */
       exit(0);
     case 'm':                                                               /* Test flag -m set meg level */
       switch (optarg[0]) {
@@ -36,20 +40,27 @@ void handle_test_options(int argc, char* argv[]) {                          /* H
       strcpy(new_sys_dir, optarg);
       break;
     case '?':
-      if (optopt == 'm' || optopt == 'd' || optopt == 'c')                   /* Send print if argument not given */
+      if (optopt == 'm' || optopt == 'd' || optopt == 'c'                    /* Send print if argument not given */
+          || strchr(PAGER_OPTIONS, optopt))
         printf("Option -%c requires an argument.\n", optopt);
       else if (isprint(optopt))                                               /* */
         printf("Unknown option `-%c'.\n", optopt);
       else
         printf("Unknown option character `\\x%x'.\n", optopt);
       abort();
-    default:
-      abort();
+    default:                                                                /* Pager options */
+      if (pager_config_option(&cfg, c, optarg) != 1)
+        abort();
     }
 
   if (new_sys_dir[0] == '\0')
     strcpy(new_sys_dir, "./tests/testdb");
 
+  if (!pager_init(&cfg)) {
+    put_msg(ERROR, "invalid pager configuration\n");
+    exit(EXIT_FAILURE);
+  }
+
   if (!set_system_dir(new_sys_dir)) {
     put_msg(ERROR, "cannot set system dir at %s\n", new_sys_dir);
     exit(EXIT_FAILURE);
@@ -67,11 +78,39 @@ int main(int argc, char* argv[]) {
   test_page_read_with_offset("testpage_w_offset");
   */
 
+  test_page_policies("testpage_policies");
+  test_page_pins("testpage_policies");
+  test_page_vectored("testpage_vectored");
+  test_page_readahead("testpage_policies");
+  test_page_io_engine("testpage_vectored");
+  test_page_mmap("testpage_policies");
+  test_page_write_back("testpage_policies");
+  test_page_write_failure("testpage_policies");
+  test_page_cleaner("testpage_policies");
+  test_page_threads("testpage_policies", "testpage_threads");
+  test_page_huge_pages("testpage_threads");
+  test_page_strategy("testpage_policies");
+  test_page_profiler("testpage_policies");
+  test_page_trace("testpage_policies");
+  test_page_io_estimate("testpage_policies");
+  test_page_fd_cache("testpage_fd");
+  test_page_tablespace("testpage.tablespace");
+  test_page_prealloc("testpage_prealloc");
+  test_page_compressed("testpage_compressed");
+  test_page_wal("testpage_policies");
+  test_page_wal_checkpoint("testpage_policies");
+  test_page_wal_pinned("testpage_policies");
+
   char my_tbl[] = "Me";
   test_tbl_write(my_tbl);
   test_tbl_read(my_tbl);
 
-  test_tbl_natural_join(my_tbl, "You");                                                              
+  test_tbl_natural_join(my_tbl, "You");
+  test_tbl_storage("Slotted", SLOTTED_STORAGE, my_tbl);
+  test_tbl_storage("Pax", PAX_STORAGE, my_tbl);
+  test_tbl_storage("Column", COLUMN_STORAGE, my_tbl);
+  test_tbl_reopen("Reopen", SLOTTED_STORAGE, "Reopen", 20000);
+  test_tbl_reopen("ReopenCol", COLUMN_STORAGE, "ReopenCol.Str.dict", 20000);
 
   return (0);
 }
@@ -1,6 +1,17 @@
 #include "testpager.h"
+#include "pagetrace.h"
+#include "tablespace.h"
+#include "lz.h"
+#include "wal.h"
 #include "pmsg.h"
 #include <string.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <signal.h>
 
 #define NUM_BLOCKS_IN_FILE 20 /* can be greater than NUM_PAGES */
 #define NUM_RECORDS_IN_BLOCK 3
@@ -11,7 +22,7 @@ static size_t str_len = 14;
 
 void test_page_write(char const* fname) {
   put_msg(INFO, "test_page_write() ...\n");
-  pager_init();
+  pager_init(NULL);
   /* put_pager_info(DEBUG, "After pager_init"); */
 
   page_p pg;
@@ -49,7 +60,7 @@ void test_page_write(char const* fname) {
 
 void test_page_read(char const* fname) {
   put_msg(INFO, "test_page_read() ...\n");
-  pager_init();
+  pager_init(NULL);
   /* put_pager_info(DEBUG, "After pager_init"); */
 
   page_p pg;
@@ -97,7 +108,7 @@ void test_page_read(char const* fname) {
 
 void test_page_write_with_offset(char const* fname) {
   put_msg(INFO, "test_page_write_with_offset() ...\n");
-  pager_init();
+  pager_init(NULL);
   /* put_pager_info(DEBUG, "After pager_init"); */
 
   page_p pg;
@@ -133,7 +144,7 @@ void test_page_write_with_offset(char const* fname) {
 
 void test_page_read_with_offset(char const* fname) {
   put_msg(INFO, "test_page_read_with_offset() ...\n");
-  pager_init();
+  pager_init(NULL);
   /* put_pager_info(DEBUG, "After pager_init"); */
 
   page_p pg;
@@ -180,3 +191,1130 @@ void test_page_read_with_offset(char const* fname) {
   /* put_pager_info(DEBUG, "After pager_terminate"); */
   put_msg(INFO, "test_page_read_with_offset() succeeds.\n");
 }
+
+void test_page_policies(char const* fname) {
+  put_msg(INFO, "test_page_policies() ...\n");
+  pager_config saved = pager_cfg, cfg = pager_cfg;
+
+  for (int policy = 0; policy < NUM_PAGER_POLICIES; policy++) {
+    put_msg(INFO, "page replacement policy %s\n", pager_policy_name(policy));
+    cfg.policy = policy;
+    if (!pager_init(&cfg)) {
+      put_msg(FATAL, "pager_init with policy %s fails\n",
+              pager_policy_name(policy));
+      exit(EXIT_FAILURE);
+    }
+    test_page_write(fname);
+    test_page_read(fname);
+
+    /* a skewed access pattern: a few hot blocks between scans */
+    pager_init(NULL);
+    for (size_t round = 0; round < 3; round++)
+      for (size_t bnr = 0; bnr < NUM_BLOCKS_IN_FILE; bnr++) {
+        size_t hot = bnr % 2 ? bnr : bnr % 3;
+        page_p pg = get_page(fname, hot);
+        page_set_pos_begin(pg);
+        if (!pg || page_get_int(pg) != ints_in[0] + hot) {
+          put_msg(FATAL, "test_page_policies fails with policy %s at block %d\n",
+                  pager_policy_name(policy), hot);
+          exit(EXIT_FAILURE);
+        }
+        unpin(pg);
+      }
+    put_pager_profiler_info(INFO);
+    pager_terminate();
+  }
+
+  pager_init(&saved);
+  put_msg(INFO, "test_page_policies() succeeds.\n");
+}
+
+void test_page_pins(char const* fname) {
+  put_msg(INFO, "test_page_pins() ...\n");
+  pager_config saved = pager_cfg, cfg = pager_cfg;
+  cfg.num_pages = 2;
+  pager_init(&cfg);
+
+  page_p pg0 = get_page(fname, 0);
+  page_p again = get_page(fname, 0);
+  page_p pg1 = get_page(fname, 1);
+  if (!pg0 || again != pg0 || !pg1 || page_pin_count(pg0) != 2) {
+    put_msg(FATAL, "test_page_pins fails: page of block 0 should have 2 pins\n");
+    exit(EXIT_FAILURE);
+  }
+  unpin(again);
+
+  /* all pages are pinned, a pinned page must not be stolen */
+  if (get_page(fname, 2)) {
+    put_msg(FATAL, "test_page_pins fails: got a page while all pages are pinned\n");
+    exit(EXIT_FAILURE);
+  }
+  if (page_pin_count(pg0) != 1 || page_block_nr(pg0) != 0
+      || page_block_nr(pg1) != 1) {
+    put_msg(FATAL, "test_page_pins fails: pinned pages were replaced\n");
+    exit(EXIT_FAILURE);
+  }
+
+  /* after the last pin of block 1 is dropped, its page can be replaced */
+  unpin(pg1);
+  page_p pg2 = get_page(fname, 2);
+  if (!pg2 || pg2 != pg1 || page_block_nr(pg0) != 0) {
+    put_msg(FATAL, "test_page_pins fails: the unpinned page should be replaced\n");
+    exit(EXIT_FAILURE);
+  }
+  unpin(pg2);
+  unpin(pg0);
+  pager_terminate();
+
+  pager_init(&saved);
+  put_msg(INFO, "test_page_pins() succeeds.\n");
+}
+
+#define NUM_VECTORED_BLOCKS 8
+
+void test_page_vectored(char const* fname) {
+  put_msg(INFO, "test_page_vectored() ...\n");
+  test_page_write(fname);
+
+  page_p pgs[NUM_VECTORED_BLOCKS];
+  int first = 2;
+  pager_init(NULL);
+  get_page(fname, first + 3); /* a buffered block in the middle of the run */
+  if (get_pages(fname, first, NUM_VECTORED_BLOCKS, pgs) != NUM_VECTORED_BLOCKS) {
+    put_msg(FATAL, "get_pages %d blocks fails\n", NUM_VECTORED_BLOCKS);
+    exit(EXIT_FAILURE);
+  }
+  unpin(pgs[3]);
+  for (int i = 0; i < NUM_VECTORED_BLOCKS; i++) {
+    int val = page_get_int_at(pgs[i], PAGE_HEADER_SIZE);
+    if (val != ints_in[0] + first + i) {
+      put_msg(FATAL, "test_page_vectored fails: (read: %d, should be %d)\n",
+              val, ints_in[0] + first + i);
+      exit(EXIT_FAILURE);
+    }
+    page_put_int_at(pgs[i], PAGE_HEADER_SIZE, val + 100);
+  }
+  write_pages(pgs, NUM_VECTORED_BLOCKS);
+  for (int i = 0; i < NUM_VECTORED_BLOCKS; i++)
+    unpin(pgs[i]);
+  put_pager_profiler_info(INFO);
+  pager_terminate();
+
+  /* read back the written blocks */
+  pager_init(NULL);
+  get_pages(fname, first, NUM_VECTORED_BLOCKS, pgs);
+  for (int i = 0; i < NUM_VECTORED_BLOCKS; i++) {
+    int val = page_get_int_at(pgs[i], PAGE_HEADER_SIZE);
+    if (val != ints_in[0] + first + i + 100) {
+      put_msg(FATAL, "test_page_vectored fails: (read: %d, should be %d)\n",
+              val, ints_in[0] + first + i + 100);
+      exit(EXIT_FAILURE);
+    }
+    unpin(pgs[i]);
+  }
+  put_pager_profiler_info(INFO);
+  pager_terminate();
+  put_msg(INFO, "test_page_vectored() succeeds.\n");
+}
+
+void test_page_readahead(char const* fname) {
+  put_msg(INFO, "test_page_readahead() ...\n");
+  pager_config saved = pager_cfg, cfg = pager_cfg;
+  cfg.num_pages = 16; /* read ahead at most 4 blocks at a time */
+  pager_init(&cfg);
+
+  int n = pager_prefetch(fname, 0, NUM_BLOCKS_IN_FILE);
+  if (n != 4) {
+    put_msg(FATAL, "test_page_readahead fails: prefetched %d blocks, should be 4\n", n);
+    exit(EXIT_FAILURE);
+  }
+  pager_terminate();
+
+  /* a scan is read ahead and must see the same data */
+  pager_init(&cfg);
+  test_page_read(fname);
+  pager_init(&saved);
+  put_msg(INFO, "test_page_readahead() succeeds.\n");
+}
+
+void test_page_io_engine(char const* fname) {
+  put_msg(INFO, "test_page_io_engine() ...\n");
+  pager_config saved = pager_cfg, cfg = pager_cfg;
+  cfg.io_engine = PAGER_IO_URING;
+  cfg.num_pages = 16;
+  cfg.io_depth = 4;
+  pager_init(&cfg);
+
+  /* the vectored and read-ahead paths, now through io_uring
+     (or synchronous I/O if io_uring is not available) */
+  test_page_vectored(fname);
+  test_page_write(fname);
+  test_page_readahead(fname);
+
+  pager_init(&saved);
+  put_msg(INFO, "test_page_io_engine() succeeds.\n");
+}
+
+void test_page_mmap(char const* fname) {
+  put_msg(INFO, "test_page_mmap() ...\n");
+  pager_config saved = pager_cfg, cfg = pager_cfg;
+  cfg.access = PAGER_MMAP;
+  pager_init(&cfg);
+  if (pager_cfg.access != PAGER_MMAP) {
+    /* a tablespace or a log: the pager falls back to copying */
+    pager_init(&saved);
+    put_msg(INFO, "test_page_mmap() succeeds, the files are copied.\n");
+    return;
+  }
+
+  /* the existing file is read through its mapping */
+  test_page_read(fname);
+
+  pager_init(NULL);
+  page_p pg = get_page(fname, 0);
+  if (!pg || page_put_int_at(pg, PAGE_HEADER_SIZE, 0)) {
+    put_msg(FATAL, "test_page_mmap fails: a mapped page must be read-only\n");
+    exit(EXIT_FAILURE);
+  }
+  unpin(pg);
+  pager_terminate();
+
+  /* a file written by the copy pager, then mapped */
+  pager_init(&saved);
+  test_page_write(fname);
+  pager_init(NULL);
+  pg = get_page(fname, 1);
+  page_put_int_at(pg, PAGE_HEADER_SIZE, 2700);
+  unpin(pg);
+  if (!map_file(fname) || !(pg = get_page(fname, 1))
+      || page_get_int_at(pg, PAGE_HEADER_SIZE) != 2700) {
+    put_msg(FATAL, "test_page_mmap fails: the mapping must see the written block\n");
+    exit(EXIT_FAILURE);
+  }
+  unpin(pg);
+  pager_terminate();
+
+  test_page_write(fname);
+  pager_init(&saved);
+  put_msg(INFO, "test_page_mmap() succeeds.\n");
+}
+
+/* The int at the beginning of block bnr, as it is on disk */
+static int disk_int(char const* fname, int bnr) {
+  int val = 0, fd = open(fname, O_RDONLY);
+  pread(fd, &val, INT_SIZE, BLOCK_SIZE * bnr + PAGE_HEADER_SIZE);
+  close(fd);
+  return val;
+}
+
+void test_page_write_back(char const* fname) {
+  put_msg(INFO, "test_page_write_back() ...\n");
+  test_page_write(fname);
+  pager_config saved = pager_cfg, cfg = pager_cfg;
+  cfg.num_pages = 4;
+  cfg.clean_target = 0; /* no writes behind the back of the test */
+  pager_init(&cfg);
+
+  /* unpin() keeps a dirty page in the buffer */
+  for (int i = 0; i < 3; i++) {
+    page_p pg = get_page(fname, 0);
+    page_put_int_at(pg, PAGE_HEADER_SIZE, 2700 + i);
+    unpin(pg);
+  }
+  if (disk_int(fname, 0) != ints_in[0]) {
+    put_msg(FATAL, "test_page_write_back fails: block 0 written before a flush\n");
+    exit(EXIT_FAILURE);
+  }
+  pager_flush();
+  if (disk_int(fname, 0) != 2702) {
+    put_msg(FATAL, "test_page_write_back fails: block 0 not flushed\n");
+    exit(EXIT_FAILURE);
+  }
+
+  /* dirty pages are written back when they are replaced */
+  for (int bnr = 1; bnr < 3; bnr++) {
+    page_p pg = get_page(fname, bnr);
+    page_put_int_at(pg, PAGE_HEADER_SIZE, 2700 + bnr);
+    unpin(pg);
+  }
+  for (int bnr = 10; bnr < 14; bnr++)
+    unpin(get_page(fname, bnr));
+  for (int bnr = 1; bnr < 3; bnr++)
+    if (disk_int(fname, bnr) != 2700 + bnr) {
+      put_msg(FATAL, "test_page_write_back fails: replaced block %d not written\n", bnr);
+      exit(EXIT_FAILURE);
+    }
+  put_pager_profiler_info(INFO);
+  pager_terminate();
+
+  test_page_write(fname);
+  pager_init(&saved);
+  put_msg(INFO, "test_page_write_back() succeeds.\n");
+}
+
+void test_page_write_failure(char const* fname) {
+  put_msg(INFO, "test_page_write_failure() ...\n");
+  test_page_write(fname);
+  pager_config saved = pager_cfg, cfg = pager_cfg;
+  cfg.num_pages = 4;
+  cfg.clean_target = 0;
+  cfg.io_engine = PAGER_IO_SYNC;
+
+  /* a child fills the buffer with dirty blocks it cannot write back
+     beyond a file size limit, and replaces none of them; the blocks are
+     not in sequence, so that none is read ahead */
+  int const blocks[] = {17, 11, 15, 13};
+  pid_t pid = fork();
+  if (pid == 0) {
+    if (!pager_init(&cfg))
+      _exit(EXIT_FAILURE);
+    for (int i = 0; i < 4; i++) {
+      page_p pg = get_page(fname, blocks[i]);
+      page_put_int_at(pg, PAGE_HEADER_SIZE, 2700 + blocks[i]);
+      unpin(pg);
+    }
+    struct rlimit lim, old;
+    getrlimit(RLIMIT_FSIZE, &old);
+    lim = old;
+    lim.rlim_cur = 10 * BLOCK_SIZE;
+    signal(SIGXFSZ, SIG_IGN);
+    setrlimit(RLIMIT_FSIZE, &lim);
+    page_p pg = get_page(fname, 0);
+    setrlimit(RLIMIT_FSIZE, &old);
+    if (pg)
+      _exit(2); /* a dirty block was replaced */
+    pager_terminate(); /* and written back now */
+    _exit(0);
+  }
+  int status;
+  if (pid == -1 || waitpid(pid, &status, 0) != pid || !WIFEXITED(status)
+      || WEXITSTATUS(status) != 0) {
+    put_msg(FATAL, "test_page_write_failure fails: no child (%d)\n",
+            WEXITSTATUS(status));
+    exit(EXIT_FAILURE);
+  }
+  for (int i = 0; i < 4; i++)
+    if (disk_int(fname, blocks[i]) != 2700 + blocks[i]) {
+      put_msg(FATAL, "test_page_write_failure fails: block %d lost\n",
+              blocks[i]);
+      exit(EXIT_FAILURE);
+    }
+
+  test_page_write(fname);
+  pager_init(&saved);
+  put_msg(INFO, "test_page_write_failure() succeeds.\n");
+}
+
+void test_page_cleaner(char const* fname) {
+  put_msg(INFO, "test_page_cleaner() ...\n");
+  test_page_write(fname);
+  pager_config saved = pager_cfg, cfg = pager_cfg;
+  cfg.num_pages = 8;
+  cfg.clean_target = 50;
+  pager_init(&cfg);
+
+  for (int bnr = 0; bnr < 8; bnr++) {
+    page_p pg = get_page(fname, bnr);
+    page_put_int_at(pg, PAGE_HEADER_SIZE, 2700 + bnr);
+    unpin(pg);
+  }
+  /* the cleaner writes back at least half of the pages on its own,
+     the least recently used first */
+  int num_written = 0;
+  for (int wait = 0; wait < 200 && num_written < 4; wait++) {
+    usleep(10000);
+    num_written = 0;
+    for (int bnr = 0; bnr < 8; bnr++)
+      num_written += disk_int(fname, bnr) == 2700 + bnr;
+  }
+  if (num_written < 4 || disk_int(fname, 0) != 2700) {
+    put_msg(FATAL, "test_page_cleaner fails: %d pages written back\n", num_written);
+    exit(EXIT_FAILURE);
+  }
+  put_pager_profiler_info(INFO);
+  pager_terminate();
+  for (int bnr = 0; bnr < 8; bnr++)
+    if (disk_int(fname, bnr) != 2700 + bnr) {
+      put_msg(FATAL, "test_page_cleaner fails: block %d not written back\n", bnr);
+      exit(EXIT_FAILURE);
+    }
+
+  test_page_write(fname);
+  pager_init(&saved);
+  put_msg(INFO, "test_page_cleaner() succeeds.\n");
+}
+
+#define NUM_SCAN_THREADS 4
+#define NUM_SCAN_ROUNDS 50
+
+typedef struct {
+  char const* fname;
+  int ok;
+} scan_arg;
+
+/* Scan a file written by test_page_write() over and over, holding a pin
+   on its first block, which the other threads scanning it share */
+static void *scan_thread(void* arg) {
+  scan_arg *a = arg;
+  page_p first = get_page(a->fname, 0);
+  a->ok = first != NULL;
+  for (int round = 0; a->ok && round < NUM_SCAN_ROUNDS; round++)
+    for (int bnr = 0; a->ok && bnr < NUM_BLOCKS_IN_FILE; bnr++) {
+      page_p pg = get_page(a->fname, bnr);
+      if (!pg || page_block_nr(pg) != bnr) {
+        a->ok = 0;
+        break;
+      }
+      page_latch(pg, 0);
+      for (size_t i = 0; i < NUM_RECORDS_IN_BLOCK; i++)
+        if (page_get_int_at(pg, PAGE_HEADER_SIZE + i*(INT_SIZE + str_len))
+            != ints_in[i] + bnr)
+          a->ok = 0;
+      page_unlatch(pg);
+      unpin(pg);
+    }
+  unpin(first);
+  return arg;
+}
+
+void test_page_threads(char const* fname1, char const* fname2) {
+  put_msg(INFO, "test_page_threads() ...\n");
+  test_page_write(fname1);
+  test_page_write(fname2);
+  pager_config saved = pager_cfg, cfg = pager_cfg;
+  cfg.num_pages = 8;
+  pager_init(&cfg);
+
+  pthread_t threads[NUM_SCAN_THREADS];
+  scan_arg args[NUM_SCAN_THREADS];
+  for (int i = 0; i < NUM_SCAN_THREADS; i++) {
+    args[i].fname = i % 2 ? fname2 : fname1;
+    if (pthread_create(&threads[i], 0, scan_thread, &args[i]) != 0) {
+      put_msg(FATAL, "test_page_threads: cannot create a thread\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+  for (int i = 0; i < NUM_SCAN_THREADS; i++) {
+    pthread_join(threads[i], 0);
+    if (!args[i].ok) {
+      put_msg(FATAL, "test_page_threads fails: thread %d read a wrong page\n", i);
+      put_pager_info(FATAL, "After the scans");
+      exit(EXIT_FAILURE);
+    }
+  }
+  for (int i = 0; i < NUM_PAGES; i++)
+    if (page_pin_count(pages[i]) != 0) {
+      put_msg(FATAL, "test_page_threads fails: page %d is still pinned\n", i);
+      exit(EXIT_FAILURE);
+    }
+  put_pager_profiler_info(INFO);
+  pager_terminate();
+
+  pager_init(&saved);
+  put_msg(INFO, "test_page_threads() succeeds.\n");
+}
+
+void test_page_huge_pages(char const* fname) {
+  put_msg(INFO, "test_page_huge_pages() ...\n");
+  pager_config saved = pager_cfg, cfg = pager_cfg;
+  cfg.huge_pages = 1; /* falls back to transparent huge pages */
+  if (!pager_init(&cfg)) {
+    put_msg(FATAL, "test_page_huge_pages fails: no buffer pool\n");
+    exit(EXIT_FAILURE);
+  }
+  test_page_write(fname);
+  test_page_read(fname);
+  pager_init(&saved);
+  put_msg(INFO, "test_page_huge_pages() succeeds.\n");
+}
+
+/* Get and unpin blocks [first, last) of fname with strategy s */
+static void scan_with_strategy(char const* fname, int first, int last,
+                               access_strategy_p s) {
+  for (int bnr = first; bnr < last; bnr++) {
+    page_p pg = get_page_with_strategy(fname, bnr, s);
+    if (!pg || page_get_int_at(pg, PAGE_HEADER_SIZE) != ints_in[0] + bnr) {
+      put_msg(FATAL, "test_page_strategy fails: wrong block %d\n", bnr);
+      exit(EXIT_FAILURE);
+    }
+    unpin(pg);
+  }
+}
+
+void test_page_strategy(char const* fname) {
+  put_msg(INFO, "test_page_strategy() ...\n");
+  test_page_write(fname);
+  pager_config saved = pager_cfg, cfg = pager_cfg;
+  cfg.num_pages = 8;
+  pager_init(&cfg);
+
+  if (make_access_strategy(NUM_PAGES)) {
+    put_msg(FATAL, "test_page_strategy fails: a ring took the whole buffer\n");
+    exit(EXIT_FAILURE);
+  }
+  access_strategy_p s = make_access_strategy(0);
+  if (!s) {
+    put_msg(FATAL, "test_page_strategy fails: no access strategy\n");
+    exit(EXIT_FAILURE);
+  }
+
+  /* two hot blocks survive scans of more blocks than the buffer has */
+  page_p hot[2] = {get_page(fname, 10), get_page(fname, 15)};
+  unpin(hot[0]);
+  unpin(hot[1]);
+  for (int round = 0; round < 3; round++)
+    scan_with_strategy(fname, 0, 10, s);
+  if (page_block_nr(hot[0]) != 10 || page_block_nr(hot[1]) != 15) {
+    put_msg(FATAL, "test_page_strategy fails: the scan replaced hot blocks\n");
+    exit(EXIT_FAILURE);
+  }
+  page_p pg = get_page(fname, 10);
+  unpin(pg);
+  if (pg != hot[0]) {
+    put_msg(FATAL, "test_page_strategy fails: block 10 is not buffered\n");
+    exit(EXIT_FAILURE);
+  }
+
+  /* a block referenced without the strategy leaves the ring */
+  pg = get_page(fname, 9);
+  unpin(pg);
+  scan_with_strategy(fname, 0, 9, s);
+  if (page_block_nr(pg) != 9) {
+    put_msg(FATAL, "test_page_strategy fails: block 9 was recycled\n");
+    exit(EXIT_FAILURE);
+  }
+  put_pager_profiler_info(INFO);
+  release_access_strategy(s);
+  pager_terminate();
+
+  pager_init(&saved);
+  put_msg(INFO, "test_page_strategy() succeeds.\n");
+}
+
+/* Value of a row of a CSV dump of the profiler, -1 if there is none.
+   Without a metric, the sum of all rows of the section (a histogram). */
+static long csv_value(FILE* fp, char const* section, char const* name,
+                      char const* metric) {
+  char line[256], row[256];
+  long val = -1, sum = 0;
+  snprintf(row, sizeof row, "%s,%s,%s", section, name, metric);
+  rewind(fp);
+  while (fgets(line, sizeof line, fp))
+    if (strncmp(line, row, strlen(row)) != 0)
+      continue;
+    else if (*metric && line[strlen(row)] == ',')
+      val = atol(line + strlen(row) + 1);
+    else if (!*metric)
+      sum += atol(strrchr(line, ',') + 1);
+  return *metric ? val : sum;
+}
+
+void test_page_profiler(char const* fname) {
+  put_msg(INFO, "test_page_profiler() ...\n");
+  test_page_write(fname);
+  pager_config saved = pager_cfg, cfg = pager_cfg;
+  cfg.num_pages = 4;
+  cfg.policy = PAGER_LRU;
+  cfg.access = PAGER_COPY;
+  cfg.clean_target = 0;
+  pager_init(&cfg);
+
+  /* no scan, so nothing is read ahead; block 3 is dirty when replaced */
+  int bnrs[] = {1, 3, 5, 1, 3, 7, 9, 11, 13};
+  for (size_t i = 0; i < sizeof bnrs / sizeof bnrs[0]; i++) {
+    page_p pg = get_page(fname, bnrs[i]);
+    if (i == 4)
+      page_put_int_at(pg, PAGE_HEADER_SIZE, 2700);
+    unpin(pg);
+  }
+  put_pager_profiler_info(INFO);
+
+  FILE *fp = tmpfile();
+  if (!dump_pager_profiler(fp, PAGER_STATS_CSV)) {
+    put_msg(FATAL, "test_page_profiler fails: no CSV dump\n");
+    exit(EXIT_FAILURE);
+  }
+  char const* metrics[] = {"hits", "misses", "evictions", "dirty_evictions",
+                           "bytes_read", "bytes_written"};
+  long expected[] = {2, 7, 3, 1, 7 * BLOCK_SIZE, BLOCK_SIZE};
+  for (int i = 0; i < 6; i++)
+    if (csv_value(fp, "file", fname, metrics[i]) != expected[i]) {
+      put_msg(FATAL, "test_page_profiler fails: %s of %s is %ld, not %ld\n",
+              metrics[i], fname, csv_value(fp, "file", fname, metrics[i]),
+              expected[i]);
+      exit(EXIT_FAILURE);
+    }
+  if (csv_value(fp, "read_latency_us", "", "") != 7
+      || csv_value(fp, "write_latency_us", "", "") != 1) {
+    put_msg(FATAL, "test_page_profiler fails: latencies of %ld reads, %ld writes\n",
+            csv_value(fp, "read_latency_us", "", ""),
+            csv_value(fp, "write_latency_us", "", ""));
+    exit(EXIT_FAILURE);
+  }
+  fclose(fp);
+
+  char json[8192], name[128];
+  fp = tmpfile();
+  long len = dump_pager_profiler(fp, PAGER_STATS_JSON) ? ftell(fp) : 0;
+  rewind(fp);
+  len = fread(json, 1, len < sizeof json ? len : sizeof json - 1, fp);
+  json[len] = '\0';
+  fclose(fp);
+  snprintf(name, sizeof name, "{\"name\": \"%s\", \"hits\": 2,", fname);
+  if (json[0] != '{' || !strstr(json, name)) {
+    put_msg(FATAL, "test_page_profiler fails: no JSON dump of %s\n", fname);
+    exit(EXIT_FAILURE);
+  }
+  pager_terminate();
+
+  test_page_write(fname);
+  pager_init(&saved);
+  put_msg(INFO, "test_page_profiler() succeeds.\n");
+}
+
+void test_page_trace(char const* fname) {
+  put_msg(INFO, "test_page_trace() ...\n");
+  test_page_write(fname);
+  pager_config saved = pager_cfg, cfg = pager_cfg;
+  char trace_name[] = "testpage_trace.trace";
+  cfg.trace_file = trace_name;
+  pager_init(&cfg);
+
+  /* GET 2, GET 4, UNPIN 4 dirty, UNPIN 2, GET 2, UNPIN 2 */
+  page_p pg2 = get_page(fname, 2), pg4 = get_page(fname, 4);
+  page_put_int_at(pg4, PAGE_HEADER_SIZE, 2700);
+  unpin(pg4);
+  unpin(pg2);
+  unpin(get_page(fname, 2));
+  pager_terminate();
+
+  FILE *fp = fopen(trace_name, "r");
+  page_trace_header h;
+  if (!fp || fread(&h, sizeof h, 1, fp) != 1 || h.magic != PAGE_TRACE_MAGIC
+      || h.num_pages != cfg.num_pages) {
+    put_msg(FATAL, "test_page_trace fails: no trace header in %s\n",
+            trace_name);
+    exit(EXIT_FAILURE);
+  }
+  page_trace_rec r;
+  char name[256];
+  int fid = -1, gets = 0, unpins = 0, dirty = 0;
+  while (fread(&r, sizeof r, 1, fp) == 1) {
+    if (r.op == TRACE_FILE) {
+      size_t len = r.blk_nr < sizeof name ? r.blk_nr : sizeof name - 1;
+      name[fread(name, 1, len, fp)] = '\0';
+      if (strcmp(name, fname) == 0)
+        fid = r.fid;
+    } else if (r.fid == fid && r.op == TRACE_GET) {
+      gets += r.blk_nr == 2 || r.blk_nr == 4;
+    } else if (r.fid == fid && r.op == TRACE_UNPIN) {
+      unpins++;
+      dirty += r.dirty && r.blk_nr == 4;
+    }
+  }
+  fclose(fp);
+  remove(trace_name);
+  if (fid < 0 || gets != 3 || unpins != 3 || dirty != 1) {
+    put_msg(FATAL, "test_page_trace fails: file %d, %d gets, %d unpins, "
+            "%d dirty\n", fid, gets, unpins, dirty);
+    exit(EXIT_FAILURE);
+  }
+
+  test_page_write(fname);
+  pager_init(&saved);
+  put_msg(INFO, "test_page_trace() succeeds.\n");
+}
+
+void test_page_io_estimate(char const* fname) {
+  put_msg(INFO, "test_page_io_estimate() ...\n");
+  test_page_write(fname);
+  pager_config saved = pager_cfg, cfg = pager_cfg;
+  cfg.access = PAGER_COPY;
+  cfg.io_engine = PAGER_IO_SYNC;
+  cfg.clean_target = 0;
+  if (pager_config_option(&cfg, 'D', "ssd") != 1
+      || strcmp(cfg.device.name, "ssd") != 0
+      || pager_config_option(&cfg, 'D', "100,1,4") != 1
+      || cfg.device.queue_depth != 4
+      || pager_config_option(&cfg, 'D', "100,0,4") != 0
+      || pager_config_option(&cfg, 'D', "100,1") != 0) {
+    put_msg(FATAL, "test_page_io_estimate fails: option -D\n");
+    exit(EXIT_FAILURE);
+  }
+  cfg.device.mb_per_s = BLOCK_SIZE / 10.0; /* 10us per block */
+  pager_init(&cfg);
+
+  /* 3 seeks and 3 blocks read */
+  int bnrs[] = {1, 3, 5, 3};
+  for (size_t i = 0; i < sizeof bnrs / sizeof bnrs[0]; i++)
+    unpin(get_page(fname, bnrs[i]));
+  put_pager_profiler_info(INFO);
+  double t = pager_io_time(NULL);
+  pager_device hdd = PAGER_DEVICE_HDD, ssd = PAGER_DEVICE_SSD;
+  if (t < 329.9 || t > 330.1
+      || pager_io_time(&ssd) >= pager_io_time(&hdd)) {
+    put_msg(FATAL, "test_page_io_estimate fails: %.1f us, not 330 us\n", t);
+    exit(EXIT_FAILURE);
+  }
+  pager_terminate();
+
+  pager_init(&saved);
+  put_msg(INFO, "test_page_io_estimate() succeeds.\n");
+}
+
+/* Check that block blk of fname holds value, returns 0 if not */
+static int check_fd_cache_value(char const* fname, int blk, int value) {
+  page_p pg = get_page(fname, blk);
+  int res = pg && page_get_int_at(pg, PAGE_HEADER_SIZE) == value;
+  if (pg) unpin(pg);
+  if (!res)
+    put_msg(FATAL, "test_page_fd_cache fails: block %d of %s is not %d\n",
+            blk, fname, value);
+  return res;
+}
+
+void test_page_fd_cache(char const* fname) {
+  put_msg(INFO, "test_page_fd_cache() ...\n");
+  pager_config saved = pager_cfg, cfg = pager_cfg;
+  cfg.max_open_files = 2;
+  pager_init(&cfg);
+
+  /* twice as many files as descriptors, written and read in turns */
+  char names[4][64];
+  for (int k = 0; k < 4; k++)
+    snprintf(names[k], sizeof names[k], "%s_%d", fname, k);
+  for (int blk = 0; blk < 3; blk++)
+    for (int k = 0; k < 4; k++) {
+      page_p pg = get_page(names[k], blk);
+      if (!pg) {
+        put_msg(FATAL, "test_page_fd_cache fails: no block %d of %s\n",
+                blk, names[k]);
+        exit(EXIT_FAILURE);
+      }
+      page_put_int_at(pg, PAGE_HEADER_SIZE, 100 * k + blk);
+      unpin(pg);
+    }
+  for (int blk = 0; blk < 3; blk++)
+    for (int k = 0; k < 4; k++)
+      if (!check_fd_cache_value(names[k], blk, 100 * k + blk))
+        exit(EXIT_FAILURE);
+  close_file(names[0]);
+  if (file_num_blocks(names[0]) != 3) {
+    put_msg(FATAL, "test_page_fd_cache fails: %s has %d blocks, not 3\n",
+            names[0], file_num_blocks(names[0]));
+    exit(EXIT_FAILURE);
+  }
+  put_pager_profiler_info(INFO);
+  pager_terminate();
+
+  /* what went through reopened descriptors is on disk */
+  pager_init(&saved);
+  for (int k = 0; k < 4; k++)
+    if (file_num_blocks(names[k]) != 3
+        || !check_fd_cache_value(names[k], 2, 100 * k + 2))
+      exit(EXIT_FAILURE);
+  pager_terminate();
+  pager_init(&saved);
+  put_msg(INFO, "test_page_fd_cache() succeeds.\n");
+}
+
+/* Write value at the start of block blk_nr of segment seg */
+static int put_ts_value(int seg, int blk_nr, int value) {
+  long bs = pager_cfg.block_size;
+  char block[bs];
+  memset(block, 0, bs);
+  memcpy(block, &value, sizeof value);
+  if (pwrite(ts_fd(), block, bs, (off_t) bs * ts_block(seg, blk_nr)) != bs)
+    return 0;
+  ts_written(seg, blk_nr);
+  return 1;
+}
+
+/* The value at the start of block blk_nr of segment seg */
+static int get_ts_value(int seg, int blk_nr) {
+  int value = -1;
+  pread(ts_fd(), &value, sizeof value,
+        (off_t) pager_cfg.block_size * ts_block(seg, blk_nr));
+  return value;
+}
+
+void test_page_tablespace(char const* fname) {
+  put_msg(INFO, "test_page_tablespace() ...\n");
+  unlink(fname);
+  if (!ts_open(fname, pager_cfg.block_size, 2)) {
+    put_msg(FATAL, "test_page_tablespace fails: ts_open\n");
+    exit(EXIT_FAILURE);
+  }
+
+  /* two segments growing in turns get extents in turns */
+  int a = ts_segment("ts_a", 1), b = ts_segment("ts_b", 1);
+  for (int blk = 0; blk < 4; blk++)
+    if (!ts_grow(a, blk + 1) || !ts_grow(b, blk + 1)
+        || !put_ts_value(a, blk, 100 + blk) || !put_ts_value(b, blk, 200 + blk)) {
+      put_msg(FATAL, "test_page_tablespace fails: block %d\n", blk);
+      exit(EXIT_FAILURE);
+    }
+  if (ts_block(a, 0) + 1 != ts_block(a, 1)
+      || ts_block(a, 1) + 1 == ts_block(a, 2)) {
+    put_msg(FATAL, "test_page_tablespace fails: blocks %ld %ld %ld of ts_a\n",
+            ts_block(a, 0), ts_block(a, 1), ts_block(a, 2));
+    exit(EXIT_FAILURE);
+  }
+  long a0 = ts_block(a, 0);
+  ts_close();
+
+  /* the block map survives closing */
+  if (!ts_open(fname, pager_cfg.block_size, 8)
+      || ts_extent_blocks() != 2 || (a = ts_segment("ts_a", 0)) == -1
+      || (b = ts_segment("ts_b", 0)) == -1 || ts_num_blocks(b) != 4) {
+    put_msg(FATAL, "test_page_tablespace fails: reopening\n");
+    exit(EXIT_FAILURE);
+  }
+  for (int blk = 0; blk < 4; blk++)
+    if (get_ts_value(a, blk) != 100 + blk || get_ts_value(b, blk) != 200 + blk) {
+      put_msg(FATAL, "test_page_tablespace fails: block %d reads %d %d\n",
+              blk, get_ts_value(a, blk), get_ts_value(b, blk));
+      exit(EXIT_FAILURE);
+    }
+
+  /* the extents of a dropped segment are reused */
+  ts_rename("ts_b", "ts_a");
+  b = ts_segment("ts_a", 0);
+  int c = ts_segment("ts_c", 1);
+  ts_grow(c, 4);
+  if (ts_segment("ts_b", 0) != -1 || get_ts_value(b, 3) != 203
+      || (ts_block(c, 0) != a0 && ts_block(c, 2) != a0)) {
+    put_msg(FATAL, "test_page_tablespace fails: dropping ts_a\n");
+    exit(EXIT_FAILURE);
+  }
+  ts_close();
+  unlink(fname);
+  put_msg(INFO, "test_page_tablespace() succeeds.\n");
+}
+
+/* Check that fname has num_blocks blocks in a Unix file of alloc_blocks */
+static void check_prealloc_size(char const* fname, int num_blocks,
+                                int alloc_blocks) {
+  struct stat st;
+  if (file_num_blocks(fname) != num_blocks || stat(fname, &st) == -1
+      || st.st_size != (off_t) alloc_blocks * pager_cfg.block_size) {
+    put_msg(FATAL, "test_page_prealloc fails: %s has %d blocks, not %d,"
+            " in %ld bytes\n", fname, file_num_blocks(fname), num_blocks,
+            (long) st.st_size);
+    exit(EXIT_FAILURE);
+  }
+}
+
+void test_page_prealloc(char const* fname) {
+  put_msg(INFO, "test_page_prealloc() ...\n");
+  pager_config saved = pager_cfg, cfg = pager_cfg;
+  cfg.grow_blocks = 8;
+  unlink(fname);
+  pager_init(&cfg);
+  for (int blk = 0; blk < 10; blk++) {
+    page_p pg = get_page(fname, blk);
+    if (!pg) {
+      put_msg(FATAL, "test_page_prealloc fails: no block %d\n", blk);
+      exit(EXIT_FAILURE);
+    }
+    page_put_int_at(pg, PAGE_HEADER_SIZE, blk);
+    unpin(pg);
+  }
+  pager_terminate();
+
+  /* the number of blocks comes from the header, not from the file size */
+  pager_init(&saved);
+  check_prealloc_size(fname, 10, 16);
+  unpin(get_page(fname, 10));
+  pager_terminate();
+  pager_init(&saved);
+  check_prealloc_size(fname, 11, 16);
+  page_p pg = get_page(fname, 9);
+  if (!pg || page_get_int_at(pg, PAGE_HEADER_SIZE) != 9) {
+    put_msg(FATAL, "test_page_prealloc fails: block 9\n");
+    exit(EXIT_FAILURE);
+  }
+  unpin(pg);
+  pager_terminate();
+  pager_init(&saved);
+  put_msg(INFO, "test_page_prealloc() succeeds.\n");
+}
+
+/* Check that lz.h gives back the n bytes of src */
+static void check_lz_roundtrip(char const* src, size_t n, char const* what) {
+  char zbuf[4096], out[4096];
+  size_t len = lz_compress(src, n, zbuf, sizeof zbuf);
+  if (len == 0 || lz_decompress(zbuf, len, out, sizeof out) != (long) n
+      || memcmp(src, out, n) != 0) {
+    put_msg(FATAL, "test_page_compressed fails: %s data\n", what);
+    exit(EXIT_FAILURE);
+  }
+}
+
+void test_page_compressed(char const* fname) {
+  put_msg(INFO, "test_page_compressed() ...\n");
+  char data[2048];
+  for (size_t i = 0; i < sizeof data; i++)
+    data[i] = i % 100 < 40 ? strs_in[i % 3][i % 7] : 0;
+  check_lz_roundtrip(data, sizeof data, "repetitive");
+  unsigned seed = 17;
+  for (size_t i = 0; i < sizeof data; i++)
+    data[i] = (char) (rand_r(&seed) >> 7);
+  check_lz_roundtrip(data, sizeof data, "random");
+  char zbuf[16];
+  if (lz_compress(data, sizeof data, zbuf, sizeof zbuf) != 0
+      || lz_decompress(data, 64, zbuf, sizeof zbuf) != -1) {
+    put_msg(FATAL, "test_page_compressed fails: out of room\n");
+    exit(EXIT_FAILURE);
+  }
+
+  if (ts_active()) {
+    put_msg(INFO, "test_page_compressed() succeeds, in a tablespace.\n");
+    return;
+  }
+  unlink(fname);
+  if (!create_compressed_file(fname)) {
+    put_msg(FATAL, "test_page_compressed fails: cannot create %s\n", fname);
+    exit(EXIT_FAILURE);
+  }
+  for (int blk = 0; blk < NUM_BLOCKS_IN_FILE; blk++) {
+    page_p pg = get_page(fname, blk);
+    if (!pg) {
+      put_msg(FATAL, "test_page_compressed fails: no block %d\n", blk);
+      exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < NUM_RECORDS_IN_BLOCK; i++) {
+      page_put_int(pg, ints_in[i] + blk);
+      page_put_str(pg, strs_in[i], str_len);
+    }
+    unpin(pg);
+  }
+  close_file(fname);
+  struct stat st;
+  if (stat(fname, &st) == -1
+      || st.st_size >= (off_t) NUM_BLOCKS_IN_FILE * pager_cfg.block_size) {
+    put_msg(FATAL, "test_page_compressed fails: %s is not compressed\n",
+            fname);
+    exit(EXIT_FAILURE);
+  }
+
+  /* the file is known to be compressed when it is opened again */
+  pager_config saved = pager_cfg;
+  pager_terminate();
+  pager_init(&saved);
+  if (file_num_blocks(fname) != NUM_BLOCKS_IN_FILE) {
+    put_msg(FATAL, "test_page_compressed fails: %d blocks\n",
+            file_num_blocks(fname));
+    exit(EXIT_FAILURE);
+  }
+  for (int blk = NUM_BLOCKS_IN_FILE - 1; blk >= 0; blk--) {
+    page_p pg = get_page(fname, blk);
+    if (!pg) {
+      put_msg(FATAL, "test_page_compressed fails: no block %d\n", blk);
+      exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < NUM_RECORDS_IN_BLOCK; i++) {
+      char str[64];
+      int int_out = page_get_int(pg);
+      page_get_str(pg, str, str_len);
+      if (int_out != ints_in[i] + blk || strcmp(str, strs_in[i]) != 0) {
+        put_msg(FATAL, "test_page_compressed fails: block %d record %d\n",
+                blk, (int) i);
+        exit(EXIT_FAILURE);
+      }
+    }
+    unpin(pg);
+  }
+  put_msg(INFO, "test_page_compressed() succeeds.\n");
+}
+
+void test_page_wal(char const* fname) {
+  put_msg(INFO, "test_page_wal() ...\n");
+  test_page_write(fname);
+  pager_config saved = pager_cfg, cfg = pager_cfg;
+  cfg.wal = PAGER_WAL_FULL;
+  cfg.clean_target = 0; /* the pages stay in the buffer until the crash */
+  cfg.io_engine = PAGER_IO_SYNC;
+
+  /* a child commits changes to the pages and crashes before writing
+     them back, then changes block 1 without committing */
+  pid_t pid = fork();
+  if (pid == 0) {
+    if (!pager_init(&cfg))
+      _exit(EXIT_FAILURE);
+    for (int bnr = 0; bnr < 4; bnr++) {
+      page_p pg = get_page(fname, bnr);
+      page_put_int_at(pg, PAGE_HEADER_SIZE, 2700 + bnr);
+      unpin(pg);
+    }
+    if (!pager_commit())
+      _exit(EXIT_FAILURE);
+    page_p pg = get_page(fname, 1);
+    page_put_int_at(pg, PAGE_HEADER_SIZE, 42);
+    unpin(pg);
+    _exit(0);
+  }
+  int status;
+  if (pid == -1 || waitpid(pid, &status, 0) != pid || !WIFEXITED(status)
+      || WEXITSTATUS(status) != 0) {
+    put_msg(FATAL, "test_page_wal fails: no child\n");
+    exit(EXIT_FAILURE);
+  }
+
+  /* opening the pager again redoes the committed changes */
+  pager_init(&cfg);
+  for (int bnr = 0; bnr < 4; bnr++) {
+    page_p pg = get_page(fname, bnr);
+    if (!pg || page_get_int_at(pg, PAGE_HEADER_SIZE) != 2700 + bnr) {
+      put_msg(FATAL, "test_page_wal fails: block %d not redone\n", bnr);
+      exit(EXIT_FAILURE);
+    }
+    unpin(pg);
+  }
+  put_pager_profiler_info(INFO);
+  pager_terminate();
+
+  /* a clean shutdown leaves an empty log */
+  struct stat st;
+  if (stat("db.wal", &st) == -1 || st.st_size != 64) {
+    put_msg(FATAL, "test_page_wal fails: the log is not empty\n");
+    exit(EXIT_FAILURE);
+  }
+  pager_init(&saved); /* without a log, which it removes */
+  test_page_write(fname);
+  pager_init(&saved);
+  put_msg(INFO, "test_page_wal() succeeds.\n");
+}
+
+void test_page_wal_pinned(char const* fname) {
+  put_msg(INFO, "test_page_wal_pinned() ...\n");
+  test_page_write(fname);
+  pager_config saved = pager_cfg, cfg = pager_cfg;
+  cfg.wal = PAGER_WAL_FULL;
+  cfg.clean_target = 0;
+  cfg.io_engine = PAGER_IO_SYNC;
+
+  /* a child commits while block 0 is pinned, and crashes */
+  pid_t pid = fork();
+  if (pid == 0) {
+    if (!pager_init(&cfg))
+      _exit(EXIT_FAILURE);
+    page_p pinned = get_page(fname, 0);
+    page_put_int_at(pinned, PAGE_HEADER_SIZE, 2700);
+    page_p pg = get_page(fname, 1);
+    page_put_int_at(pg, PAGE_HEADER_SIZE, 2701);
+    unpin(pg);
+    if (pager_commit() != -1)
+      _exit(2); /* the changes of block 0 are taken for durable */
+    _exit(0);
+  }
+  int status;
+  if (pid == -1 || waitpid(pid, &status, 0) != pid || !WIFEXITED(status)
+      || WEXITSTATUS(status) != 0) {
+    put_msg(FATAL, "test_page_wal_pinned fails: no child (%d)\n",
+            WEXITSTATUS(status));
+    exit(EXIT_FAILURE);
+  }
+
+  /* only the unpinned block is redone */
+  pager_init(&cfg);
+  page_p pg0 = get_page(fname, 0), pg1 = get_page(fname, 1);
+  if (!pg0 || !pg1 || page_get_int_at(pg0, PAGE_HEADER_SIZE) != ints_in[0]
+      || page_get_int_at(pg1, PAGE_HEADER_SIZE) != 2701) {
+    put_msg(FATAL, "test_page_wal_pinned fails: wrong blocks redone\n");
+    exit(EXIT_FAILURE);
+  }
+  unpin(pg1);
+  /* a commit after the unpin logs the pinned changes */
+  page_put_int_at(pg0, PAGE_HEADER_SIZE, 2700);
+  if (pager_commit() != -1) {
+    put_msg(FATAL, "test_page_wal_pinned fails: pinned page committed\n");
+    exit(EXIT_FAILURE);
+  }
+  unpin(pg0);
+  if (pager_commit() != 1) {
+    put_msg(FATAL, "test_page_wal_pinned fails: unpinned page not committed\n");
+    exit(EXIT_FAILURE);
+  }
+  pager_terminate();
+
+  pager_init(&saved); /* without a log, which it removes */
+  test_page_write(fname);
+  pager_init(&saved);
+  put_msg(INFO, "test_page_wal_pinned() succeeds.\n");
+}
+
+static char *test_catalog(long* len) {
+  *len = strlen("catalog 2700");
+  return strdup("catalog 2700");
+}
+
+void test_page_wal_checkpoint(char const* fname) {
+  put_msg(INFO, "test_page_wal_checkpoint() ...\n");
+  test_page_write(fname);
+  pager_config saved = pager_cfg, cfg = pager_cfg;
+  cfg.wal = PAGER_WAL_FULL;
+  cfg.clean_target = 0;
+  cfg.io_engine = PAGER_IO_SYNC;
+
+  /* a child commits changes to blocks 0-3 and checkpoints twice, the
+     second time writing them back, then commits changes to blocks 0-1
+     and crashes */
+  pid_t pid = fork();
+  if (pid == 0) {
+    if (!pager_init(&cfg))
+      _exit(EXIT_FAILURE);
+    pager_set_catalog(test_catalog);
+    for (int bnr = 0; bnr < 4; bnr++) {
+      page_p pg = get_page(fname, bnr);
+      page_put_int_at(pg, PAGE_HEADER_SIZE, 2700 + bnr);
+      unpin(pg);
+    }
+    if (!pager_commit() || !pager_checkpoint())
+      _exit(EXIT_FAILURE);
+    long size = wal_size();
+    if (!pager_checkpoint() || wal_size() >= size)
+      _exit(2); /* the log is not truncated */
+    for (int bnr = 0; bnr < 2; bnr++) {
+      page_p pg = get_page(fname, bnr);
+      page_put_int_at(pg, PAGE_HEADER_SIZE, 4200 + bnr);
+      unpin(pg);
+    }
+    if (!pager_commit())
+      _exit(EXIT_FAILURE);
+    _exit(0);
+  }
+  int status;
+  if (pid == -1 || waitpid(pid, &status, 0) != pid || !WIFEXITED(status)
+      || WEXITSTATUS(status) != 0) {
+    put_msg(FATAL, "test_page_wal_checkpoint fails: no child (%d)\n",
+            WEXITSTATUS(status));
+    exit(EXIT_FAILURE);
+  }
+
+  /* the blocks written back are not redone, the others are */
+  pager_init(&cfg);
+  for (int bnr = 0; bnr < 4; bnr++) {
+    page_p pg = get_page(fname, bnr);
+    int expected = bnr < 2 ? 4200 + bnr : 2700 + bnr;
+    if (!pg || page_get_int_at(pg, PAGE_HEADER_SIZE) != expected) {
+      put_msg(FATAL, "test_page_wal_checkpoint fails: block %d\n", bnr);
+      exit(EXIT_FAILURE);
+    }
+    unpin(pg);
+  }
+  /* the catalog of the last checkpoint is recovered, once */
+  long len;
+  char *catalog = pager_recovered_catalog(&len);
+  if (!catalog || len != (long) strlen("catalog 2700")
+      || memcmp(catalog, "catalog 2700", len) != 0
+      || pager_recovered_catalog(&len)) {
+    put_msg(FATAL, "test_page_wal_checkpoint fails: no catalog\n");
+    exit(EXIT_FAILURE);
+  }
+  free(catalog);
+  pager_init(&saved);
+  test_page_write(fname);
+  pager_init(&saved);
+  put_msg(INFO, "test_page_wal_checkpoint() succeeds.\n");
+}
@@ -7,5 +7,27 @@ extern void test_page_write(char const* fname);
 extern void test_page_read(char const* fname);
 extern void test_page_write_with_offset(char const* fname);
 extern void test_page_read_with_offset(char const* fname);
+extern void test_page_policies(char const* fname);
+extern void test_page_pins(char const* fname);
+extern void test_page_vectored(char const* fname);
+extern void test_page_readahead(char const* fname);
+extern void test_page_io_engine(char const* fname);
+extern void test_page_mmap(char const* fname);
+extern void test_page_write_back(char const* fname);
+extern void test_page_write_failure(char const* fname);
+extern void test_page_cleaner(char const* fname);
+extern void test_page_threads(char const* fname1, char const* fname2);
+extern void test_page_huge_pages(char const* fname);
+extern void test_page_strategy(char const* fname);
+extern void test_page_profiler(char const* fname);
+extern void test_page_trace(char const* fname);
+extern void test_page_io_estimate(char const* fname);
+extern void test_page_fd_cache(char const* fname);
+extern void test_page_tablespace(char const* fname);
+extern void test_page_prealloc(char const* fname);
+extern void test_page_compressed(char const* fname);
+extern void test_page_wal(char const* fname);
+extern void test_page_wal_checkpoint(char const* fname);
+extern void test_page_wal_pinned(char const* fname);
 
 #endif
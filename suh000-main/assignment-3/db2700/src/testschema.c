@@ -96,3 +96,151 @@ void test_tbl_natural_join(char const* my_tbl, char const* yr_tbl) {
   put_pager_profiler_info(INFO);
   put_msg(INFO,  "test_tbl_natural_join() done.\n\n");
 }
+
+/* Write records to a table with storage st and read them back; row_tbl
+   holds as many records of the same schema in row storage */
+void test_tbl_storage(char const* tbl_name, tbl_storage st,
+                      char const* row_tbl) {
+  put_msg(INFO, "test_tbl_storage (\"%s\", %s) ...\n", tbl_name,
+          tbl_storage_name(st));
+
+  open_db();
+  char id_attr[20] = "Id", str_attr[20] = "Str";
+  char *attrs[] = {strcat(id_attr, tbl_name), strcat(str_attr, tbl_name), "Int"};
+  int attr_types[] = {INT_TYPE, STR_TYPE, INT_TYPE};
+  schema_p sch = create_test_schema(tbl_name, 3, attrs, attr_types);
+  if (!set_tbl_storage(sch, st)) {
+    put_msg(FATAL, "test_tbl_storage: no %s storage\n", tbl_storage_name(st));
+    exit(EXIT_FAILURE);
+  }
+  test_data_gen(sch, in_recs, NUM_RECORDS);
+  for (size_t rec_n = 0; rec_n < NUM_RECORDS; rec_n++)
+    append_record(in_recs[rec_n], sch);
+  close_db();
+
+  open_db();
+  sch = get_schema(tbl_name);
+  tbl_p tbl = get_table(tbl_name);
+  record out_rec = new_record(sch);
+  set_tbl_position(tbl, TBL_BEG);
+  int rec_n = 0;
+  while (get_record(out_rec, sch) > 0) {
+    if (rec_n >= NUM_RECORDS || !equal_record(out_rec, in_recs[rec_n], sch)) {
+      put_msg(FATAL, "test_tbl_storage: wrong record %d\n", rec_n);
+      put_record_info(FATAL, out_rec, sch);
+      exit(EXIT_FAILURE);
+    }
+    release_record(in_recs[rec_n++], sch);
+  }
+  if (rec_n != NUM_RECORDS || schema_storage(sch) != st) {
+    put_msg(FATAL, "test_tbl_storage: only %d of %d records read\n",
+            rec_n, NUM_RECORDS);
+    exit(EXIT_FAILURE);
+  }
+
+  /* in slotted pages, the strings take the bytes they hold, not their
+     declared length; a PAX page holds as many records as a row page;
+     the ids in a column take a few bits each */
+  char id_column[50];
+  sprintf(id_column, "%s.%s", tbl_name, id_attr);
+  int num_blocks = file_num_blocks(st == COLUMN_STORAGE ? id_column : tbl_name);
+  int row_blocks = file_num_blocks(row_tbl);
+  if (st == PAX_STORAGE ? num_blocks != row_blocks
+      : num_blocks >= row_blocks) {
+    put_msg(FATAL, "test_tbl_storage: %d blocks, %d in row storage\n",
+            num_blocks, row_blocks);
+    exit(EXIT_FAILURE);
+  }
+
+  /* a search finds the int fields at their offsets in the slots, in
+     the minipages, or in their column */
+  tbl_p res = table_search(tbl, id_attr, "<", 100);
+  char res_name[40] = "tmp_tbl__"; /* as table_search() names it */
+  schema_p res_sch = get_schema(strcat(res_name, tbl_name));
+  int num_found = 0;
+  for (set_tbl_position(res, TBL_BEG); get_record(out_rec, res_sch) > 0; )
+    if (*(int *) out_rec[0] != num_found++) {
+      put_msg(FATAL, "test_tbl_storage: search finds id %d\n",
+              *(int *) out_rec[0]);
+      exit(EXIT_FAILURE);
+    }
+  if (num_found != 100) {
+    put_msg(FATAL, "test_tbl_storage: search finds %d records\n", num_found);
+    exit(EXIT_FAILURE);
+  }
+  remove_table(res);
+  res = table_search(tbl, id_attr, "==", 517);
+  res_sch = get_schema(res_name);
+  set_tbl_position(res, TBL_BEG);
+  if (get_record(out_rec, res_sch) <= 0 || *(int *) out_rec[0] != 517
+      || get_record(out_rec, res_sch) > 0) {
+    put_msg(FATAL, "test_tbl_storage: no record of id 517\n");
+    exit(EXIT_FAILURE);
+  }
+  remove_table(res);
+  release_record(out_rec, sch);
+  close_db();
+
+  put_msg(INFO,  "test_tbl_storage() succeeds.\n");
+}
+
+/* Write num_records records to a table with storage st, whose file
+   fname takes more blocks than the offset of a record in a block, and
+   read them back after the database is opened again */
+void test_tbl_reopen(char const* tbl_name, tbl_storage st,
+                     char const* fname, int num_records) {
+  put_msg(INFO, "test_tbl_reopen (\"%s\", %s) ...\n", tbl_name,
+          tbl_storage_name(st));
+
+  open_db();
+  char *attrs[] = {"Id", "Str", "Int"};
+  int attr_types[] = {INT_TYPE, STR_TYPE, INT_TYPE};
+  schema_p sch = create_test_schema(tbl_name, 3, attrs, attr_types);
+  if (!set_tbl_storage(sch, st)) {
+    put_msg(FATAL, "test_tbl_reopen: no %s storage\n", tbl_storage_name(st));
+    exit(EXIT_FAILURE);
+  }
+  record rec = new_record(sch);
+  for (int i = 0; i < num_records; i++) {
+    fill_gen_record(sch, rec, i);
+    append_record(rec, sch);
+  }
+  int num_blocks = file_num_blocks(fname);
+  close_db();
+
+  if (num_blocks <= BLOCK_SIZE) {
+    put_msg(FATAL, "test_tbl_reopen: %s has only %d blocks\n", fname,
+            num_blocks);
+    exit(EXIT_FAILURE);
+  }
+  open_db();
+  if (file_num_blocks(fname) != num_blocks) {
+    put_msg(FATAL, "test_tbl_reopen: %s has %d blocks, not %d\n", fname,
+            file_num_blocks(fname), num_blocks);
+    exit(EXIT_FAILURE);
+  }
+  sch = get_schema(tbl_name);
+  record out_rec = new_record(sch);
+  char str[40];
+  int rec_n = 0;
+  set_tbl_position(get_table(tbl_name), TBL_BEG);
+  while (get_record(out_rec, sch) > 0) {
+    sprintf(str, "%s_Val_%d", tbl_name, rec_n);
+    if (*(int *) out_rec[0] != rec_n || strcmp(out_rec[1], str) != 0) {
+      put_msg(FATAL, "test_tbl_reopen: wrong record %d\n", rec_n);
+      put_record_info(FATAL, out_rec, sch);
+      exit(EXIT_FAILURE);
+    }
+    rec_n++;
+  }
+  if (rec_n != num_records) {
+    put_msg(FATAL, "test_tbl_reopen: only %d of %d records read\n",
+            rec_n, num_records);
+    exit(EXIT_FAILURE);
+  }
+  release_record(out_rec, sch);
+  release_record(rec, sch);
+  close_db();
+
+  put_msg(INFO,  "test_tbl_reopen() succeeds.\n");
+}
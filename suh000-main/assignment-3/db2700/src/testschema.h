@@ -6,5 +6,9 @@
 extern void test_tbl_write(char const* tbl_name);
 extern void test_tbl_read(char const* tbl_name);
 extern void test_tbl_natural_join(char const* my_tbl, char const* yr_tbl);
+extern void test_tbl_storage(char const* tbl_name, tbl_storage st,
+                             char const* row_tbl);
+extern void test_tbl_reopen(char const* tbl_name, tbl_storage st,
+                            char const* fname, int num_records);
 
 #endif
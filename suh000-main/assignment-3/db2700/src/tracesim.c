@@ -0,0 +1,551 @@
+/**********************************************************
+ * Buffer cache simulator: replay a page trace of the     *
+ * pager (see pagetrace.h) against buffer pool sizes and  *
+ * replacement policies, including Belady's OPT.          *
+ **********************************************************/
+
+#include "pagetrace.h"
+#include "pmsg.h"
+#include <ctype.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/** @brief A traced pin or unpin, the blocks are numbered densely */
+typedef struct event {
+  int op;    /**< TRACE_GET or TRACE_UNPIN */
+  int dirty; /**< non-zero if the page is dirty at TRACE_UNPIN */
+  int blk;   /**< block id */
+  long next; /**< index of the next TRACE_GET of the block, LONG_MAX if none */
+} event;
+
+static page_trace_header header;
+static event *events;
+static long num_events;
+static long num_gets;
+static int num_files;
+
+/** file id and block nr of the block ids */
+static int *blk_fid, *blk_nr;
+static int num_blks;
+
+/** (fid, blk_nr) -> block id, open addressing */
+static int *blk_table;
+static unsigned blk_table_mask;
+
+enum { SIM_LRU, SIM_CLOCK, SIM_LRU2, SIM_2Q, SIM_ARC, SIM_OPT, NUM_SIM_POLICIES };
+
+/* the order of pager_policy, and OPT */
+static char const* policy_names[NUM_SIM_POLICIES] = {
+  "lru", "clock", "lru2", "2q", "arc", "opt"
+};
+
+static void *alloc(size_t n, size_t size) {
+  void *p = calloc(n ? n : 1, size);
+  if (!p) {
+    put_msg(FATAL, "out of memory.\n");
+    exit(EXIT_FAILURE);
+  }
+  return p;
+}
+
+static unsigned hash_ids(int fid, int nr) {
+  return (unsigned) fid * 0x9E3779B1u ^ (unsigned) nr * 0x85EBCA77u;
+}
+
+/* The id of block (fid, nr), numbering it on demand */
+static int blk_id(int fid, int nr) {
+  if (2 * (unsigned) num_blks >= blk_table_mask) { /* grow the table */
+    unsigned mask = blk_table_mask ? 2 * blk_table_mask + 1 : 1023;
+    int *table = alloc(mask + 1, sizeof (int));
+    memset(table, -1, (mask + 1) * sizeof (int));
+    for (int id = 0; id < num_blks; id++) {
+      unsigned h = hash_ids(blk_fid[id], blk_nr[id]) & mask;
+      while (table[h] >= 0) h = (h + 1) & mask;
+      table[h] = id;
+    }
+    free(blk_table);
+    blk_table = table;
+    blk_table_mask = mask;
+    blk_fid = realloc(blk_fid, (mask + 1) / 2 * sizeof (int));
+    blk_nr = realloc(blk_nr, (mask + 1) / 2 * sizeof (int));
+    if (!blk_fid || !blk_nr) {
+      put_msg(FATAL, "out of memory.\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+  unsigned h = hash_ids(fid, nr) & blk_table_mask;
+  for (; blk_table[h] >= 0; h = (h + 1) & blk_table_mask)
+    if (blk_fid[blk_table[h]] == fid && blk_nr[blk_table[h]] == nr)
+      return blk_table[h];
+  blk_fid[num_blks] = fid;
+  blk_nr[num_blks] = nr;
+  return blk_table[h] = num_blks++;
+}
+
+/* Read the trace, and find the next reference of every TRACE_GET */
+static void read_trace(char const* fname) {
+  FILE *fp = fopen(fname, "r");
+  if (!fp || fread(&header, sizeof header, 1, fp) != 1
+      || header.magic != PAGE_TRACE_MAGIC) {
+    put_msg(FATAL, "%s is not a page trace.\n", fname);
+    exit(EXIT_FAILURE);
+  }
+  if (header.version != PAGE_TRACE_VERSION) {
+    put_msg(FATAL, "%s: trace version %d, not %d.\n", fname,
+            header.version, PAGE_TRACE_VERSION);
+    exit(EXIT_FAILURE);
+  }
+  long cap = 4096;
+  events = alloc(cap, sizeof (event));
+  page_trace_rec r;
+  while (fread(&r, sizeof r, 1, fp) == 1) {
+    if (r.op == TRACE_FILE) {
+      if (r.blk_nr < 0 || fseek(fp, r.blk_nr, SEEK_CUR) != 0)
+        break;
+      num_files++;
+      continue;
+    }
+    if (r.op != TRACE_GET && r.op != TRACE_UNPIN) {
+      put_msg(FATAL, "%s: invalid record %ld.\n", fname, num_events);
+      exit(EXIT_FAILURE);
+    }
+    if (num_events == cap) {
+      cap *= 2;
+      events = realloc(events, cap * sizeof (event));
+      if (!events) {
+        put_msg(FATAL, "out of memory.\n");
+        exit(EXIT_FAILURE);
+      }
+    }
+    event *e = &events[num_events++];
+    e->op = r.op;
+    e->dirty = r.dirty;
+    e->blk = blk_id(r.fid, r.blk_nr);
+    num_gets += r.op == TRACE_GET;
+  }
+  fclose(fp);
+
+  long *next_get = alloc(num_blks, sizeof (long));
+  for (int id = 0; id < num_blks; id++)
+    next_get[id] = LONG_MAX;
+  for (long i = num_events - 1; i >= 0; i--)
+    if (events[i].op == TRACE_GET) {
+      events[i].next = next_get[events[i].blk];
+      next_get[events[i].blk] = i;
+    }
+  free(next_get);
+}
+
+/** @brief A doubly linked list of frames or of ghost blocks,
+    the links are kept in arrays */
+typedef struct list {
+  int first, last, len;
+} list;
+
+static void list_init(list* l) {
+  l->first = l->last = -1;
+  l->len = 0;
+}
+
+static void list_append(list* l, int* prev, int* next, int x) {
+  prev[x] = l->last;
+  next[x] = -1;
+  if (l->last >= 0) next[l->last] = x;
+  else l->first = x;
+  l->last = x;
+  l->len++;
+}
+
+static void list_remove(list* l, int* prev, int* next, int x) {
+  if (prev[x] >= 0) next[prev[x]] = next[x];
+  else l->first = next[x];
+  if (next[x] >= 0) prev[next[x]] = prev[x];
+  else l->last = prev[x];
+  l->len--;
+}
+
+/** @brief A buffer page of the simulation */
+typedef struct frame {
+  int blk;     /**< block id, -1 if free */
+  int pins;    /**< number of pins */
+  int dirty;   /**< non-zero if changed since it was read */
+  int ref;     /**< reference bit, used by CLOCK */
+  long hist1;  /**< time of the last reference, used by LRU-2 */
+  long hist2;  /**< time of the second last reference, used by LRU-2 */
+  long next;   /**< index of the next reference, used by OPT */
+  int queue;   /**< queue the frame is in, -1 if none */
+} frame;
+
+/** @brief State of one simulation: a policy and a buffer size.
+    The policies follow those of pager.c. */
+static struct {
+  int policy;
+  int size;
+  frame *frames;
+  int num_used;     /**< number of frames that ever got a block */
+  int *frame_of;    /**< frame of every block id, -1 if not buffered */
+  int *current;     /**< block of the last TRACE_GET of every file id */
+  list q[2];        /**< LRU: unpinned; 2Q: A1in and Am; ARC: T1 and T2 */
+  int *qprev, *qnext;
+  list g[2];        /**< ghosts: LRU-2 history, 2Q A1out, ARC B1 and B2 */
+  int *ghost;       /**< ghost list + 1 of every block id, 0 if none */
+  long *gstamp;     /**< LRU-2: last reference of a ghost */
+  int *gprev, *gnext;
+  int hand;         /**< CLOCK hand */
+  long clock;       /**< LRU-2: one tick per reference */
+  int arc_p;        /**< ARC: target length of T1 */
+  long hits, misses, seeks, writes, no_page;
+  int last_fid, last_nr;
+} sim;
+
+static void ghost_remove(int blk) {
+  int g = sim.ghost[blk] - 1;
+  if (g < 0) return;
+  list_remove(&sim.g[g], sim.gprev, sim.gnext, blk);
+  sim.ghost[blk] = 0;
+}
+
+static void ghost_add(int g, int blk, long stamp) {
+  ghost_remove(blk);
+  list_append(&sim.g[g], sim.gprev, sim.gnext, blk);
+  sim.ghost[blk] = g + 1;
+  sim.gstamp[blk] = stamp;
+}
+
+static void ghost_trim(int g, int max_len) {
+  while (sim.g[g].len > (max_len > 0 ? max_len : 0))
+    ghost_remove(sim.g[g].first);
+}
+
+static void enqueue(int q, int f) {
+  if (sim.frames[f].queue >= 0)
+    list_remove(&sim.q[sim.frames[f].queue], sim.qprev, sim.qnext, f);
+  sim.frames[f].queue = q;
+  if (q >= 0)
+    list_append(&sim.q[q], sim.qprev, sim.qnext, f);
+}
+
+static int first_unpinned(int q) {
+  for (int f = sim.q[q].first; f >= 0; f = sim.qnext[f])
+    if (sim.frames[f].pins == 0)
+      return f;
+  return -1;
+}
+
+/* A disk access to block blk, counted as a seek unless it is adjacent
+   to the previous one */
+static void disk_io(int blk) {
+  if (blk_fid[blk] != sim.last_fid || abs(blk_nr[blk] - sim.last_nr) > 1)
+    sim.seeks++;
+  sim.last_fid = blk_fid[blk];
+  sim.last_nr = blk_nr[blk];
+}
+
+static void missed(int blk) {
+  if (sim.policy != SIM_ARC || !sim.ghost[blk]) return;
+  list *b1 = &sim.g[0], *b2 = &sim.g[1];
+  if (sim.ghost[blk] == 1) {
+    int delta = b2->len > b1->len ? b2->len / b1->len : 1;
+    sim.arc_p = sim.arc_p + delta < sim.size ? sim.arc_p + delta : sim.size;
+  } else {
+    int delta = b1->len > b2->len ? b1->len / b2->len : 1;
+    sim.arc_p = sim.arc_p - delta > 0 ? sim.arc_p - delta : 0;
+  }
+}
+
+static int victim(int blk, long now) {
+  int res = -1;
+  switch (sim.policy) {
+  case SIM_LRU:
+    return sim.q[0].first; /* only unpinned frames are queued */
+  case SIM_CLOCK:
+    for (int i = 0; i < 2 * sim.size; i++) {
+      frame *f = &sim.frames[sim.hand];
+      int f_nr = sim.hand;
+      sim.hand = (sim.hand + 1) % sim.size;
+      if (f->pins) continue;
+      if (!f->ref) return f_nr;
+      f->ref = 0;
+    }
+    return -1;
+  case SIM_2Q:
+    if (sim.q[0].len > (sim.size / 4 > 1 ? sim.size / 4 : 1) || sim.q[1].len == 0)
+      res = first_unpinned(0);
+    if (res < 0) res = first_unpinned(1);
+    if (res < 0) res = first_unpinned(0);
+    return res;
+  case SIM_ARC: {
+    int in_b2 = sim.ghost[blk] == 2, t1 = sim.q[0].len;
+    if (t1 > 0 && (t1 > sim.arc_p || (in_b2 && t1 == sim.arc_p)))
+      res = first_unpinned(0);
+    if (res < 0) res = first_unpinned(1);
+    if (res < 0) res = first_unpinned(0);
+    return res;
+  }
+  }
+  /* LRU-2 and OPT look at all unpinned frames */
+  for (int i = 0; i < sim.size; i++) {
+    frame *f = &sim.frames[i], *r = res >= 0 ? &sim.frames[res] : 0;
+    if (f->pins) continue;
+    if (sim.policy == SIM_OPT ? !r || f->next > r->next
+        : !r || f->hist2 < r->hist2
+        || (f->hist2 == r->hist2 && f->hist1 < r->hist1))
+      res = i;
+  }
+  return res;
+}
+
+static void evicted(int f_nr) {
+  frame *f = &sim.frames[f_nr];
+  switch (sim.policy) {
+  case SIM_CLOCK:
+    f->ref = 0;
+    break;
+  case SIM_LRU2:
+    ghost_add(0, f->blk, f->hist1);
+    ghost_trim(0, sim.size);
+    break;
+  case SIM_2Q:
+    if (f->queue == 0) {
+      ghost_add(0, f->blk, 0);
+      ghost_trim(0, sim.size / 2 > 1 ? sim.size / 2 : 1);
+    }
+    break;
+  case SIM_ARC:
+    ghost_add(f->queue == 0 ? 0 : 1, f->blk, 0);
+    enqueue(-1, f_nr);
+    ghost_trim(0, sim.size - sim.q[0].len);
+    ghost_trim(1, 2 * sim.size - sim.q[0].len - sim.q[1].len - sim.g[0].len);
+    break;
+  }
+  enqueue(-1, f_nr);
+}
+
+static void loaded(int f_nr) {
+  frame *f = &sim.frames[f_nr];
+  switch (sim.policy) {
+  case SIM_CLOCK:
+    f->ref = 1;
+    break;
+  case SIM_LRU2:
+    f->hist2 = sim.ghost[f->blk] ? sim.gstamp[f->blk] : 0;
+    ghost_remove(f->blk);
+    f->hist1 = ++sim.clock;
+    break;
+  case SIM_2Q:
+  case SIM_ARC:
+    enqueue(sim.ghost[f->blk] ? 1 : 0, f_nr);
+    ghost_remove(f->blk);
+    break;
+  }
+}
+
+static void touched(int f_nr) {
+  frame *f = &sim.frames[f_nr];
+  switch (sim.policy) {
+  case SIM_CLOCK:
+    f->ref = 1;
+    break;
+  case SIM_LRU2:
+    f->hist2 = f->hist1;
+    f->hist1 = ++sim.clock;
+    break;
+  case SIM_2Q:
+    if (f->queue == 1) enqueue(1, f_nr);
+    break;
+  case SIM_ARC:
+    enqueue(1, f_nr);
+    break;
+  }
+}
+
+static void get(long i) {
+  event *e = &events[i];
+  int fid = blk_fid[e->blk], f_nr = sim.frame_of[e->blk];
+  if (f_nr >= 0) {
+    sim.hits++;
+    if (sim.current[fid] != e->blk) /* not a new reference otherwise */
+      touched(f_nr);
+    if (sim.frames[f_nr].pins++ == 0 && sim.policy == SIM_LRU)
+      enqueue(-1, f_nr);
+  } else {
+    sim.misses++;
+    missed(e->blk);
+    f_nr = sim.num_used < sim.size ? sim.num_used++ : victim(e->blk, i);
+    if (f_nr < 0) { /* all pages are pinned, get_page() fails */
+      sim.no_page++;
+      return;
+    }
+    frame *f = &sim.frames[f_nr];
+    if (f->blk >= 0) {
+      evicted(f_nr);
+      if (f->dirty) {
+        sim.writes++;
+        disk_io(f->blk);
+      }
+      if (sim.current[blk_fid[f->blk]] == f->blk)
+        sim.current[blk_fid[f->blk]] = -1;
+      sim.frame_of[f->blk] = -1;
+    }
+    f->blk = e->blk;
+    f->dirty = 0;
+    f->pins = 1;
+    sim.frame_of[e->blk] = f_nr;
+    disk_io(e->blk);
+    loaded(f_nr);
+  }
+  sim.frames[f_nr].next = e->next;
+  sim.current[fid] = e->blk;
+}
+
+static void unpin(long i) {
+  event *e = &events[i];
+  int f_nr = sim.frame_of[e->blk];
+  if (f_nr < 0 || sim.frames[f_nr].pins == 0) return; /* got no page */
+  frame *f = &sim.frames[f_nr];
+  f->dirty |= e->dirty;
+  if (--f->pins == 0 && sim.policy == SIM_LRU)
+    enqueue(0, f_nr);
+}
+
+static void simulate(int policy, int size) {
+  int max_fid = 0;
+  for (int id = 0; id < num_blks; id++)
+    if (blk_fid[id] > max_fid) max_fid = blk_fid[id];
+
+  memset(&sim, 0, sizeof sim);
+  sim.policy = policy;
+  sim.size = size;
+  sim.frames = alloc(size, sizeof (frame));
+  for (int i = 0; i < size; i++) {
+    sim.frames[i].blk = -1;
+    sim.frames[i].queue = -1;
+  }
+  sim.frame_of = alloc(num_blks, sizeof (int));
+  memset(sim.frame_of, -1, num_blks * sizeof (int));
+  sim.current = alloc(max_fid + 1, sizeof (int));
+  memset(sim.current, -1, (max_fid + 1) * sizeof (int));
+  sim.qprev = alloc(size, sizeof (int));
+  sim.qnext = alloc(size, sizeof (int));
+  sim.ghost = alloc(num_blks, sizeof (int));
+  sim.gstamp = alloc(num_blks, sizeof (long));
+  sim.gprev = alloc(num_blks, sizeof (int));
+  sim.gnext = alloc(num_blks, sizeof (int));
+  for (int i = 0; i < 2; i++) {
+    list_init(&sim.q[i]);
+    list_init(&sim.g[i]);
+  }
+  sim.last_fid = -1;
+  sim.last_nr = -1;
+
+  for (long i = 0; i < num_events; i++)
+    if (events[i].op == TRACE_GET)
+      get(i);
+    else
+      unpin(i);
+
+  long refs = sim.hits + sim.misses;
+  printf("%-6s %8d %12ld %9.1f%% %12ld %10ld", policy_names[policy], size,
+         sim.misses, refs ? 100.0 * sim.hits / refs : 0.0, sim.seeks,
+         sim.writes);
+  if (sim.no_page)
+    printf("  (%ld gets found all pages pinned)", sim.no_page);
+  printf("\n");
+
+  free(sim.frames);
+  free(sim.frame_of);
+  free(sim.current);
+  free(sim.qprev);
+  free(sim.qnext);
+  free(sim.ghost);
+  free(sim.gstamp);
+  free(sim.gprev);
+  free(sim.gnext);
+}
+
+/* Parse a comma separated list of positive numbers into sizes[],
+   returns the number of sizes, 0 if the list is invalid */
+static int parse_sizes(char const* str, int sizes[], int max) {
+  int n = 0;
+  while (*str && n < max) {
+    char *end;
+    long v = strtol(str, &end, 10);
+    if (end == str || v < 1 || v > INT_MAX || (*end && *end != ','))
+      return 0;
+    sizes[n++] = v;
+    str = *end ? end + 1 : end;
+  }
+  return *str ? 0 : n;
+}
+
+int main(int argc, char* argv[]) {
+  enum { MAX_SIZES = 32 };
+  int c, sizes[MAX_SIZES], num_sizes = 0, use[NUM_SIM_POLICIES] = {0};
+  int num_use = 0;
+  msglevel = WARN;
+  while ((c = getopt(argc, argv, "hp:r:")) != -1)
+    switch (c) {
+    case 'h':
+      printf("Usage: run_tracesim [switches] trace\n");
+      printf("\t-h           help, print this message\n");
+      printf("\t-p n,n,...   buffer sizes in pages, default to 1/4 to 4 times\n");
+      printf("\t             the size of the traced pager\n");
+      printf("\t-r p,p,...   policies [lru,clock,lru2,2q,arc,opt], default to all\n");
+      printf("Replays the page accesses traced with the pager option -T.\n");
+      printf("Misses are reads, dirty pages are written when replaced, and\n");
+      printf("a disk access not adjacent to the previous one is a seek.\n");
+      printf("Read-ahead and the background cleaner are not simulated.\n");
+      exit(0);
+    case 'p':
+      num_sizes = parse_sizes(optarg, sizes, MAX_SIZES);
+      if (!num_sizes) {
+        put_msg(ERROR, "invalid buffer sizes \"%s\".\n", optarg);
+        exit(EXIT_FAILURE);
+      }
+      break;
+    case 'r':
+      for (char *p = strtok(optarg, ","); p; p = strtok(0, ",")) {
+        int i = 0;
+        while (i < NUM_SIM_POLICIES && strcmp(p, policy_names[i]) != 0) i++;
+        if (i == NUM_SIM_POLICIES) {
+          put_msg(ERROR, "unknown policy \"%s\".\n", p);
+          exit(EXIT_FAILURE);
+        }
+        if (!use[i]++) num_use++;
+      }
+      break;
+    default:
+      if (isprint(optopt))
+        printf("Unknown option `-%c'.\n", optopt);
+      exit(EXIT_FAILURE);
+    }
+  if (optind != argc - 1) {
+    put_msg(ERROR, "run_tracesim: give one trace file, see -h.\n");
+    exit(EXIT_FAILURE);
+  }
+  read_trace(argv[optind]);
+
+  if (!num_sizes)
+    for (int k = 4; k >= -2; k -= 1) {
+      int n = k > 0 ? header.num_pages / k : header.num_pages << -k;
+      if (n >= 1 && k != 3 && (!num_sizes || n != sizes[num_sizes - 1]))
+        sizes[num_sizes++] = n;
+    }
+  if (!num_use)
+    for (int i = 0; i < NUM_SIM_POLICIES; i++)
+      use[i] = 1;
+
+  printf("%ld gets of %d blocks in %d files, traced with %d pages (%s)\n",
+         num_gets, num_blks, num_files, header.num_pages,
+         header.policy < NUM_SIM_POLICIES ? policy_names[header.policy] : "?");
+  printf("%-6s %8s %12s %10s %12s %10s\n",
+         "policy", "pages", "misses", "hit ratio", "seeks", "writes");
+  for (int s = 0; s < num_sizes; s++)
+    for (int p = 0; p < NUM_SIM_POLICIES; p++)
+      if (use[p])
+        simulate(p, sizes[s]);
+  return 0;
+}
@@ -0,0 +1,575 @@
+/**********************************************************
+ * Write-ahead log with group commit                      *
+ **********************************************************/
+
+#define _GNU_SOURCE /* fallocate() */
+#include "wal.h"
+#include "pmsg.h"
+#include <fcntl.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/** @brief Header of the log file */
+typedef struct wal_header {
+  uint32_t magic;      /**< WAL_MAGIC */
+  uint32_t version;    /**< WAL_VERSION */
+  uint32_t block_size; /**< block size in bytes */
+  uint32_t unused;
+  uint64_t base_lsn;   /**< LSN of the start of the log file */
+  uint64_t start_lsn;  /**< LSN of the first record kept, where redo
+                            starts; the room of those before is freed */
+  uint64_t ckpt_lsn;   /**< LSN of the last checkpoint record, 0 for none */
+} wal_header;
+
+/** room of the header, the first record follows it */
+#define HEADER_BYTES 64
+
+/** longest file name of a page record */
+#define MAX_NAME_LEN 1024
+
+/** @brief Types of records */
+enum { REC_PAGE = 1, REC_COMMIT = 2, REC_CHECKPOINT = 3 };
+
+/** @brief Header of a record, followed by the file name and the data
+    of a page record, or by the data of a checkpoint record */
+typedef struct rec_header {
+  uint32_t len;      /**< length of the record, this header included */
+  uint32_t sum;      /**< checksum of the record, taken with sum 0 */
+  uint64_t lsn;      /**< LSN of the record, i.e. of its end */
+  uint32_t type;     /**< REC_PAGE, REC_COMMIT or REC_CHECKPOINT */
+  int32_t blk_nr;    /**< block of a page record */
+  uint32_t offset;   /**< offset of the data in the block */
+  uint32_t data_len; /**< number of bytes of data */
+  uint32_t name_len; /**< number of bytes of the file name */
+  uint32_t unused;
+} rec_header;
+
+/** @brief Start of the data of a checkpoint record, followed by the
+    entries of the dirty page table and the catalog */
+typedef struct ckpt_header {
+  uint64_t begin;       /**< end of the log when the table was taken */
+  uint32_t num_pages;   /**< number of entries */
+  uint32_t catalog_len; /**< number of bytes of the catalog, at the end */
+} ckpt_header;
+
+/** @brief An entry of the dirty page table, followed by the file name */
+typedef struct ckpt_entry {
+  uint64_t rec_lsn;
+  int32_t blk_nr;
+  uint32_t name_len;
+} ckpt_entry;
+
+static struct {
+  int fd;            /**< log file, -1 if none is open */
+  wal_sync mode;
+  long block_size;
+  wal_lsn base;      /**< LSN of the start of the log file */
+  wal_lsn start;     /**< LSN of the first record kept */
+  wal_lsn ckpt;      /**< LSN of the last checkpoint record, 0 for none */
+  wal_lsn end;       /**< LSN of the end of the last record */
+  wal_lsn written;   /**< LSN up to which the records are in the file */
+  wal_lsn synced;    /**< LSN up to which the file is synced */
+  char *buf;         /**< the records after the written ones */
+  size_t buf_len;
+  size_t buf_cap;
+  char *spare;       /**< buffer of buf_cap bytes the flusher writes */
+  int flushing;      /**< non-zero while a thread writes the log */
+  wal_stats stats;
+} wal = { .fd = -1 };
+
+/* guards wal, and is released while writing and syncing */
+static pthread_mutex_t wal_mutex = PTHREAD_MUTEX_INITIALIZER;
+/* signalled when a thread is done writing the log */
+static pthread_cond_t wal_flushed = PTHREAD_COND_INITIALIZER;
+
+/** offset in the log file of the record that starts at LSN lsn */
+#define lsn_offset(lsn) (HEADER_BYTES + (off_t) ((lsn) - wal.base))
+
+/** start of a checksum */
+#define SUM_BASIS 2166136261u
+
+/* FNV-1a of len bytes at p, going on from h */
+static uint32_t checksum(uint32_t h, char const* p, size_t len) {
+  for (size_t i = 0; i < len; i++)
+    h = (h ^ (unsigned char) p[i]) * 16777619u;
+  return h;
+}
+
+/* Whether the record at p, which starts at LSN pos_lsn and has n bytes
+   of the log left, is valid */
+static int valid_record(char const* p, size_t n, wal_lsn pos_lsn) {
+  rec_header h;
+  if (n < sizeof h) return 0;
+  memcpy(&h, p, sizeof h);
+  if (h.len < sizeof h || h.len > n || h.lsn != pos_lsn + h.len
+      || (h.type != REC_PAGE && h.type != REC_COMMIT
+          && h.type != REC_CHECKPOINT)
+      || (size_t) h.name_len + h.data_len != h.len - sizeof h)
+    return 0;
+  uint32_t sum = h.sum;
+  h.sum = 0;
+  return checksum(checksum(SUM_BASIS, (char const*) &h, sizeof h),
+                  p + sizeof h, h.len - sizeof h) == sum;
+}
+
+/* Read the records of the log file kept into a buffer of *len bytes.
+   Returns NULL upon failure. */
+static char *read_records(size_t* len) {
+  struct stat st;
+  if (fstat(wal.fd, &st) == -1) return 0;
+  off_t off = lsn_offset(wal.start);
+  *len = st.st_size > off ? st.st_size - off : 0;
+  char *log = malloc(*len + 1);
+  if (log && *len > 0
+      && pread(wal.fd, log, *len, off) != (ssize_t) *len) {
+    free(log);
+    return 0;
+  }
+  return log;
+}
+
+/* Length of the valid records at the start of log, and in *committed
+   the length of those up to the last commit record */
+static size_t scan_records(char const* log, size_t len, size_t* committed) {
+  size_t pos = 0;
+  *committed = 0;
+  while (valid_record(log + pos, len - pos, wal.start + pos)) {
+    rec_header h;
+    memcpy(&h, log + pos, sizeof h);
+    pos += h.len;
+    if (h.type == REC_COMMIT)
+      *committed = pos;
+  }
+  return pos;
+}
+
+/* The data of the checkpoint record among the len bytes of records at
+   log, in *ch and *data_len, NULL if there is none */
+static char const* find_checkpoint(char const* log, size_t len,
+                                   ckpt_header* ch, size_t* data_len) {
+  for (size_t pos = 0; wal.ckpt && pos < len; ) {
+    rec_header h;
+    memcpy(&h, log + pos, sizeof h);
+    if (h.lsn == wal.ckpt && h.type == REC_CHECKPOINT
+        && h.data_len >= sizeof *ch) {
+      memcpy(ch, log + pos + sizeof h, sizeof *ch);
+      *data_len = h.data_len;
+      return log + pos + sizeof h;
+    }
+    pos += h.len;
+  }
+  return 0;
+}
+
+static int write_header() {
+  wal_header h = {WAL_MAGIC, WAL_VERSION, wal.block_size, 0,
+                  wal.base, wal.start, wal.ckpt};
+  return pwrite(wal.fd, &h, sizeof h, 0) == sizeof h;
+}
+
+int wal_open(char const* path, long block_size, wal_sync mode,
+             wal_lsn base) {
+  if (wal.fd != -1) wal_close();
+  wal.fd = open(path, O_RDWR | O_CREAT, 0600);
+  if (wal.fd == -1) {
+    put_msg(ERROR, "wal_open: cannot open %s.\n", path);
+    return 0;
+  }
+  wal.mode = mode;
+  wal.block_size = block_size;
+  memset(&wal.stats, 0, sizeof wal.stats);
+
+  wal_header h;
+  ssize_t n = pread(wal.fd, &h, sizeof h, 0);
+  if (n == 0) { /* a new log */
+    wal.base = wal.start = base;
+    wal.ckpt = 0;
+    if (!write_header()) {
+      put_msg(ERROR, "wal_open: cannot write the header of %s.\n", path);
+      wal_close();
+      return 0;
+    }
+  } else if (n != sizeof h || h.magic != WAL_MAGIC
+             || h.version != WAL_VERSION || h.block_size != block_size) {
+    put_msg(ERROR, "wal_open: %s is not a log of %ld-byte blocks.\n",
+            path, block_size);
+    wal_close();
+    return 0;
+  } else {
+    wal.base = h.base_lsn;
+    wal.start = h.start_lsn < h.base_lsn ? h.base_lsn : h.start_lsn;
+    wal.ckpt = h.ckpt_lsn;
+  }
+
+  /* the next record goes after the last valid one */
+  size_t len, committed;
+  char *log = read_records(&len);
+  if (!log) {
+    put_msg(ERROR, "wal_open: cannot read %s.\n", path);
+    wal_close();
+    return 0;
+  }
+  len = scan_records(log, len, &committed);
+  free(log);
+  wal.end = wal.written = wal.synced = wal.start + len;
+  if (wal.ckpt > wal.end)
+    wal.ckpt = 0;
+  /* a torn record is cut off, so that what follows it is never read */
+  if (ftruncate(wal.fd, lsn_offset(wal.end)) == -1)
+    put_msg(WARN, "wal_open: cannot truncate %s.\n", path);
+
+  /* room for a record of a whole block */
+  wal.buf_cap = 64 * 1024;
+  while (wal.buf_cap < 2 * (sizeof (rec_header) + MAX_NAME_LEN + block_size))
+    wal.buf_cap *= 2;
+  wal.buf = malloc(wal.buf_cap);
+  wal.spare = malloc(wal.buf_cap);
+  wal.buf_len = 0;
+  wal.flushing = 0;
+  if (!wal.buf || !wal.spare) {
+    put_msg(ERROR, "wal_open: out of memory.\n");
+    wal_close();
+    return 0;
+  }
+  return 1;
+}
+
+/* Write the log up to lsn to the file, and sync it if sync is non-zero.
+   A thread that finds another one writing waits for it and writes what
+   is left after it, all the records appended so far, so the records of
+   the threads that come meanwhile are written and synced together.
+   Called holding wal_mutex. Returns 0 upon failure. */
+static int flush_locked(wal_lsn lsn, int sync) {
+  for (;;) {
+    if (sync ? wal.synced >= lsn : wal.written >= lsn) return 1;
+    if (wal.flushing) {
+      pthread_cond_wait(&wal_flushed, &wal_mutex);
+      continue;
+    }
+    wal.flushing = 1;
+    char *data = wal.buf;
+    size_t n = wal.buf_len;
+    wal_lsn target = wal.end;
+    off_t off = lsn_offset(wal.written);
+    wal.buf = wal.spare; /* the others append to the other buffer */
+    wal.spare = data;
+    wal.buf_len = 0;
+    pthread_mutex_unlock(&wal_mutex);
+
+    int ok = n == 0 || pwrite(wal.fd, data, n, off) == (ssize_t) n;
+    if (ok && sync)
+      ok = fdatasync(wal.fd) == 0;
+
+    pthread_mutex_lock(&wal_mutex);
+    wal.flushing = 0;
+    pthread_cond_broadcast(&wal_flushed);
+    if (!ok) {
+      put_msg(ERROR, "wal: cannot write the log.\n");
+      return 0;
+    }
+    wal.written = target;
+    if (sync) {
+      wal.synced = target;
+      wal.stats.num_syncs++;
+    }
+  }
+}
+
+/* Append a record with header h, file name name and data data.
+   Returns the LSN of the record, 0 upon failure. */
+static wal_lsn append(rec_header* h, char const* name, char const* data) {
+  size_t len = sizeof *h + h->name_len + h->data_len;
+  pthread_mutex_lock(&wal_mutex);
+  /* a checkpoint record may not fit the buffers, which grow then */
+  while (len > wal.buf_cap) {
+    if (wal.flushing) {
+      pthread_cond_wait(&wal_flushed, &wal_mutex);
+      continue;
+    }
+    size_t cap = wal.buf_cap;
+    while (cap < len) cap *= 2;
+    char *buf = realloc(wal.buf, cap);
+    if (buf) wal.buf = buf;
+    char *spare = buf ? realloc(wal.spare, cap) : 0;
+    if (!spare) {
+      pthread_mutex_unlock(&wal_mutex);
+      put_msg(ERROR, "wal: out of memory for a record of %zu bytes.\n", len);
+      return 0;
+    }
+    wal.spare = spare;
+    wal.buf_cap = cap;
+  }
+  while (wal.buf_len + len > wal.buf_cap)
+    if (!flush_locked(wal.end, 0)) {
+      pthread_mutex_unlock(&wal_mutex);
+      return 0;
+    }
+  h->len = len;
+  h->lsn = wal.end + len;
+  h->sum = 0;
+  char *p = wal.buf + wal.buf_len;
+  memcpy(p, h, sizeof *h);
+  memcpy(p + sizeof *h, name, h->name_len);
+  memcpy(p + sizeof *h + h->name_len, data, h->data_len);
+  uint32_t sum = checksum(SUM_BASIS, p, len);
+  memcpy(p + offsetof(rec_header, sum), &sum, sizeof sum);
+  wal.buf_len += len;
+  wal.end += len;
+  wal.stats.bytes_logged += len;
+  wal_lsn lsn = wal.end;
+  pthread_mutex_unlock(&wal_mutex);
+  return lsn;
+}
+
+wal_lsn wal_log_page(char const* fname, int blk_nr, int offset, int len,
+                     char const* data) {
+  size_t name_len = strlen(fname);
+  if (wal.fd == -1 || name_len > MAX_NAME_LEN || offset < 0 || len < 0
+      || offset + len > wal.block_size) {
+    put_msg(ERROR, "wal_log_page: cannot log block %d of %s.\n",
+            blk_nr, fname);
+    return 0;
+  }
+  rec_header h = {0};
+  h.type = REC_PAGE;
+  h.blk_nr = blk_nr;
+  h.offset = offset;
+  h.data_len = len;
+  h.name_len = name_len;
+  wal_lsn lsn = append(&h, fname, data);
+  if (lsn) {
+    pthread_mutex_lock(&wal_mutex);
+    wal.stats.num_records++;
+    pthread_mutex_unlock(&wal_mutex);
+  }
+  return lsn;
+}
+
+wal_lsn wal_commit(void) {
+  if (wal.fd == -1) return 0;
+  rec_header h = {0};
+  h.type = REC_COMMIT;
+  wal_lsn lsn = append(&h, "", "");
+  if (!lsn) return 0;
+  pthread_mutex_lock(&wal_mutex);
+  wal.stats.num_commits++;
+  int ok = wal.mode == WAL_SYNC_OFF
+    || flush_locked(lsn, wal.mode == WAL_SYNC_FULL);
+  pthread_mutex_unlock(&wal_mutex);
+  return ok ? lsn : 0;
+}
+
+int wal_flush(wal_lsn lsn) {
+  if (wal.fd == -1) return 1;
+  pthread_mutex_lock(&wal_mutex);
+  int ok = flush_locked(lsn, wal.mode != WAL_SYNC_OFF);
+  pthread_mutex_unlock(&wal_mutex);
+  return ok;
+}
+
+/** @brief An entry of the dirty page table of the checkpoint redone */
+typedef struct redo_dirty {
+  char const* name; /**< file name, not terminated */
+  uint32_t name_len;
+  int32_t blk_nr;
+  wal_lsn rec_lsn;
+} redo_dirty;
+
+/* order of the dirty page table, by file and block */
+static int cmp_redo_dirty(void const* a, void const* b) {
+  redo_dirty const *x = a, *y = b;
+  if (x->name_len != y->name_len)
+    return x->name_len < y->name_len ? -1 : 1;
+  int c = memcmp(x->name, y->name, x->name_len);
+  if (c) return c;
+  return x->blk_nr < y->blk_nr ? -1 : (x->blk_nr > y->blk_nr);
+}
+
+long wal_redo(int (*redo)(wal_page_rec const* rec, void* arg), void* arg) {
+  if (wal.fd == -1) return -1;
+  size_t len, committed;
+  char *log = read_records(&len);
+  if (!log) {
+    put_msg(ERROR, "wal_redo: cannot read the log.\n");
+    return -1;
+  }
+  len = scan_records(log, len, &committed);
+
+  /* the dirty page table of the checkpoint, sorted to be searched */
+  ckpt_header ch = {0};
+  size_t data_len;
+  char const* data = find_checkpoint(log, len, &ch, &data_len);
+  redo_dirty *dpt = malloc((data ? ch.num_pages : 0) * sizeof *dpt + 1);
+  size_t num_dirty = 0;
+  for (size_t pos = sizeof ch; data && num_dirty < ch.num_pages; num_dirty++) {
+    ckpt_entry e;
+    memcpy(&e, data + pos, sizeof e);
+    dpt[num_dirty] = (redo_dirty) {
+      data + pos + sizeof e, e.name_len, e.blk_nr, e.rec_lsn
+    };
+    pos += sizeof e + e.name_len;
+  }
+  qsort(dpt, num_dirty, sizeof *dpt, cmp_redo_dirty);
+
+  /* the records are handed in the order they were appended */
+  long n = 0;
+  for (size_t pos = 0; n >= 0 && pos < committed; ) {
+    rec_header h;
+    memcpy(&h, log + pos, sizeof h);
+    redo_dirty key = {
+      log + pos + sizeof h, h.name_len, h.blk_nr, wal.start + pos
+    };
+    if (h.type == REC_PAGE) {
+      /* the changes to a block not in the table were on disk when the
+         table was taken, and so were those before its rec_lsn */
+      redo_dirty *d = !data || h.lsn > ch.begin ? &key
+        : bsearch(&key, dpt, num_dirty, sizeof *dpt, cmp_redo_dirty);
+      if (d && d->rec_lsn <= key.rec_lsn) {
+        char name[MAX_NAME_LEN + 1];
+        memcpy(name, key.name, h.name_len);
+        name[h.name_len] = '\0';
+        wal_page_rec r = {
+          h.lsn, name, h.blk_nr, h.offset, h.data_len,
+          log + pos + sizeof h + h.name_len
+        };
+        n = redo(&r, arg) ? n + 1 : -1;
+      }
+    }
+    pos += h.len;
+  }
+  free(dpt);
+  free(log);
+  return n;
+}
+
+char* wal_catalog(long* len) {
+  if (wal.fd == -1) return 0;
+  size_t log_len, committed, data_len;
+  char *log = read_records(&log_len);
+  if (!log) return 0;
+  log_len = scan_records(log, log_len, &committed);
+  ckpt_header ch;
+  char const* data = find_checkpoint(log, log_len, &ch, &data_len);
+  char *catalog = data && ch.catalog_len <= data_len - sizeof ch
+    ? malloc(ch.catalog_len + 1) : 0;
+  if (catalog) {
+    memcpy(catalog, data + data_len - ch.catalog_len, ch.catalog_len);
+    catalog[ch.catalog_len] = '\0';
+    *len = ch.catalog_len;
+  }
+  free(log);
+  return catalog;
+}
+
+int wal_checkpoint(wal_lsn begin, wal_dirty_page const* dpt, int n,
+                   char const* catalog, long catalog_len) {
+  if (wal.fd == -1) return 0;
+  size_t len = sizeof (ckpt_header) + catalog_len;
+  for (int i = 0; i < n; i++)
+    len += sizeof (ckpt_entry) + strlen(dpt[i].fname);
+  char *data = malloc(len);
+  if (!data) {
+    put_msg(ERROR, "wal_checkpoint: out of memory.\n");
+    return 0;
+  }
+  /* redo starts at the oldest change that may not be on disk */
+  wal_lsn redo_lsn = begin;
+  ckpt_header ch = { begin, n, catalog_len };
+  memcpy(data, &ch, sizeof ch);
+  size_t pos = sizeof ch;
+  for (int i = 0; i < n; i++) {
+    ckpt_entry e = { dpt[i].rec_lsn, dpt[i].blk_nr, strlen(dpt[i].fname) };
+    memcpy(data + pos, &e, sizeof e);
+    memcpy(data + pos + sizeof e, dpt[i].fname, e.name_len);
+    pos += sizeof e + e.name_len;
+    if (dpt[i].rec_lsn < redo_lsn) redo_lsn = dpt[i].rec_lsn;
+  }
+  memcpy(data + pos, catalog, catalog_len);
+  rec_header h = {0};
+  h.type = REC_CHECKPOINT;
+  h.data_len = len;
+  wal_lsn lsn = append(&h, "", data);
+  free(data);
+
+  /* the header points to the record once it is on disk, and the room of
+     the records before the start of redo is freed after that */
+  pthread_mutex_lock(&wal_mutex);
+  int ok = lsn && flush_locked(lsn, wal.mode != WAL_SYNC_OFF);
+  if (ok) {
+    wal_lsn old_start = wal.start;
+    if (redo_lsn > wal.start) wal.start = redo_lsn;
+    wal.ckpt = lsn;
+    wal.stats.num_checkpoints++;
+    ok = write_header()
+      && (wal.mode == WAL_SYNC_OFF || fdatasync(wal.fd) == 0);
+    if (ok && wal.start > old_start)
+      fallocate(wal.fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                lsn_offset(old_start), wal.start - old_start);
+  }
+  pthread_mutex_unlock(&wal_mutex);
+  if (!ok)
+    put_msg(ERROR, "wal_checkpoint: cannot write the checkpoint.\n");
+  return ok;
+}
+
+int wal_reset(void) {
+  if (wal.fd == -1) return 1;
+  pthread_mutex_lock(&wal_mutex);
+  while (wal.flushing)
+    pthread_cond_wait(&wal_flushed, &wal_mutex);
+  wal.base = wal.start = wal.written = wal.synced = wal.end;
+  wal.ckpt = 0;
+  wal.buf_len = 0;
+  int ok = write_header() && ftruncate(wal.fd, HEADER_BYTES) == 0
+    && (wal.mode == WAL_SYNC_OFF || fdatasync(wal.fd) == 0);
+  pthread_mutex_unlock(&wal_mutex);
+  if (!ok)
+    put_msg(ERROR, "wal_reset: cannot empty the log.\n");
+  return ok;
+}
+
+void wal_close(void) {
+  if (wal.fd == -1) return;
+  pthread_mutex_lock(&wal_mutex);
+  if (wal.buf)
+    flush_locked(wal.end, wal.mode != WAL_SYNC_OFF);
+  close(wal.fd);
+  wal.fd = -1;
+  free(wal.buf);
+  free(wal.spare);
+  wal.buf = wal.spare = 0;
+  pthread_mutex_unlock(&wal_mutex);
+}
+
+int wal_active(void) {
+  return wal.fd != -1;
+}
+
+long wal_size(void) {
+  pthread_mutex_lock(&wal_mutex);
+  long size = wal.end - wal.start;
+  pthread_mutex_unlock(&wal_mutex);
+  return size;
+}
+
+wal_lsn wal_end(void) {
+  pthread_mutex_lock(&wal_mutex);
+  wal_lsn end = wal.end;
+  pthread_mutex_unlock(&wal_mutex);
+  return end;
+}
+
+int wal_fd(void) {
+  return wal.fd;
+}
+
+wal_stats wal_get_stats(void) {
+  pthread_mutex_lock(&wal_mutex);
+  wal_stats s = wal.stats;
+  pthread_mutex_unlock(&wal_mutex);
+  return s;
+}
@@ -0,0 +1,148 @@
+/** @file wal.h
+ * @brief A write-ahead log of the changes to the pages.
+ *
+ * Every change to a page is appended to the log as a <em>page record</em>
+ * holding the changed bytes of the block, before the page is written
+ * back, so the data files can be written lazily: what a crash loses of
+ * them is redone from the log. The position of a record in the log,
+ * counted from the creation of the log and never reset, is its
+ * <em>log sequence number</em> (LSN). A page keeps the LSN of its last
+ * record in its header, and a record is redone only on a page with a
+ * smaller LSN, so redoing it again does no harm.
+ *
+ * A <em>commit record</em> makes the records before it durable,
+ * according to the @ref wal_sync "sync mode" of the log.
+ * Commits are grouped: a commit that finds another one syncing the log
+ * waits for it and syncs the records of all the commits that came
+ * meanwhile with one fdatasync(), so concurrent commits share the syncs.
+ * The records are appended to a buffer, which is written to the log file
+ * when it is full, at a commit and before a page is written back
+ * (see @ref wal_flush "wal_flush()").
+ *
+ * The log file starts with a header holding the LSN of its first record.
+ * @ref wal_reset "wal_reset()" empties the log once all the pages are
+ * written back and synced, i.e. at a sharp checkpoint.
+ * Every record carries its LSN and a checksum, and the log ends at the
+ * first record that is torn or does not follow its predecessor.
+ * Redo stops at the last commit record: the records of a commit that
+ * did not finish are not redone.
+ *
+ * A <em>fuzzy checkpoint</em> does not wait for the pages to be written
+ * back: @ref wal_checkpoint "wal_checkpoint()" appends a checkpoint
+ * record holding the <em>dirty page table</em>, i.e. the pages whose
+ * changes may not be on disk with the LSN of their oldest such change,
+ * and the catalog of the database, and the header points to it. Redo
+ * starts at the oldest change of the table, skips the records before
+ * the checkpoint of the pages that are not in it, and runs in threads
+ * of their own for different files. The records before the start of
+ * redo are no longer needed, and their room in the log file is freed.
+ */
+
+#ifndef _WAL_H_
+#define _WAL_H_
+
+#include <stdint.h>
+
+/** "WALG" */
+#define WAL_MAGIC 0x474c4157u
+
+#define WAL_VERSION 2
+
+/** size of the log the pager lets grow before a checkpoint empties it */
+#define WAL_CHECKPOINT_BYTES (4L << 20)
+
+/** a log sequence number, 0 for none */
+typedef uint64_t wal_lsn;
+
+/** @brief How durable a commit is */
+typedef enum {
+  WAL_SYNC_OFF,    /**< the log is never synced, the operating system
+                        writes it when it likes */
+  WAL_SYNC_NORMAL, /**< a commit writes the log to the operating system,
+                        which survives a crash of the process; the log is
+                        synced before data pages are written back */
+  WAL_SYNC_FULL    /**< a commit waits until the log is synced */
+} wal_sync;
+
+/** @brief A page record, as handed to the redo function */
+typedef struct wal_page_rec {
+  wal_lsn lsn;       /**< LSN of the record */
+  char const* fname; /**< file of the block */
+  int blk_nr;        /**< block number */
+  int offset;        /**< offset of the changed bytes in the block */
+  int len;           /**< number of changed bytes */
+  char const* data;  /**< the changed bytes */
+} wal_page_rec;
+
+/** @brief An entry of the dirty page table of a checkpoint */
+typedef struct wal_dirty_page {
+  char const* fname; /**< file of the block */
+  int blk_nr;        /**< block number */
+  wal_lsn rec_lsn;   /**< LSN up to which the changes to the block are on
+                          disk: redo starts there for it */
+} wal_dirty_page;
+
+/** @brief Counters of the log since it was opened */
+typedef struct wal_stats {
+  long num_records;  /**< number of page records appended */
+  long num_commits;  /**< number of commits */
+  long num_syncs;    /**< number of fdatasync() of the log */
+  long num_checkpoints; /**< number of checkpoint records */
+  long bytes_logged; /**< number of bytes appended */
+} wal_stats;
+
+/** Open the log in file @em path, creating it if it does not exist,
+    for blocks of @em block_size bytes. A new log starts at @em base,
+    past the LSNs of the pages of an earlier log, which redo compares.
+    Returns 0 upon failure. */
+extern int wal_open(char const* path, long block_size, wal_sync mode,
+                    wal_lsn base);
+/** Write the buffered records and close the log. */
+extern void wal_close(void);
+/** Whether a log is open. */
+extern int wal_active(void);
+/** Hand the page records of the log from the start of redo of its last
+    checkpoint up to its last commit record to @em redo, but those before
+    the checkpoint of the blocks it does not list. The records are handed
+    in the order they were appended, and the first one @em redo returns 0
+    for stops the redo.
+    Returns the number of records handed, -1 upon failure. */
+extern long wal_redo(int (*redo)(wal_page_rec const* rec, void* arg),
+                     void* arg);
+/** The catalog of the last checkpoint of the log, in a buffer of
+    @em *len bytes the caller frees. Returns NULL if there is none. */
+extern char* wal_catalog(long* len);
+
+/** Append a page record of the @em len bytes at @em data, which are the
+    bytes at @em offset of block @em blk_nr of file @em fname.
+    Returns the LSN of the record, 0 upon failure. */
+extern wal_lsn wal_log_page(char const* fname, int blk_nr, int offset,
+                            int len, char const* data);
+/** Append a commit record and make the log durable up to it as the sync
+    mode asks for. Returns the LSN of the record, 0 upon failure. */
+extern wal_lsn wal_commit(void);
+/** Write the log up to @em lsn to the log file, and sync it unless the
+    sync mode is off; called before a page with LSN @em lsn is written
+    back. Returns 0 upon failure. */
+extern int wal_flush(wal_lsn lsn);
+/** Append a checkpoint record with the @em n entries of the dirty page
+    table @em dpt, taken when the log ended at @em begin, and the
+    @em catalog_len bytes of @em catalog, sync it unless the sync mode
+    is off, and make it the checkpoint redo starts from. The room of the
+    records before the start of redo is freed.
+    Returns 0 upon failure. */
+extern int wal_checkpoint(wal_lsn begin, wal_dirty_page const* dpt, int n,
+                          char const* catalog, long catalog_len);
+/** Empty the log: its records are no longer needed, since the pages
+    they changed are on disk. Returns 0 upon failure. */
+extern int wal_reset(void);
+/** Number of bytes of the records redo may need, from its start. */
+extern long wal_size(void);
+/** LSN of the end of the last record appended. */
+extern wal_lsn wal_end(void);
+/** Descriptor of the log file, -1 if no log is open. */
+extern int wal_fd(void);
+/** The counters of the log since it was opened. */
+extern wal_stats wal_get_stats(void);
+
+#endif